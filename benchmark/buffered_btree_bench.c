@@ -0,0 +1,134 @@
+// Copyright 2011-2022 David Robillard <d@drobilla.net>
+// SPDX-License-Identifier: ISC
+
+#include "bench.h"
+
+#include "../test/test_data.h"
+
+#include "zix/attributes.h"
+#include "zix/btree.h"
+#include "zix/buffered_btree.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct {
+  double insert_s; ///< Time to insert n elements
+  double find_s;   ///< Time to find n elements
+} BenchResults;
+
+static int
+int_cmp(const void* a, const void* b, const void* ZIX_UNUSED(user_data))
+{
+  const uintptr_t ia = (uintptr_t)a;
+  const uintptr_t ib = (uintptr_t)b;
+
+  return ia < ib ? -1 : ia > ib ? 1 : 0;
+}
+
+static uint64_t
+ith_key(const size_t i)
+{
+  return 1U + unique_rand(i);
+}
+
+static BenchResults
+bench_zix_btree(const size_t n_elems)
+{
+  BenchResults    results = {0.0, 0.0};
+  ZixBTree* const t       = zix_btree_new(NULL, int_cmp, NULL);
+
+  BenchmarkTime start = bench_start();
+  for (size_t i = 0U; i < n_elems; ++i) {
+    zix_btree_insert(t, (void*)(uintptr_t)ith_key(i));
+  }
+  results.insert_s = bench_end(&start);
+
+  start = bench_start();
+  for (size_t i = 0U; i < n_elems; ++i) {
+    ZixBTreeIter ti = zix_btree_end_iter;
+    if (zix_btree_find(t, (void*)(uintptr_t)ith_key(i), &ti)) {
+      fprintf(stderr, "error: Failed to find element %zu\n", i);
+      exit(EXIT_FAILURE);
+    }
+  }
+  results.find_s = bench_end(&start);
+
+  zix_btree_free(t, NULL, NULL);
+  return results;
+}
+
+static BenchResults
+bench_zix_buffered_btree(const size_t n_elems)
+{
+  BenchResults            results = {0.0, 0.0};
+  ZixBufferedBTree* const t       = zix_buffered_btree_new(NULL);
+
+  BenchmarkTime start = bench_start();
+  for (size_t i = 0U; i < n_elems; ++i) {
+    zix_buffered_btree_insert(t, ith_key(i), i);
+  }
+  results.insert_s = bench_end(&start);
+
+  start = bench_start();
+  for (size_t i = 0U; i < n_elems; ++i) {
+    if (zix_buffered_btree_find(t, ith_key(i), NULL)) {
+      fprintf(stderr, "error: Failed to find element %zu\n", i);
+      exit(EXIT_FAILURE);
+    }
+  }
+  results.find_s = bench_end(&start);
+
+  zix_buffered_btree_free(t);
+  return results;
+}
+
+int
+main(int argc, char** argv)
+{
+  if (argc != 3) {
+    fprintf(stderr, "USAGE: %s MIN_N MAX_N\n", argv[0]);
+    return 1;
+  }
+
+  const size_t min_n = strtoul(argv[1], NULL, 10);
+  const size_t max_n = strtoul(argv[2], NULL, 10);
+  if (!min_n || max_n < min_n) {
+    fprintf(stderr, "error: Invalid arguments\n");
+    return 1;
+  }
+
+  fprintf(stderr, "Benchmarking %zu .. %zu elements\n", min_n, max_n);
+
+  FILE* const dat = fopen("buffered_btree.txt", "w");
+  if (!dat) {
+    fprintf(stderr, "error: Failed to open buffered_btree.txt\n");
+    return 1;
+  }
+
+  fprintf(dat,
+          "# n\tZixBTree insert\tZixBufferedBTree insert"
+          "\tZixBTree find\tZixBufferedBTree find\n");
+
+  for (size_t n = min_n; n <= max_n; n *= 2U) {
+    fprintf(stderr, "n = %zu\n", n);
+
+    const BenchResults btree    = bench_zix_btree(n);
+    const BenchResults buffered = bench_zix_buffered_btree(n);
+
+    fprintf(dat,
+            "%zu\t%lf\t%lf\t%lf\t%lf\n",
+            n,
+            btree.insert_s,
+            buffered.insert_s,
+            btree.find_s,
+            buffered.find_s);
+  }
+
+  fclose(dat);
+
+  fprintf(stderr, "Wrote buffered_btree.txt (seconds)\n");
+
+  return EXIT_SUCCESS;
+}
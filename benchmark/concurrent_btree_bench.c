@@ -0,0 +1,223 @@
+// Copyright 2011-2022 David Robillard <d@drobilla.net>
+// SPDX-License-Identifier: ISC
+
+#include "bench.h"
+
+#include "../test/test_data.h"
+
+#include "zix/attributes.h"
+#include "zix/btree.h"
+#include "zix/common.h"
+#include "zix/concurrent_btree.h"
+#include "zix/thread.h"
+
+#include <pthread.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MAX_THREADS 256U
+
+typedef struct {
+  ZixBTree*           btree;        ///< Single-threaded tree, or null
+  pthread_rwlock_t*   lock;         ///< Lock for btree
+  ZixConcurrentBTree* cbtree;       ///< Concurrent tree, or null
+  size_t              n_elems;      ///< Number of elements initially in tree
+  size_t              n_ops;        ///< Number of operations to perform
+  unsigned            read_percent; ///< Percentage of operations that read
+  unsigned            seed;         ///< Random seed for this thread
+} BenchThread;
+
+static int
+int_cmp(const void* a, const void* b, const void* ZIX_UNUSED(user_data))
+{
+  const uintptr_t ia = (uintptr_t)a;
+  const uintptr_t ib = (uintptr_t)b;
+
+  return ia < ib ? -1 : ia > ib ? 1 : 0;
+}
+
+/// Return the value for key `i`, where the first n_elems keys start in a tree
+static void*
+ith_elem(const size_t i)
+{
+  return (void*)(1U + unique_rand(i));
+}
+
+static void*
+bench_thread(void* const arg)
+{
+  const BenchThread* const thread = (const BenchThread*)arg;
+
+  uintptr_t r = thread->seed;
+  for (size_t i = 0U; i < thread->n_ops; ++i) {
+    r = lcg(r);
+
+    // Use half of the key space that's initially in the tree, half not
+    void* const    e    = ith_elem((size_t)(r >> 8U) % (2U * thread->n_elems));
+    const unsigned roll = (unsigned)(r >> 1U) % 100U;
+    void*          out  = NULL;
+
+    if (thread->btree) {
+      if (roll < thread->read_percent) {
+        ZixBTreeIter ti = zix_btree_end_iter;
+        pthread_rwlock_rdlock(thread->lock);
+        zix_btree_find(thread->btree, e, &ti);
+        pthread_rwlock_unlock(thread->lock);
+      } else if (roll & 1U) {
+        pthread_rwlock_wrlock(thread->lock);
+        zix_btree_insert(thread->btree, e);
+        pthread_rwlock_unlock(thread->lock);
+      } else {
+        ZixBTreeIter next = zix_btree_end_iter;
+        pthread_rwlock_wrlock(thread->lock);
+        zix_btree_remove(thread->btree, e, &out, &next);
+        pthread_rwlock_unlock(thread->lock);
+      }
+    } else {
+      if (roll < thread->read_percent) {
+        zix_concurrent_btree_find(thread->cbtree, e, &out);
+      } else if (roll & 1U) {
+        zix_concurrent_btree_insert(thread->cbtree, e);
+      } else {
+        zix_concurrent_btree_remove(thread->cbtree, e, &out);
+      }
+    }
+  }
+
+  return NULL;
+}
+
+/// Run the workload on `n_threads` threads and return throughput in Mops/s
+static double
+bench_run(BenchThread* const threads,
+          const unsigned     n_threads,
+          const size_t       n_ops)
+{
+  ZixThread handles[MAX_THREADS]; // NOLINT
+
+  const BenchmarkTime start = bench_start();
+
+  for (unsigned i = 0U; i < n_threads; ++i) {
+    threads[i].n_ops = n_ops / n_threads;
+    threads[i].seed  = i + 1U;
+    if (zix_thread_create(&handles[i], 65536U, bench_thread, &threads[i])) {
+      fprintf(stderr, "error: Failed to create thread\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  for (unsigned i = 0U; i < n_threads; ++i) {
+    zix_thread_join(handles[i], NULL);
+  }
+
+  return (double)n_ops / bench_end(&start) / 1000000.0;
+}
+
+static double
+bench_zix_btree(const size_t   n_elems,
+                const size_t   n_ops,
+                const unsigned n_threads,
+                const unsigned read_percent)
+{
+  fprintf(stderr, "Benchmarking ZixBTree with %u threads\n", n_threads);
+
+  pthread_rwlock_t lock;
+  ZixBTree* const  t = zix_btree_new(NULL, int_cmp, NULL);
+
+  pthread_rwlock_init(&lock, NULL);
+  for (size_t i = 0U; i < n_elems; ++i) {
+    zix_btree_insert(t, ith_elem(i));
+  }
+
+  BenchThread threads[MAX_THREADS];
+  for (unsigned i = 0U; i < n_threads; ++i) {
+    const BenchThread thread = {t, &lock, NULL, n_elems, 0U, read_percent, 0U};
+    threads[i]               = thread;
+  }
+
+  const double mops = bench_run(threads, n_threads, n_ops);
+
+  pthread_rwlock_destroy(&lock);
+  zix_btree_free(t, NULL, NULL);
+  return mops;
+}
+
+static double
+bench_zix_concurrent_btree(const size_t   n_elems,
+                           const size_t   n_ops,
+                           const unsigned n_threads,
+                           const unsigned read_percent)
+{
+  fprintf(
+    stderr, "Benchmarking ZixConcurrentBTree with %u threads\n", n_threads);
+
+  ZixConcurrentBTree* const t = zix_concurrent_btree_new(NULL, int_cmp, NULL);
+
+  for (size_t i = 0U; i < n_elems; ++i) {
+    zix_concurrent_btree_insert(t, ith_elem(i));
+  }
+
+  BenchThread threads[MAX_THREADS];
+  for (unsigned i = 0U; i < n_threads; ++i) {
+    const BenchThread thread = {NULL, NULL, t, n_elems, 0U, read_percent, 0U};
+    threads[i]               = thread;
+  }
+
+  const double mops = bench_run(threads, n_threads, n_ops);
+
+  zix_concurrent_btree_free(t, NULL, NULL);
+  return mops;
+}
+
+int
+main(int argc, char** argv)
+{
+  if (argc < 4 || argc > 5) {
+    fprintf(stderr,
+            "USAGE: %s N_ELEMS N_OPS MAX_THREADS [READ_PERCENT]\n",
+            argv[0]);
+    return 1;
+  }
+
+  const size_t   n_elems      = strtoul(argv[1], NULL, 10);
+  const size_t   n_ops        = strtoul(argv[2], NULL, 10);
+  const unsigned max_threads  = (unsigned)strtoul(argv[3], NULL, 10);
+  const unsigned read_percent =
+    (argc > 4) ? (unsigned)strtoul(argv[4], NULL, 10) : 90U;
+
+  if (!n_elems || max_threads < 1U || max_threads > MAX_THREADS ||
+      read_percent > 100U) {
+    fprintf(stderr, "error: Invalid arguments\n");
+    return 1;
+  }
+
+  fprintf(stderr,
+          "Benchmarking %zu operations on %zu elements, %u%% reads\n",
+          n_ops,
+          n_elems,
+          read_percent);
+
+  FILE* const dat = fopen("concurrent_btree.txt", "w");
+  if (!dat) {
+    fprintf(stderr, "error: Failed to open concurrent_btree.txt\n");
+    return 1;
+  }
+
+  fprintf(dat, "# threads\tZixBTree+rwlock\tZixConcurrentBTree\n");
+  for (unsigned n = 1U; n <= max_threads; n *= 2U) {
+    fprintf(dat, "%u", n);
+    fprintf(dat, "\t%lf", bench_zix_btree(n_elems, n_ops, n, read_percent));
+    fprintf(dat,
+            "\t%lf",
+            bench_zix_concurrent_btree(n_elems, n_ops, n, read_percent));
+    fprintf(dat, "\n");
+  }
+
+  fclose(dat);
+
+  fprintf(stderr, "Wrote concurrent_btree.txt (millions of operations/s)\n");
+
+  return EXIT_SUCCESS;
+}
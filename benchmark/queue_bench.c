@@ -0,0 +1,179 @@
+// Copyright 2022 David Robillard <d@drobilla.net>
+// SPDX-License-Identifier: ISC
+
+#include "bench.h"
+
+#include "zix/queue.h"
+#include "zix/ring.h"
+#include "zix/thread.h"
+
+#include <pthread.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MAX_THREADS 256U
+#define N_SLOTS 1024U
+
+typedef struct {
+  uint64_t thread; ///< Index of the thread that pushed this message
+  uint64_t count;  ///< Number of messages that thread pushed before this
+} Message;
+
+typedef struct {
+  ZixQueue*        queue;  ///< Lock-free queue, or null
+  ZixRing*         ring;   ///< Single-threaded ring, or null
+  pthread_mutex_t* lock;   ///< Lock for ring
+  size_t           n_msgs; ///< Number of messages to push or pop
+  unsigned         index;  ///< Index of this thread
+  bool             writer; ///< True if this thread pushes, false if it pops
+  uint64_t         sum;    ///< Sum of popped counts, to use the results
+} BenchThread;
+
+static bool
+ring_push(const BenchThread* const thread, const Message* const msg)
+{
+  pthread_mutex_lock(thread->lock);
+  const bool pushed =
+    zix_ring_write(thread->ring, msg, sizeof(Message)) == sizeof(Message);
+  pthread_mutex_unlock(thread->lock);
+  return pushed;
+}
+
+static bool
+ring_pop(const BenchThread* const thread, Message* const msg)
+{
+  pthread_mutex_lock(thread->lock);
+  const bool popped =
+    zix_ring_read(thread->ring, msg, sizeof(Message)) == sizeof(Message);
+  pthread_mutex_unlock(thread->lock);
+  return popped;
+}
+
+static void*
+bench_thread(void* const arg)
+{
+  BenchThread* const thread = (BenchThread*)arg;
+
+  Message msg = {thread->index, 0U};
+  for (size_t i = 0U; i < thread->n_msgs; ++i) {
+    if (thread->writer) {
+      msg.count = i;
+      while (thread->queue ? !zix_queue_push(thread->queue, &msg)
+                           : !ring_push(thread, &msg)) {
+      }
+    } else {
+      while (thread->queue ? !zix_queue_pop(thread->queue, &msg)
+                           : !ring_pop(thread, &msg)) {
+      }
+
+      thread->sum += msg.count;
+    }
+  }
+
+  return NULL;
+}
+
+/// Run `n_threads` writers and readers and return throughput in Mmsgs/s
+static double
+bench_run(ZixQueue* const        queue,
+          ZixRing* const         ring,
+          pthread_mutex_t* const lock,
+          const unsigned         n_threads,
+          const size_t           n_msgs)
+{
+  static BenchThread threads[2U * MAX_THREADS];
+  ZixThread          handles[2U * MAX_THREADS]; // NOLINT
+
+  const BenchmarkTime start = bench_start();
+
+  for (unsigned i = 0U; i < 2U * n_threads; ++i) {
+    const BenchThread thread = {
+      queue, ring, lock, n_msgs / n_threads, i / 2U, !(i % 2U), 0U};
+
+    threads[i] = thread;
+    if (zix_thread_create(&handles[i], 65536U, bench_thread, &threads[i])) {
+      fprintf(stderr, "error: Failed to create thread\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  for (unsigned i = 0U; i < 2U * n_threads; ++i) {
+    zix_thread_join(handles[i], NULL);
+  }
+
+  return (double)n_msgs / bench_end(&start) / 1000000.0;
+}
+
+static double
+bench_zix_ring(const size_t n_msgs, const unsigned n_threads)
+{
+  fprintf(
+    stderr, "Benchmarking ZixRing with %u+%u threads\n", n_threads, n_threads);
+
+  pthread_mutex_t lock;
+  ZixRing* const  ring = zix_ring_new(NULL, N_SLOTS * sizeof(Message));
+
+  pthread_mutex_init(&lock, NULL);
+
+  const double mmsgs = bench_run(NULL, ring, &lock, n_threads, n_msgs);
+
+  pthread_mutex_destroy(&lock);
+  zix_ring_free(ring);
+  return mmsgs;
+}
+
+static double
+bench_zix_queue(const size_t n_msgs, const unsigned n_threads)
+{
+  fprintf(
+    stderr, "Benchmarking ZixQueue with %u+%u threads\n", n_threads, n_threads);
+
+  ZixQueue* const queue = zix_queue_new(NULL, N_SLOTS, sizeof(Message));
+
+  const double mmsgs = bench_run(queue, NULL, NULL, n_threads, n_msgs);
+
+  zix_queue_free(queue);
+  return mmsgs;
+}
+
+int
+main(int argc, char** argv)
+{
+  if (argc != 3) {
+    fprintf(stderr, "USAGE: %s N_MESSAGES MAX_THREADS\n", argv[0]);
+    return 1;
+  }
+
+  const size_t   n_msgs      = strtoul(argv[1], NULL, 10);
+  const unsigned max_threads = (unsigned)strtoul(argv[2], NULL, 10);
+
+  if (!n_msgs || max_threads < 1U || max_threads > MAX_THREADS) {
+    fprintf(stderr, "error: Invalid arguments\n");
+    return 1;
+  }
+
+  fprintf(stderr, "Benchmarking %zu messages\n", n_msgs);
+
+  FILE* const dat = fopen("queue.txt", "w");
+  if (!dat) {
+    fprintf(stderr, "error: Failed to open queue.txt\n");
+    return 1;
+  }
+
+  fprintf(dat, "# threads\tZixRing+mutex\tZixQueue\n");
+  for (unsigned n = 1U; n <= max_threads; n *= 2U) {
+    fprintf(dat, "%u", n);
+    fprintf(dat, "\t%lf", bench_zix_ring(n_msgs, n));
+    fprintf(dat, "\t%lf", bench_zix_queue(n_msgs, n));
+    fprintf(dat, "\n");
+  }
+
+  fclose(dat);
+
+  fprintf(stderr, "Wrote queue.txt (millions of messages/s)\n");
+
+  return EXIT_SUCCESS;
+}
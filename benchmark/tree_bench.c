@@ -9,6 +9,7 @@
 #include "zix/attributes.h"
 #include "zix/btree.h"
 #include "zix/common.h"
+#include "zix/radix_tree.h"
 #include "zix/tree.h"
 
 ZIX_DISABLE_GLIB_WARNINGS
@@ -16,6 +17,7 @@ ZIX_DISABLE_GLIB_WARNINGS
 ZIX_RESTORE_WARNINGS
 
 #include <inttypes.h>
+#include <math.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -132,18 +134,12 @@ bench_zix_tree(size_t n_elems,
   return EXIT_SUCCESS;
 }
 
+/// Run the ZixBTree benchmark phases on `t`, setting each time that finishes
 static int
-bench_zix_btree(size_t n_elems,
-                FILE*  insert_dat,
-                FILE*  search_dat,
-                FILE*  iter_dat,
-                FILE*  del_dat)
+run_zix_btree(ZixBTree* const t, const size_t n_elems, double times[4])
 {
-  start_test("ZixBTree");
-
   uintptr_t    r  = 0U;
   ZixBTreeIter ti = zix_btree_end_iter;
-  ZixBTree*    t  = zix_btree_new(NULL, int_cmp, NULL);
 
   // Insert n_elems elements
   struct timespec insert_start = bench_start();
@@ -152,10 +148,12 @@ bench_zix_btree(size_t n_elems,
 
     ZixStatus status = zix_btree_insert(t, (void*)r);
     if (status) {
-      return test_fail("Failed to insert %" PRIuPTR "\n", r);
+      return test_fail("Failed to insert %" PRIuPTR " (%s)\n",
+                       r,
+                       zix_strerror(status));
     }
   }
-  fprintf(insert_dat, "\t%lf", bench_end(&insert_start));
+  times[0] = bench_end(&insert_start);
 
   // Search for all elements
   struct timespec search_start = bench_start();
@@ -168,7 +166,7 @@ bench_zix_btree(size_t n_elems,
       return test_fail("Failed to get %" PRIuPTR "\n", r);
     }
   }
-  fprintf(search_dat, "\t%lf", bench_end(&search_start));
+  times[1] = bench_end(&search_start);
 
   // Iterate over all elements
   struct timespec iter_start = bench_start();
@@ -177,7 +175,7 @@ bench_zix_btree(size_t n_elems,
     volatile void* const value = zix_btree_get(iter);
     (void)value;
   }
-  fprintf(iter_dat, "\t%lf", bench_end(&iter_start));
+  times[2] = bench_end(&iter_start);
 
   // Delete all elements
   struct timespec del_start = bench_start();
@@ -190,9 +188,101 @@ bench_zix_btree(size_t n_elems,
       return test_fail("Failed to remove %" PRIuPTR "\n", r);
     }
   }
+  times[3] = bench_end(&del_start);
+
+  return EXIT_SUCCESS;
+}
+
+static int
+bench_zix_btree(size_t n_elems,
+                size_t page_size,
+                FILE*  insert_dat,
+                FILE*  search_dat,
+                FILE*  iter_dat,
+                FILE*  del_dat)
+{
+  start_test("ZixBTree");
+
+  // Phases that don't finish are written as NaN so every row is complete
+  double    times[4] = {(double)NAN, (double)NAN, (double)NAN, (double)NAN};
+  ZixBTree* t = zix_btree_new_with_page_size(NULL, page_size, int_cmp, NULL);
+
+  int st = EXIT_FAILURE;
+  if (!t) {
+    test_fail("Failed to create tree with %zu byte pages\n", page_size);
+  } else {
+    st = run_zix_btree(t, n_elems, times);
+    zix_btree_free(t, NULL, NULL);
+  }
+
+  fprintf(insert_dat, "\t%lf", times[0]);
+  fprintf(search_dat, "\t%lf", times[1]);
+  fprintf(iter_dat, "\t%lf", times[2]);
+  fprintf(del_dat, "\t%lf", times[3]);
+  return st;
+}
+
+static int
+bench_zix_radix_tree(size_t n_elems,
+                     FILE*  insert_dat,
+                     FILE*  search_dat,
+                     FILE*  iter_dat,
+                     FILE*  del_dat)
+{
+  start_test("ZixRadixTree");
+
+  uintptr_t        r  = 0U;
+  ZixRadixTreeIter ti = zix_radix_tree_end_iter;
+  ZixRadixTree*    t  = zix_radix_tree_new(NULL);
+
+  // Insert n_elems elements
+  struct timespec insert_start = bench_start();
+  for (size_t i = 0; i < n_elems; i++) {
+    r = unique_rand(i);
+
+    ZixStatus status = zix_radix_tree_insert(t, r, (void*)r);
+    if (status) {
+      return test_fail("Failed to insert %" PRIuPTR "\n", r);
+    }
+  }
+  fprintf(insert_dat, "\t%lf", bench_end(&insert_start));
+
+  // Search for all elements
+  struct timespec search_start = bench_start();
+  for (size_t i = 0; i < n_elems; i++) {
+    r = unique_rand(i);
+    if (zix_radix_tree_find(t, r, &ti)) {
+      return test_fail("Failed to find %" PRIuPTR "\n", r);
+    }
+    if ((uintptr_t)zix_radix_tree_get(ti) != r) {
+      return test_fail("Failed to get %" PRIuPTR "\n", r);
+    }
+  }
+  fprintf(search_dat, "\t%lf", bench_end(&search_start));
+
+  // Iterate over all elements
+  struct timespec  iter_start = bench_start();
+  ZixRadixTreeIter iter       = zix_radix_tree_begin(t);
+  for (; !zix_radix_tree_iter_is_end(iter);
+       zix_radix_tree_iter_increment(&iter)) {
+    volatile void* const value = zix_radix_tree_get(iter);
+    (void)value;
+  }
+  fprintf(iter_dat, "\t%lf", bench_end(&iter_start));
+
+  // Delete all elements
+  struct timespec del_start = bench_start();
+  for (size_t i = 0; i < n_elems; i++) {
+    r = unique_rand(i);
+
+    void* removed = NULL;
+    if (zix_radix_tree_remove(t, r, &removed)) {
+      return test_fail("Failed to remove %" PRIuPTR "\n", r);
+    }
+  }
   fprintf(del_dat, "\t%lf", bench_end(&del_start));
 
-  zix_btree_free(t, NULL, NULL);
+  zix_radix_tree_free(t, NULL, NULL);
 
   return EXIT_SUCCESS;
 }
@@ -272,7 +362,11 @@ main(int argc, char** argv)
 
   fprintf(stderr, "Benchmarking %zu .. %zu elements\n", min_n, max_n);
 
-#define HEADER "# n\tZixTree\tZixBTree\tGSequence\n"
+  static const size_t page_sizes[] = {256U, 512U, 1024U, 4096U, 16384U, 65536U};
+  static const size_t n_page_sizes = sizeof(page_sizes) / sizeof(size_t);
+
+#define HEADER "# n\tZixTree\tZixBTree\tZixRadixTree\tGSequence\n"
+#define PAGE_HEADER "# n\t256\t512\t1024\t4096\t16384\t65536\n"
 
   FILE* insert_dat = fopen("tree_insert.txt", "w");
   FILE* search_dat = fopen("tree_search.txt", "w");
@@ -282,6 +376,16 @@ main(int argc, char** argv)
   fprintf(search_dat, HEADER);
   fprintf(iter_dat, HEADER);
   fprintf(del_dat, HEADER);
+
+  FILE* page_insert_dat = fopen("btree_page_insert.txt", "w");
+  FILE* page_search_dat = fopen("btree_page_search.txt", "w");
+  FILE* page_iter_dat   = fopen("btree_page_iterate.txt", "w");
+  FILE* page_del_dat    = fopen("btree_page_delete.txt", "w");
+  fprintf(page_insert_dat, PAGE_HEADER);
+  fprintf(page_search_dat, PAGE_HEADER);
+  fprintf(page_iter_dat, PAGE_HEADER);
+  fprintf(page_del_dat, PAGE_HEADER);
+
   for (size_t n = min_n; n <= max_n; n *= 2) {
     fprintf(stderr, "n = %zu\n", n);
     fprintf(insert_dat, "%zu", n);
@@ -289,21 +393,47 @@ main(int argc, char** argv)
     fprintf(iter_dat, "%zu", n);
     fprintf(del_dat, "%zu", n);
     bench_zix_tree(n, insert_dat, search_dat, iter_dat, del_dat);
-    bench_zix_btree(n, insert_dat, search_dat, iter_dat, del_dat);
+    bench_zix_btree(n, 4096U, insert_dat, search_dat, iter_dat, del_dat);
+    bench_zix_radix_tree(n, insert_dat, search_dat, iter_dat, del_dat);
     bench_glib(n, insert_dat, search_dat, iter_dat, del_dat);
     fprintf(insert_dat, "\n");
     fprintf(search_dat, "\n");
     fprintf(iter_dat, "\n");
     fprintf(del_dat, "\n");
+
+    // Sweep over B-tree page sizes
+    fprintf(page_insert_dat, "%zu", n);
+    fprintf(page_search_dat, "%zu", n);
+    fprintf(page_iter_dat, "%zu", n);
+    fprintf(page_del_dat, "%zu", n);
+    for (size_t p = 0U; p < n_page_sizes; ++p) {
+      bench_zix_btree(n,
+                      page_sizes[p],
+                      page_insert_dat,
+                      page_search_dat,
+                      page_iter_dat,
+                      page_del_dat);
+    }
+    fprintf(page_insert_dat, "\n");
+    fprintf(page_search_dat, "\n");
+    fprintf(page_iter_dat, "\n");
+    fprintf(page_del_dat, "\n");
   }
   fclose(insert_dat);
   fclose(search_dat);
   fclose(iter_dat);
   fclose(del_dat);
+  fclose(page_insert_dat);
+  fclose(page_search_dat);
+  fclose(page_iter_dat);
+  fclose(page_del_dat);
 
   fprintf(
     stderr,
     "Wrote tree_insert.txt tree_search.txt tree_iterate.txt tree_del.txt\n");
+  fprintf(stderr,
+          "Wrote btree_page_insert.txt btree_page_search.txt "
+          "btree_page_iterate.txt btree_page_delete.txt\n");
 
   return EXIT_SUCCESS;
 }
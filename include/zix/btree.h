@@ -31,17 +31,70 @@ extern "C" {
    "fanout") of a B-Tree is high enough that a relatively short tree can
    contain many elements.  With the default page size of 4 KiB, the default
    height of 6 is enough to store trillions.
+
+   Smaller pages make for a taller tree though, and the smallest pages have
+   only 8 children per node in the worst case, so a tree with them may only
+   be able to hold about a million elements.  A higher limit can be set by
+   defining this when building both the library and everything that uses it,
+   since it changes the size of iterators.
 */
 #ifndef ZIX_BTREE_MAX_HEIGHT
 #  define ZIX_BTREE_MAX_HEIGHT 6U
 #endif
 
+/// The smallest page size that can be used for B-Tree nodes, in bytes
+#define ZIX_BTREE_MIN_PAGE_SIZE 256U
+
+/// The largest page size that can be used for B-Tree nodes, in bytes
+#define ZIX_BTREE_MAX_PAGE_SIZE 65536U
+
 /// A B-Tree
 typedef struct ZixBTreeImpl ZixBTree;
 
 /// A B-Tree node (opaque)
 typedef struct ZixBTreeNodeImpl ZixBTreeNode;
 
+/**
+   Statistics about the pool of pages used for the nodes of a B-Tree.
+
+   Pages are allocated in slabs, which are only freed along with the tree,
+   so memory used by removed nodes is kept and reused for new ones.
+*/
+typedef struct {
+  size_t n_slabs;      ///< Number of slabs allocated
+  size_t n_pages;      ///< Number of pages in all slabs
+  size_t n_used_pages; ///< Number of pages currently used by nodes
+  size_t n_free_pages; ///< Number of freed pages available for reuse
+} ZixBTreePoolStats;
+
+/// Statistics about the nodes on one level of a B-Tree
+typedef struct {
+  size_t n_nodes;  ///< Number of nodes on this level
+  size_t n_vals;   ///< Total number of values in all nodes on this level
+  size_t min_vals; ///< Number of values in the emptiest node on this level
+  size_t max_vals; ///< Capacity of every node on this level
+} ZixBTreeLevelStats;
+
+/**
+   Statistics about the shape of a B-Tree.
+
+   The average fill of a level is `n_vals / (n_nodes * max_vals)`.  Every
+   node other than the root is always at least about half full, so a tree
+   that has had many values removed can be up to twice as large as one that
+   was built with the same contents from scratch.
+
+   The counts of structural changes are since the tree was created, and
+   include the history of any tree it was split from or snapshotted from.
+*/
+typedef struct {
+  unsigned           height;      ///< Number of levels, including leaves
+  ZixBTreeLevelStats levels[ZIX_BTREE_MAX_HEIGHT]; ///< From the root down
+  size_t             n_bytes;     ///< Total size of all nodes in bytes
+  size_t             n_splits;    ///< Number of full nodes split in two
+  size_t             n_merges;    ///< Number of pairs of nodes merged
+  size_t             n_rotations; ///< Number of rebalancings of siblings
+} ZixBTreeStats;
+
 /**
    An iterator over a B-Tree.
 
@@ -58,10 +111,7 @@ typedef struct {
 } ZixBTreeIter;
 
 /// A static end iterator for convenience
-static const ZixBTreeIter zix_btree_end_iter = {
-  {NULL, NULL, NULL, NULL, NULL, NULL},
-  {0U, 0U, 0U, 0U, 0U, 0U},
-  0U};
+static const ZixBTreeIter zix_btree_end_iter = {{NULL}, {0U}, 0U};
 
 /**
    Create a new (empty) B-Tree.
@@ -78,6 +128,106 @@ zix_btree_new(ZixAllocator* ZIX_NULLABLE allocator,
               ZixComparator ZIX_NONNULL  cmp,
               const void* ZIX_NULLABLE   cmp_data);
 
+/**
+   Create a new (empty) B-Tree with a specific node size.
+
+   This is like zix_btree_new(), but allows the size of each node to be tuned
+   for the workload.  Larger pages make the tree shallower, which favours
+   search and iteration, while smaller pages make insertion and removal
+   cheaper since less data needs to be moved around within a node.
+
+   Note that the height of the tree is limited by #ZIX_BTREE_MAX_HEIGHT, so
+   very small pages limit the number of elements the tree can hold.  Insertion
+   fails with #ZIX_STATUS_OVERFLOW if this limit is reached.
+
+   @param allocator Allocator used for the tree and its nodes.
+
+   @param page_size Size of every node in bytes, which must be a power of two
+   between #ZIX_BTREE_MIN_PAGE_SIZE and #ZIX_BTREE_MAX_PAGE_SIZE inclusive.
+
+   @param cmp Comparator for values, see zix_btree_new().
+
+   @param cmp_data Pointer passed to `cmp`.
+
+   @return A new tree, or null if `page_size` is invalid or allocation failed.
+*/
+ZIX_API
+ZixBTree* ZIX_ALLOCATED
+zix_btree_new_with_page_size(ZixAllocator* ZIX_NULLABLE allocator,
+                             size_t                     page_size,
+                             ZixComparator ZIX_NONNULL  cmp,
+                             const void* ZIX_NULLABLE   cmp_data);
+
+/**
+   Function for getting the string key of a value.
+
+   The returned string must remain valid and unchanged for as long as the
+   value is in a tree.
+*/
+typedef const char* ZIX_NONNULL (*ZixBTreeKeyFunc)( //
+  const void* ZIX_NULLABLE value,
+  const void* ZIX_NULLABLE user_data);
+
+/**
+   Create a new (empty) B-Tree of values with string keys.
+
+   Values are ordered by comparing their keys with strcmp().  Rather than
+   calling a comparator for every value visited, each node stores a common
+   prefix length, and a fixed-size slice of every key just past that prefix.
+   Most comparisons during a search are then integer comparisons within the
+   node, and keys are only read in full to check the prefix, or to break ties
+   between equal slices.  This makes searching much faster for keys with
+   long shared prefixes like URIs or paths, at the cost of a slightly lower
+   fan-out.
+
+   Values passed to search functions like zix_btree_find() must also work
+   with `key`.
+
+   @param allocator Allocator used for the tree and its nodes.
+
+   @param page_size Size of every node in bytes, see
+   zix_btree_new_with_page_size().
+
+   @param key Function that returns the key of a value.
+
+   @param key_data Pointer passed to `key`.
+
+   @return A new tree, or null if `page_size` is invalid or allocation failed.
+*/
+ZIX_API
+ZixBTree* ZIX_ALLOCATED
+zix_btree_new_with_string_keys(ZixAllocator* ZIX_NULLABLE  allocator,
+                               size_t                      page_size,
+                               ZixBTreeKeyFunc ZIX_NONNULL key,
+                               const void* ZIX_NULLABLE    key_data);
+
+/**
+   Create a snapshot of `t`.
+
+   The snapshot is a new tree with exactly the same contents, which can be
+   modified independently of `t`.  This takes constant time, since the nodes
+   of `t` are shared rather than copied: nodes are reference counted, and
+   modifying any tree copies only the shared nodes on the path to the change.
+   So, a snapshot is cheap to take and hold on to, and the cost of modifying
+   a tree is proportional to how much it has diverged from the others.
+
+   Values themselves are never copied, so several trees may contain the same
+   values.  Care must be taken to not destroy values that are still in
+   another tree, for example by only passing a destroy function to
+   zix_btree_free() for the last remaining tree.
+
+   Trees that share nodes are not independent with respect to threads, since
+   they modify shared reference counts.  Any number of threads may read
+   snapshots, but modifying, snapshotting, or freeing any of the trees
+   requires exclusive access to all of them.
+
+   @return A new tree, or null if allocation failed or too many trees already
+   share nodes with `t` (about 65 thousand).
+*/
+ZIX_API
+ZixBTree* ZIX_ALLOCATED
+zix_btree_snapshot(ZixBTree* ZIX_NONNULL t);
+
 /**
    Free `t` and all the nodes it contains.
 
@@ -102,16 +252,117 @@ zix_btree_clear(ZixBTree* ZIX_NONNULL       t,
                 ZixDestroyFunc ZIX_NULLABLE destroy,
                 const void* ZIX_NULLABLE    destroy_user_data);
 
-/// Return the number of elements in `t`
+/**
+   Return the number of elements in `t`.
+
+   This is constant time, unless `t` was split (see zix_btree_split()) and
+   hasn't been counted since, in which case it counts the elements every time.
+*/
 ZIX_PURE_API
 size_t
 zix_btree_size(const ZixBTree* ZIX_NONNULL t);
 
+/**
+   Count the elements in `t` if necessary, and return the number.
+
+   Splitting doesn't count the elements in either tree, since that would take
+   time proportional to their size.  This counts them and stores the result in
+   `t`, so that zix_btree_size() is constant time again.  It does nothing more
+   than that for a tree that hasn't been split.
+*/
+ZIX_API
+size_t
+zix_btree_count(ZixBTree* ZIX_NONNULL t);
+
+/// Return the size of the nodes in `t` in bytes
+ZIX_PURE_API
+size_t
+zix_btree_page_size(const ZixBTree* ZIX_NONNULL t);
+
+/**
+   Return statistics about the pool of pages used by `t`.
+
+   A tree shares a pool with its snapshots, so this describes the memory used
+   by all of them together.
+*/
+ZIX_PURE_API
+ZixBTreePoolStats
+zix_btree_pool_stats(const ZixBTree* ZIX_NONNULL t);
+
+/**
+   Return statistics about the shape of `t`.
+
+   This visits every node, so takes time proportional to the size of the
+   tree.  Nodes shared with snapshots are counted as part of every tree that
+   contains them.
+*/
+ZIX_PURE_API
+ZixBTreeStats
+zix_btree_stats(const ZixBTree* ZIX_NONNULL t);
+
+/**
+   Rebuild `t` with nodes that are filled evenly.
+
+   After many removals, nodes may be only half full, and scattered around
+   memory.  This copies every value into new nodes, which are allocated in
+   key order from a new pool, so the tree is small and shallow, and a scan
+   of it reads memory sequentially.  The old nodes are then released, along
+   with the old pool if no snapshot still uses it.
+
+   Filling nodes completely makes the smallest tree, which is best for a
+   tree that is mostly read, but inserting into a full node splits it again.
+   Leaving some room in every node avoids this, so a tree that will still be
+   modified can be compacted without making the next insertions slower.
+
+   This rebuilds the whole tree at once, so takes time proportional to its
+   size, and invalidates all iterators.
+
+   @param t The tree to compact.
+
+   @param fill The percentage of each node to fill, from 50 (the least that
+   a node may be filled) to 100.  Nodes are spread evenly, so some may have
+   one more value than this, and a small tree may have fuller nodes.
+
+   @return #ZIX_STATUS_SUCCESS, #ZIX_STATUS_BAD_ARG if `fill` is out of
+   range, or #ZIX_STATUS_NO_MEM if the new nodes could not be allocated, in
+   which case `t` is unchanged.
+*/
+ZIX_API
+ZixStatus
+zix_btree_compact(ZixBTree* ZIX_NONNULL t, unsigned fill);
+
 /// Insert the element `e` into `t`
 ZIX_API
 ZixStatus
 zix_btree_insert(ZixBTree* ZIX_NONNULL t, void* ZIX_NULLABLE e);
 
+/**
+   Insert many elements into `t` at once.
+
+   This is equivalent to inserting each element with zix_btree_insert(), but
+   much faster for large batches, since each insertion resumes from the path
+   of the previous one instead of searching from the root.  Consecutive values
+   that land in the same leaf are simply appended to it, and nodes are only
+   split when they run out of space.
+
+   @param t Tree to insert into.
+
+   @param values Array of values to insert, sorted in ascending order
+   according to the tree comparator.
+
+   @param n_values Number of elements in `values`.
+
+   @return #ZIX_STATUS_SUCCESS if every value was inserted,
+   #ZIX_STATUS_EXISTS if some were skipped because they were already in the
+   tree, or an error if allocation failed, in which case only some leading
+   elements of `values` may have been inserted.
+*/
+ZIX_API
+ZixStatus
+zix_btree_insert_sorted_batch(ZixBTree* ZIX_NONNULL                  t,
+                              void* ZIX_NULLABLE const* ZIX_NULLABLE values,
+                              size_t                                 n_values);
+
 /**
    Remove the value `e` from `t`.
 
@@ -123,6 +374,9 @@ zix_btree_insert(ZixBTree* ZIX_NONNULL t, void* ZIX_NULLABLE e);
 
    @param next On successful return, set to point at the value that immediately
    followed `e`.
+
+   @return #ZIX_STATUS_SUCCESS, #ZIX_STATUS_NOT_FOUND, or #ZIX_STATUS_NO_MEM if
+   nodes shared with a snapshot could not be copied.
 */
 ZIX_API
 ZixStatus
@@ -131,6 +385,122 @@ zix_btree_remove(ZixBTree* ZIX_NONNULL           t,
                  void* ZIX_NULLABLE* ZIX_NONNULL out,
                  ZixBTreeIter* ZIX_NONNULL       next);
 
+/**
+   Remove many values from `t` at once.
+
+   This is equivalent to removing each key with zix_btree_remove(), but much
+   faster for large batches, since each removal resumes from the path of the
+   previous one instead of searching from the root.
+
+   @param t Tree to remove from.
+
+   @param keys Array of keys to remove, sorted in ascending order according to
+   the tree comparator.
+
+   @param n_keys Number of elements in `keys`.
+
+   @param destroy Function called exactly once for every removed value, just
+   after it is removed from the tree.
+
+   @param destroy_user_data Pointer passed to `destroy`.
+
+   @return #ZIX_STATUS_SUCCESS if every key was removed,
+   #ZIX_STATUS_NOT_FOUND if some keys were not in the tree, or
+   #ZIX_STATUS_NO_MEM if nodes shared with a snapshot could not be copied, in
+   which case only some leading elements of `keys` may have been removed.
+*/
+ZIX_API
+ZixStatus
+zix_btree_remove_sorted_batch(ZixBTree* ZIX_NONNULL                        t,
+                              const void* ZIX_NULLABLE const* ZIX_NULLABLE keys,
+                              size_t                      n_keys,
+                              ZixDestroyFunc ZIX_NULLABLE destroy,
+                              const void* ZIX_NULLABLE    destroy_user_data);
+
+/**
+   Remove every value in a range from `t`.
+
+   This removes all values from `lower` up to, but not including, `upper`.
+   Subtrees that are entirely within the range are dropped at once, and only
+   the nodes along the two edges of the range are rebalanced, so this is much
+   faster than removing values one at a time.  Removing `k` values takes time
+   proportional to the height of the tree, plus `k` divided by the node size
+   (plus `k` calls to `destroy`, if it is given).
+
+   @param t Tree to remove from.
+
+   @param lower Iterator to the first value to remove, typically from
+   zix_btree_begin() or zix_btree_lower_bound().  If this is the end, or not
+   before `upper`, then nothing is removed.
+
+   @param upper Iterator to the first value after the range, which may be the
+   end to remove everything from `lower` onwards.
+
+   @param destroy Function called exactly once for every removed value.
+
+   @param destroy_user_data Pointer passed to `destroy`.
+
+   @return #ZIX_STATUS_SUCCESS, or #ZIX_STATUS_NO_MEM if nodes shared with a
+   snapshot could not be copied, in which case nothing is removed.
+*/
+ZIX_API
+ZixStatus
+zix_btree_erase_range(ZixBTree* ZIX_NONNULL       t,
+                      ZixBTreeIter                lower,
+                      ZixBTreeIter                upper,
+                      ZixDestroyFunc ZIX_NULLABLE destroy,
+                      const void* ZIX_NULLABLE    destroy_user_data);
+
+/**
+   Split `t` into two trees at `key`.
+
+   Every value that isn't less than `key` is moved into a new tree, and the
+   rest remain in `t`.  Subtrees are moved without being visited, so this
+   takes time proportional to the height of the tree.  The sizes of the trees
+   are no longer known, so either should be counted with zix_btree_count() if
+   its size will be needed more than once.
+
+   The new tree shares a pool of pages with `t`, but no nodes, so the two
+   trees may be modified independently, even by different threads if the
+   compiler supports atomic operations.
+
+   @param t Tree to split.
+
+   @param key Key to split at, which doesn't need to be in the tree.
+
+   @param right Set to the new tree, which is empty if every value in `t` is
+   less than `key`.
+
+   @return #ZIX_STATUS_SUCCESS, or #ZIX_STATUS_NO_MEM if allocation failed,
+   in which case `t` is unchanged and `right` is set to null.
+*/
+ZIX_API
+ZixStatus
+zix_btree_split(ZixBTree* ZIX_NONNULL               t,
+                const void* ZIX_NULLABLE            key,
+                ZixBTree* ZIX_NULLABLE* ZIX_NONNULL right);
+
+/**
+   Move every value in `right` to the end of `left`, and free `right`.
+
+   This is the inverse of zix_btree_split(): every value in `left` must be
+   less than every value in `right`, and the two are joined by relinking
+   their nodes along the edge where they meet, which takes time proportional
+   to the height of the taller tree.
+
+   The trees must have the same allocator, page size, and comparator (or key
+   function), and `right` must either share a pool with `left` (for example,
+   because it was split from it), or not share its pool with any other tree.
+
+   @return #ZIX_STATUS_SUCCESS, #ZIX_STATUS_BAD_ARG if the trees can't be
+   joined, #ZIX_STATUS_OVERFLOW if the joined tree would be too tall, or
+   #ZIX_STATUS_NO_MEM if allocation failed.  On failure, both trees keep
+   their contents, and `right` is not freed.
+*/
+ZIX_API
+ZixStatus
+zix_btree_join(ZixBTree* ZIX_NONNULL left, ZixBTree* ZIX_NONNULL right);
+
 /**
    Set `ti` to an element exactly equal to `e` in `t`.
 
@@ -142,6 +512,42 @@ zix_btree_find(const ZixBTree* ZIX_NONNULL t,
                const void* ZIX_NULLABLE    e,
                ZixBTreeIter* ZIX_NONNULL   ti);
 
+/**
+   Set `ti` to an element exactly equal to `e` in `t`, starting from `ti`.
+
+   This is equivalent to zix_btree_find(), but uses `ti` as a "finger" to
+   start searching from, which must be an iterator in `t` (possibly the end).
+   The search only climbs as high as necessary to reach a subtree that could
+   contain `e`, so finding a value near the previous one is much faster than
+   starting from the root.  This is useful for accesses with good locality,
+   where `ti` can be kept between calls as a cursor.
+
+   If no such item exists, `ti` is left unchanged, so it can still be used.
+*/
+ZIX_API
+ZixStatus
+zix_btree_find_near(const ZixBTree* ZIX_NONNULL t,
+                    const void* ZIX_NULLABLE    e,
+                    ZixBTreeIter* ZIX_NONNULL   ti);
+
+/**
+   Insert the element `e` into `t`, starting from the position `ti`.
+
+   This is equivalent to zix_btree_insert(), but searches from `ti` like
+   zix_btree_find_near(), and inserts directly into the leaf if it has room.
+   Afterwards, `ti` points to the new element (or the existing equal one),
+   and can be passed to the next call.  Like any modification, this
+   invalidates all other iterators.
+
+   @return #ZIX_STATUS_SUCCESS, #ZIX_STATUS_EXISTS, #ZIX_STATUS_OVERFLOW, or
+   #ZIX_STATUS_NO_MEM, in which case `ti` is set to the end.
+*/
+ZIX_API
+ZixStatus
+zix_btree_insert_near(ZixBTree* ZIX_NONNULL     t,
+                      void* ZIX_NULLABLE        e,
+                      ZixBTreeIter* ZIX_NONNULL ti);
+
 /**
    Set `ti` to the smallest element in `t` that is not less than `e`.
 
@@ -179,6 +585,32 @@ ZIX_CONST_API
 ZixBTreeIter
 zix_btree_end(const ZixBTree* ZIX_NULLABLE t);
 
+/**
+   Partition `t` into ranges of roughly equal size for parallel iteration.
+
+   The tree is divided at the boundaries of subtrees on the highest level that
+   has enough of them, so this only visits the upper levels of the tree, and
+   the sizes of ranges are within a small factor of each other.  Every range
+   can be scanned independently, by any number of threads at once, as long as
+   the tree isn't modified.
+
+   @param t Tree to partition.
+
+   @param n_parts Maximum number of ranges, which must be at least 1.
+
+   @param bounds Array of at least `n_parts + 1` iterators.  Range `i` starts
+   at `bounds[i]` and ends just before `bounds[i + 1]`, and the last bound is
+   the end of the tree.
+
+   @return The number of ranges, which is less than `n_parts` if the tree is
+   too small to divide that many times (but always at least 1).
+*/
+ZIX_API
+size_t
+zix_btree_partition(const ZixBTree* ZIX_NONNULL t,
+                    size_t                      n_parts,
+                    ZixBTreeIter* ZIX_NONNULL   bounds);
+
 /// Return true iff `lhs` is equal to `rhs`
 ZIX_CONST_API
 bool
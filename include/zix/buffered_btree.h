@@ -0,0 +1,119 @@
+// Copyright 2011-2022 David Robillard <d@drobilla.net>
+// SPDX-License-Identifier: ISC
+
+#ifndef ZIX_BUFFERED_BTREE_H
+#define ZIX_BUFFERED_BTREE_H
+
+#include "zix/allocator.h"
+#include "zix/attributes.h"
+#include "zix/common.h"
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+   @addtogroup zix
+   @{
+   @name Buffered BTree
+   @{
+*/
+
+/**
+   A write-optimized B-Tree that maps 64-bit integer keys to 64-bit values.
+
+   This is a B^ε-Tree: every internal node has a buffer of pending changes
+   ("messages") as well as children.  Changes are added to the buffer at the
+   root, and when a buffer fills up, a batch of messages is moved down to the
+   child that most of them are destined for.  A change is written to a leaf
+   only once, along with many others, so insertion and removal are much
+   cheaper than in a ZixBTree, particularly for large trees with random keys.
+
+   The price is paid by searches, which must check the buffer of every node
+   on the way down to a leaf.  Since the tree has a smaller fanout to make
+   room for buffers, it is also somewhat taller.
+
+   Insertion and removal are "blind": they don't search the tree to see if
+   the key is already present, so inserting an existing key replaces its
+   value, removing a missing key does nothing, and the tree doesn't know how
+   many entries it contains.
+*/
+typedef struct ZixBufferedBTreeImpl ZixBufferedBTree;
+
+/// Create a new (empty) buffered B-Tree
+ZIX_API
+ZixBufferedBTree* ZIX_ALLOCATED
+zix_buffered_btree_new(ZixAllocator* ZIX_NULLABLE allocator);
+
+/// Free `t` and all the nodes it contains
+ZIX_API
+void
+zix_buffered_btree_free(ZixBufferedBTree* ZIX_NULLABLE t);
+
+/**
+   Insert or replace an entry in `t`.
+
+   If an entry with the given key is already present, its value is replaced.
+
+   @return #ZIX_STATUS_SUCCESS, or #ZIX_STATUS_NO_MEM if a buffer had to be
+   flushed but a new node could not be allocated.
+*/
+ZIX_API
+ZixStatus
+zix_buffered_btree_insert(ZixBufferedBTree* ZIX_NONNULL t,
+                          uint64_t                      key,
+                          uint64_t                      value);
+
+/**
+   Remove an entry from `t` if it is present.
+
+   @return #ZIX_STATUS_SUCCESS (even if there is no such entry), or
+   #ZIX_STATUS_NO_MEM if a buffer had to be flushed but a new node could not
+   be allocated.
+*/
+ZIX_API
+ZixStatus
+zix_buffered_btree_remove(ZixBufferedBTree* ZIX_NONNULL t, uint64_t key);
+
+/**
+   Find the value for a key in `t`.
+
+   @param t Tree to search.
+
+   @param key Key to search for.
+
+   @param value If not null, set to the value of the entry if it is found.
+
+   @return #ZIX_STATUS_SUCCESS, or #ZIX_STATUS_NOT_FOUND.
+*/
+ZIX_API
+ZixStatus
+zix_buffered_btree_find(const ZixBufferedBTree* ZIX_NONNULL t,
+                        uint64_t                            key,
+                        uint64_t* ZIX_NULLABLE              value);
+
+/**
+   Move every pending change in `t` down to the leaves.
+
+   This is never necessary for correctness, but makes subsequent searches
+   faster, which can be useful after a large batch of changes.
+
+   @return #ZIX_STATUS_SUCCESS, or #ZIX_STATUS_NO_MEM if a new node could not
+   be allocated, in which case some changes may still be pending.
+*/
+ZIX_API
+ZixStatus
+zix_buffered_btree_flush(ZixBufferedBTree* ZIX_NONNULL t);
+
+/**
+   @}
+   @}
+*/
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* ZIX_BUFFERED_BTREE_H */
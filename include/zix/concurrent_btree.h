@@ -0,0 +1,145 @@
+// Copyright 2011-2022 David Robillard <d@drobilla.net>
+// SPDX-License-Identifier: ISC
+
+#ifndef ZIX_CONCURRENT_BTREE_H
+#define ZIX_CONCURRENT_BTREE_H
+
+#include "zix/allocator.h"
+#include "zix/attributes.h"
+#include "zix/common.h"
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+   @addtogroup zix
+   @{
+   @name Concurrent BTree
+   @{
+*/
+
+/**
+   A B-Tree that can be used from many threads at once.
+
+   This is a variant of ZixBTree that uses optimistic lock coupling instead of
+   a global lock.  Every node has a version counter which is incremented by
+   every modification.  Readers never write to shared memory, they just record
+   versions on the way down and check that they didn't change, restarting if
+   a concurrent write got in the way.  Writers lock only the nodes they
+   modify, so operations on different parts of the tree proceed in parallel.
+
+   Since readers may still be looking at a node when a writer removes it from
+   the tree, nodes freed by removal are only retired, and not actually freed
+   until zix_concurrent_btree_collect() or zix_concurrent_btree_free() is
+   called.  The same applies to removed values, which may still be passed to
+   the comparator by concurrent readers, so they must not be destroyed until
+   no other threads are accessing the tree.
+
+   Values must not be null.  There are no iterators, since they can not be
+   kept valid while other threads modify the tree.
+*/
+typedef struct ZixConcurrentBTreeImpl ZixConcurrentBTree;
+
+/**
+   Create a new (empty) concurrent B-Tree.
+
+   The given comparator must be a total ordering, and must be safe to call
+   from several threads at once.
+*/
+ZIX_API
+ZixConcurrentBTree* ZIX_ALLOCATED
+zix_concurrent_btree_new(ZixAllocator* ZIX_NULLABLE allocator,
+                         ZixComparator ZIX_NONNULL  cmp,
+                         const void* ZIX_NULLABLE   cmp_data);
+
+/**
+   Free `t` and all the nodes it contains.
+
+   This must only be called when no other threads are accessing the tree.
+
+   @param destroy Function to call once for every value in the tree.  This can
+   be used to free values if they are dynamically allocated.
+*/
+ZIX_API
+void
+zix_concurrent_btree_free(ZixConcurrentBTree* ZIX_NULLABLE t,
+                          ZixDestroyFunc ZIX_NULLABLE      destroy,
+                          const void* ZIX_NULLABLE         destroy_user_data);
+
+/**
+   Free all the nodes that were retired by removals.
+
+   This must only be called when no other threads are accessing the tree,
+   for example between phases of a parallel computation.
+*/
+ZIX_API
+void
+zix_concurrent_btree_collect(ZixConcurrentBTree* ZIX_NONNULL t);
+
+/**
+   Return the number of elements in `t`.
+
+   If other threads are modifying the tree, this is only a snapshot.
+*/
+ZIX_API
+size_t
+zix_concurrent_btree_size(const ZixConcurrentBTree* ZIX_NONNULL t);
+
+/**
+   Insert the element `e` into `t`.
+
+   @return #ZIX_STATUS_SUCCESS, #ZIX_STATUS_EXISTS if an equal element is
+   already in the tree, or #ZIX_STATUS_NO_MEM.
+*/
+ZIX_API
+ZixStatus
+zix_concurrent_btree_insert(ZixConcurrentBTree* ZIX_NONNULL t,
+                            void* ZIX_NONNULL               e);
+
+/**
+   Remove the value `e` from `t`.
+
+   @param t Tree to remove from.
+
+   @param e Value to remove.
+
+   @param out Set to point to the removed pointer (which may not equal `e`).
+
+   @return #ZIX_STATUS_SUCCESS, or #ZIX_STATUS_NOT_FOUND.
+*/
+ZIX_API
+ZixStatus
+zix_concurrent_btree_remove(ZixConcurrentBTree* ZIX_NONNULL t,
+                            const void* ZIX_NONNULL         e,
+                            void* ZIX_NULLABLE* ZIX_NONNULL out);
+
+/**
+   Find an element exactly equal to `e` in `t`.
+
+   @param t Tree to search.
+
+   @param e Key to search for.
+
+   @param out Set to point to the value in the tree if it is found.
+
+   @return #ZIX_STATUS_SUCCESS, or #ZIX_STATUS_NOT_FOUND.
+*/
+ZIX_API
+ZixStatus
+zix_concurrent_btree_find(const ZixConcurrentBTree* ZIX_NONNULL t,
+                          const void* ZIX_NONNULL               e,
+                          void* ZIX_NULLABLE* ZIX_NONNULL       out);
+
+/**
+   @}
+   @}
+*/
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* ZIX_CONCURRENT_BTREE_H */
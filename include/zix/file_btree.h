@@ -0,0 +1,246 @@
+// Copyright 2011-2022 David Robillard <d@drobilla.net>
+// SPDX-License-Identifier: ISC
+
+#ifndef ZIX_FILE_BTREE_H
+#define ZIX_FILE_BTREE_H
+
+#include "zix/allocator.h"
+#include "zix/attributes.h"
+#include "zix/common.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+   @addtogroup zix
+   @{
+   @name File BTree
+   @{
+*/
+
+/// The size of a page in a file B-Tree, in bytes
+#define ZIX_FILE_BTREE_PAGE_SIZE 4096U
+
+/**
+   The maximum height of a file B-Tree.
+
+   This determines the size of iterators.  Every internal node other than the
+   root has at least 128 children, so a tree this tall would need more pages
+   than a 64-bit file can hold.
+*/
+#define ZIX_FILE_BTREE_MAX_HEIGHT 10U
+
+/**
+   A B-Tree index stored in a memory-mapped file.
+
+   This is a B+-Tree that maps 64-bit integer keys to 64-bit integer values,
+   where every node is one page of the file.  Nodes refer to their children by
+   page number rather than by address, so the file can be closed and opened
+   again later, and opening a file is instant regardless of its size, since
+   pages are only read from disk when a search first touches them.
+
+   Changes are written to the mapping directly, and flushed to disk by the
+   operating system at some point, or explicitly with zix_file_btree_sync().
+   There is no journal, so a file is only guaranteed to be consistent after a
+   successful sync.  Files are not portable between machines with different
+   byte orders.  Everything read from the file is checked before it is used,
+   so operations on a corrupt file fail with #ZIX_STATUS_BAD_ARG.
+
+   Removal does not rebalance the tree or reclaim pages, so the file only ever
+   grows.  This keeps removal cheap, and is a good trade-off for indices that
+   are mostly added to, but a file with heavy churn should occasionally be
+   rebuilt.
+
+   This is only available on systems that support POSIX memory mapping.
+   Elsewhere, zix_file_btree_open() always fails.
+*/
+typedef struct ZixFileBTreeImpl ZixFileBTree;
+
+/**
+   An iterator over the entries of a file B-Tree in order of key.
+
+   Iterators refer to nodes by page number, so they can be copied freely, but
+   modifying the tree invalidates all iterators.  A range of keys can be
+   scanned by starting from zix_file_btree_lower_bound() and incrementing
+   until the end, or a key past the range.
+
+   The contents of this type are considered an implementation detail and should
+   not be used directly by clients.  They are nevertheless exposed here so that
+   iterators can be allocated on the stack.
+*/
+typedef struct {
+  uint64_t pages[ZIX_FILE_BTREE_MAX_HEIGHT];   ///< Page stack from the root
+  uint16_t indexes[ZIX_FILE_BTREE_MAX_HEIGHT]; ///< Index stack
+  uint16_t level;                              ///< Current level
+} ZixFileBTreeIter;
+
+/// A static end iterator for convenience
+static const ZixFileBTreeIter zix_file_btree_end_iter = {{0U}, {0U}, 0U};
+
+/**
+   Open or create a B-Tree file.
+
+   If the file at `path` does not exist or is empty, a new empty tree is
+   written to it.  Otherwise, the file must be a tree previously written by
+   this implementation.
+
+   @param allocator Allocator used for the (small) tree handle, nodes are
+   always in the file.
+
+   @param path Path to the file to open.
+
+   @return A new tree handle, or null if the file could not be opened or is
+   not a valid tree.
+*/
+ZIX_API
+ZixFileBTree* ZIX_ALLOCATED
+zix_file_btree_open(ZixAllocator* ZIX_NULLABLE allocator,
+                    const char* ZIX_NONNULL    path);
+
+/**
+   Close a tree opened with zix_file_btree_open().
+
+   This unmaps the file without syncing it first, the operating system will
+   still eventually write any changes to disk.
+*/
+ZIX_API
+void
+zix_file_btree_close(ZixFileBTree* ZIX_NULLABLE t);
+
+/**
+   Flush all changes to disk.
+
+   This blocks until all modified pages are written.
+
+   @return #ZIX_STATUS_SUCCESS, or #ZIX_STATUS_ERROR if writing failed.
+*/
+ZIX_API
+ZixStatus
+zix_file_btree_sync(ZixFileBTree* ZIX_NONNULL t);
+
+/// Return the number of entries in `t`
+ZIX_PURE_API
+size_t
+zix_file_btree_size(const ZixFileBTree* ZIX_NONNULL t);
+
+/**
+   Insert a new entry into `t`.
+
+   @return #ZIX_STATUS_SUCCESS, #ZIX_STATUS_EXISTS if there is already an
+   entry with the given key, #ZIX_STATUS_NO_MEM if the file could not be
+   remapped, #ZIX_STATUS_ERROR if the file could not be resized,
+   #ZIX_STATUS_OVERFLOW if the tree is already as tall as possible, or
+   #ZIX_STATUS_BAD_ARG if the file is corrupt.
+*/
+ZIX_API
+ZixStatus
+zix_file_btree_insert(ZixFileBTree* ZIX_NONNULL t,
+                      uint64_t                  key,
+                      uint64_t                  value);
+
+/**
+   Remove an entry from `t`.
+
+   @param t Tree to remove from.
+
+   @param key Key of the entry to remove.
+
+   @param value If not null, set to the value of the removed entry.
+
+   @return #ZIX_STATUS_SUCCESS, #ZIX_STATUS_NOT_FOUND, or #ZIX_STATUS_BAD_ARG
+   if the file is corrupt.
+*/
+ZIX_API
+ZixStatus
+zix_file_btree_remove(ZixFileBTree* ZIX_NONNULL t,
+                      uint64_t                  key,
+                      uint64_t* ZIX_NULLABLE    value);
+
+/**
+   Find the value for a key in `t`.
+
+   @param t Tree to search.
+
+   @param key Key to search for.
+
+   @param value If not null, set to the value of the entry if it is found.
+
+   @return #ZIX_STATUS_SUCCESS, #ZIX_STATUS_NOT_FOUND, or #ZIX_STATUS_BAD_ARG
+   if the file is corrupt.
+*/
+ZIX_API
+ZixStatus
+zix_file_btree_find(const ZixFileBTree* ZIX_NONNULL t,
+                    uint64_t                        key,
+                    uint64_t* ZIX_NULLABLE          value);
+
+/**
+   Find the first entry in `t` with a key that is not less than `key`.
+
+   @param t Tree to search.
+
+   @param key Key to search for.
+
+   @param ti Set to the first entry with a key not less than `key`, or the end
+   if there is no such entry.
+
+   @return #ZIX_STATUS_SUCCESS, or #ZIX_STATUS_BAD_ARG if the file is
+   corrupt, in which case `ti` is set to the end.
+*/
+ZIX_API
+ZixStatus
+zix_file_btree_lower_bound(const ZixFileBTree* ZIX_NONNULL t,
+                           uint64_t                        key,
+                           ZixFileBTreeIter* ZIX_NONNULL   ti);
+
+/// Set `ti` to the first entry in `t`, like zix_file_btree_lower_bound()
+ZIX_API
+ZixStatus
+zix_file_btree_begin(const ZixFileBTree* ZIX_NONNULL t,
+                     ZixFileBTreeIter* ZIX_NONNULL   ti);
+
+/// Return true iff `i` is an iterator at the end of a tree
+static inline bool
+zix_file_btree_iter_is_end(const ZixFileBTreeIter i)
+{
+  return !i.pages[0];
+}
+
+/// Return the key of the entry at `i`, which must not be the end
+ZIX_PURE_API
+uint64_t
+zix_file_btree_iter_key(const ZixFileBTree* ZIX_NONNULL t, ZixFileBTreeIter i);
+
+/// Return the value of the entry at `i`, which must not be the end
+ZIX_PURE_API
+uint64_t
+zix_file_btree_iter_value(const ZixFileBTree* ZIX_NONNULL t,
+                          ZixFileBTreeIter                i);
+
+/**
+   Increment `i` to point to the next entry in the tree.
+
+   @return #ZIX_STATUS_SUCCESS, #ZIX_STATUS_REACHED_END if `i` was at the
+   last entry, or #ZIX_STATUS_BAD_ARG if the file is corrupt.  In both of the
+   latter cases, `i` is set to the end.
+*/
+ZIX_API
+ZixStatus
+zix_file_btree_iter_increment(const ZixFileBTree* ZIX_NONNULL t,
+                              ZixFileBTreeIter* ZIX_NONNULL   i);
+
+/**
+   @}
+   @}
+*/
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* ZIX_FILE_BTREE_H */
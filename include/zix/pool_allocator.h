@@ -0,0 +1,94 @@
+// Copyright 2021 David Robillard <d@drobilla.net>
+// SPDX-License-Identifier: ISC
+
+#ifndef ZIX_POOL_ALLOCATOR_H
+#define ZIX_POOL_ALLOCATOR_H
+
+#include "zix/allocator.h"
+#include "zix/attributes.h"
+
+#include <stddef.h>
+
+/// The size of pages allocated from the backing allocator in bytes
+#define ZIX_POOL_ALLOCATOR_PAGE_SIZE 4096U
+
+/// The granularity of small allocation sizes in bytes
+#define ZIX_POOL_ALLOCATOR_GRANULARITY 16U
+
+/// The largest allocation size that is served from a free list
+#define ZIX_POOL_ALLOCATOR_MAX_SIZE 512U
+
+/// The number of small allocation size classes
+#define ZIX_POOL_ALLOCATOR_N_BINS \
+  (ZIX_POOL_ALLOCATOR_MAX_SIZE / ZIX_POOL_ALLOCATOR_GRANULARITY)
+
+/// A page of memory allocated from the backing allocator
+typedef struct ZixPoolAllocatorPageImpl ZixPoolAllocatorPage;
+
+/// Free blocks of a single size
+typedef struct {
+  void* ZIX_NULLABLE free; ///< Most recently freed block
+  char* ZIX_NULLABLE top;  ///< Start of never-used space in the newest page
+  char* ZIX_NULLABLE end;  ///< End of the newest page
+} ZixPoolAllocatorBin;
+
+/**
+   A pool allocator for many small objects of a few sizes.
+
+   This allocator is designed for data structures like trees and hash tables
+   which allocate many nodes of the same size one at a time.  Small
+   allocations are rounded up to a multiple of #ZIX_POOL_ALLOCATOR_GRANULARITY
+   and carved out of pages which hold blocks of a single size.  Freed blocks
+   are kept in a free list per size, so they are immediately reused by the
+   next allocation of the same size, and allocation and deallocation are both
+   constant time, with no per-block overhead.
+
+   Pages are allocated from a backing allocator, and are only returned to it
+   when the pool is cleared, so memory usage is proportional to the maximum
+   number of blocks of each size in use at once.
+
+   The details are:
+
+   - All allocations are aligned to #ZIX_POOL_ALLOCATOR_GRANULARITY.
+
+   - Allocations larger than #ZIX_POOL_ALLOCATOR_MAX_SIZE take one or more
+     whole pages directly from the backing allocator, and are returned to it
+     when freed.  This works for occasional larger objects, but wastes space
+     if there are many that are only a bit larger than the maximum size.
+
+   - Aligned allocations are passed directly to the backing allocator.
+
+   - There is no locking, so a pool must only be used by a single thread at a
+     time.  Using one pool per thread avoids contention entirely, but memory
+     must be freed by the thread that allocated it.
+*/
+typedef struct {
+  ZixAllocator                       base;    ///< Base allocator instance
+  ZixAllocator* ZIX_NULLABLE         backing; ///< Allocator for pages
+  ZixPoolAllocatorPage* ZIX_NULLABLE pages;   ///< All allocated pages
+
+  /// Free blocks for each size class, smallest first
+  ZixPoolAllocatorBin bins[ZIX_POOL_ALLOCATOR_N_BINS];
+} ZixPoolAllocator;
+
+/**
+   Return a new empty pool allocator.
+
+   @param backing Allocator used to allocate pages, or null to use the system
+   allocator.
+*/
+ZIX_API
+ZixPoolAllocator
+zix_pool_allocator(ZixAllocator* ZIX_NULLABLE backing);
+
+/**
+   Free all memory allocated by a pool allocator.
+
+   This invalidates every block previously allocated from the pool, including
+   those that were not freed.  The pool is left empty, and can be used again.
+*/
+ZIX_API
+void
+zix_pool_allocator_clear(ZixPoolAllocator* ZIX_NONNULL allocator);
+
+#endif // ZIX_POOL_ALLOCATOR_H
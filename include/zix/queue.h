@@ -0,0 +1,112 @@
+// Copyright 2022 David Robillard <d@drobilla.net>
+// SPDX-License-Identifier: ISC
+
+#ifndef ZIX_QUEUE_H
+#define ZIX_QUEUE_H
+
+#include "zix/allocator.h"
+#include "zix/attributes.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+   @addtogroup zix
+   @{
+   @name Queue
+   @{
+*/
+
+/**
+   A lock-free bounded queue of fixed-size elements.
+
+   Unlike @ref ZixRing, a queue is thread-safe with any number of readers and
+   writers, so it can be used to gather work from many threads into one, or
+   distribute work from one thread to many.  Every element has the same size,
+   and is copied into a slot in the queue when it is pushed, and out of it
+   when it is popped.
+
+   Pushing and popping never block or allocate, so both are realtime safe, but
+   they may retry if another thread is pushing or popping at the same time.
+   Elements pushed by a single thread are popped in the order they were
+   pushed, but there is no order between elements pushed by different
+   threads.
+*/
+typedef struct ZixQueueImpl ZixQueue;
+
+/**
+   Create a new queue.
+
+   @param allocator Allocator for the queue and its slots.
+   @param n_slots Maximum number of elements in the queue at once (note this
+   may be rounded up to a power of two, and is at least two).
+   @param slot_size Size of every element in bytes.
+*/
+ZIX_MALLOC_API
+ZixQueue* ZIX_ALLOCATED
+zix_queue_new(ZixAllocator* ZIX_NULLABLE allocator,
+              uint32_t                   n_slots,
+              uint32_t                   slot_size);
+
+/// Destroy a queue
+ZIX_API
+void
+zix_queue_free(ZixQueue* ZIX_NULLABLE queue);
+
+/**
+   Lock the queue data into physical memory.
+
+   This function is NOT thread safe or real-time safe, but it should be called
+   after zix_queue_new() to lock all queue memory to avoid page faults while
+   using the queue, like zix_ring_mlock().
+*/
+ZIX_API
+void
+zix_queue_mlock(ZixQueue* ZIX_NONNULL queue);
+
+/// Return the maximum number of elements in the queue at once
+ZIX_PURE_API
+uint32_t
+zix_queue_capacity(const ZixQueue* ZIX_NONNULL queue);
+
+/// Return the size of every element in bytes
+ZIX_PURE_API
+uint32_t
+zix_queue_slot_size(const ZixQueue* ZIX_NONNULL queue);
+
+/**
+   Push an element to the back of the queue.
+
+   @param queue The queue to push to.
+   @param src The element to copy into the queue, which must be the slot size.
+   @return True if the element was pushed, or false if the queue is full.
+*/
+ZIX_API
+bool
+zix_queue_push(ZixQueue* ZIX_NONNULL queue, const void* ZIX_NONNULL src);
+
+/**
+   Pop an element from the front of the queue.
+
+   @param queue The queue to pop from.
+   @param dst Buffer to copy the element to, which must be the slot size.
+   @return True if an element was popped, or false if the queue is empty.
+*/
+ZIX_API
+bool
+zix_queue_pop(ZixQueue* ZIX_NONNULL queue, void* ZIX_NONNULL dst);
+
+/**
+   @}
+   @}
+*/
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* ZIX_QUEUE_H */
@@ -0,0 +1,200 @@
+// Copyright 2011-2022 David Robillard <d@drobilla.net>
+// SPDX-License-Identifier: ISC
+
+#ifndef ZIX_RADIX_TREE_H
+#define ZIX_RADIX_TREE_H
+
+#include "zix/allocator.h"
+#include "zix/attributes.h"
+#include "zix/common.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+   @addtogroup zix
+   @{
+   @name Radix Tree
+   @{
+*/
+
+/// The maximum number of internal nodes on the path to any value
+#define ZIX_RADIX_TREE_MAX_HEIGHT 8U
+
+/**
+   An ordered map from 64-bit integer keys to pointers.
+
+   This is an adaptive radix tree, which uses successive bytes of the key
+   (most significant first) to choose a child at each level, rather than
+   comparing keys.  Nodes grow and shrink between 4, 16, 48, and 256 children
+   to keep them small, levels with only a single child are skipped, and a
+   value is stored as soon as its key is unique, so a search only touches a
+   few nodes, and never calls a comparator.
+
+   The interface is similar to ZixBTree, except the key is separate from the
+   value, and is always compared numerically.
+*/
+typedef struct ZixRadixTreeImpl ZixRadixTree;
+
+/// An internal node in a radix tree
+typedef struct ZixRadixTreeNodeImpl ZixRadixTreeNode;
+
+/// A leaf in a radix tree, which holds a key and a value
+typedef struct ZixRadixTreeLeafImpl ZixRadixTreeLeaf;
+
+/**
+   An iterator over a radix tree.
+
+   Note that modifying the tree invalidates all iterators.
+
+   The contents of this type are considered an implementation detail and should
+   not be used directly by clients.  They are nevertheless exposed here so that
+   iterators can be allocated on the stack.
+*/
+typedef struct {
+  ZixRadixTreeNode* ZIX_NULLABLE nodes[ZIX_RADIX_TREE_MAX_HEIGHT];   ///< Nodes
+  uint16_t                       indexes[ZIX_RADIX_TREE_MAX_HEIGHT]; ///< Bytes
+  uint16_t                       level; ///< Number of nodes above the leaf
+  ZixRadixTreeLeaf* ZIX_NULLABLE leaf;  ///< Current leaf, or null at the end
+} ZixRadixTreeIter;
+
+/// A static end iterator for convenience
+static const ZixRadixTreeIter zix_radix_tree_end_iter = {
+  {NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL},
+  {0U, 0U, 0U, 0U, 0U, 0U, 0U, 0U},
+  0U,
+  NULL};
+
+/// Create a new (empty) radix tree
+ZIX_API
+ZixRadixTree* ZIX_ALLOCATED
+zix_radix_tree_new(ZixAllocator* ZIX_NULLABLE allocator);
+
+/**
+   Free `t` and all the nodes it contains.
+
+   @param destroy Function to call once for every value in the tree.  This can
+   be used to free values if they are dynamically allocated.
+*/
+ZIX_API
+void
+zix_radix_tree_free(ZixRadixTree* ZIX_NULLABLE  t,
+                    ZixDestroyFunc ZIX_NULLABLE destroy,
+                    const void* ZIX_NULLABLE    destroy_user_data);
+
+/// Return the number of elements in `t`
+ZIX_PURE_API
+size_t
+zix_radix_tree_size(const ZixRadixTree* ZIX_NONNULL t);
+
+/**
+   Insert the value `value` with key `key` into `t`.
+
+   @return #ZIX_STATUS_SUCCESS, #ZIX_STATUS_EXISTS if `t` already contains
+   `key` (in which case the tree is unchanged), or #ZIX_STATUS_NO_MEM.
+*/
+ZIX_API
+ZixStatus
+zix_radix_tree_insert(ZixRadixTree* ZIX_NONNULL t,
+                      uint64_t                  key,
+                      void* ZIX_NULLABLE        value);
+
+/**
+   Remove the entry with key `key` from `t`.
+
+   @param t Tree to remove from.
+
+   @param key Key of the entry to remove.
+
+   @param out Set to the value of the removed entry.
+
+   @return #ZIX_STATUS_SUCCESS, or #ZIX_STATUS_NOT_FOUND.
+*/
+ZIX_API
+ZixStatus
+zix_radix_tree_remove(ZixRadixTree* ZIX_NONNULL       t,
+                      uint64_t                        key,
+                      void* ZIX_NULLABLE* ZIX_NONNULL out);
+
+/**
+   Set `ti` to the entry with key `key` in `t`.
+
+   @return #ZIX_STATUS_SUCCESS, or #ZIX_STATUS_NOT_FOUND, in which case `ti`
+   is set to the end.
+*/
+ZIX_API
+ZixStatus
+zix_radix_tree_find(const ZixRadixTree* ZIX_NONNULL t,
+                    uint64_t                        key,
+                    ZixRadixTreeIter* ZIX_NONNULL   ti);
+
+/**
+   Set `ti` to the first entry with a key that is not less than `key`.
+
+   If every key in `t` is less than `key`, then `ti` is set to the end.
+
+   @return #ZIX_STATUS_SUCCESS.
+*/
+ZIX_API
+ZixStatus
+zix_radix_tree_lower_bound(const ZixRadixTree* ZIX_NONNULL t,
+                           uint64_t                        key,
+                           ZixRadixTreeIter* ZIX_NONNULL   ti);
+
+/// Return the key at the given position in the tree, which must not be the end
+ZIX_PURE_API
+uint64_t
+zix_radix_tree_key(ZixRadixTreeIter ti);
+
+/// Return the value at the given position in the tree
+ZIX_PURE_API
+void* ZIX_NULLABLE
+zix_radix_tree_get(ZixRadixTreeIter ti);
+
+/// Return an iterator to the first (smallest) entry in `t`
+ZIX_PURE_API
+ZixRadixTreeIter
+zix_radix_tree_begin(const ZixRadixTree* ZIX_NONNULL t);
+
+/// Return an iterator to the end of `t` (one past the last entry)
+ZIX_CONST_API
+ZixRadixTreeIter
+zix_radix_tree_end(const ZixRadixTree* ZIX_NULLABLE t);
+
+/// Return true iff `lhs` is equal to `rhs`
+ZIX_CONST_API
+bool
+zix_radix_tree_iter_equals(ZixRadixTreeIter lhs, ZixRadixTreeIter rhs);
+
+/// Return true iff `i` is an iterator at the end of a tree
+static inline bool
+zix_radix_tree_iter_is_end(const ZixRadixTreeIter i)
+{
+  return !i.leaf;
+}
+
+/// Increment `i` to point to the next entry in the tree
+ZIX_API
+ZixStatus
+zix_radix_tree_iter_increment(ZixRadixTreeIter* ZIX_NONNULL i);
+
+/// Return an iterator one past `iter`
+ZIX_API
+ZixRadixTreeIter
+zix_radix_tree_iter_next(ZixRadixTreeIter iter);
+
+/**
+   @}
+   @}
+*/
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* ZIX_RADIX_TREE_H */
@@ -6,7 +6,9 @@
 
 #include "zix/allocator.h"
 #include "zix/attributes.h"
+#include "zix/common.h"
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -38,6 +40,28 @@ ZIX_MALLOC_API
 ZixRing* ZIX_ALLOCATED
 zix_ring_new(ZixAllocator* ZIX_NULLABLE allocator, uint32_t size);
 
+/**
+   Create a new mirrored ring.
+
+   A mirrored ring maps the same memory twice in a row, so that any data in
+   the ring is contiguous in memory, even if it wraps around the end.  This
+   means that zix_ring_write_reserve() and zix_ring_read_acquire() always
+   return a single region, so variable-length data can be used directly in
+   the ring by code that needs contiguous memory.
+
+   The ring memory is allocated by the system rather than `allocator` (which
+   is only used for the ring itself), and the size is rounded up to a whole
+   number of pages.  This is currently only supported on Linux, but clients
+   can fall back to zix_ring_new() if it fails.
+
+   @param allocator Allocator for the ring structure.
+   @param size Size in bytes (note this may be rounded up).
+   @return A new ring, or null if a mirrored ring couldn't be created.
+*/
+ZIX_MALLOC_API
+ZixRing* ZIX_ALLOCATED
+zix_ring_new_mirrored(ZixAllocator* ZIX_NULLABLE allocator, uint32_t size);
+
 /// Destroy a ring
 ZIX_API
 void
@@ -76,6 +100,11 @@ ZIX_PURE_API
 uint32_t
 zix_ring_write_space(const ZixRing* ZIX_NONNULL ring);
 
+/// Return true if `ring` is mirrored, see zix_ring_new_mirrored()
+ZIX_PURE_API
+bool
+zix_ring_is_mirrored(const ZixRing* ZIX_NONNULL ring);
+
 /// Return the capacity (i.e. total write space when empty)
 ZIX_PURE_API
 uint32_t
@@ -103,6 +132,179 @@ zix_ring_write(ZixRing* ZIX_NONNULL    ring,
                const void* ZIX_NONNULL src,
                uint32_t                size);
 
+/**
+   A contiguous region of memory in a ring.
+
+   Data that wraps around the end of the ring is made up of two regions, the
+   second of which starts at the beginning of the ring buffer.
+*/
+typedef struct {
+  void* ZIX_NULLABLE data; ///< Start of region, or null if empty
+  uint32_t           size; ///< Size of region in bytes
+} ZixRingRegion;
+
+/**
+   Reserve space to write in the ring without copying.
+
+   If there is enough space for `size` bytes, this sets `regions` to the one
+   or two regions where they can be written in place.  The data isn't visible
+   to the reader until it is published with zix_ring_write_commit().
+
+   @param ring The ring to write to.
+   @param size The number of bytes to reserve.
+   @param regions Array of two regions which are set to the reserved space.
+   The second region is empty if the space doesn't wrap around, which is
+   always the case for a mirrored ring.
+   @return `size` if the space was reserved, otherwise zero, in which case
+   both regions are empty.
+*/
+ZIX_API
+uint32_t
+zix_ring_write_reserve(ZixRing* ZIX_NONNULL       ring,
+                       uint32_t                   size,
+                       ZixRingRegion* ZIX_NONNULL regions);
+
+/**
+   Publish data written in place to the reader.
+
+   @param ring The ring that was written to.
+   @param size The number of bytes to publish, which must not be more than
+   was reserved by the last call to zix_ring_write_reserve().
+   @return `size` if the data was published, otherwise zero.
+*/
+ZIX_API
+uint32_t
+zix_ring_write_commit(ZixRing* ZIX_NONNULL ring, uint32_t size);
+
+/**
+   Acquire data to read from the ring without copying.
+
+   If there are at least `size` bytes available for reading, this sets
+   `regions` to the one or two regions where they can be read in place.  The
+   data remains in the ring until it is released with zix_ring_read_release().
+
+   @param ring The ring to read from.
+   @param size The number of bytes to acquire.
+   @param regions Array of two regions which are set to the acquired data.
+   The second region is empty if the data doesn't wrap around, which is
+   always the case for a mirrored ring.
+   @return `size` if the data was acquired, otherwise zero, in which case both
+   regions are empty.
+*/
+ZIX_API
+uint32_t
+zix_ring_read_acquire(ZixRing* ZIX_NONNULL       ring,
+                      uint32_t                   size,
+                      ZixRingRegion* ZIX_NONNULL regions);
+
+/**
+   Release data that was read in place, so the space can be written again.
+
+   @param ring The ring that was read from.
+   @param size The number of bytes to release, which must not be more than
+   was acquired by the last call to zix_ring_read_acquire().
+   @return `size` if the data was released, otherwise zero.
+*/
+ZIX_API
+uint32_t
+zix_ring_read_release(ZixRing* ZIX_NONNULL ring, uint32_t size);
+
+/**
+   @}
+   @name Messages
+   @{
+
+   A ring can also be used as a queue of variable-length messages.  Every
+   message is written as a frame, which is a header with the payload size
+   followed by the payload, and is published to the reader all at once.  The
+   message functions must not be mixed with the byte functions above on the
+   same ring, since those don't know about frames.
+*/
+
+/**
+   Function called on every message read in a batch.
+
+   @param regions Array of two regions that contain the message payload, the
+   second of which is empty if the payload doesn't wrap around.
+   @param user_data Data passed to zix_ring_read_msgs().
+*/
+typedef void (*ZixRingMsgFunc)( //
+  const ZixRingRegion* ZIX_NONNULL regions,
+  void* ZIX_NULLABLE               user_data);
+
+/**
+   Write a message to the ring.
+
+   @param ring The ring to write to.
+   @param src The message payload.
+   @param size The size of the payload in bytes.
+   @return #ZIX_STATUS_SUCCESS, or #ZIX_STATUS_NO_MEM if there isn't enough
+   space for the message and its header, in which case nothing is written.
+*/
+ZIX_API
+ZixStatus
+zix_ring_write_msg(ZixRing* ZIX_NONNULL    ring,
+                   const void* ZIX_NONNULL src,
+                   uint32_t                size);
+
+/**
+   Read a message from the ring.
+
+   @param ring The ring to read from.
+   @param dst Buffer to copy the message payload to.
+   @param capacity The size of `dst` in bytes.
+   @param size Set to the size of the message payload in bytes.
+   @return #ZIX_STATUS_SUCCESS, #ZIX_STATUS_NOT_FOUND if there are no
+   messages, or #ZIX_STATUS_NO_MEM if the message is larger than `capacity`,
+   in which case it remains in the ring.
+*/
+ZIX_API
+ZixStatus
+zix_ring_read_msg(ZixRing* ZIX_NONNULL  ring,
+                  void* ZIX_NONNULL     dst,
+                  uint32_t              capacity,
+                  uint32_t* ZIX_NONNULL size);
+
+/**
+   Acquire the next message to read from the ring without copying.
+
+   This sets `regions` to the one or two regions that contain the next message
+   payload, which remains in the ring until it is released with
+   zix_ring_read_msg_release().
+
+   @return #ZIX_STATUS_SUCCESS, or #ZIX_STATUS_NOT_FOUND if there are no
+   messages, in which case both regions are empty.
+*/
+ZIX_API
+ZixStatus
+zix_ring_read_msg_acquire(ZixRing* ZIX_NONNULL       ring,
+                          ZixRingRegion* ZIX_NONNULL regions);
+
+/**
+   Release the message acquired by zix_ring_read_msg_acquire().
+
+   @return #ZIX_STATUS_SUCCESS, or #ZIX_STATUS_NOT_FOUND if there are no
+   messages.
+*/
+ZIX_API
+ZixStatus
+zix_ring_read_msg_release(ZixRing* ZIX_NONNULL ring);
+
+/**
+   Read every available message from the ring in place.
+
+   This calls `func` on the payload of every message that has been written,
+   then releases them all at once, which is cheaper than reading messages one
+   at a time since the reader and writer only synchronize once.
+
+   @return The number of messages read.
+*/
+ZIX_API
+uint32_t
+zix_ring_read_msgs(ZixRing* ZIX_NONNULL       ring,
+                   ZixRingMsgFunc ZIX_NONNULL func,
+                   void* ZIX_NULLABLE         user_data);
+
 /**
    @}
    @}
@@ -10,6 +10,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -25,6 +26,24 @@ extern "C" {
 /// A balanced binary search tree
 typedef struct ZixTreeImpl ZixTree;
 
+/**
+   The links of an element in a tree.
+
+   Normally, the tree allocates these for every element, but an intrusive tree
+   instead uses links that are embedded in the elements themselves, see
+   zix_tree_new_intrusive().
+
+   The contents of this type are considered an implementation detail and should
+   not be used directly by clients.  They are nevertheless exposed here so that
+   links can be embedded in other structures.
+*/
+typedef struct ZixTreeNodeImpl {
+  void* ZIX_NULLABLE                   data;  ///< Element
+  struct ZixTreeNodeImpl* ZIX_NULLABLE left;  ///< Left child
+  struct ZixTreeNodeImpl* ZIX_NULLABLE right; ///< Right child
+  uintptr_t parent_balance; ///< Parent with height difference in low bits
+} ZixTreeLinks;
+
 /// An iterator over a @ref ZixTree
 typedef struct ZixTreeNodeImpl ZixTreeIter;
 
@@ -38,6 +57,51 @@ zix_tree_new(ZixAllocator* ZIX_NULLABLE  allocator,
              ZixDestroyFunc ZIX_NULLABLE destroy,
              const void* ZIX_NULLABLE    destroy_user_data);
 
+/**
+   Create a new (empty) intrusive tree.
+
+   An intrusive tree doesn't allocate anything for its elements.  Instead,
+   every element must be a structure with a ZixTreeLinks member, which the
+   tree uses to link it in place, so insertion never fails for lack of
+   memory, and the element is next to its links when searching.
+
+   The element is passed to functions as usual, and the tree finds its links
+   at the given offset, so an element can only be in one tree for each links
+   member.  The tree never frees elements, so they must outlive the tree, or
+   be removed from it first.
+
+   @param allocator Allocator for the tree itself.
+   @param allow_duplicates Whether to allow equal elements.
+   @param cmp Comparator for elements.
+   @param cmp_data User data for `cmp`.
+   @param links_offset Offset of the ZixTreeLinks member in elements, as given
+   by `offsetof()`.
+*/
+ZIX_API
+ZixTree* ZIX_ALLOCATED
+zix_tree_new_intrusive(ZixAllocator* ZIX_NULLABLE allocator,
+                       bool                       allow_duplicates,
+                       ZixComparator ZIX_NONNULL  cmp,
+                       void* ZIX_NULLABLE         cmp_data,
+                       size_t                     links_offset);
+
+/**
+   Create a new (empty) ranked tree.
+
+   A ranked tree also stores the size of every subtree in its nodes, which
+   makes nodes slightly larger, but allows elements to be found by their
+   position with zix_tree_select(), and positions to be found by element with
+   zix_tree_rank(), in logarithmic time.
+*/
+ZIX_API
+ZixTree* ZIX_ALLOCATED
+zix_tree_new_ranked(ZixAllocator* ZIX_NULLABLE  allocator,
+                    bool                        allow_duplicates,
+                    ZixComparator ZIX_NONNULL   cmp,
+                    void* ZIX_NULLABLE          cmp_data,
+                    ZixDestroyFunc ZIX_NULLABLE destroy,
+                    const void* ZIX_NULLABLE    destroy_user_data);
+
 /// Free `t`
 ZIX_API
 void
@@ -60,6 +124,54 @@ ZIX_API
 ZixStatus
 zix_tree_remove(ZixTree* ZIX_NONNULL t, ZixTreeIter* ZIX_NONNULL ti);
 
+/**
+   Move every element of `other` that isn't in `t` into `t`.
+
+   This is a set union, which is done by splitting and joining subtrees
+   rather than inserting elements one by one, so it takes O(m log(n/m + 1))
+   time for trees of sizes m <= n, and never allocates.  Elements in `other`
+   that are equal to one in `t` are destroyed, and `other` is left empty.
+
+   Both trees must use the same comparator, and neither can allow duplicates.
+   Since nodes are moved between trees, they must also have the same
+   allocator, and either both be intrusive with the same links offset, or
+   neither be.
+
+   @return #ZIX_STATUS_SUCCESS, or #ZIX_STATUS_BAD_ARG if the trees are not
+   compatible, in which case neither is changed.
+*/
+ZIX_API
+ZixStatus
+zix_tree_union(ZixTree* ZIX_NONNULL t, ZixTree* ZIX_NONNULL other);
+
+/**
+   Remove every element from `t` that isn't equal to one in `other`.
+
+   This is a set intersection, which takes O(m log(n/m + 1)) time like
+   zix_tree_union().  Only `t` is modified, and both trees must use the same
+   comparator, and not allow duplicates.
+
+   @return #ZIX_STATUS_SUCCESS, or #ZIX_STATUS_BAD_ARG if a tree allows
+   duplicates, in which case `t` isn't changed.
+*/
+ZIX_API
+ZixStatus
+zix_tree_intersection(ZixTree* ZIX_NONNULL t, const ZixTree* ZIX_NONNULL other);
+
+/**
+   Remove every element from `t` that is equal to one in `other`.
+
+   This is a set difference, which takes O(m log(n/m + 1)) time like
+   zix_tree_union().  Only `t` is modified, and both trees must use the same
+   comparator, and not allow duplicates.
+
+   @return #ZIX_STATUS_SUCCESS, or #ZIX_STATUS_BAD_ARG if a tree allows
+   duplicates, in which case `t` isn't changed.
+*/
+ZIX_API
+ZixStatus
+zix_tree_difference(ZixTree* ZIX_NONNULL t, const ZixTree* ZIX_NONNULL other);
+
 /**
    Set `ti` to an element equal to `e` in `t`.
 
@@ -71,6 +183,29 @@ zix_tree_find(const ZixTree* ZIX_NONNULL             t,
               const void* ZIX_NULLABLE               e,
               ZixTreeIter* ZIX_NULLABLE* ZIX_NONNULL ti);
 
+/**
+   Return the number of elements in `t` that are less than `e`.
+
+   This is the index that `e` would have in the sorted sequence of elements,
+   if it was inserted before any equal elements.  The tree must be ranked.
+*/
+ZIX_PURE_API
+size_t
+zix_tree_rank(const ZixTree* ZIX_NONNULL t, const void* ZIX_NULLABLE e);
+
+/**
+   Return an iterator to the element in `t` with index `k`.
+
+   The index is the position in the sorted sequence of elements, so the
+   smallest element has index 0.  The tree must be ranked.
+
+   @return An iterator to the element, or the end if `k` is not less than the
+   size of `t`.
+*/
+ZIX_PURE_API
+ZixTreeIter* ZIX_NULLABLE
+zix_tree_select(ZixTree* ZIX_NONNULL t, size_t k);
+
 /// Return the data associated with the given tree item
 ZIX_PURE_API
 void* ZIX_NULLABLE
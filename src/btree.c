@@ -1,818 +1,2904 @@
 // Copyright 2011-2021 David Robillard <d@drobilla.net>
 // SPDX-License-Identifier: ISC
 
+#if defined(__linux__) && !defined(_DEFAULT_SOURCE)
+#  define _DEFAULT_SOURCE // For madvise()
+#endif
+
 #include "zix/btree.h"
 
+#include "zix_atomic.h"
+#include "zix_config.h"
+
+#if USE_MADVISE
+#  include <sys/mman.h>
+#endif
+
 #include <assert.h>
 #include <stdint.h>
 #include <string.h>
 
 // #define ZIX_BTREE_SORTED_CHECK 1
 
-// Define ZixShort as an integer type half the size of a pointer
-#if UINTPTR_MAX >= UINT32_MAX
-typedef uint32_t ZixShort;
-#else
-typedef uint16_t ZixShort;
-#endif
-
 #ifndef ZIX_BTREE_PAGE_SIZE
 #  define ZIX_BTREE_PAGE_SIZE 4096U
 #endif
 
-#define ZIX_BTREE_NODE_SPACE (ZIX_BTREE_PAGE_SIZE - 2U * sizeof(ZixShort))
-#define ZIX_BTREE_LEAF_VALS ((ZIX_BTREE_NODE_SPACE / sizeof(void*)) - 1U)
-#define ZIX_BTREE_INODE_VALS (ZIX_BTREE_LEAF_VALS / 2U)
+/// Size of the largest slab of pages, which is a huge page on most systems
+#ifndef ZIX_BTREE_MAX_SLAB_SIZE
+#  define ZIX_BTREE_MAX_SLAB_SIZE (2U * 1024U * 1024U)
+#endif
+
+/// Whether to advise the system to back full-sized slabs with huge pages
+#ifndef ZIX_BTREE_HUGE_PAGES
+#  if USE_MADVISE && defined(MADV_HUGEPAGE)
+#    define ZIX_BTREE_HUGE_PAGES 1
+#  else
+#    define ZIX_BTREE_HUGE_PAGES 0
+#  endif
+#endif
+
+/**
+   A pool of pages for nodes, shared by a tree and all of its snapshots.
+
+   Pages are allocated in slabs that double in size up to
+   ZIX_BTREE_MAX_SLAB_SIZE, so small trees stay small, while large trees make
+   few allocations and don't fragment the heap.  Freed nodes are put on a
+   free list to be reused, and are only returned to the allocator when the
+   last tree that uses the pool is freed.
+
+   Trees split from one another share a pool, but not nodes, so they may be
+   modified by different threads.  A shared pool is protected by a spin lock
+   for this, which is held only long enough to take or return a page.  A pool
+   that is only used by one tree isn't locked at all, since only that tree
+   could share it with another.  Without atomic operations, there is no lock,
+   so trees that share a pool can't be modified concurrently.
+*/
+typedef struct {
+  uintptr_t     lock;          ///< Nonzero while the pool is in use
+  ZixAllocator* allocator;     ///< Allocator for slabs and this pool
+  size_t        page_size;     ///< Size of every page in bytes
+  uintptr_t     n_trees;       ///< Number of trees that use this pool
+  void**        slabs;         ///< Array of all allocated slabs
+  size_t        slabs_size;    ///< Capacity of slabs array
+  char*         next;          ///< Next unused page in the current slab
+  char*         end;           ///< End of the current slab
+  void*         free_list;     ///< Linked list of free pages
+  size_t        slab_n_pages;  ///< Number of pages in the current slab
+  size_t        n_slabs;       ///< Number of allocated slabs
+  size_t        n_pages;       ///< Number of pages in all slabs
+  size_t        n_used_pages;  ///< Number of pages in use by nodes
+  size_t        n_free_pages;  ///< Number of pages on the free list
+} ZixBTreePool;
 
 struct ZixBTreeImpl {
-  ZixAllocator* allocator;
-  ZixBTreeNode* root;
-  ZixComparator cmp;
-  const void*   cmp_data;
-  size_t        size;
+  ZixAllocator*   allocator;
+  ZixBTreePool*   pool;
+  ZixBTreeNode*   root;
+  ZixComparator   cmp;
+  const void*     cmp_data;
+  ZixBTreeKeyFunc key;
+  const void*     key_data;
+  size_t          size;       ///< Number of values, if size_known
+  bool            size_known; ///< True if size is correct
+  size_t          page_size;
+  size_t          n_splits;
+  size_t          n_merges;
+  size_t          n_rotations;
+  uint16_t        leaf_vals;
+  uint16_t        inode_vals;
 };
 
+/**
+   A node, which fills exactly one page.
+
+   The size of the values array depends on the page size of the tree, so
+   leaves and internal nodes have different capacities.  In an internal node,
+   the values are followed by the child pointers.
+
+   In a tree with string keys, the children (or values in a leaf) are followed
+   by an inline slice of every key, and the length of the prefix that all keys
+   in the node share.  Each slice is the next 8 bytes of the key after that
+   prefix, as a big-endian integer, so slices compare like the keys do.
+
+   Nodes may be shared between snapshots, so each has a count of the parents
+   that point to it.  The root of a tree is never shared, so every node that
+   is reachable only through nodes with a single reference belongs to one
+   tree, and can be modified in place.
+*/
 struct ZixBTreeNodeImpl {
-  ZixShort is_leaf;
-  ZixShort n_vals;
-
-  union {
-    struct {
-      void* vals[ZIX_BTREE_LEAF_VALS];
-    } leaf;
-
-    struct {
-      void*         vals[ZIX_BTREE_INODE_VALS];
-      ZixBTreeNode* children[ZIX_BTREE_INODE_VALS + 1U];
-    } inode;
-  } data;
+  uint16_t is_leaf;  ///< True iff this is a leaf
+  uint16_t max_vals; ///< Capacity of vals
+  uint16_t n_vals;   ///< Number of values
+  uint16_t refs;     ///< Number of parents that point to this node
+  void*    vals[];   ///< Values, then children if this is an internal node
 };
 
-#if ((defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L) || \
-     (defined(__cplusplus) && __cplusplus >= 201103L))
-static_assert(sizeof(ZixBTree) <= ZIX_BTREE_PAGE_SIZE, "");
-static_assert(sizeof(ZixBTreeNode) <= ZIX_BTREE_PAGE_SIZE, "");
-static_assert(sizeof(ZixBTreeNode) >=
-                ZIX_BTREE_PAGE_SIZE - 2U * sizeof(ZixBTreeNode*),
-              "");
-#endif
-
-static ZixBTreeNode*
-zix_btree_node_new(ZixAllocator* const allocator, const bool leaf)
+static ZixBTreePool*
+zix_btree_pool_new(ZixAllocator* const allocator, const size_t page_size)
 {
-#if !((defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L) || \
-      (defined(__cplusplus) && __cplusplus >= 201103L))
-  assert(sizeof(ZixBTreeNode) <= ZIX_BTREE_PAGE_SIZE);
-  assert(sizeof(ZixBTreeNode) >=
-         ZIX_BTREE_PAGE_SIZE - 2U * sizeof(ZixBTreeNode*));
-#endif
+  ZixBTreePool* const pool =
+    (ZixBTreePool*)zix_calloc(allocator, 1U, sizeof(ZixBTreePool));
 
-  ZixBTreeNode* const node = (ZixBTreeNode*)zix_aligned_alloc(
-    allocator, ZIX_BTREE_PAGE_SIZE, ZIX_BTREE_PAGE_SIZE);
-
-  if (node) {
-    node->is_leaf = leaf;
-    node->n_vals  = 0U;
+  if (pool) {
+    pool->allocator = allocator;
+    pool->page_size = page_size;
+    pool->n_trees   = 1U;
   }
 
-  return node;
-}
-
-ZIX_PURE_FUNC
-static ZixBTreeNode*
-zix_btree_child(const ZixBTreeNode* const node, const unsigned i)
-{
-  assert(!node->is_leaf);
-  assert(i <= ZIX_BTREE_INODE_VALS);
-  return node->data.inode.children[i];
+  return pool;
 }
 
-ZixBTree*
-zix_btree_new(ZixAllocator* const allocator,
-              const ZixComparator cmp,
-              const void* const   cmp_data)
+static void
+zix_btree_pool_free(ZixBTreePool* const pool)
 {
-#if !((defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L) || \
-      (defined(__cplusplus) && __cplusplus >= 201103L))
-  assert(sizeof(ZixBTree) <= ZIX_BTREE_PAGE_SIZE);
-#endif
+  for (size_t i = 0U; i < pool->n_slabs; ++i) {
+    zix_aligned_free(pool->allocator, pool->slabs[i]);
+  }
 
-  assert(cmp);
+  zix_free(pool->allocator, pool->slabs);
+  zix_free(pool->allocator, pool);
+}
 
-  ZixBTree* const t = (ZixBTree*)zix_aligned_alloc(
-    allocator, ZIX_BTREE_PAGE_SIZE, ZIX_BTREE_PAGE_SIZE);
+/**
+   Lock `pool` if it is shared with other trees, and return true if it was.
 
-  if (!t) {
-    return NULL;
+   The calling tree is one of the users of the pool, so if it is the only one,
+   no other tree can be using the pool, or start to until this tree is split
+   or snapshotted.  The number of trees is loaded with acquire semantics,
+   which makes everything that the last other user did visible here.
+*/
+static bool
+zix_btree_pool_lock(ZixBTreePool* const pool)
+{
+  if (zix_atomic_load(&pool->n_trees) < 2U) {
+    return false;
   }
 
-  if (!(t->root = zix_btree_node_new(allocator, true))) {
-    zix_aligned_free(allocator, t);
-    return NULL;
+#if ZIX_ATOMIC_RMW
+  while (!zix_atomic_cas(&pool->lock, 0U, 1U)) {
+    zix_atomic_pause();
   }
+#endif
 
-  t->allocator = allocator;
-  t->cmp       = cmp;
-  t->cmp_data  = cmp_data;
-  t->size      = 0;
-
-  return t;
+  return true;
 }
 
 static void
-zix_btree_free_children(ZixBTree* const      t,
-                        ZixBTreeNode* const  n,
-                        const ZixDestroyFunc destroy,
-                        const void* const    destroy_user_data)
+zix_btree_pool_unlock(ZixBTreePool* const pool, const bool locked)
 {
-  if (!n->is_leaf) {
-    for (ZixShort i = 0; i < n->n_vals + 1U; ++i) {
-      zix_btree_free_children(
-        t, zix_btree_child(n, i), destroy, destroy_user_data);
-      zix_aligned_free(t->allocator, zix_btree_child(n, i));
-    }
-  }
-
-  if (destroy) {
-    if (n->is_leaf) {
-      for (ZixShort i = 0U; i < n->n_vals; ++i) {
-        destroy(n->data.leaf.vals[i], destroy_user_data);
-      }
-    } else {
-      for (ZixShort i = 0U; i < n->n_vals; ++i) {
-        destroy(n->data.inode.vals[i], destroy_user_data);
-      }
-    }
+  if (locked) {
+    zix_atomic_store(&pool->lock, 0U);
   }
 }
 
-void
-zix_btree_free(ZixBTree* const      t,
-               const ZixDestroyFunc destroy,
-               const void* const    destroy_user_data)
+/// Add a tree that uses `pool`
+static void
+zix_btree_pool_ref(ZixBTreePool* const pool)
 {
-  if (t) {
-    zix_btree_clear(t, destroy, destroy_user_data);
-    zix_aligned_free(t->allocator, t->root);
-    zix_aligned_free(t->allocator, t);
-  }
+  const bool locked = zix_btree_pool_lock(pool);
+  zix_atomic_store(&pool->n_trees, pool->n_trees + 1U);
+  zix_btree_pool_unlock(pool, locked);
 }
 
-void
-zix_btree_clear(ZixBTree* const t,
-                ZixDestroyFunc  destroy,
-                const void*     destroy_user_data)
+/// Remove a tree that uses `pool`, and free it if it was the last
+static void
+zix_btree_pool_unref(ZixBTreePool* const pool)
 {
-  zix_btree_free_children(t, t->root, destroy, destroy_user_data);
+  const bool      locked  = zix_btree_pool_lock(pool);
+  const uintptr_t n_trees = pool->n_trees - 1U;
+  zix_atomic_store(&pool->n_trees, n_trees);
+  zix_btree_pool_unlock(pool, locked);
 
-  memset(t->root, 0, sizeof(ZixBTreeNode));
-  t->root->is_leaf = true;
-  t->size          = 0U;
+  if (!n_trees) {
+    zix_btree_pool_free(pool);
+  }
 }
 
-size_t
-zix_btree_size(const ZixBTree* const t)
+/// Allocate a new slab of at least `min_pages` and make it current, or fail
+static bool
+zix_btree_pool_grow(ZixBTreePool* const pool, const size_t min_pages)
 {
-  assert(t);
-  return t->size;
-}
+  const size_t max_n_pages = ZIX_BTREE_MAX_SLAB_SIZE / pool->page_size;
 
-static ZixShort
-zix_btree_max_vals(const ZixBTreeNode* const node)
-{
-  return node->is_leaf ? ZIX_BTREE_LEAF_VALS : ZIX_BTREE_INODE_VALS;
+  // Double the slab size each time, up to the maximum
+  size_t n_pages = pool->slab_n_pages ? 2U * pool->slab_n_pages : 1U;
+  if (n_pages < min_pages) {
+    n_pages = min_pages;
+  }
+
+  if (n_pages > max_n_pages) {
+    n_pages = max_n_pages ? max_n_pages : 1U;
+  }
+
+  // Make room in the array of slabs first, so a new slab is never leaked
+  if (pool->n_slabs == pool->slabs_size) {
+    const size_t new_size  = pool->slabs_size ? 2U * pool->slabs_size : 8U;
+    void** const new_slabs = (void**)zix_realloc(
+      pool->allocator, pool->slabs, new_size * sizeof(void*));
+
+    if (!new_slabs) {
+      return false;
+    }
+
+    pool->slabs      = new_slabs;
+    pool->slabs_size = new_size;
+  }
+
+  // Align full-sized slabs to their size so they can be huge pages
+  const size_t size = n_pages * pool->page_size;
+  const size_t align =
+    (size == ZIX_BTREE_MAX_SLAB_SIZE) ? size : pool->page_size;
+
+  char* const slab = (char*)zix_aligned_alloc(pool->allocator, align, size);
+  if (!slab) {
+    return false;
+  }
+
+#if ZIX_BTREE_HUGE_PAGES
+  if (size == ZIX_BTREE_MAX_SLAB_SIZE) {
+    madvise(slab, size, MADV_HUGEPAGE); // Only a hint, failure is harmless
+  }
+#endif
+
+  pool->slabs[pool->n_slabs++] = slab;
+  pool->next                   = slab;
+  pool->end                    = slab + size;
+  pool->slab_n_pages           = n_pages;
+  pool->n_pages += n_pages;
+  return true;
 }
 
-static ZixShort
-zix_btree_min_vals(const ZixBTreeNode* const node)
+static void*
+zix_btree_pool_alloc(ZixBTreePool* const pool)
 {
-  return (ZixShort)(((zix_btree_max_vals(node) + 1U) / 2U) - 1U);
+  const bool locked = zix_btree_pool_lock(pool);
+
+  void* page = pool->free_list;
+  if (page) {
+    // Reuse the most recently freed page, which is likely still in cache
+    pool->free_list = *(void**)page;
+    --pool->n_free_pages;
+  } else if (pool->next < pool->end || zix_btree_pool_grow(pool, 1U)) {
+    // Take the next unused page from the current slab
+    page = pool->next;
+    pool->next += pool->page_size;
+  }
+
+  if (page) {
+    ++pool->n_used_pages;
+  }
+
+  zix_btree_pool_unlock(pool, locked);
+  return page;
 }
 
-/// Shift pointers in `array` of length `n` right starting at `i`
 static void
-zix_btree_ainsert(void** const   array,
-                  const unsigned n,
-                  const unsigned i,
-                  void* const    e)
+zix_btree_pool_release(ZixBTreePool* const pool, void* const page)
 {
-  memmove(array + i + 1, array + i, (n - i) * sizeof(e));
-  array[i] = e;
+  const bool locked = zix_btree_pool_lock(pool);
+  *(void**)page     = pool->free_list;
+  pool->free_list   = page;
+  --pool->n_used_pages;
+  ++pool->n_free_pages;
+  zix_btree_pool_unlock(pool, locked);
 }
 
-/// Erase element `i` in `array` of length `n` and return erased element
-static void*
-zix_btree_aerase(void** const array, const unsigned n, const unsigned i)
-{
-  void* const ret = array[i];
-  memmove(array + i, array + i + 1, (n - i) * sizeof(ret));
-  return ret;
-}
+/**
+   Move every page of `src` into `dst`, and free `src`.
 
-/// Split lhs, the i'th child of `n`, into two nodes
-static ZixBTreeNode*
-zix_btree_split_child(ZixAllocator* const allocator,
-                      ZixBTreeNode* const n,
-                      const unsigned      i,
-                      ZixBTreeNode* const lhs)
+   The source pool must not be used by any other tree.  Its slabs are only
+   freed along with `dst`, and its free pages (including any that were never
+   used) are put on the free list of `dst`.  Returns false, leaving both pools
+   unchanged, if the array of slabs could not be grown.
+*/
+static bool
+zix_btree_pool_absorb(ZixBTreePool* const dst, ZixBTreePool* const src)
 {
-  assert(lhs->n_vals == zix_btree_max_vals(lhs));
-  assert(n->n_vals < ZIX_BTREE_INODE_VALS);
-  assert(i < n->n_vals + 1U);
-  assert(zix_btree_child(n, i) == lhs);
-
-  const ZixShort max_n_vals = zix_btree_max_vals(lhs);
-  ZixBTreeNode*  rhs        = zix_btree_node_new(allocator, lhs->is_leaf);
-  if (!rhs) {
-    return NULL;
-  }
+  assert(src->n_trees == 1U);
+  assert(src->page_size == dst->page_size);
 
-  // LHS and RHS get roughly half, less the middle value which moves up
-  lhs->n_vals = max_n_vals / 2U;
-  rhs->n_vals = (ZixShort)(max_n_vals - lhs->n_vals - 1);
+  const bool locked = zix_btree_pool_lock(dst);
 
-  if (lhs->is_leaf) {
-    // Copy large half from LHS to new RHS node
-    memcpy(rhs->data.leaf.vals,
-           lhs->data.leaf.vals + lhs->n_vals + 1,
-           rhs->n_vals * sizeof(void*));
+  // Make room in the array of slabs for those in the source pool
+  const size_t n_slabs = dst->n_slabs + src->n_slabs;
+  if (n_slabs > dst->slabs_size) {
+    void** const new_slabs = (void**)zix_realloc(
+      dst->allocator, dst->slabs, n_slabs * sizeof(void*));
 
-    // Move middle value up to parent
-    zix_btree_ainsert(
-      n->data.inode.vals, n->n_vals, i, lhs->data.leaf.vals[lhs->n_vals]);
-  } else {
-    // Copy large half from LHS to new RHS node
-    memcpy(rhs->data.inode.vals,
-           lhs->data.inode.vals + lhs->n_vals + 1,
-           rhs->n_vals * sizeof(void*));
-    memcpy(rhs->data.inode.children,
-           lhs->data.inode.children + lhs->n_vals + 1,
-           (rhs->n_vals + 1U) * sizeof(ZixBTreeNode*));
+    if (!new_slabs) {
+      zix_btree_pool_unlock(dst, locked);
+      return false;
+    }
 
-    // Move middle value up to parent
-    zix_btree_ainsert(
-      n->data.inode.vals, n->n_vals, i, lhs->data.inode.vals[lhs->n_vals]);
+    dst->slabs      = new_slabs;
+    dst->slabs_size = n_slabs;
   }
 
-  // Insert new RHS node in parent at position i
-  zix_btree_ainsert((void**)n->data.inode.children, ++n->n_vals, i + 1U, rhs);
-
-  return rhs;
-}
+  memcpy(dst->slabs + dst->n_slabs, src->slabs, src->n_slabs * sizeof(void*));
+  dst->n_slabs = n_slabs;
 
-#ifdef ZIX_BTREE_SORTED_CHECK
-/// Check that `n` is sorted with respect to search key `e`
-static bool
-zix_btree_node_is_sorted_with_respect_to(const ZixComparator compare,
-                                         const void* const   compare_user_data,
-                                         void* const* const  values,
-                                         const unsigned      n_values,
-                                         const void* const   key)
-{
-  if (n_values <= 1U) {
-    return true;
+  // Free the rest of the current source slab, so it isn't wasted
+  for (char* p = src->next; p < src->end; p += src->page_size) {
+    void* const page = p;
+    *(void**)page    = src->free_list;
+    src->free_list   = page;
+    ++src->n_free_pages;
   }
 
-  int cmp = compare(values[0], key, compare_user_data);
-  for (unsigned i = 1U; i < n_values; ++i) {
-    const int next_cmp = compare(values[i], key, compare_user_data);
-    if ((cmp >= 0 && next_cmp < 0) || (cmp > 0 && next_cmp <= 0)) {
-      return false;
+  // Prepend the source free list to the destination free list
+  if (src->free_list) {
+    void** tail = (void**)src->free_list;
+    while (*tail) {
+      tail = (void**)*tail;
     }
 
-    cmp = next_cmp;
+    *tail          = dst->free_list;
+    dst->free_list = src->free_list;
   }
 
+  dst->n_pages += src->n_pages;
+  dst->n_used_pages += src->n_used_pages;
+  dst->n_free_pages += src->n_free_pages;
+
+  zix_btree_pool_unlock(dst, locked);
+
+  zix_free(src->allocator, src->slabs);
+  zix_free(src->allocator, src);
   return true;
 }
-#endif
 
-static unsigned
-zix_btree_find_value(const ZixComparator compare,
-                     const void* const   compare_user_data,
-                     void* const* const  values,
-                     const unsigned      n_values,
-                     const void* const   key,
-                     bool* const         equal)
+/// Return the offset of the key slices in a node of a tree with string keys
+static size_t
+zix_btree_slices_offset(const ZixBTreeNode* const node)
 {
-  unsigned first = 0U;
-  unsigned count = n_values;
+  const size_t n_ptrs =
+    node->max_vals + (node->is_leaf ? 0U : node->max_vals + 1U);
 
-  while (count > 0U) {
-    const unsigned half  = count >> 1U;
-    const unsigned i     = first + half;
-    void* const    value = values[i];
-    const int      cmp   = compare(value, key, compare_user_data);
+  const size_t end = offsetof(ZixBTreeNode, vals) + (n_ptrs * sizeof(void*));
 
-    if (!cmp) {
-      *equal = true;
-      return i;
-    }
+  return (end + sizeof(uint64_t) - 1U) & ~(sizeof(uint64_t) - 1U);
+}
 
-    if (cmp < 0) {
-      first += half + 1U;
-      count -= half + 1U;
-    } else {
-      count = half;
-    }
-  }
+/**
+   Return the key slices of a node in a tree with string keys.
 
-  assert(first == n_values || compare(values[first], key, compare_user_data));
-  *equal = false;
-  return first;
+   The slices array has one more element than the node's capacity, which
+   holds the length of the common prefix of its keys.
+*/
+static uint64_t*
+zix_btree_slices(ZixBTreeNode* const node)
+{
+  void* const slices = (char*)node + zix_btree_slices_offset(node);
+
+  return (uint64_t*)slices;
 }
 
-static unsigned
-zix_btree_find_pattern(const ZixComparator compare_key,
-                       const void* const   compare_key_user_data,
-                       void* const* const  values,
-                       const unsigned      n_values,
-                       const void* const   key,
-                       bool* const         equal)
+static const uint64_t*
+zix_btree_const_slices(const ZixBTreeNode* const node)
 {
-#ifdef ZIX_BTREE_SORTED_CHECK
-  assert(zix_btree_node_is_sorted_with_respect_to(
-    compare_key, compare_key_user_data, values, n_values, key));
-#endif
-
-  unsigned first = 0U;
-  unsigned count = n_values;
+  const void* const slices = (const char*)node + zix_btree_slices_offset(node);
 
-  while (count > 0U) {
-    const unsigned half  = count >> 1U;
-    const unsigned i     = first + half;
-    void* const    value = values[i];
-    const int      cmp   = compare_key(value, key, compare_key_user_data);
+  return (const uint64_t*)slices;
+}
 
-    if (cmp == 0) {
-      // Found a match, but keep searching for the leftmost one
-      *equal = true;
-      count  = half;
+static ZixBTreeNode*
+zix_btree_node_new(const ZixBTree* const t, const bool leaf)
+{
+  ZixBTreeNode* const node = (ZixBTreeNode*)zix_btree_pool_alloc(t->pool);
 
-    } else if (cmp < 0) {
-      // Search right half
-      first += half + 1U;
-      count -= half + 1U;
+  if (node) {
+    node->is_leaf  = leaf;
+    node->max_vals = leaf ? t->leaf_vals : t->inode_vals;
+    node->n_vals   = 0U;
+    node->refs     = 1U;
 
-    } else {
-      // Search left half
-      count = half;
+    if (t->key) {
+      zix_btree_slices(node)[node->max_vals] = 0U;
     }
   }
 
-  assert(!*equal ||
-         (compare_key(values[first], key, compare_key_user_data) == 0 &&
-          (first == 0U ||
-           (compare_key(values[first - 1U], key, compare_key_user_data) < 0))));
-
-  return first;
+  return node;
 }
 
-/// Convenience wrapper to find a value in an internal node
-static unsigned
-zix_btree_inode_find(const ZixBTree* const     t,
-                     const ZixBTreeNode* const n,
-                     const void* const         e,
-                     bool* const               equal)
+/// Return the next 8 bytes of `str` as a big-endian integer, padded with zeros
+static uint64_t
+zix_btree_slice(const char* str)
 {
-  assert(!n->is_leaf);
+  uint64_t slice = 0U;
+  for (unsigned i = 0U; i < 8U; ++i) {
+    slice <<= 8U;
+    if (*str) {
+      slice |= (uint8_t)*str++;
+    }
+  }
 
-  return zix_btree_find_value(
-    t->cmp, t->cmp_data, n->data.inode.vals, n->n_vals, e, equal);
+  return slice;
 }
 
-/// Convenience wrapper to find a value in a leaf node
-static unsigned
-zix_btree_leaf_find(const ZixBTree* const     t,
-                    const ZixBTreeNode* const n,
-                    const void* const         e,
-                    bool* const               equal)
+/// Return the length of the common prefix of two strings
+static size_t
+zix_btree_common_prefix(const char* const a, const char* const b)
 {
-  assert(n->is_leaf);
+  size_t n = 0U;
+  while (a[n] && a[n] == b[n]) {
+    ++n;
+  }
 
-  return zix_btree_find_value(
-    t->cmp, t->cmp_data, n->data.leaf.vals, n->n_vals, e, equal);
+  return n;
 }
 
-static inline bool
-zix_btree_can_remove_from(const ZixBTreeNode* const n)
+static const char*
+zix_btree_key(const ZixBTree* const t, const void* const value)
 {
-  assert(n->n_vals >= zix_btree_min_vals(n));
-  return n->n_vals > zix_btree_min_vals(n);
+  return t->key(value, t->key_data);
 }
 
-static inline bool
-zix_btree_is_full(const ZixBTreeNode* const n)
+/// Recalculate the common prefix and all key slices in `n`, if necessary
+static void
+zix_btree_update_slices(const ZixBTree* const t, ZixBTreeNode* const n)
 {
-  assert(n->n_vals <= zix_btree_max_vals(n));
+  if (!t->key) {
+    return;
+  }
+
+  // Keys are sorted, so the prefix of the first and last is shared by all
+  uint64_t* const slices = zix_btree_slices(n);
+  size_t          prefix = 0U;
+  if (n->n_vals) {
+    prefix = zix_btree_common_prefix(zix_btree_key(t, n->vals[0]),
+                                     zix_btree_key(t, n->vals[n->n_vals - 1U]));
+  }
+
+  for (unsigned i = 0U; i < n->n_vals; ++i) {
+    slices[i] = zix_btree_slice(zix_btree_key(t, n->vals[i]) + prefix);
+  }
+
+  slices[n->max_vals] = prefix;
+}
+
+/// Return the array of child pointers of an internal node
+static ZixBTreeNode**
+zix_btree_children(ZixBTreeNode* const node)
+{
+  assert(!node->is_leaf);
+  return (ZixBTreeNode**)(node->vals + node->max_vals);
+}
+
+ZIX_PURE_FUNC
+static ZixBTreeNode*
+zix_btree_child(const ZixBTreeNode* const node, const unsigned i)
+{
+  assert(!node->is_leaf);
+  assert(i <= node->n_vals);
+  return ((ZixBTreeNode* const*)(node->vals + node->max_vals))[i];
+}
+
+/// Return a new copy of `node` that shares its children, or null
+static ZixBTreeNode*
+zix_btree_node_copy(const ZixBTree* const t, const ZixBTreeNode* const node)
+{
+  if (!node->is_leaf) {
+    for (unsigned i = 0U; i < node->n_vals + 1U; ++i) {
+      if (zix_btree_child(node, i)->refs == UINT16_MAX) {
+        return NULL; // Too many references to count
+      }
+    }
+  }
+
+  ZixBTreeNode* const copy = zix_btree_node_new(t, node->is_leaf);
+  if (copy) {
+    copy->n_vals = node->n_vals;
+    memcpy(copy->vals, node->vals, node->n_vals * sizeof(void*));
+
+    if (t->key) {
+      const uint64_t* const slices = zix_btree_const_slices(node);
+
+      memcpy(zix_btree_slices(copy), slices, node->n_vals * sizeof(uint64_t));
+      zix_btree_slices(copy)[copy->max_vals] = slices[node->max_vals];
+    }
+
+    if (!node->is_leaf) {
+      ZixBTreeNode** const children = zix_btree_children(copy);
+      for (unsigned i = 0U; i < node->n_vals + 1U; ++i) {
+        children[i] = zix_btree_child(node, i);
+        ++children[i]->refs;
+      }
+    }
+  }
+
+  return copy;
+}
+
+/**
+   Make the ith child of `n` exclusive to this tree and return it.
+
+   The parent `n` must already be exclusive to this tree.  If the child is
+   shared with other trees, then it's replaced with a copy, so the returned
+   node can be modified in place.  Returns null if copying failed.
+*/
+static ZixBTreeNode*
+zix_btree_own_child(const ZixBTree* const t,
+                    ZixBTreeNode* const   n,
+                    const unsigned        i)
+{
+  ZixBTreeNode** const slot  = zix_btree_children(n) + i;
+  ZixBTreeNode* const  child = *slot;
+
+  assert(n->refs == 1U);
+  if (child->refs == 1U) {
+    return child;
+  }
+
+  ZixBTreeNode* const copy = zix_btree_node_copy(t, child);
+  if (copy) {
+    --child->refs;
+    *slot = copy;
+  }
+
+  return copy;
+}
+
+ZixBTree*
+zix_btree_new(ZixAllocator* const allocator,
+              const ZixComparator cmp,
+              const void* const   cmp_data)
+{
+  return zix_btree_new_with_page_size(
+    allocator, ZIX_BTREE_PAGE_SIZE, cmp, cmp_data);
+}
+
+ZixBTree*
+zix_btree_new_with_page_size(ZixAllocator* const allocator,
+                             const size_t        page_size,
+                             const ZixComparator cmp,
+                             const void* const   cmp_data)
+{
+  assert(cmp);
+
+  if (page_size < ZIX_BTREE_MIN_PAGE_SIZE ||
+      page_size > ZIX_BTREE_MAX_PAGE_SIZE || (page_size & (page_size - 1U))) {
+    return NULL;
+  }
+
+  ZixBTree* const t = (ZixBTree*)zix_malloc(allocator, sizeof(ZixBTree));
+
+  if (!t) {
+    return NULL;
+  }
+
+  /* The largest leaf capacity that leaves room for an internal node with half
+     as many values and one more child in the same space.  Using one less than
+     the number of slots makes the number of values in leaves even. */
+
+  const size_t n_slots =
+    (page_size - offsetof(ZixBTreeNode, vals)) / sizeof(void*);
+
+  if (!(t->pool = zix_btree_pool_new(allocator, page_size))) {
+    zix_free(allocator, t);
+    return NULL;
+  }
+
+  t->allocator   = allocator;
+  t->cmp         = cmp;
+  t->cmp_data    = cmp_data;
+  t->key         = NULL;
+  t->key_data    = NULL;
+  t->size        = 0;
+  t->size_known  = true;
+  t->page_size   = page_size;
+  t->n_splits    = 0U;
+  t->n_merges    = 0U;
+  t->n_rotations = 0U;
+  t->leaf_vals   = (uint16_t)(n_slots - 1U);
+  t->inode_vals  = (uint16_t)(t->leaf_vals / 2U);
+
+  if (!(t->root = zix_btree_node_new(t, true))) {
+    zix_btree_pool_free(t->pool);
+    zix_free(allocator, t);
+    return NULL;
+  }
+
+  return t;
+}
+
+/// Compare values in a tree with string keys, where `user_data` is the tree
+static int
+zix_btree_string_cmp(const void* const a,
+                     const void* const b,
+                     const void* const user_data)
+{
+  const ZixBTree* const t = (const ZixBTree*)user_data;
+
+  return strcmp(zix_btree_key(t, a), zix_btree_key(t, b));
+}
+
+ZixBTree*
+zix_btree_new_with_string_keys(ZixAllocator* const   allocator,
+                               const size_t          page_size,
+                               const ZixBTreeKeyFunc key,
+                               const void* const     key_data)
+{
+  assert(key);
+
+  ZixBTree* const t = zix_btree_new_with_page_size(
+    allocator, page_size, zix_btree_string_cmp, NULL);
+
+  if (t) {
+    /* Reduce the capacity of nodes to make room for a slice per key, and the
+       common prefix length, with room to align them. */
+
+    const size_t fixed = offsetof(ZixBTreeNode, vals) + 2U * sizeof(uint64_t);
+    const size_t ptr   = sizeof(void*);
+
+    t->cmp_data   = t;
+    t->key        = key;
+    t->key_data   = key_data;
+    t->leaf_vals  = (uint16_t)((page_size - fixed) / (ptr + 8U));
+    t->inode_vals = (uint16_t)((page_size - fixed - ptr) / (2U * ptr + 8U));
+
+    // Set up the (still empty) root again with the new capacity
+    t->root->max_vals = t->leaf_vals;
+    zix_btree_update_slices(t, t->root);
+  }
+
+  return t;
+}
+
+ZixBTree*
+zix_btree_snapshot(ZixBTree* const t)
+{
+  assert(t);
+
+  ZixBTree* const snapshot =
+    (ZixBTree*)zix_malloc(t->allocator, sizeof(ZixBTree));
+
+  if (snapshot) {
+    *snapshot = *t;
+    if (t->key) {
+      snapshot->cmp_data = snapshot;
+    }
+
+    // Copy the root, so the root of a tree is never shared
+    if (!(snapshot->root = zix_btree_node_copy(t, t->root))) {
+      zix_free(t->allocator, snapshot);
+      return NULL;
+    }
+
+    zix_btree_pool_ref(t->pool);
+  }
+
+  return snapshot;
+}
+
+/// Return the number of values in the subtree rooted at `n`
+ZIX_PURE_FUNC
+static size_t
+zix_btree_count_values(const ZixBTreeNode* const n)
+{
+  size_t count = n->n_vals;
+
+  if (!n->is_leaf) {
+    for (unsigned i = 0U; i < n->n_vals + 1U; ++i) {
+      count += zix_btree_count_values(zix_btree_child(n, i));
+    }
+  }
+
+  return count;
+}
+
+/// Call `destroy` (if given) for every value in the subtree rooted at `n`
+static size_t
+zix_btree_destroy_values(const ZixBTreeNode* const n,
+                         const ZixDestroyFunc      destroy,
+                         const void* const         destroy_user_data)
+{
+  size_t count = n->n_vals;
+
+  if (!n->is_leaf) {
+    for (unsigned i = 0U; i < n->n_vals + 1U; ++i) {
+      count += zix_btree_destroy_values(
+        zix_btree_child(n, i), destroy, destroy_user_data);
+    }
+  }
+
+  if (destroy) {
+    for (unsigned i = 0U; i < n->n_vals; ++i) {
+      destroy(n->vals[i], destroy_user_data);
+    }
+  }
+
+  return count;
+}
+
+/// Drop a reference to `n`, and free it if it is no longer used
+static void
+zix_btree_release(ZixBTree* const t, ZixBTreeNode* const n)
+{
+  if (--n->refs) {
+    return; // Still shared with another tree
+  }
+
+  if (!n->is_leaf) {
+    for (unsigned i = 0U; i < n->n_vals + 1U; ++i) {
+      zix_btree_release(t, zix_btree_child(n, i));
+    }
+  }
+
+  zix_btree_pool_release(t->pool, n);
+}
+
+void
+zix_btree_free(ZixBTree* const      t,
+               const ZixDestroyFunc destroy,
+               const void* const    destroy_user_data)
+{
+  if (t) {
+    zix_btree_clear(t, destroy, destroy_user_data);
+    zix_btree_pool_release(t->pool, t->root);
+    zix_btree_pool_unref(t->pool);
+    zix_free(t->allocator, t);
+  }
+}
+
+void
+zix_btree_clear(ZixBTree* const t,
+                ZixDestroyFunc  destroy,
+                const void*     destroy_user_data)
+{
+  ZixBTreeNode* const root = t->root;
+
+  assert(root->refs == 1U);
+
+  if (destroy) {
+    zix_btree_destroy_values(root, destroy, destroy_user_data);
+  }
+
+  if (!root->is_leaf) {
+    for (unsigned i = 0U; i < root->n_vals + 1U; ++i) {
+      zix_btree_release(t, zix_btree_child(root, i));
+    }
+  }
+
+  t->root->is_leaf  = true;
+  t->root->max_vals = t->leaf_vals;
+  t->root->n_vals   = 0U;
+  t->size           = 0U;
+  t->size_known     = true;
+  zix_btree_update_slices(t, t->root);
+}
+
+size_t
+zix_btree_size(const ZixBTree* const t)
+{
+  assert(t);
+
+  return t->size_known ? t->size : zix_btree_count_values(t->root);
+}
+
+size_t
+zix_btree_count(ZixBTree* const t)
+{
+  assert(t);
+
+  if (!t->size_known) {
+    t->size       = zix_btree_count_values(t->root);
+    t->size_known = true;
+  }
+
+  return t->size;
+}
+
+size_t
+zix_btree_page_size(const ZixBTree* const t)
+{
+  assert(t);
+  return t->page_size;
+}
+
+ZixBTreePoolStats
+zix_btree_pool_stats(const ZixBTree* const t)
+{
+  assert(t);
+
+  const ZixBTreePool* const pool  = t->pool;
+  const ZixBTreePoolStats   stats = {
+    pool->n_slabs, pool->n_pages, pool->n_used_pages, pool->n_free_pages};
+
+  return stats;
+}
+
+static unsigned
+zix_btree_max_vals(const ZixBTreeNode* const node)
+{
+  return node->max_vals;
+}
+
+static unsigned
+zix_btree_min_vals(const ZixBTreeNode* const node)
+{
+  return ((zix_btree_max_vals(node) + 1U) / 2U) - 1U;
+}
+
+/// Shift pointers in `array` of length `n` right starting at `i`
+static void
+zix_btree_ainsert(void** const   array,
+                  const unsigned n,
+                  const unsigned i,
+                  void* const    e)
+{
+  memmove(array + i + 1, array + i, (n - i) * sizeof(e));
+  array[i] = e;
+}
+
+/// Erase element `i` in `array` of length `n` and return erased element
+static void*
+zix_btree_aerase(void** const array, const unsigned n, const unsigned i)
+{
+  void* const ret = array[i];
+  memmove(array + i, array + i + 1, (n - i) * sizeof(ret));
+  return ret;
+}
+
+/// Insert value `e` at index `i` in leaf `n`, updating key slices
+static void
+zix_btree_leaf_insert(const ZixBTree* const t,
+                      ZixBTreeNode* const   n,
+                      const unsigned        i,
+                      void* const           e)
+{
+  zix_btree_ainsert(n->vals, n->n_vals++, i, e);
+
+  if (t->key) {
+    uint64_t* const   slices = zix_btree_slices(n);
+    const size_t      prefix = (size_t)slices[n->max_vals];
+    const unsigned    j      = i ? 0U : n->n_vals - 1U;
+    const char* const key    = zix_btree_key(t, e);
+    const char* const other  = zix_btree_key(t, n->vals[j]);
+
+    if (n->n_vals > 1U && !strncmp(key, other, prefix)) {
+      // The new key shares the prefix, so only its slice needs calculating
+      memmove(slices + i + 1,
+              slices + i,
+              (n->n_vals - 1U - i) * sizeof(uint64_t));
+
+      slices[i] = zix_btree_slice(key + prefix);
+    } else {
+      zix_btree_update_slices(t, n);
+    }
+  }
+}
+
+/// Erase and return the value at index `i` in leaf `n`, updating key slices
+static void*
+zix_btree_leaf_erase(const ZixBTree* const t,
+                     ZixBTreeNode* const   n,
+                     const unsigned        i)
+{
+  --n->n_vals;
+
+  if (t->key) {
+    // The prefix is still shared by the remaining keys, so slices just shift
+    uint64_t* const slices = zix_btree_slices(n);
+    memmove(slices + i, slices + i + 1, (n->n_vals - i) * sizeof(uint64_t));
+  }
+
+  return zix_btree_aerase(n->vals, n->n_vals, i);
+}
+
+/// Split lhs, the i'th child of `n`, into two nodes
+static ZixBTreeNode*
+zix_btree_split_child(ZixBTree* const     t,
+                      ZixBTreeNode* const n,
+                      const unsigned      i,
+                      ZixBTreeNode* const lhs)
+{
+  assert(lhs->n_vals == zix_btree_max_vals(lhs));
+  assert(n->n_vals < zix_btree_max_vals(n));
+  assert(i < n->n_vals + 1U);
+  assert(zix_btree_child(n, i) == lhs);
+
+  const unsigned max_n_vals = zix_btree_max_vals(lhs);
+  ZixBTreeNode*  rhs        = zix_btree_node_new(t, lhs->is_leaf);
+  if (!rhs) {
+    return NULL;
+  }
+
+  // LHS and RHS get roughly half, less the middle value which moves up
+  lhs->n_vals = (uint16_t)(max_n_vals / 2U);
+  rhs->n_vals = (uint16_t)(max_n_vals - lhs->n_vals - 1U);
+
+  // Copy large half from LHS to new RHS node
+  memcpy(rhs->vals, lhs->vals + lhs->n_vals + 1, rhs->n_vals * sizeof(void*));
+  if (!lhs->is_leaf) {
+    memcpy(zix_btree_children(rhs),
+           zix_btree_children(lhs) + lhs->n_vals + 1,
+           (rhs->n_vals + 1U) * sizeof(ZixBTreeNode*));
+  }
+
+  // Move middle value up to parent
+  zix_btree_ainsert(n->vals, n->n_vals, i, lhs->vals[lhs->n_vals]);
+
+  // Insert new RHS node in parent at position i
+  zix_btree_ainsert((void**)zix_btree_children(n), ++n->n_vals, i + 1U, rhs);
+
+  zix_btree_update_slices(t, n);
+  zix_btree_update_slices(t, lhs);
+  zix_btree_update_slices(t, rhs);
+  ++t->n_splits;
+  return rhs;
+}
+
+#ifdef ZIX_BTREE_SORTED_CHECK
+/// Check that `n` is sorted with respect to search key `e`
+static bool
+zix_btree_node_is_sorted_with_respect_to(const ZixComparator compare,
+                                         const void* const   compare_user_data,
+                                         void* const* const  values,
+                                         const unsigned      n_values,
+                                         const void* const   key)
+{
+  if (n_values <= 1U) {
+    return true;
+  }
+
+  int cmp = compare(values[0], key, compare_user_data);
+  for (unsigned i = 1U; i < n_values; ++i) {
+    const int next_cmp = compare(values[i], key, compare_user_data);
+    if ((cmp >= 0 && next_cmp < 0) || (cmp > 0 && next_cmp <= 0)) {
+      return false;
+    }
+
+    cmp = next_cmp;
+  }
+
+  return true;
+}
+#endif
+
+static unsigned
+zix_btree_find_value(const ZixComparator compare,
+                     const void* const   compare_user_data,
+                     void* const* const  values,
+                     const unsigned      n_values,
+                     const void* const   key,
+                     bool* const         equal)
+{
+  unsigned first = 0U;
+  unsigned count = n_values;
+
+  while (count > 0U) {
+    const unsigned half  = count >> 1U;
+    const unsigned i     = first + half;
+    void* const    value = values[i];
+    const int      cmp   = compare(value, key, compare_user_data);
+
+    if (!cmp) {
+      *equal = true;
+      return i;
+    }
+
+    if (cmp < 0) {
+      first += half + 1U;
+      count -= half + 1U;
+    } else {
+      count = half;
+    }
+  }
+
+  assert(first == n_values || compare(values[first], key, compare_user_data));
+  *equal = false;
+  return first;
+}
+
+static unsigned
+zix_btree_find_pattern(const ZixComparator compare_key,
+                       const void* const   compare_key_user_data,
+                       void* const* const  values,
+                       const unsigned      n_values,
+                       const void* const   key,
+                       bool* const         equal)
+{
+#ifdef ZIX_BTREE_SORTED_CHECK
+  assert(zix_btree_node_is_sorted_with_respect_to(
+    compare_key, compare_key_user_data, values, n_values, key));
+#endif
+
+  unsigned first = 0U;
+  unsigned count = n_values;
+
+  while (count > 0U) {
+    const unsigned half  = count >> 1U;
+    const unsigned i     = first + half;
+    void* const    value = values[i];
+    const int      cmp   = compare_key(value, key, compare_key_user_data);
+
+    if (cmp == 0) {
+      // Found a match, but keep searching for the leftmost one
+      *equal = true;
+      count  = half;
+
+    } else if (cmp < 0) {
+      // Search right half
+      first += half + 1U;
+      count -= half + 1U;
+
+    } else {
+      // Search left half
+      count = half;
+    }
+  }
+
+  assert(!*equal ||
+         (compare_key(values[first], key, compare_key_user_data) == 0 &&
+          (first == 0U ||
+           (compare_key(values[first - 1U], key, compare_key_user_data) < 0))));
+
+  return first;
+}
+
+/**
+   Find a value in a node of a tree with string keys.
+
+   This is equivalent to zix_btree_find_value(), but compares the inline key
+   slices, and only looks at the keys themselves to check the common prefix,
+   or when slices are equal but don't include the end of the key.
+*/
+static unsigned
+zix_btree_find_string(const ZixBTree* const     t,
+                      const ZixBTreeNode* const n,
+                      const void* const         e,
+                      bool* const               equal)
+{
+  *equal = false;
+  if (!n->n_vals) {
+    return 0U;
+  }
+
+  const uint64_t* const slices = zix_btree_const_slices(n);
+  const size_t          prefix = (size_t)slices[n->max_vals];
+  const char* const     key    = zix_btree_key(t, e);
+
+  if (prefix) {
+    // If the key doesn't share the prefix, it's before or after every value
+    const int cmp = strncmp(key, zix_btree_key(t, n->vals[0]), prefix);
+    if (cmp) {
+      return cmp < 0 ? 0U : n->n_vals;
+    }
+  }
+
+  const uint64_t slice = zix_btree_slice(key + prefix);
+  unsigned       first = 0U;
+  unsigned       count = n->n_vals;
+
+  while (count > 0U) {
+    const unsigned half = count >> 1U;
+    const unsigned i    = first + half;
+
+    int cmp = (slices[i] < slice) ? -1 : (slices[i] > slice) ? 1 : 0;
+    if (!cmp && (slice & 0xFFU)) {
+      // Slices are equal and the key continues, so compare the rest
+      cmp = strcmp(zix_btree_key(t, n->vals[i]) + prefix + 8U,
+                   key + prefix + 8U);
+    }
+
+    if (!cmp) {
+      *equal = true;
+      return i;
+    }
+
+    if (cmp < 0) {
+      first += half + 1U;
+      count -= half + 1U;
+    } else {
+      count = half;
+    }
+  }
+
+  return first;
+}
+
+/// Convenience wrapper to find a value in an internal node
+static unsigned
+zix_btree_inode_find(const ZixBTree* const     t,
+                     const ZixBTreeNode* const n,
+                     const void* const         e,
+                     bool* const               equal)
+{
+  assert(!n->is_leaf);
+
+  return t->key ? zix_btree_find_string(t, n, e, equal)
+                : zix_btree_find_value(
+                    t->cmp, t->cmp_data, n->vals, n->n_vals, e, equal);
+}
+
+/// Convenience wrapper to find a value in a leaf node
+static unsigned
+zix_btree_leaf_find(const ZixBTree* const     t,
+                    const ZixBTreeNode* const n,
+                    const void* const         e,
+                    bool* const               equal)
+{
+  assert(n->is_leaf);
+
+  return t->key ? zix_btree_find_string(t, n, e, equal)
+                : zix_btree_find_value(
+                    t->cmp, t->cmp_data, n->vals, n->n_vals, e, equal);
+}
+
+static inline bool
+zix_btree_can_remove_from(const ZixBTreeNode* const n)
+{
+  assert(n->n_vals >= zix_btree_min_vals(n));
+  return n->n_vals > zix_btree_min_vals(n);
+}
+
+static inline bool
+zix_btree_is_full(const ZixBTreeNode* const n)
+{
+  assert(n->n_vals <= zix_btree_max_vals(n));
   return n->n_vals == zix_btree_max_vals(n);
 }
 
-static ZixStatus
-zix_btree_grow_up(ZixBTree* const t)
-{
-  ZixBTreeNode* const new_root = zix_btree_node_new(t->allocator, false);
-  if (!new_root) {
+/// Return the height of `t`, the number of levels including the leaves
+static unsigned
+zix_btree_height(const ZixBTree* const t)
+{
+  unsigned height = 1U;
+  for (const ZixBTreeNode* n = t->root; !n->is_leaf;
+       n                        = zix_btree_child(n, 0U)) {
+    ++height;
+  }
+
+  return height;
+}
+
+/// Accumulate statistics for the subtree at `n` on `level` into `stats`
+static void
+zix_btree_node_stats(const ZixBTreeNode* const n,
+                     const unsigned            level,
+                     ZixBTreeStats* const      stats)
+{
+  ZixBTreeLevelStats* const l = &stats->levels[level];
+
+  if (!l->n_nodes || n->n_vals < l->min_vals) {
+    l->min_vals = n->n_vals;
+  }
+
+  l->max_vals = zix_btree_max_vals(n);
+  l->n_vals += n->n_vals;
+  ++l->n_nodes;
+
+  if (!n->is_leaf) {
+    for (unsigned i = 0U; i <= n->n_vals; ++i) {
+      zix_btree_node_stats(zix_btree_child(n, i), level + 1U, stats);
+    }
+  }
+}
+
+ZixBTreeStats
+zix_btree_stats(const ZixBTree* const t)
+{
+  assert(t);
+
+  ZixBTreeStats stats;
+  memset(&stats, 0, sizeof(stats));
+
+  stats.height = zix_btree_height(t);
+  zix_btree_node_stats(t->root, 0U, &stats);
+
+  size_t n_nodes = 0U;
+  for (unsigned i = 0U; i < stats.height; ++i) {
+    n_nodes += stats.levels[i].n_nodes;
+  }
+
+  stats.n_bytes     = n_nodes * t->page_size;
+  stats.n_splits    = t->n_splits;
+  stats.n_merges    = t->n_merges;
+  stats.n_rotations = t->n_rotations;
+  return stats;
+}
+
+/**
+   The shape of a packed tree, with nodes filled to a given percentage.
+
+   Levels are indexed from the leaves up.  The things on each level (values
+   in leaves, and children in internal nodes) are spread evenly between its
+   nodes, so each is either as full as the others or has one more.
+*/
+typedef struct {
+  unsigned height;                        ///< Number of levels
+  size_t   n_nodes[ZIX_BTREE_MAX_HEIGHT]; ///< Number of nodes on each level
+  size_t   n_items[ZIX_BTREE_MAX_HEIGHT]; ///< Number of things on each level
+  size_t   n_built[ZIX_BTREE_MAX_HEIGHT]; ///< Number of nodes built so far
+} ZixBTreePacking;
+
+/**
+   Return the number of nodes to spread `n_items` things between.
+
+   A node with capacity for `max_items` things is filled to `fill` percent
+   of that, but never less than the minimum, so there may be fewer nodes
+   (and the last level may have a single, less full, root).
+*/
+static size_t
+zix_btree_packed_nodes(const size_t   n_items,
+                       const size_t   max_items,
+                       const unsigned fill)
+{
+  const size_t min_items = max_items / 2U;
+  const size_t n_full    = (max_items * fill + 99U) / 100U;
+  const size_t target    = n_full > min_items ? n_full : min_items;
+  const size_t n_max     = n_items / min_items;
+  const size_t n_nodes   = (n_items + target - 1U) / target;
+
+  return (n_nodes <= n_max) ? n_nodes : n_max ? n_max : 1U;
+}
+
+static ZixBTreePacking
+zix_btree_packing(const ZixBTree* const t,
+                  const size_t          size,
+                  const unsigned        fill)
+{
+  ZixBTreePacking p;
+  memset(&p, 0, sizeof(p));
+
+  /* Each leaf but the last is followed by a separator in a parent, so count
+     one more thing than values, and give leaves room for one more to match */
+  const size_t n_leaves =
+    zix_btree_packed_nodes(size + 1U, t->leaf_vals + 1U, fill);
+
+  p.height     = 1U;
+  p.n_nodes[0] = n_leaves;
+  p.n_items[0] = size + 1U - n_leaves;
+
+  // Add parents until there is a single root
+  for (size_t n = n_leaves; n > 1U; ++p.height) {
+    const size_t n_children = n;
+
+    assert(p.height < ZIX_BTREE_MAX_HEIGHT);
+    n = zix_btree_packed_nodes(n_children, t->inode_vals + 1U, fill);
+    p.n_nodes[p.height] = n;
+    p.n_items[p.height] = n_children;
+  }
+
+  return p;
+}
+
+/**
+   Build a packed subtree at `level` with the next values from `iter`.
+
+   Returns null if a node could not be allocated, in which case the nodes
+   already allocated are leaked, and must be freed along with their pool.
+*/
+static ZixBTreeNode*
+zix_btree_pack(const ZixBTree* const  t,
+               ZixBTreePacking* const p,
+               const unsigned         level,
+               ZixBTreeIter* const    iter)
+{
+  ZixBTreeNode* const n = zix_btree_node_new(t, level == 0U);
+  if (!n) {
+    return NULL;
+  }
+
+  // Take an even share of the things on this level
+  const size_t i     = p->n_built[level]++;
+  const size_t q     = p->n_items[level] / p->n_nodes[level];
+  const size_t r     = p->n_items[level] % p->n_nodes[level];
+  const size_t count = q + ((i < r) ? 1U : 0U);
+
+  if (!level) {
+    for (size_t j = 0U; j < count; ++j) {
+      n->vals[j] = zix_btree_get(*iter);
+      zix_btree_iter_increment(iter);
+    }
+
+    n->n_vals = (uint16_t)count;
+  } else {
+    ZixBTreeNode** const children = zix_btree_children(n);
+
+    for (size_t j = 0U; j < count; ++j) {
+      if (!(children[j] = zix_btree_pack(t, p, level - 1U, iter))) {
+        return NULL;
+      }
+
+      if (j + 1U < count) {
+        n->vals[j] = zix_btree_get(*iter);
+        zix_btree_iter_increment(iter);
+      }
+    }
+
+    n->n_vals = (uint16_t)(count - 1U);
+  }
+
+  zix_btree_update_slices(t, n);
+  return n;
+}
+
+ZixStatus
+zix_btree_compact(ZixBTree* const t, const unsigned fill)
+{
+  assert(t);
+
+  if (fill < 50U || fill > 100U) {
+    return ZIX_STATUS_BAD_ARG;
+  }
+
+  ZixBTreePacking packing = zix_btree_packing(t, zix_btree_count(t), fill);
+  size_t          n_nodes = 0U;
+  for (unsigned i = 0U; i < packing.height; ++i) {
+    n_nodes += packing.n_nodes[i];
+  }
+
+  // Build the new tree in a new pool, in a single slab if it isn't too large
+  ZixBTreePool* const old_pool = t->pool;
+  ZixBTreePool* const new_pool =
+    zix_btree_pool_new(old_pool->allocator, t->page_size);
+
+  if (!new_pool) {
+    return ZIX_STATUS_NO_MEM;
+  }
+
+  if (!zix_btree_pool_grow(new_pool, n_nodes)) {
+    zix_btree_pool_free(new_pool);
+    return ZIX_STATUS_NO_MEM;
+  }
+
+  ZixBTreeIter iter = zix_btree_begin(t);
+
+  t->pool = new_pool;
+
+  ZixBTreeNode* const root =
+    zix_btree_pack(t, &packing, packing.height - 1U, &iter);
+
+  t->pool = old_pool;
+  if (!root) {
+    zix_btree_pool_free(new_pool);
+    return ZIX_STATUS_NO_MEM;
+  }
+
+  // Drop the old tree, which frees the old pool if nothing else uses it
+  assert(zix_btree_iter_is_end(iter));
+  zix_btree_release(t, t->root);
+  zix_btree_pool_unref(old_pool);
+  t->pool = new_pool;
+  t->root = root;
+  return ZIX_STATUS_SUCCESS;
+}
+
+static ZixStatus
+zix_btree_grow_up(ZixBTree* const t)
+{
+  /* Iterators have a fixed-size stack, which limits the height of the tree.
+     This is only likely to be reached with small pages. */
+
+  if (zix_btree_height(t) >= ZIX_BTREE_MAX_HEIGHT) {
+    return ZIX_STATUS_OVERFLOW;
+  }
+
+  ZixBTreeNode* const new_root = zix_btree_node_new(t, false);
+  if (!new_root) {
+    return ZIX_STATUS_NO_MEM;
+  }
+
+  // Set old root as the only child of the new root
+  zix_btree_children(new_root)[0] = t->root;
+
+  // Split the old root to get two balanced siblings
+  zix_btree_split_child(t, new_root, 0, t->root);
+  t->root = new_root;
+
+  return ZIX_STATUS_SUCCESS;
+}
+
+ZixStatus
+zix_btree_insert(ZixBTree* const t, void* const e)
+{
+  assert(t);
+
+  ZixStatus st = ZIX_STATUS_SUCCESS;
+
+  // Grow up if necessary to ensure the root is not full
+  if (zix_btree_is_full(t->root)) {
+    if ((st = zix_btree_grow_up(t))) {
+      return st;
+    }
+  }
+
+  // Walk down from the root until we reach a suitable leaf
+  ZixBTreeNode* node = t->root;
+  while (!node->is_leaf) {
+    // Search for the value in this node
+    bool           equal = false;
+    const unsigned i     = zix_btree_inode_find(t, node, e, &equal);
+    if (equal) {
+      return ZIX_STATUS_EXISTS;
+    }
+
+    // Value not in this node, but may be in the ith child
+    ZixBTreeNode* child = zix_btree_own_child(t, node, i);
+    if (!child) {
+      return ZIX_STATUS_NO_MEM;
+    }
+
+    if (zix_btree_is_full(child)) {
+      // The child is full, split it before continuing
+      ZixBTreeNode* const rhs = zix_btree_split_child(t, node, i, child);
+
+      if (!rhs) {
+        return ZIX_STATUS_NO_MEM;
+      }
+
+      // Compare with new split value to determine which side to use
+      const int cmp = t->cmp(node->vals[i], e, t->cmp_data);
+      if (cmp < 0) {
+        child = rhs; // Split value is less than the new value, move right
+      } else if (cmp == 0) {
+        return ZIX_STATUS_EXISTS; // Split value is exactly the value to insert
+      }
+    }
+
+    // Descend to child node and continue
+    node = child;
+  }
+
+  // Search for the value in the leaf
+  bool           equal = false;
+  const unsigned i     = zix_btree_leaf_find(t, node, e, &equal);
+  if (equal) {
+    return ZIX_STATUS_EXISTS;
+  }
+
+  // The value is not in the tree, insert into the leaf
+  zix_btree_leaf_insert(t, node, i, e);
+  ++t->size;
+  return ZIX_STATUS_SUCCESS;
+}
+
+static void
+zix_btree_iter_set_frame(ZixBTreeIter* const ti,
+                         ZixBTreeNode* const n,
+                         const unsigned      i)
+{
+  ti->nodes[ti->level]   = n;
+  ti->indexes[ti->level] = (uint16_t)i;
+}
+
+static void
+zix_btree_iter_push(ZixBTreeIter* const ti,
+                    ZixBTreeNode* const n,
+                    const unsigned      i)
+{
+  assert(ti->level + 1U < ZIX_BTREE_MAX_HEIGHT);
+  ++ti->level;
+  ti->nodes[ti->level]   = n;
+  ti->indexes[ti->level] = (uint16_t)i;
+}
+
+static void
+zix_btree_iter_pop(ZixBTreeIter* const ti)
+{
+  assert(ti->level > 0U);
+  ti->nodes[ti->level]   = NULL;
+  ti->indexes[ti->level] = 0U;
+  --ti->level;
+}
+
+/**
+   Return true iff `e` is less than the upper bound of a subtree in a path.
+
+   The upper bound of the subtree at `level` is the value immediately after it
+   in the nearest ancestor where the path does not descend to the last child.
+   Batch operations only move forwards through the tree, so the lower bound
+   never needs to be checked.
+*/
+static bool
+zix_btree_is_below_bound(const ZixBTree* const     t,
+                         const ZixBTreeIter* const path,
+                         const uint16_t            level,
+                         const void* const         e)
+{
+  for (uint16_t l = level; l > 0U; --l) {
+    const ZixBTreeNode* const parent = path->nodes[l - 1U];
+    const uint16_t            i      = path->indexes[l - 1U];
+
+    if (i < parent->n_vals) {
+      return t->cmp(parent->vals[i], e, t->cmp_data) > 0;
+    }
+  }
+
+  return true; // Rightmost subtree on every level, so there is no upper bound
+}
+
+ZixStatus
+zix_btree_insert_sorted_batch(ZixBTree* const    t,
+                              void* const* const values,
+                              const size_t       n_values)
+{
+  assert(t);
+  assert(values || !n_values);
+
+  ZixBTreeIter  path      = zix_btree_end_iter;
+  ZixBTreeNode* last_leaf = NULL; // Leaf of the previous insertion
+  unsigned      last_i    = 0U;   // Index of the previous insertion
+  bool          existed   = false;
+  ZixStatus     st        = ZIX_STATUS_SUCCESS;
+
+  path.nodes[0] = t->root;
+
+  for (size_t v = 0U; v < n_values; ++v) {
+    void* const e = values[v];
+
+    assert(!v || t->cmp(values[v - 1U], e, t->cmp_data) <= 0);
+
+    /* Climb back up the previous path until we reach a subtree that contains
+       the new value, and that isn't full so a child can be split into it. */
+
+    while (path.level > 0U &&
+           (zix_btree_is_full(path.nodes[path.level]) ||
+            !zix_btree_is_below_bound(t, &path, path.level, e))) {
+      --path.level;
+    }
+
+    if (!path.level && zix_btree_is_full(t->root)) {
+      if ((st = zix_btree_grow_up(t))) {
+        return st;
+      }
+
+      path.nodes[0] = t->root;
+    }
+
+    // Walk down from there until we reach a suitable leaf, like insert
+    ZixBTreeNode* node  = path.nodes[path.level];
+    bool          equal = false;
+    while (!node->is_leaf && !equal) {
+      unsigned i = zix_btree_inode_find(t, node, e, &equal);
+      if (equal) {
+        break;
+      }
+
+      ZixBTreeNode* child = zix_btree_own_child(t, node, i);
+      if (!child) {
+        return ZIX_STATUS_NO_MEM;
+      }
+
+      if (zix_btree_is_full(child)) {
+        ZixBTreeNode* const rhs = zix_btree_split_child(t, node, i, child);
+
+        if (!rhs) {
+          return ZIX_STATUS_NO_MEM;
+        }
+
+        const int cmp = t->cmp(node->vals[i], e, t->cmp_data);
+        if (cmp < 0) {
+          child = rhs;
+          ++i;
+        } else if (cmp == 0) {
+          equal = true;
+          break;
+        }
+      }
+
+      path.indexes[path.level] = (uint16_t)i;
+      zix_btree_iter_push(&path, child, 0U);
+      node = child;
+    }
+
+    if (!equal) {
+      /* Values are sorted, so when we're still in the same leaf, the new
+         value can only go at or after the previous one.  This makes appending
+         a run of values to a leaf about as cheap as filling an array. */
+
+      const unsigned start = (node == last_leaf) ? last_i : 0U;
+      const unsigned i =
+        start + zix_btree_find_value(t->cmp,
+                                     t->cmp_data,
+                                     node->vals + start,
+                                     node->n_vals - start,
+                                     e,
+                                     &equal);
+
+      if (!equal) {
+        zix_btree_leaf_insert(t, node, i, e);
+        ++t->size;
+        last_leaf = node;
+        last_i    = i;
+      }
+    }
+
+    existed = existed || equal;
+  }
+
+  return existed ? ZIX_STATUS_EXISTS : ZIX_STATUS_SUCCESS;
+}
+
+/// Enlarge left child by stealing a value from its right sibling
+static ZixBTreeNode*
+zix_btree_rotate_left(ZixBTree* const     t,
+                      ZixBTreeNode* const parent,
+                      const unsigned      i)
+{
+  ZixBTreeNode* const lhs = zix_btree_own_child(t, parent, i);
+  ZixBTreeNode* const rhs = zix_btree_own_child(t, parent, i + 1);
+  if (!lhs || !rhs) {
+    return NULL;
+  }
+
+  assert(lhs->is_leaf == rhs->is_leaf);
+
+  // Move parent value to end of LHS
+  lhs->vals[lhs->n_vals++] = parent->vals[i];
+
+  // Move first value in RHS to parent
+  parent->vals[i] = zix_btree_aerase(rhs->vals, rhs->n_vals, 0);
+
+  if (!lhs->is_leaf) {
+    // Move first child pointer from RHS to end of LHS
+    zix_btree_children(lhs)[lhs->n_vals] = (ZixBTreeNode*)zix_btree_aerase(
+      (void**)zix_btree_children(rhs), rhs->n_vals, 0);
+  }
+
+  --rhs->n_vals;
+
+  zix_btree_update_slices(t, parent);
+  zix_btree_update_slices(t, lhs);
+  zix_btree_update_slices(t, rhs);
+  ++t->n_rotations;
+  return lhs;
+}
+
+/// Enlarge a child by stealing a value from its left sibling
+static ZixBTreeNode*
+zix_btree_rotate_right(ZixBTree* const     t,
+                       ZixBTreeNode* const parent,
+                       const unsigned      i)
+{
+  ZixBTreeNode* const lhs = zix_btree_own_child(t, parent, i - 1);
+  ZixBTreeNode* const rhs = zix_btree_own_child(t, parent, i);
+  if (!lhs || !rhs) {
+    return NULL;
+  }
+
+  assert(lhs->is_leaf == rhs->is_leaf);
+
+  // Prepend parent value to RHS
+  zix_btree_ainsert(rhs->vals, rhs->n_vals++, 0, parent->vals[i - 1]);
+
+  if (!lhs->is_leaf) {
+    // Move last child pointer from LHS and prepend to RHS
+    zix_btree_ainsert((void**)zix_btree_children(rhs),
+                      rhs->n_vals,
+                      0,
+                      zix_btree_children(lhs)[lhs->n_vals]);
+  }
+
+  // Move last value from LHS to parent
+  parent->vals[i - 1] = lhs->vals[--lhs->n_vals];
+
+  zix_btree_update_slices(t, parent);
+  zix_btree_update_slices(t, lhs);
+  zix_btree_update_slices(t, rhs);
+  ++t->n_rotations;
+  return rhs;
+}
+
+/// Move n[i] down, merge the left and right child, return the merged node
+static ZixBTreeNode*
+zix_btree_merge(ZixBTree* const t, ZixBTreeNode* const n, const unsigned i)
+{
+  ZixBTreeNode* const lhs = zix_btree_own_child(t, n, i);
+  ZixBTreeNode* const rhs = zix_btree_own_child(t, n, i + 1);
+  if (!lhs || !rhs) {
+    return NULL;
+  }
+
+  assert(lhs->is_leaf == rhs->is_leaf);
+  assert(lhs->n_vals + rhs->n_vals < zix_btree_max_vals(lhs));
+
+  // Move parent value to end of LHS
+  lhs->vals[lhs->n_vals++] = zix_btree_aerase(n->vals, n->n_vals, i);
+
+  // Erase corresponding child pointer (to RHS) in parent
+  zix_btree_aerase((void**)zix_btree_children(n), n->n_vals, i + 1U);
+
+  // Add everything from RHS to end of LHS
+  memcpy(lhs->vals + lhs->n_vals, rhs->vals, rhs->n_vals * sizeof(void*));
+  if (!lhs->is_leaf) {
+    memcpy(zix_btree_children(lhs) + lhs->n_vals,
+           zix_btree_children(rhs),
+           (rhs->n_vals + 1U) * sizeof(void*));
+  }
+
+  lhs->n_vals = (uint16_t)(lhs->n_vals + rhs->n_vals);
+
+  if (--n->n_vals == 0) {
+    // Root is now empty, replace it with its only child
+    assert(n == t->root);
+    t->root = lhs;
+    zix_btree_pool_release(t->pool, n);
+  } else {
+    zix_btree_update_slices(t, n);
+  }
+
+  zix_btree_pool_release(t->pool, rhs);
+  zix_btree_update_slices(t, lhs);
+  ++t->n_merges;
+  return lhs;
+}
+
+/// Remove the min value from the subtree rooted at the ith child of `n`
+static ZixStatus
+zix_btree_remove_min(ZixBTree* const     t,
+                     ZixBTreeNode* const n,
+                     const unsigned      i,
+                     void** const        out)
+{
+  ZixBTreeNode* m = zix_btree_own_child(t, n, i);
+
+  assert(!m || zix_btree_can_remove_from(m));
+
+  while (m && !m->is_leaf) {
+    ZixBTreeNode* const* const children = zix_btree_children(m);
+
+    m = zix_btree_can_remove_from(children[0]) ? zix_btree_own_child(t, m, 0)
+        : zix_btree_can_remove_from(children[1])
+          ? zix_btree_rotate_left(t, m, 0)
+          : zix_btree_merge(t, m, 0);
+  }
+
+  if (!m) {
+    return ZIX_STATUS_NO_MEM;
+  }
+
+  *out = zix_btree_leaf_erase(t, m, 0U);
+  return ZIX_STATUS_SUCCESS;
+}
+
+/// Remove the max value from the subtree rooted at the ith child of `n`
+static ZixStatus
+zix_btree_remove_max(ZixBTree* const     t,
+                     ZixBTreeNode* const n,
+                     const unsigned      i,
+                     void** const        out)
+{
+  ZixBTreeNode* m = zix_btree_own_child(t, n, i);
+
+  assert(!m || zix_btree_can_remove_from(m));
+
+  while (m && !m->is_leaf) {
+    ZixBTreeNode* const* const children = zix_btree_children(m);
+
+    const unsigned y = m->n_vals - 1U;
+    const unsigned z = m->n_vals;
+
+    m = zix_btree_can_remove_from(children[z]) ? zix_btree_own_child(t, m, z)
+        : zix_btree_can_remove_from(children[y])
+          ? zix_btree_rotate_right(t, m, z)
+          : zix_btree_merge(t, m, y);
+  }
+
+  if (!m) {
+    return ZIX_STATUS_NO_MEM;
+  }
+
+  *out = m->vals[--m->n_vals];
+  return ZIX_STATUS_SUCCESS;
+}
+
+/// Enlarge the child at the top of `iter` and return it, or null on failure
+static ZixBTreeNode*
+zix_btree_fatten_child(ZixBTree* const t, ZixBTreeIter* const iter)
+{
+  ZixBTreeNode* const n = iter->nodes[iter->level];
+  const unsigned      i = iter->indexes[iter->level];
+
+  assert(n);
+  assert(!n->is_leaf);
+  ZixBTreeNode* const* const children = zix_btree_children(n);
+
+  if (i > 0 && zix_btree_can_remove_from(children[i - 1U])) {
+    return zix_btree_rotate_right(t, n, i); // Steal a key from left sibling
+  }
+
+  if (i < n->n_vals && zix_btree_can_remove_from(children[i + 1U])) {
+    return zix_btree_rotate_left(t, n, i); // Steal a key from right sibling
+  }
+
+  // Both child's siblings are minimal, merge them
+
+  if (i == n->n_vals) {
+    --iter->indexes[iter->level];
+    return zix_btree_merge(t, n, i - 1U); // Merge last two children
+  }
+
+  return zix_btree_merge(t, n, i); // Merge left and right siblings
+}
+
+/**
+   Replace the ith value in `n` with one from a child if possible.
+
+   @return #ZIX_STATUS_SUCCESS, #ZIX_STATUS_NOT_FOUND if both children are
+   minimal so they must be merged instead, or #ZIX_STATUS_NO_MEM.
+*/
+static ZixStatus
+zix_btree_replace_value(ZixBTree* const     t,
+                        ZixBTreeNode* const n,
+                        const unsigned      i,
+                        void** const        out)
+{
+  ZixBTreeNode* const lhs = zix_btree_child(n, i);
+  ZixBTreeNode* const rhs = zix_btree_child(n, i + 1);
+  if (!zix_btree_can_remove_from(lhs) && !zix_btree_can_remove_from(rhs)) {
+    return ZIX_STATUS_NOT_FOUND;
+  }
+
+  // Stash the value for the caller before it is replaced
+  void* const value = n->vals[i];
+
+  const ZixStatus st =
+    // Left child has more values, steal its largest
+    (lhs->n_vals > rhs->n_vals) ? zix_btree_remove_max(t, n, i, &n->vals[i])
+
+    // Right child has more values, steal its smallest
+    : (rhs->n_vals > lhs->n_vals)
+      ? zix_btree_remove_min(t, n, i + 1U, &n->vals[i])
+
+      // Children are balanced, use index parity as a low-bias tie breaker
+      : (i & 1U) ? zix_btree_remove_max(t, n, i, &n->vals[i])
+                 : zix_btree_remove_min(t, n, i + 1U, &n->vals[i]);
+
+  if (!st) {
+    zix_btree_update_slices(t, n);
+    *out = value;
+  }
+
+  return st;
+}
+
+ZixStatus
+zix_btree_remove(ZixBTree* const     t,
+                 const void* const   e,
+                 void** const        out,
+                 ZixBTreeIter* const next)
+{
+  assert(t);
+  assert(out);
+
+  ZixBTreeNode* n  = t->root;
+  ZixBTreeIter* ti = next;
+  ZixStatus     st = ZIX_STATUS_SUCCESS;
+
+  *ti = zix_btree_end_iter;
+
+  /* To remove in a single walk down, the tree is adjusted along the way so
+     that the current node always has at least one more value than the
+     minimum.  This ensures that there is always room to remove, without
+     having to merge nodes again on a traversal back up. */
+
+  if (!n->is_leaf && n->n_vals == 1U &&
+      !zix_btree_can_remove_from(zix_btree_children(n)[0U]) &&
+      !zix_btree_can_remove_from(zix_btree_children(n)[1U])) {
+    // Root has only two children, both minimal, merge them into a new root
+    if (!(n = zix_btree_merge(t, n, 0))) {
+      return ZIX_STATUS_NO_MEM;
+    }
+  }
+
+  while (!n->is_leaf) {
+    assert(n == t->root || zix_btree_can_remove_from(n));
+
+    // Search for the value in the current node and update the iterator
+    bool           equal = false;
+    const unsigned i     = zix_btree_inode_find(t, n, e, &equal);
+
+    zix_btree_iter_set_frame(ti, n, i);
+
+    if (equal) {
+      // Found in internal node
+      if (!(st = zix_btree_replace_value(t, n, i, out))) {
+        // Replaced hole with a value from a direct child
+        --t->size;
+        return st;
+      }
+
+      if (st != ZIX_STATUS_NOT_FOUND) {
+        break; // Failed to copy a shared node
+      }
+
+      // Both preceding and succeeding child are minimal, merge and continue
+      n = zix_btree_merge(t, n, i);
+
+    } else {
+      // Not found in internal node, is in the ith child if anywhere
+      n = zix_btree_can_remove_from(zix_btree_child(n, i))
+            ? zix_btree_own_child(t, n, i)
+            : zix_btree_fatten_child(t, ti);
+    }
+
+    if (!n) {
+      break; // Failed to copy a shared node
+    }
+
+    ++ti->level;
+  }
+
+  if (!n || !n->is_leaf) {
+    *ti = zix_btree_end_iter;
     return ZIX_STATUS_NO_MEM;
   }
 
-  // Set old root as the only child of the new root
-  new_root->data.inode.children[0] = t->root;
+  // We're at the leaf the value may be in, search for the value in it
+  bool           equal = false;
+  const unsigned i     = zix_btree_leaf_find(t, n, e, &equal);
 
-  // Split the old root to get two balanced siblings
-  zix_btree_split_child(t->allocator, new_root, 0, t->root);
-  t->root = new_root;
+  if (!equal) { // Not found in tree
+    *ti = zix_btree_end_iter;
+    return ZIX_STATUS_NOT_FOUND;
+  }
+
+  // Erase from leaf node
+  *out = zix_btree_leaf_erase(t, n, i);
+
+  // Update next iterator
+  if (n->n_vals == 0U) {
+    // Removed the last element in the tree
+    assert(n == t->root);
+    assert(!t->size_known || t->size == 1U);
+    *ti = zix_btree_end_iter;
+  } else if (i == n->n_vals) {
+    // Removed the largest element in this leaf, increment to the next
+    zix_btree_iter_set_frame(ti, n, i - 1);
+    zix_btree_iter_increment(ti);
+  } else {
+    zix_btree_iter_set_frame(ti, n, i);
+  }
 
+  --t->size;
   return ZIX_STATUS_SUCCESS;
 }
 
 ZixStatus
-zix_btree_insert(ZixBTree* const t, void* const e)
+zix_btree_remove_sorted_batch(ZixBTree* const          t,
+                              const void* const* const keys,
+                              const size_t             n_keys,
+                              const ZixDestroyFunc     destroy,
+                              const void* const        destroy_user_data)
 {
   assert(t);
+  assert(keys || !n_keys);
 
-  ZixStatus st = ZIX_STATUS_SUCCESS;
+  ZixBTreeIter path    = zix_btree_end_iter;
+  bool         missing = false;
 
-  // Grow up if necessary to ensure the root is not full
-  if (zix_btree_is_full(t->root)) {
-    if ((st = zix_btree_grow_up(t))) {
-      return st;
+  path.nodes[0] = t->root;
+
+  for (size_t k = 0U; k < n_keys; ++k) {
+    const void* const e = keys[k];
+
+    assert(!k || t->cmp(keys[k - 1U], e, t->cmp_data) <= 0);
+
+    /* Climb back up the previous path until we reach a subtree that contains
+       the key, and that has a value to spare so a child can be fattened. */
+
+    while (path.level > 0U &&
+           (!zix_btree_can_remove_from(path.nodes[path.level]) ||
+            !zix_btree_is_below_bound(t, &path, path.level, e))) {
+      --path.level;
     }
-  }
 
-  // Walk down from the root until we reach a suitable leaf
-  ZixBTreeNode* node = t->root;
-  while (!node->is_leaf) {
-    // Search for the value in this node
-    bool           equal = false;
-    const unsigned i     = zix_btree_inode_find(t, node, e, &equal);
-    if (equal) {
-      return ZIX_STATUS_EXISTS;
+    ZixBTreeNode* n = path.nodes[path.level];
+    if (!path.level && !n->is_leaf && n->n_vals == 1U &&
+        !zix_btree_can_remove_from(zix_btree_children(n)[0U]) &&
+        !zix_btree_can_remove_from(zix_btree_children(n)[1U])) {
+      // Root has only two children, both minimal, merge them into a new root
+      if (!(n = zix_btree_merge(t, n, 0))) {
+        return ZIX_STATUS_NO_MEM;
+      }
+
+      path.nodes[0] = n;
     }
 
-    // Value not in this node, but may be in the ith child
-    ZixBTreeNode* child = node->data.inode.children[i];
-    if (zix_btree_is_full(child)) {
-      // The child is full, split it before continuing
-      ZixBTreeNode* const rhs =
-        zix_btree_split_child(t->allocator, node, i, child);
+    // Walk down from there like remove until the value is found
+    void* out   = NULL;
+    bool  found = false;
+    while (!n->is_leaf) {
+      bool           equal = false;
+      const unsigned i     = zix_btree_inode_find(t, n, e, &equal);
+
+      path.indexes[path.level] = (uint16_t)i;
+
+      if (equal) {
+        const ZixStatus st = zix_btree_replace_value(t, n, i, &out);
+        if (!st) {
+          found = true;
+          break;
+        }
+
+        if (st != ZIX_STATUS_NOT_FOUND) {
+          return st;
+        }
+
+        n = zix_btree_merge(t, n, i);
+      } else {
+        n = zix_btree_can_remove_from(zix_btree_child(n, i))
+              ? zix_btree_own_child(t, n, i)
+              : zix_btree_fatten_child(t, &path);
+      }
 
-      if (!rhs) {
+      if (!n) {
         return ZIX_STATUS_NO_MEM;
       }
 
-      // Compare with new split value to determine which side to use
-      const int cmp = t->cmp(node->data.inode.vals[i], e, t->cmp_data);
-      if (cmp < 0) {
-        child = rhs; // Split value is less than the new value, move right
-      } else if (cmp == 0) {
-        return ZIX_STATUS_EXISTS; // Split value is exactly the value to insert
+      if (n == t->root) {
+        // Merged the last value out of the root, so the child replaced it
+        path.nodes[0] = n;
+      } else {
+        zix_btree_iter_push(&path, n, 0U);
       }
     }
 
-    // Descend to child node and continue
-    node = child;
+    if (!found) {
+      bool           equal = false;
+      const unsigned i     = zix_btree_leaf_find(t, n, e, &equal);
+      if (equal) {
+        out   = zix_btree_leaf_erase(t, n, i);
+        found = true;
+      }
+    }
+
+    if (found) {
+      --t->size;
+      if (destroy) {
+        destroy(out, destroy_user_data);
+      }
+    } else {
+      missing = true;
+    }
   }
 
-  // Search for the value in the leaf
-  bool           equal = false;
-  const unsigned i     = zix_btree_leaf_find(t, node, e, &equal);
-  if (equal) {
-    return ZIX_STATUS_EXISTS;
+  return missing ? ZIX_STATUS_NOT_FOUND : ZIX_STATUS_SUCCESS;
+}
+
+/**
+   Balance two adjacent nodes with the separator value between them.
+
+   The nodes may have any number of values, including none, as long as they
+   have the same height.  If everything fits in one node, then `rhs` is merged
+   into `lhs` and freed, and true is returned.  Otherwise, the values are
+   split evenly between them, and `sep` is set to the new separator.
+*/
+static bool
+zix_btree_balance(ZixBTree* const     t,
+                  ZixBTreeNode* const lhs,
+                  void* const         old_sep,
+                  ZixBTreeNode* const rhs,
+                  void** const        sep)
+{
+  assert(lhs->is_leaf == rhs->is_leaf);
+  assert(lhs->refs == 1U && rhs->refs == 1U);
+
+  const unsigned total = lhs->n_vals + 1U + rhs->n_vals;
+  if (total <= zix_btree_max_vals(lhs)) {
+    // Merge everything into LHS
+    lhs->vals[lhs->n_vals] = old_sep;
+    memcpy(lhs->vals + lhs->n_vals + 1U,
+           rhs->vals,
+           rhs->n_vals * sizeof(void*));
+
+    if (!lhs->is_leaf) {
+      memcpy(zix_btree_children(lhs) + lhs->n_vals + 1U,
+             zix_btree_children(rhs),
+             (rhs->n_vals + 1U) * sizeof(ZixBTreeNode*));
+    }
+
+    lhs->n_vals = (uint16_t)total;
+    zix_btree_pool_release(t->pool, rhs);
+    zix_btree_update_slices(t, lhs);
+    ++t->n_merges;
+    return true;
   }
 
-  // The value is not in the tree, insert into the leaf
-  zix_btree_ainsert(node->data.leaf.vals, node->n_vals++, i, e);
-  ++t->size;
-  return ZIX_STATUS_SUCCESS;
+  const unsigned n_lhs = total / 2U;
+  if (lhs->n_vals == n_lhs) {
+    *sep = old_sep; // Already balanced
+  } else if (lhs->n_vals < n_lhs) {
+    // Move values from the start of RHS to the end of LHS
+    const unsigned d = n_lhs - lhs->n_vals;
+
+    lhs->vals[lhs->n_vals] = old_sep;
+    memcpy(lhs->vals + lhs->n_vals + 1U, rhs->vals, (d - 1U) * sizeof(void*));
+    *sep = rhs->vals[d - 1U];
+    memmove(rhs->vals, rhs->vals + d, (rhs->n_vals - d) * sizeof(void*));
+
+    if (!lhs->is_leaf) {
+      ZixBTreeNode** const r = zix_btree_children(rhs);
+
+      memcpy(zix_btree_children(lhs) + lhs->n_vals + 1U,
+             r,
+             d * sizeof(ZixBTreeNode*));
+      memmove(r, r + d, (rhs->n_vals + 1U - d) * sizeof(ZixBTreeNode*));
+    }
+
+    lhs->n_vals = (uint16_t)(lhs->n_vals + d);
+    rhs->n_vals = (uint16_t)(rhs->n_vals - d);
+  } else {
+    // Move values from the end of LHS to the start of RHS
+    const unsigned d = lhs->n_vals - n_lhs;
+
+    memmove(rhs->vals + d, rhs->vals, rhs->n_vals * sizeof(void*));
+    memcpy(rhs->vals, lhs->vals + n_lhs + 1U, (d - 1U) * sizeof(void*));
+    rhs->vals[d - 1U] = old_sep;
+    *sep              = lhs->vals[n_lhs];
+
+    if (!lhs->is_leaf) {
+      ZixBTreeNode** const r = zix_btree_children(rhs);
+
+      memmove(r + d, r, (rhs->n_vals + 1U) * sizeof(ZixBTreeNode*));
+      memcpy(r,
+             zix_btree_children(lhs) + n_lhs + 1U,
+             d * sizeof(ZixBTreeNode*));
+    }
+
+    lhs->n_vals = (uint16_t)n_lhs;
+    rhs->n_vals = (uint16_t)(rhs->n_vals + d);
+  }
+
+  zix_btree_update_slices(t, lhs);
+  zix_btree_update_slices(t, rhs);
+  t->n_rotations += (*sep != old_sep) ? 1U : 0U;
+  return false;
 }
 
 static void
-zix_btree_iter_set_frame(ZixBTreeIter* const ti,
-                         ZixBTreeNode* const n,
-                         const ZixShort      i)
+zix_btree_repair(ZixBTree* t, ZixBTreeNode* n);
+
+/// Balance the ith and next children of `n`, and repair the result
+static void
+zix_btree_rebalance(ZixBTree* const     t,
+                    ZixBTreeNode* const n,
+                    const unsigned      i)
 {
-  ti->nodes[ti->level]   = n;
-  ti->indexes[ti->level] = (uint16_t)i;
+  ZixBTreeNode** const children = zix_btree_children(n);
+  ZixBTreeNode* const  lhs      = children[i];
+  ZixBTreeNode* const  rhs      = children[i + 1U];
+
+  if (zix_btree_balance(t, lhs, n->vals[i], rhs, &n->vals[i])) {
+    zix_btree_aerase(n->vals, --n->n_vals, i);
+    zix_btree_aerase((void**)children, n->n_vals + 1U, i + 1U);
+    zix_btree_repair(t, lhs);
+  } else {
+    zix_btree_repair(t, lhs);
+    zix_btree_repair(t, rhs);
+  }
+
+  zix_btree_update_slices(t, n);
 }
 
+/**
+   Fix any underfull children of `n` after a range was erased below it.
+
+   An underfull child may have no values at all, in which case its only child
+   may be underfull in the same way, and so on.  These nodes are balanced with
+   a sibling, which cascades down as necessary, and may leave the pair
+   underfull again, so they're checked until both are full enough.  If `n`
+   itself runs out of values, it's left for its parent to repair.
+*/
 static void
-zix_btree_iter_push(ZixBTreeIter* const ti,
-                    ZixBTreeNode* const n,
-                    const ZixShort      i)
+zix_btree_repair(ZixBTree* const t, ZixBTreeNode* const n)
 {
-  assert(ti->level < ZIX_BTREE_MAX_HEIGHT);
-  ++ti->level;
-  ti->nodes[ti->level]   = n;
-  ti->indexes[ti->level] = (uint16_t)i;
+  if (n->is_leaf) {
+    return;
+  }
+
+  for (unsigned i = 0U; n->n_vals && i <= n->n_vals;) {
+    const ZixBTreeNode* const child = zix_btree_child(n, i);
+    if (child->n_vals >= zix_btree_min_vals(child)) {
+      ++i;
+    } else {
+      i = i ? i - 1U : i;
+      zix_btree_rebalance(t, n, i);
+    }
+  }
+}
+
+/**
+   Join two adjacent subtrees of the same height that have no separator.
+
+   This zips the right edge of `lhs` and the left edge of `rhs` together from
+   the bottom up, and returns true if everything was merged into `lhs`, or
+   false if both nodes remain with `sep` set to a new separator.
+*/
+static bool
+zix_btree_zip(ZixBTree* const     t,
+              ZixBTreeNode* const lhs,
+              ZixBTreeNode* const rhs,
+              void** const        sep)
+{
+  // Zip the edge children, which leaves a separator for them if they're split
+  void* old_sep = NULL;
+  if (lhs->is_leaf || zix_btree_zip(t,
+                                    zix_btree_children(lhs)[lhs->n_vals],
+                                    zix_btree_children(rhs)[0],
+                                    &old_sep)) {
+    if (!rhs->n_vals) {
+      zix_btree_pool_release(t->pool, rhs); // Nothing is left in RHS
+      zix_btree_repair(t, lhs);
+      return true;
+    }
+
+    // Use the first value of RHS as the separator, its first child is gone
+    old_sep = zix_btree_aerase(rhs->vals, --rhs->n_vals, 0U);
+    if (!rhs->is_leaf) {
+      zix_btree_aerase(
+        (void**)zix_btree_children(rhs), rhs->n_vals + 1U, 0U);
+    }
+  }
+
+  const bool merged = zix_btree_balance(t, lhs, old_sep, rhs, sep);
+
+  zix_btree_repair(t, lhs);
+  if (!merged) {
+    zix_btree_repair(t, rhs);
+  }
+
+  return merged;
 }
 
+/// Remove any nodes with no values from the top of the tree
 static void
-zix_btree_iter_pop(ZixBTreeIter* const ti)
+zix_btree_shrink(ZixBTree* const t)
 {
-  assert(ti->level > 0U);
-  ti->nodes[ti->level]   = NULL;
-  ti->indexes[ti->level] = 0U;
-  --ti->level;
+  while (!t->root->is_leaf && !t->root->n_vals) {
+    ZixBTreeNode* const root = t->root;
+
+    t->root = zix_btree_child(root, 0U);
+    zix_btree_pool_release(t->pool, root);
+  }
+
+  assert(t->root->refs == 1U);
 }
 
-/// Enlarge left child by stealing a value from its right sibling
-static ZixBTreeNode*
-zix_btree_rotate_left(ZixBTreeNode* const parent, const unsigned i)
+/**
+   Erase a range of values from the subtree rooted at `n`.
+
+   The range starts at the leaf position `lower` and ends before the leaf
+   position `upper`, where a null bound means the start or end of the
+   subtree.  Children entirely within the range are dropped without being
+   visited (except to destroy values), so only the nodes along the two
+   bounding paths are modified.
+*/
+static void
+zix_btree_erase_in(ZixBTree* const       t,
+                   ZixBTreeNode* const   n,
+                   const unsigned        level,
+                   const uint16_t* const lower,
+                   const uint16_t* const upper,
+                   const ZixDestroyFunc  destroy,
+                   const void* const     destroy_user_data)
 {
-  ZixBTreeNode* const lhs = zix_btree_child(parent, i);
-  ZixBTreeNode* const rhs = zix_btree_child(parent, i + 1);
+  const unsigned first = lower ? lower[level] : 0U;
+  const unsigned last  = upper ? upper[level] : n->n_vals;
 
-  assert(lhs->is_leaf == rhs->is_leaf);
+  if (n->is_leaf) {
+    if (destroy) {
+      for (unsigned i = first; i < last; ++i) {
+        destroy(n->vals[i], destroy_user_data);
+      }
+    }
 
-  if (lhs->is_leaf) {
-    // Move parent value to end of LHS
-    lhs->data.leaf.vals[lhs->n_vals++] = parent->data.inode.vals[i];
+    memmove(n->vals + first,
+            n->vals + last,
+            (n->n_vals - last) * sizeof(void*));
 
-    // Move first value in RHS to parent
-    parent->data.inode.vals[i] =
-      zix_btree_aerase(rhs->data.leaf.vals, rhs->n_vals, 0);
-  } else {
-    // Move parent value to end of LHS
-    lhs->data.inode.vals[lhs->n_vals++] = parent->data.inode.vals[i];
+    n->n_vals = (uint16_t)(n->n_vals - (last - first));
+    t->size -= last - first;
+    zix_btree_update_slices(t, n);
+    return;
+  }
 
-    // Move first value in RHS to parent
-    parent->data.inode.vals[i] =
-      zix_btree_aerase(rhs->data.inode.vals, rhs->n_vals, 0);
+  ZixBTreeNode** const children = zix_btree_children(n);
+  if (lower && upper && first == last) {
+    // Both bounds are in the same child
+    zix_btree_erase_in(
+      t, children[first], level + 1U, lower, upper, destroy, destroy_user_data);
 
-    // Move first child pointer from RHS to end of LHS
-    lhs->data.inode.children[lhs->n_vals] = (ZixBTreeNode*)zix_btree_aerase(
-      (void**)rhs->data.inode.children, rhs->n_vals, 0);
+    zix_btree_repair(t, n);
+    return;
   }
 
-  --rhs->n_vals;
+  // Erase from the children that contain the bounds
+  if (lower) {
+    zix_btree_erase_in(
+      t, children[first], level + 1U, lower, NULL, destroy, destroy_user_data);
+  }
 
-  return lhs;
+  if (upper) {
+    zix_btree_erase_in(
+      t, children[last], level + 1U, NULL, upper, destroy, destroy_user_data);
+  }
+
+  // Erase the values and entire children between them
+  const unsigned first_gone = lower ? first + 1U : first;
+  const unsigned last_gone  = upper ? last : last + 1U;
+  for (unsigned i = first_gone; i < last_gone; ++i) {
+    t->size -= zix_btree_destroy_values(
+      children[i], destroy, destroy_user_data);
+    zix_btree_release(t, children[i]);
+  }
+
+  if (destroy) {
+    for (unsigned i = first; i < last; ++i) {
+      destroy(n->vals[i], destroy_user_data);
+    }
+  }
+
+  const unsigned n_children = n->n_vals + 1U;
+
+  t->size -= last - first;
+  memmove(n->vals + first, n->vals + last, (n->n_vals - last) * sizeof(void*));
+  memmove(children + first_gone,
+          children + last_gone,
+          (n_children - last_gone) * sizeof(ZixBTreeNode*));
+
+  n->n_vals = (uint16_t)(n->n_vals - (last - first));
+
+  if (lower && upper) {
+    // The two edge children are now adjacent, zip them together
+    void* sep = NULL;
+    if (zix_btree_zip(t, children[first], children[first + 1U], &sep)) {
+      zix_btree_aerase((void**)children, n->n_vals + 1U, first + 1U);
+    } else {
+      zix_btree_ainsert(n->vals, n->n_vals++, first, sep);
+    }
+  }
+
+  zix_btree_update_slices(t, n);
+  zix_btree_repair(t, n);
 }
 
-/// Enlarge a child by stealing a value from its left sibling
-static ZixBTreeNode*
-zix_btree_rotate_right(ZixBTreeNode* const parent, const unsigned i)
+/// Set `path` to the indexes down to the leaf position of `iter`, return depth
+static unsigned
+zix_btree_leaf_path(const ZixBTreeIter* const iter, uint16_t* const path)
 {
-  ZixBTreeNode* const lhs = zix_btree_child(parent, i - 1);
-  ZixBTreeNode* const rhs = zix_btree_child(parent, i);
+  const ZixBTreeNode* n     = iter->nodes[iter->level];
+  unsigned            level = iter->level;
 
-  assert(lhs->is_leaf == rhs->is_leaf);
+  memcpy(path, iter->indexes, (level + 1U) * sizeof(uint16_t));
+
+  if (!n->is_leaf) {
+    // The position just after the last value in the child before the value
+    n = zix_btree_child(n, path[level]);
+    while (!n->is_leaf) {
+      path[++level] = n->n_vals;
+      n             = zix_btree_child(n, n->n_vals);
+    }
 
-  if (lhs->is_leaf) {
-    // Prepend parent value to RHS
-    zix_btree_ainsert(
-      rhs->data.leaf.vals, rhs->n_vals++, 0, parent->data.inode.vals[i - 1]);
+    path[++level] = n->n_vals;
+  }
 
-    // Move last value from LHS to parent
-    parent->data.inode.vals[i - 1] = lhs->data.leaf.vals[--lhs->n_vals];
-  } else {
-    // Prepend parent value to RHS
-    zix_btree_ainsert(
-      rhs->data.inode.vals, rhs->n_vals++, 0, parent->data.inode.vals[i - 1]);
+  return level;
+}
 
-    // Move last child pointer from LHS and prepend to RHS
-    zix_btree_ainsert((void**)rhs->data.inode.children,
-                      rhs->n_vals,
-                      0,
-                      lhs->data.inode.children[lhs->n_vals]);
+/**
+   Make the nodes that erasing a range may modify exclusive to this tree.
+
+   These are the nodes along both paths, and at every level, the nodes just
+   outside them which may be merged with or steal from underfull path nodes.
+*/
+static ZixStatus
+zix_btree_own_range(const ZixBTree* const t,
+                    const uint16_t* const lower,
+                    const uint16_t* const upper)
+{
+  ZixBTreeNode* lhs_node    = t->root;
+  ZixBTreeNode* rhs_node    = upper ? t->root : NULL;
+  ZixBTreeNode* lhs_outside = NULL;
+  ZixBTreeNode* rhs_outside = NULL;
+
+  for (unsigned level = 0U; !lhs_node->is_leaf; ++level) {
+    // Own the node before the lower path, which may be in another subtree
+    const unsigned      l      = lower[level];
+    ZixBTreeNode* const lhs_up = l ? lhs_node : lhs_outside;
+    if (lhs_up) {
+      const unsigned i = l ? l - 1U : lhs_up->n_vals;
+      if (!(lhs_outside = zix_btree_own_child(t, lhs_up, i))) {
+        return ZIX_STATUS_NO_MEM;
+      }
+    }
+
+    if (!(lhs_node = zix_btree_own_child(t, lhs_node, l))) {
+      return ZIX_STATUS_NO_MEM;
+    }
+
+    if (rhs_node) {
+      // Own the node after the upper path, which may be in another subtree
+      const unsigned      u      = upper[level];
+      const bool          inside = u < rhs_node->n_vals;
+      ZixBTreeNode* const rhs_up = inside ? rhs_node : rhs_outside;
+      if (rhs_up) {
+        const unsigned i = inside ? u + 1U : 0U;
+        if (!(rhs_outside = zix_btree_own_child(t, rhs_up, i))) {
+          return ZIX_STATUS_NO_MEM;
+        }
+      }
+
+      if (!(rhs_node = zix_btree_own_child(t, rhs_node, u))) {
+        return ZIX_STATUS_NO_MEM;
+      }
+    }
+  }
+
+  return ZIX_STATUS_SUCCESS;
+}
+
+/// Return true iff leaf path `a` is before `b` in a tree of the given depth
+static bool
+zix_btree_path_less(const uint16_t* const a,
+                    const uint16_t* const b,
+                    const unsigned        depth)
+{
+  for (unsigned i = 0U; i <= depth; ++i) {
+    if (a[i] != b[i]) {
+      return a[i] < b[i];
+    }
+  }
+
+  return false;
+}
 
-    // Move last value from LHS to parent
-    parent->data.inode.vals[i - 1] = lhs->data.inode.vals[--lhs->n_vals];
+ZixStatus
+zix_btree_erase_range(ZixBTree* const      t,
+                      const ZixBTreeIter   lower,
+                      const ZixBTreeIter   upper,
+                      const ZixDestroyFunc destroy,
+                      const void* const    destroy_user_data)
+{
+  assert(t);
+
+  if (zix_btree_iter_is_end(lower)) {
+    return ZIX_STATUS_SUCCESS;
+  }
+
+  // Find the leaf positions of both ends of the range
+  uint16_t       lower_path[ZIX_BTREE_MAX_HEIGHT] = {0U};
+  uint16_t       upper_path[ZIX_BTREE_MAX_HEIGHT] = {0U};
+  const unsigned depth  = zix_btree_leaf_path(&lower, lower_path);
+  const bool     to_end = zix_btree_iter_is_end(upper);
+  if (!to_end) {
+    zix_btree_leaf_path(&upper, upper_path);
+    if (!zix_btree_path_less(lower_path, upper_path, depth)) {
+      return ZIX_STATUS_SUCCESS; // Empty range
+    }
+  }
+
+  // Copy any shared nodes first, so nothing can fail once the tree changes
+  const uint16_t* const upper_bound = to_end ? NULL : upper_path;
+  const ZixStatus       st = zix_btree_own_range(t, lower_path, upper_bound);
+  if (st) {
+    return st;
+  }
+
+  zix_btree_erase_in(
+    t, t->root, 0U, lower_path, upper_bound, destroy, destroy_user_data);
+
+  zix_btree_shrink(t);
+  return ZIX_STATUS_SUCCESS;
+}
+
+/**
+   Set `path` to the leaf position where `t` would be split at `key`.
+
+   This is the position of the first value that isn't less than `key`.  If
+   that value is in an internal node, then the position is just after the last
+   value in the child before it, so every level of the path is split the same
+   way.  Returns the depth of the leaf.
+*/
+static unsigned
+zix_btree_split_path(const ZixBTree* const t,
+                     const void* const     key,
+                     uint16_t* const       path)
+{
+  const ZixBTreeNode* n     = t->root;
+  unsigned            level = 0U;
+  bool                equal = false;
+
+  for (; !n->is_leaf; n = zix_btree_child(n, path[level++])) {
+    path[level] =
+      (uint16_t)(equal ? n->n_vals : zix_btree_inode_find(t, n, key, &equal));
+  }
+
+  path[level] =
+    (uint16_t)(equal ? n->n_vals : zix_btree_leaf_find(t, n, key, &equal));
+
+  return level;
+}
+
+/**
+   Split the subtree rooted at `n` at the leaf position `path`.
+
+   Everything after the path is moved into the node for this level in
+   `nodes`, which is returned.  Both nodes are then repaired, which may leave
+   them with no values at all, in which case the parent will repair them.
+*/
+static ZixBTreeNode*
+zix_btree_split_in(ZixBTree* const            t,
+                   ZixBTreeNode* const        n,
+                   const unsigned             level,
+                   const uint16_t* const      path,
+                   ZixBTreeNode* const* const nodes)
+{
+  ZixBTreeNode* const rhs = nodes[level];
+  const unsigned      i   = path[level];
+
+  assert(rhs->is_leaf == n->is_leaf);
+
+  rhs->n_vals = (uint16_t)(n->n_vals - i);
+  memcpy(rhs->vals, n->vals + i, rhs->n_vals * sizeof(void*));
+
+  if (!n->is_leaf) {
+    ZixBTreeNode** const children     = zix_btree_children(n);
+    ZixBTreeNode** const rhs_children = zix_btree_children(rhs);
+
+    rhs_children[0] =
+      zix_btree_split_in(t, children[i], level + 1U, path, nodes);
+    memcpy(rhs_children + 1U,
+           children + i + 1U,
+           rhs->n_vals * sizeof(ZixBTreeNode*));
   }
 
+  n->n_vals = (uint16_t)i;
+  zix_btree_update_slices(t, n);
+  zix_btree_update_slices(t, rhs);
+  zix_btree_repair(t, n);
+  zix_btree_repair(t, rhs);
   return rhs;
 }
 
-/// Move n[i] down, merge the left and right child, return the merged node
-static ZixBTreeNode*
-zix_btree_merge(ZixBTree* const t, ZixBTreeNode* const n, const unsigned i)
+ZixStatus
+zix_btree_split(ZixBTree* const        t,
+                const void* const      key,
+                ZixBTree** const       right)
 {
-  ZixBTreeNode* const lhs = zix_btree_child(n, i);
-  ZixBTreeNode* const rhs = zix_btree_child(n, i + 1);
+  assert(t);
+  assert(right);
 
-  assert(lhs->is_leaf == rhs->is_leaf);
-  assert(lhs->n_vals + rhs->n_vals < zix_btree_max_vals(lhs));
+  uint16_t       path[ZIX_BTREE_MAX_HEIGHT] = {0U};
+  const unsigned depth = zix_btree_split_path(t, key, path);
 
-  // Move parent value to end of LHS
-  if (lhs->is_leaf) {
-    lhs->data.leaf.vals[lhs->n_vals++] =
-      zix_btree_aerase(n->data.inode.vals, n->n_vals, i);
-  } else {
-    lhs->data.inode.vals[lhs->n_vals++] =
-      zix_btree_aerase(n->data.inode.vals, n->n_vals, i);
-  }
+  *right = NULL;
 
-  // Erase corresponding child pointer (to RHS) in parent
-  zix_btree_aerase((void**)n->data.inode.children, n->n_vals, i + 1U);
+  // Allocate and copy everything first, so nothing can fail later
+  ZixBTree* const rhs =
+    (ZixBTree*)zix_malloc(t->allocator, sizeof(ZixBTree));
 
-  // Add everything from RHS to end of LHS
-  if (lhs->is_leaf) {
-    memcpy(lhs->data.leaf.vals + lhs->n_vals,
-           rhs->data.leaf.vals,
-           rhs->n_vals * sizeof(void*));
-  } else {
-    memcpy(lhs->data.inode.vals + lhs->n_vals,
-           rhs->data.inode.vals,
-           rhs->n_vals * sizeof(void*));
-    memcpy(lhs->data.inode.children + lhs->n_vals,
-           rhs->data.inode.children,
-           (rhs->n_vals + 1U) * sizeof(void*));
+  if (!rhs) {
+    return ZIX_STATUS_NO_MEM;
   }
 
-  lhs->n_vals = (ZixShort)(lhs->n_vals + rhs->n_vals);
+  ZixBTreeNode* nodes[ZIX_BTREE_MAX_HEIGHT] = {NULL};
+  ZixStatus     st = zix_btree_own_range(t, path, path);
+  for (unsigned level = 0U; !st && level <= depth; ++level) {
+    if (!(nodes[level] = zix_btree_node_new(t, level == depth))) {
+      st = ZIX_STATUS_NO_MEM;
+    }
+  }
 
-  if (--n->n_vals == 0) {
-    // Root is now empty, replace it with its only child
-    assert(n == t->root);
-    t->root = lhs;
-    zix_aligned_free(t->allocator, n);
+  if (st) {
+    for (unsigned level = 0U; level <= depth && nodes[level]; ++level) {
+      zix_btree_pool_release(t->pool, nodes[level]);
+    }
+
+    zix_free(t->allocator, rhs);
+    return st;
   }
 
-  zix_aligned_free(t->allocator, rhs);
-  return lhs;
+  *rhs = *t;
+  if (t->key) {
+    rhs->cmp_data = rhs;
+  }
+
+  rhs->root = zix_btree_split_in(t, t->root, 0U, path, nodes);
+  zix_btree_shrink(t);
+  zix_btree_shrink(rhs);
+
+  // Counting the values would take longer than the split, see zix_btree_count()
+  t->size_known   = false;
+  rhs->size_known = false;
+
+  zix_btree_pool_ref(t->pool);
+  *right = rhs;
+  return ZIX_STATUS_SUCCESS;
 }
 
-/// Remove and return the min value from the subtree rooted at `n`
-static void*
-zix_btree_remove_min(ZixBTree* const t, ZixBTreeNode* n)
+/// Return true iff trees `a` and `b` have compatible nodes and values
+static bool
+zix_btree_is_compatible(const ZixBTree* const a, const ZixBTree* const b)
 {
-  assert(zix_btree_can_remove_from(n));
+  return a->allocator == b->allocator && a->page_size == b->page_size &&
+         a->cmp == b->cmp && a->key == b->key &&
+         (a->key ? a->key_data == b->key_data : a->cmp_data == b->cmp_data);
+}
 
+/// Return the first or last value in the non-empty subtree rooted at `n`
+static void*
+zix_btree_edge_value(const ZixBTreeNode* n, const bool last)
+{
   while (!n->is_leaf) {
-    ZixBTreeNode* const* const children = n->data.inode.children;
+    n = zix_btree_child(n, last ? n->n_vals : 0U);
+  }
+
+  return n->vals[last ? n->n_vals - 1U : 0U];
+}
+
+/**
+   Make the nodes along one edge of the subtree under `n` exclusive.
+
+   This is the first or last child at every level, and the sibling beside it,
+   which may be merged with or steal from it when the edge is zipped.
+*/
+static bool
+zix_btree_own_edge(const ZixBTree* const t, ZixBTreeNode* n, const bool last)
+{
+  while (n && !n->is_leaf) {
+    assert(n->n_vals);
+
+    const unsigned i = last ? n->n_vals : 0U;
+    if (!zix_btree_own_child(t, n, last ? i - 1U : 1U)) {
+      return false;
+    }
 
-    n = zix_btree_can_remove_from(children[0])   ? children[0]
-        : zix_btree_can_remove_from(children[1]) ? zix_btree_rotate_left(n, 0)
-                                                 : zix_btree_merge(t, n, 0);
+    n = zix_btree_own_child(t, n, i);
   }
 
-  return zix_btree_aerase(n->data.leaf.vals, --n->n_vals, 0);
+  return n;
 }
 
-/// Remove and return the max value from the subtree rooted at `n`
-static void*
-zix_btree_remove_max(ZixBTree* const t, ZixBTreeNode* n)
+/**
+   Find the node on one edge of `t` that is `height` levels above the leaves.
+
+   Every node on the way is made exclusive, and split if it's full, so the
+   returned node has room for another child.  Returns null if allocation
+   failed, but the tree is still valid and has the same contents.
+*/
+static ZixBTreeNode*
+zix_btree_open_edge(ZixBTree* const t, const unsigned height, const bool last)
 {
-  assert(zix_btree_can_remove_from(n));
+  if (zix_btree_is_full(t->root) && zix_btree_grow_up(t)) {
+    return NULL;
+  }
 
-  while (!n->is_leaf) {
-    ZixBTreeNode* const* const children = n->data.inode.children;
+  ZixBTreeNode* n = t->root;
+  for (unsigned h = zix_btree_height(t); h > height; --h) {
+    const unsigned i     = last ? n->n_vals : 0U;
+    ZixBTreeNode*  child = zix_btree_own_child(t, n, i);
+    if (!child) {
+      return NULL;
+    }
+
+    if (zix_btree_is_full(child)) {
+      ZixBTreeNode* const rhs = zix_btree_split_child(t, n, i, child);
+      if (!rhs) {
+        return NULL;
+      }
 
-    const unsigned y = n->n_vals - 1U;
-    const unsigned z = n->n_vals;
+      child = last ? rhs : child;
+    }
 
-    n = zix_btree_can_remove_from(children[z])   ? children[z]
-        : zix_btree_can_remove_from(children[y]) ? zix_btree_rotate_right(n, z)
-                                                 : zix_btree_merge(t, n, y);
+    n = child;
   }
 
-  return n->data.leaf.vals[--n->n_vals];
+  return n;
 }
 
-static ZixBTreeNode*
-zix_btree_fatten_child(ZixBTree* const t, ZixBTreeIter* const iter)
+ZixStatus
+zix_btree_join(ZixBTree* const left, ZixBTree* const right)
 {
-  ZixBTreeNode* const n = iter->nodes[iter->level];
-  const ZixShort      i = iter->indexes[iter->level];
+  assert(left);
+  assert(right);
+  assert(left != right);
+  assert(left->root->refs == 1U && right->root->refs == 1U);
+
+  // Check that the trees are compatible and in order
+  if (!zix_btree_is_compatible(left, right) ||
+      (left->root->n_vals && right->root->n_vals &&
+       left->cmp(zix_btree_edge_value(left->root, true),
+                 zix_btree_edge_value(right->root, false),
+                 left->cmp_data) >= 0)) {
+    return ZIX_STATUS_BAD_ARG;
+  }
 
-  assert(n);
-  assert(!n->is_leaf);
-  ZixBTreeNode* const* const children = n->data.inode.children;
+  // Move the pages of the right tree to the pool of the left if necessary
+  if (right->pool != left->pool) {
+    if (right->pool->n_trees > 1U) {
+      return ZIX_STATUS_BAD_ARG;
+    }
 
-  if (i > 0 && zix_btree_can_remove_from(children[i - 1U])) {
-    return zix_btree_rotate_right(n, i); // Steal a key from left sibling
+    if (!zix_btree_pool_absorb(left->pool, right->pool)) {
+      return ZIX_STATUS_NO_MEM;
+    }
+
+    right->pool = left->pool;
+    zix_btree_pool_ref(left->pool);
   }
 
-  if (i < n->n_vals && zix_btree_can_remove_from(children[i + 1U])) {
-    return zix_btree_rotate_left(n, i); // Steal a key from right sibling
+  if (!right->root->n_vals) {
+    zix_btree_free(right, NULL, NULL);
+    return ZIX_STATUS_SUCCESS;
   }
 
-  // Both child's siblings are minimal, merge them
+  if (!left->root->n_vals) {
+    ZixBTreeNode* const root = left->root;
 
-  if (i == n->n_vals) {
-    --iter->indexes[iter->level];
-    return zix_btree_merge(t, n, i - 1U); // Merge last two children
+    left->root       = right->root;
+    left->size       = right->size;
+    left->size_known = right->size_known;
+    right->root      = root;
+    zix_btree_free(right, NULL, NULL);
+    return ZIX_STATUS_SUCCESS;
   }
 
-  return zix_btree_merge(t, n, i); // Merge left and right siblings
-}
+  /* Find where the shorter tree fits on the inside edge of the taller one,
+     and make the nodes that zipping may modify exclusive.  The taller tree
+     may be split or grow up here, but nothing moves between the trees until
+     everything has succeeded. */
+
+  const unsigned        left_height  = zix_btree_height(left);
+  const unsigned        right_height = zix_btree_height(right);
+  const ZixBTree* const taller = left_height < right_height ? right : left;
+  if (zix_btree_height(taller) >= ZIX_BTREE_MAX_HEIGHT &&
+      (left_height == right_height || zix_btree_is_full(taller->root))) {
+    return ZIX_STATUS_OVERFLOW; // Joining would need to grow a full tree
+  }
 
-/// Replace the ith value in `n` with one from a child if possible
-static ZixStatus
-zix_btree_replace_value(ZixBTree* const     t,
-                        ZixBTreeNode* const n,
-                        const unsigned      i,
-                        void** const        out)
-{
-  ZixBTreeNode* const lhs = zix_btree_child(n, i);
-  ZixBTreeNode* const rhs = zix_btree_child(n, i + 1);
-  if (!zix_btree_can_remove_from(lhs) && !zix_btree_can_remove_from(rhs)) {
-    return ZIX_STATUS_NOT_FOUND;
+  ZixBTreeNode* parent   = NULL;
+  ZixBTreeNode* new_root = NULL;
+  ZixBTreeNode* lhs      = left->root;
+  ZixBTreeNode* rhs      = right->root;
+  if (left_height > right_height) {
+    if ((parent = zix_btree_open_edge(left, right_height + 1U, true))) {
+      lhs = zix_btree_own_child(left, parent, parent->n_vals);
+    }
+  } else if (left_height < right_height) {
+    if ((parent = zix_btree_open_edge(right, left_height + 1U, false))) {
+      rhs = zix_btree_own_child(right, parent, 0U);
+    }
+  } else {
+    parent = new_root = zix_btree_node_new(left, false);
   }
 
-  // Stash the value for the caller before it is replaced
-  *out = n->data.inode.vals[i];
+  if (!parent || !lhs || !rhs || !zix_btree_own_edge(left, lhs, true) ||
+      !zix_btree_own_edge(left, rhs, false)) {
+    if (new_root) {
+      zix_btree_pool_release(left->pool, new_root);
+    }
 
-  n->data.inode.vals[i] =
-    // Left child has more values, steal its largest
-    (lhs->n_vals > rhs->n_vals) ? zix_btree_remove_max(t, lhs)
+    zix_btree_shrink(left);
+    zix_btree_shrink(right);
+    return ZIX_STATUS_NO_MEM;
+  }
 
-    // Right child has more values, steal its smallest
-    : (rhs->n_vals > lhs->n_vals) ? zix_btree_remove_min(t, rhs)
+  // Zip the two subtrees together, and add the result to the parent
+  void*      sep    = NULL;
+  const bool merged = zix_btree_zip(left, lhs, rhs, &sep);
 
-    // Children are balanced, use index parity as a low-bias tie breaker
-    : (i & 1U) ? zix_btree_remove_max(t, lhs)
-               : zix_btree_remove_min(t, rhs);
+  ZixBTreeNode** const children = zix_btree_children(parent);
+  if (left_height > right_height) {
+    if (!merged) {
+      parent->vals[parent->n_vals] = sep;
+      children[++parent->n_vals]   = rhs;
+    }
+  } else if (left_height < right_height) {
+    if (merged) {
+      children[0] = lhs;
+    } else {
+      zix_btree_ainsert(parent->vals, parent->n_vals, 0U, sep);
+      zix_btree_ainsert((void**)children, ++parent->n_vals, 0U, lhs);
+    }
 
-  return ZIX_STATUS_SUCCESS;
-}
+    left->root  = right->root;
+    right->root = NULL;
+  } else if (merged) {
+    zix_btree_pool_release(left->pool, new_root);
+  } else {
+    parent->vals[0] = sep;
+    parent->n_vals  = 1U;
+    children[0]     = lhs;
+    children[1]     = rhs;
+    left->root      = new_root;
+  }
 
-ZixStatus
-zix_btree_remove(ZixBTree* const     t,
-                 const void* const   e,
-                 void** const        out,
-                 ZixBTreeIter* const next)
-{
-  assert(t);
-  assert(out);
+  if (!merged) {
+    zix_btree_update_slices(left, parent);
+  }
 
-  ZixBTreeNode* n  = t->root;
-  ZixBTreeIter* ti = next;
-  ZixStatus     st = ZIX_STATUS_SUCCESS;
+  zix_btree_shrink(left);
 
-  *ti = zix_btree_end_iter;
+  left->size += right->size;
+  left->size_known = left->size_known && right->size_known;
+  left->n_splits += right->n_splits;
+  left->n_merges += right->n_merges;
+  left->n_rotations += right->n_rotations;
+  zix_btree_pool_unref(right->pool);
+  zix_free(right->allocator, right);
+  return ZIX_STATUS_SUCCESS;
+}
 
-  /* To remove in a single walk down, the tree is adjusted along the way so
-     that the current node always has at least one more value than the
-     minimum.  This ensures that there is always room to remove, without
-     having to merge nodes again on a traversal back up. */
+/**
+   Search for `e` in the subtree at the current level of `ti`.
 
-  if (!n->is_leaf && n->n_vals == 1U &&
-      !zix_btree_can_remove_from(n->data.inode.children[0U]) &&
-      !zix_btree_can_remove_from(n->data.inode.children[1U])) {
-    // Root has only two children, both minimal, merge them into a new root
-    n = zix_btree_merge(t, n, 0);
-  }
+   If the value isn't found, `ti` is left at the position in a leaf where it
+   would be inserted.
+*/
+static ZixStatus
+zix_btree_find_below(const ZixBTree* const t,
+                     const void* const     e,
+                     ZixBTreeIter* const   ti)
+{
+  ZixBTreeNode* n = ti->nodes[ti->level];
 
   while (!n->is_leaf) {
-    assert(n == t->root || zix_btree_can_remove_from(n));
-
-    // Search for the value in the current node and update the iterator
     bool           equal = false;
     const unsigned i     = zix_btree_inode_find(t, n, e, &equal);
 
     zix_btree_iter_set_frame(ti, n, i);
 
     if (equal) {
-      // Found in internal node
-      if (!(st = zix_btree_replace_value(t, n, i, out))) {
-        // Replaced hole with a value from a direct child
-        --t->size;
-        return st;
-      }
-
-      // Both preceding and succeeding child are minimal, merge and continue
-      n = zix_btree_merge(t, n, i);
-
-    } else {
-      // Not found in internal node, is in the ith child if anywhere
-      n = zix_btree_can_remove_from(zix_btree_child(n, i))
-            ? zix_btree_child(n, i)
-            : zix_btree_fatten_child(t, ti);
+      return ZIX_STATUS_SUCCESS;
     }
 
-    ++ti->level;
+    n = zix_btree_child(n, i);
+    zix_btree_iter_push(ti, n, 0U);
   }
 
-  // We're at the leaf the value may be in, search for the value in it
   bool           equal = false;
   const unsigned i     = zix_btree_leaf_find(t, n, e, &equal);
 
-  if (!equal) { // Not found in tree
-    *ti = zix_btree_end_iter;
-    return ZIX_STATUS_NOT_FOUND;
-  }
+  zix_btree_iter_set_frame(ti, n, i);
+  return equal ? ZIX_STATUS_SUCCESS : ZIX_STATUS_NOT_FOUND;
+}
 
-  // Erase from leaf node
-  *out = zix_btree_aerase(n->data.leaf.vals, --n->n_vals, i);
+/**
+   Move `ti` up to the lowest node on its path whose subtree could contain `e`.
 
-  // Update next iterator
-  if (n->n_vals == 0U) {
-    // Removed the last element in the tree
-    assert(n == t->root);
-    assert(t->size == 1U);
-    *ti = zix_btree_end_iter;
-  } else if (i == n->n_vals) {
-    // Removed the largest element in this leaf, increment to the next
-    zix_btree_iter_set_frame(ti, n, i - 1);
-    zix_btree_iter_increment(ti);
-  } else {
-    zix_btree_iter_set_frame(ti, n, i);
+   The bounds of a subtree are the separators on either side of it in its
+   parent.  A subtree at the start or end of its parent shares that bound with
+   the parent, so it's checked further up, and only as many levels are
+   climbed as necessary to find a subtree that contains `e` on both sides.
+*/
+static void
+zix_btree_climb(const ZixBTree* const t,
+                const void* const     e,
+                ZixBTreeIter* const   ti)
+{
+  unsigned level    = ti->level;
+  bool     lower_ok = false;
+  bool     upper_ok = false;
+
+  for (unsigned l = ti->level; l > 0U && !(lower_ok && upper_ok); --l) {
+    const ZixBTreeNode* const parent = ti->nodes[l - 1U];
+    const unsigned            i      = ti->indexes[l - 1U];
+
+    if (!lower_ok && i > 0U) {
+      lower_ok = t->cmp(parent->vals[i - 1U], e, t->cmp_data) < 0;
+      if (!lower_ok) {
+        level    = l - 1U;
+        upper_ok = false;
+        continue;
+      }
+    }
+
+    if (!upper_ok && i < parent->n_vals) {
+      upper_ok = t->cmp(parent->vals[i], e, t->cmp_data) > 0;
+      if (!upper_ok) {
+        level    = l - 1U;
+        lower_ok = false;
+      }
+    }
   }
 
-  --t->size;
-  return ZIX_STATUS_SUCCESS;
+  while (ti->level > level) {
+    zix_btree_iter_pop(ti);
+  }
 }
 
 ZixStatus
@@ -823,33 +2909,85 @@ zix_btree_find(const ZixBTree* const t,
   assert(t);
   assert(ti);
 
-  ZixBTreeNode* n = t->root;
-
   *ti = zix_btree_end_iter;
+  zix_btree_iter_set_frame(ti, t->root, 0U);
 
-  while (!n->is_leaf) {
-    bool           equal = false;
-    const unsigned i     = zix_btree_inode_find(t, n, e, &equal);
+  const ZixStatus st = zix_btree_find_below(t, e, ti);
+  if (st) {
+    *ti = zix_btree_end_iter;
+  }
 
-    zix_btree_iter_set_frame(ti, n, i);
+  return st;
+}
 
-    if (equal) {
-      return ZIX_STATUS_SUCCESS;
-    }
+ZixStatus
+zix_btree_find_near(const ZixBTree* const t,
+                    const void* const     e,
+                    ZixBTreeIter* const   ti)
+{
+  assert(t);
+  assert(ti);
 
-    ++ti->level;
-    n = zix_btree_child(n, i);
+  if (zix_btree_iter_is_end(*ti)) {
+    return zix_btree_find(t, e, ti);
   }
 
-  bool           equal = false;
-  const unsigned i     = zix_btree_leaf_find(t, n, e, &equal);
-  if (equal) {
-    zix_btree_iter_set_frame(ti, n, i);
+  assert(ti->nodes[0] == t->root);
+
+  ZixBTreeIter iter = *ti;
+  zix_btree_climb(t, e, &iter);
+
+  const ZixStatus st = zix_btree_find_below(t, e, &iter);
+  if (!st) {
+    *ti = iter;
+  }
+
+  return st;
+}
+
+ZixStatus
+zix_btree_insert_near(ZixBTree* const     t,
+                      void* const         e,
+                      ZixBTreeIter* const ti)
+{
+  assert(t);
+  assert(ti);
+
+  ZixBTreeIter iter = *ti;
+  if (zix_btree_iter_is_end(iter)) {
+    zix_btree_iter_set_frame(&iter, t->root, 0U);
+  } else {
+    assert(iter.nodes[0] == t->root);
+    zix_btree_climb(t, e, &iter);
+  }
+
+  ZixStatus st = zix_btree_find_below(t, e, &iter);
+  if (!st) {
+    *ti = iter;
+    return ZIX_STATUS_EXISTS;
+  }
+
+  // Insert directly into the leaf if it has room and isn't shared
+  ZixBTreeNode* const leaf      = iter.nodes[iter.level];
+  bool                exclusive = !zix_btree_is_full(leaf);
+  for (unsigned l = 0U; exclusive && l <= iter.level; ++l) {
+    exclusive = iter.nodes[l]->refs == 1U;
+  }
+
+  if (exclusive) {
+    zix_btree_leaf_insert(t, leaf, iter.indexes[iter.level], e);
+    ++t->size;
+    *ti = iter;
     return ZIX_STATUS_SUCCESS;
   }
 
-  *ti = zix_btree_end_iter;
-  return ZIX_STATUS_NOT_FOUND;
+  // Otherwise, fall back to a normal insertion which may split nodes
+  if ((st = zix_btree_insert(t, e))) {
+    *ti = zix_btree_end_iter;
+    return st;
+  }
+
+  return zix_btree_find(t, e, ti);
 }
 
 ZixStatus
@@ -874,7 +3012,7 @@ zix_btree_lower_bound(const ZixBTree* const t,
 
     const unsigned i = zix_btree_find_pattern(compare_key,
                                               compare_key_user_data,
-                                              n->data.inode.vals,
+                                              n->vals,
                                               n->n_vals,
                                               key,
                                               &equal);
@@ -893,7 +3031,7 @@ zix_btree_lower_bound(const ZixBTree* const t,
 
   const unsigned i = zix_btree_find_pattern(compare_key,
                                             compare_key_user_data,
-                                            n->data.leaf.vals,
+                                            n->vals,
                                             n->n_vals,
                                             key,
                                             &equal);
@@ -925,8 +3063,7 @@ zix_btree_get(const ZixBTreeIter ti)
   assert(node);
   assert(index < node->n_vals);
 
-  return node->is_leaf ? node->data.leaf.vals[index]
-                       : node->data.inode.vals[index];
+  return node->vals[index];
 }
 
 ZixBTreeIter
@@ -936,7 +3073,7 @@ zix_btree_begin(const ZixBTree* const t)
 
   ZixBTreeIter iter = zix_btree_end_iter;
 
-  if (t->size > 0U) {
+  if (t->root->n_vals) {
     ZixBTreeNode* n = t->root;
     zix_btree_iter_set_frame(&iter, n, 0U);
 
@@ -957,6 +3094,97 @@ zix_btree_end(const ZixBTree* const t)
   return zix_btree_end_iter;
 }
 
+/// Return the number of nodes `depth` levels below `n`
+static size_t
+zix_btree_count_nodes(const ZixBTreeNode* const n, const unsigned depth)
+{
+  if (!depth) {
+    return 1U;
+  }
+
+  size_t count = 0U;
+  for (unsigned i = 0U; i < n->n_vals + 1U; ++i) {
+    count += zix_btree_count_nodes(zix_btree_child(n, i), depth - 1U);
+  }
+
+  return count;
+}
+
+/// Set the first bound that starts in subtrees at `depth` below `iter`
+static void
+zix_btree_partition_in(ZixBTreeIter* const iter,
+                       const unsigned      depth,
+                       const size_t        n_nodes,
+                       const size_t        n_parts,
+                       size_t* const       node_index,
+                       size_t* const       part_index,
+                       ZixBTreeIter* const bounds)
+{
+  const ZixBTreeNode* const n = iter->nodes[iter->level];
+
+  if (iter->level == depth) {
+    // Start the next range at this subtree if it's the next cut
+    if (*node_index == *part_index * n_nodes / n_parts) {
+      ZixBTreeIter bound = *iter;
+      while (!bound.nodes[bound.level]->is_leaf) {
+        zix_btree_iter_push(
+          &bound, zix_btree_child(bound.nodes[bound.level], 0U), 0U);
+      }
+
+      bounds[(*part_index)++] = bound;
+    }
+
+    ++*node_index;
+    return;
+  }
+
+  for (unsigned i = 0U; i < n->n_vals + 1U && *part_index < n_parts; ++i) {
+    iter->indexes[iter->level] = (uint16_t)i;
+    zix_btree_iter_push(iter, zix_btree_child(n, i), 0U);
+    zix_btree_partition_in(
+      iter, depth, n_nodes, n_parts, node_index, part_index, bounds);
+    zix_btree_iter_pop(iter);
+  }
+}
+
+size_t
+zix_btree_partition(const ZixBTree* const t,
+                    const size_t          n_parts,
+                    ZixBTreeIter* const   bounds)
+{
+  assert(t);
+  assert(n_parts);
+  assert(bounds);
+
+  // Find the highest level with enough subtrees, or the leaves
+  const unsigned height  = zix_btree_height(t);
+  unsigned       depth   = 0U;
+  size_t         n_nodes = 1U;
+  while (n_nodes < n_parts && depth + 1U < height) {
+    n_nodes = zix_btree_count_nodes(t->root, ++depth);
+  }
+
+  if (!t->root->n_vals || n_nodes == 1U || n_parts == 1U) {
+    bounds[0] = zix_btree_begin(t);
+    bounds[1] = zix_btree_end_iter;
+    return 1U;
+  }
+
+  // Start a range at evenly spaced subtrees on that level
+  const size_t n_ranges   = n_nodes < n_parts ? n_nodes : n_parts;
+  size_t       node_index = 0U;
+  size_t       part_index = 0U;
+  ZixBTreeIter iter       = zix_btree_end_iter;
+
+  zix_btree_iter_set_frame(&iter, t->root, 0U);
+  zix_btree_partition_in(
+    &iter, depth, n_nodes, n_ranges, &node_index, &part_index, bounds);
+
+  assert(part_index == n_ranges);
+  bounds[n_ranges] = zix_btree_end_iter;
+  return n_ranges;
+}
+
 bool
 zix_btree_iter_equals(const ZixBTreeIter lhs, const ZixBTreeIter rhs)
 {
@@ -991,13 +3219,13 @@ zix_btree_iter_increment(ZixBTreeIter* const i)
   } else {
     // Internal node, move down to next child
     const ZixBTreeNode* const node  = i->nodes[i->level];
-    ZixBTreeNode* const       child = node->data.inode.children[index];
+    ZixBTreeNode* const       child = zix_btree_child(node, index);
 
     zix_btree_iter_push(i, child, 0U);
 
     // Move down and left until we hit a leaf
     while (!i->nodes[i->level]->is_leaf) {
-      zix_btree_iter_push(i, i->nodes[i->level]->data.inode.children[0], 0U);
+      zix_btree_iter_push(i, zix_btree_children(i->nodes[i->level])[0], 0U);
     }
   }
 
@@ -0,0 +1,834 @@
+// Copyright 2011-2022 David Robillard <d@drobilla.net>
+// SPDX-License-Identifier: ISC
+
+#include "zix/buffered_btree.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifndef ZIX_BUFFERED_BTREE_PAGE_SIZE
+#  define ZIX_BUFFERED_BTREE_PAGE_SIZE 4096U
+#endif
+
+/// Size of the fields at the start of every node
+#define ZIX_BUFFERED_BTREE_HEADER_SIZE 8U
+
+/// Capacity of a leaf, so keys and values fill the page
+#define ZIX_BUFFERED_BTREE_LEAF_KEYS \
+  ((ZIX_BUFFERED_BTREE_PAGE_SIZE - ZIX_BUFFERED_BTREE_HEADER_SIZE) / 16U)
+
+/// Maximum number of pivots in an internal node
+#define ZIX_BUFFERED_BTREE_INODE_KEYS 15U
+
+/// Number of child slots in an internal node, including one for overflow
+#define ZIX_BUFFERED_BTREE_SLOTS (ZIX_BUFFERED_BTREE_INODE_KEYS + 2U)
+
+/// Capacity of the message buffer for each child, so buffers fill the page
+#define ZIX_BUFFERED_BTREE_BATCH                                     \
+  ((ZIX_BUFFERED_BTREE_PAGE_SIZE - ZIX_BUFFERED_BTREE_HEADER_SIZE - \
+    ((ZIX_BUFFERED_BTREE_SLOTS - 1U) * sizeof(uint64_t)) -         \
+    (ZIX_BUFFERED_BTREE_SLOTS * sizeof(void*)) -                   \
+    ((ZIX_BUFFERED_BTREE_SLOTS + 7U) / 8U * 8U)) /                 \
+   (ZIX_BUFFERED_BTREE_SLOTS * (2U * sizeof(uint64_t) + 1U)))
+
+/// Internal nodes with fewer pivots than this are merged with a sibling
+#define ZIX_BUFFERED_BTREE_INODE_MIN (ZIX_BUFFERED_BTREE_INODE_KEYS / 4U)
+
+/// Leaves with fewer entries than this are merged with a sibling
+#define ZIX_BUFFERED_BTREE_LEAF_MIN (ZIX_BUFFERED_BTREE_LEAF_KEYS / 4U)
+
+/// Maximum number of free nodes kept around for later use
+#define ZIX_BUFFERED_BTREE_MAX_SPARES 32U
+
+typedef struct ZixBufferedBTreeNodeImpl ZixBufferedBTreeNode;
+
+typedef enum {
+  ZIX_BUFFERED_BTREE_INSERT, ///< Insert or replace an entry
+  ZIX_BUFFERED_BTREE_REMOVE, ///< Remove an entry if it exists
+} ZixBufferedBTreeOp;
+
+/*
+  Every node fills one page.  Leaves are sorted arrays of entries.  Internal
+  nodes have pivots like a B+-Tree, where the ith child contains keys from
+  the previous pivot (inclusive) up to the ith one (exclusive), and the rest
+  of the page is split into a small buffer of messages for each child.  The
+  messages in a buffer are unordered, but there is at most one per key.
+
+  Messages are always newer than anything below them, so searches simply
+  stop at the first message for their key.  When the buffer for a child is
+  full, its messages are moved down into the buffers of the child, which
+  only costs a copy and a search of the pivots for each, or applied to a
+  leaf all at once.  If a buffer in the child fills up while doing this, it
+  is recursively flushed first.
+
+  Applying messages to a leaf may split it, or merge it with a sibling if it
+  becomes small.  Splits and merges only change the parent, so they are fixed
+  by the caller on the way back up, and every flush adds at most one pivot to
+  the node it flushes.  This is why internal nodes have room for one more
+  child than they are allowed to keep.  Restructuring never fails: before
+  every flush, the tree reserves enough spare nodes for the worst case, which
+  is one per level plus a new root.
+*/
+
+struct ZixBufferedBTreeNodeImpl {
+  uint16_t is_leaf;  ///< True iff this is a leaf
+  uint16_t n_keys;   ///< Number of entries in a leaf, or pivots in an inode
+  uint32_t reserved; ///< Unused padding, always zero
+
+  union {
+    struct {
+      uint64_t keys[ZIX_BUFFERED_BTREE_LEAF_KEYS];
+      uint64_t values[ZIX_BUFFERED_BTREE_LEAF_KEYS];
+    } leaf;
+
+    struct {
+      uint64_t              pivots[ZIX_BUFFERED_BTREE_SLOTS - 1U];
+      ZixBufferedBTreeNode* children[ZIX_BUFFERED_BTREE_SLOTS];
+      uint8_t               n_msgs[ZIX_BUFFERED_BTREE_SLOTS];
+      uint64_t keys[ZIX_BUFFERED_BTREE_SLOTS][ZIX_BUFFERED_BTREE_BATCH];
+      uint64_t values[ZIX_BUFFERED_BTREE_SLOTS][ZIX_BUFFERED_BTREE_BATCH];
+      uint8_t  ops[ZIX_BUFFERED_BTREE_SLOTS][ZIX_BUFFERED_BTREE_BATCH];
+    } inode;
+  } data;
+};
+
+#if ((defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L) || \
+     (defined(__cplusplus) && __cplusplus >= 201103L))
+static_assert(sizeof(ZixBufferedBTreeNode) <= ZIX_BUFFERED_BTREE_PAGE_SIZE,
+              "");
+
+// A leaf can always absorb a full batch by splitting into two
+static_assert(ZIX_BUFFERED_BTREE_BATCH <= ZIX_BUFFERED_BTREE_LEAF_KEYS, "");
+#endif
+
+struct ZixBufferedBTreeImpl {
+  ZixAllocator*         allocator; ///< Allocator for nodes and this struct
+  ZixBufferedBTreeNode* root;      ///< Root node
+  ZixBufferedBTreeNode* spares;    ///< Free nodes, linked by first child
+  unsigned              n_spares;  ///< Number of free nodes
+  unsigned              height;    ///< Number of levels, including the leaves
+};
+
+/*
+  Utilities
+*/
+
+/// Return the index of the first element of `keys` not less than `key`
+static unsigned
+zix_buffered_btree_lower_bound(const uint64_t* const keys,
+                               const unsigned        n,
+                               const uint64_t        key)
+{
+  unsigned first = 0U;
+  unsigned count = n;
+
+  while (count > 0U) {
+    const unsigned half = count >> 1U;
+    if (keys[first + half] < key) {
+      first += half + 1U;
+      count -= half + 1U;
+    } else {
+      count = half;
+    }
+  }
+
+  return first;
+}
+
+/// Return the index of the child of an internal node that may contain `key`
+static unsigned
+zix_buffered_btree_child_index(const ZixBufferedBTreeNode* const n,
+                               const uint64_t                    key)
+{
+  const uint64_t* const pivots = n->data.inode.pivots;
+  const unsigned        i =
+    zix_buffered_btree_lower_bound(pivots, n->n_keys, key);
+
+  return (i < n->n_keys && pivots[i] == key) ? i + 1U : i;
+}
+
+/// Return the index of the message for `key` in buffer `i`, or its size
+static unsigned
+zix_buffered_btree_msg_index(const ZixBufferedBTreeNode* const n,
+                             const unsigned                    i,
+                             const uint64_t                    key)
+{
+  const uint64_t* const keys   = n->data.inode.keys[i];
+  const unsigned        n_msgs = n->data.inode.n_msgs[i];
+
+  unsigned j = 0U;
+  while (j < n_msgs && keys[j] != key) {
+    ++j;
+  }
+
+  return j;
+}
+
+/// Move `count` child slots (children and their buffers) from `src` to `dst`
+static void
+zix_buffered_btree_move_slots(ZixBufferedBTreeNode* const dst,
+                              const unsigned              dst_index,
+                              ZixBufferedBTreeNode* const src,
+                              const unsigned              src_index,
+                              const unsigned              count)
+{
+  memmove(dst->data.inode.children + dst_index,
+          src->data.inode.children + src_index,
+          count * sizeof(ZixBufferedBTreeNode*));
+  memmove(dst->data.inode.n_msgs + dst_index,
+          src->data.inode.n_msgs + src_index,
+          count);
+  memmove(dst->data.inode.keys + dst_index,
+          src->data.inode.keys + src_index,
+          count * sizeof(src->data.inode.keys[0]));
+  memmove(dst->data.inode.values + dst_index,
+          src->data.inode.values + src_index,
+          count * sizeof(src->data.inode.values[0]));
+  memmove(dst->data.inode.ops + dst_index,
+          src->data.inode.ops + src_index,
+          count * sizeof(src->data.inode.ops[0]));
+}
+
+/// Insert a pivot into `n` at `i`, with `right` as the child after it
+static void
+zix_buffered_btree_insert_pivot(ZixBufferedBTreeNode* const n,
+                                const unsigned              i,
+                                const uint64_t              pivot,
+                                ZixBufferedBTreeNode* const right)
+{
+  uint64_t* const pivots = n->data.inode.pivots;
+
+  assert(n->n_keys <= ZIX_BUFFERED_BTREE_INODE_KEYS);
+  memmove(pivots + i + 1U, pivots + i, (n->n_keys - i) * sizeof(uint64_t));
+  zix_buffered_btree_move_slots(n, i + 2U, n, i + 1U, n->n_keys - i);
+
+  pivots[i]                      = pivot;
+  n->data.inode.children[i + 1U] = right;
+  n->data.inode.n_msgs[i + 1U]   = 0U;
+  ++n->n_keys;
+}
+
+/// Remove the pivot at `i` from `n`, along with the child slot after it
+static void
+zix_buffered_btree_erase_pivot(ZixBufferedBTreeNode* const n,
+                               const unsigned              i)
+{
+  uint64_t* const pivots = n->data.inode.pivots;
+
+  --n->n_keys;
+  memmove(pivots + i, pivots + i + 1U, (n->n_keys - i) * sizeof(uint64_t));
+  zix_buffered_btree_move_slots(n, i + 1U, n, i + 2U, n->n_keys - i);
+}
+
+/// Set message `j` in buffer `i` of `n`, which may be a new one at the end
+static void
+zix_buffered_btree_set_msg(ZixBufferedBTreeNode* const n,
+                           const unsigned              i,
+                           const unsigned              j,
+                           const uint64_t              key,
+                           const uint64_t              value,
+                           const uint8_t               op)
+{
+  assert(j < ZIX_BUFFERED_BTREE_BATCH);
+
+  n->data.inode.keys[i][j]   = key;
+  n->data.inode.values[i][j] = value;
+  n->data.inode.ops[i][j]    = op;
+  if (j == n->data.inode.n_msgs[i]) {
+    ++n->data.inode.n_msgs[i];
+  }
+}
+
+/// Remove message `j` from buffer `i` of `n` by replacing it with the last
+static void
+zix_buffered_btree_erase_msg(ZixBufferedBTreeNode* const n,
+                             const unsigned              i,
+                             const unsigned              j)
+{
+  const unsigned last = --n->data.inode.n_msgs[i];
+
+  n->data.inode.keys[i][j]   = n->data.inode.keys[i][last];
+  n->data.inode.values[i][j] = n->data.inode.values[i][last];
+  n->data.inode.ops[i][j]    = n->data.inode.ops[i][last];
+}
+
+/// Append the messages in buffer `src` of `n` to buffer `dst`
+static void
+zix_buffered_btree_append_msgs(ZixBufferedBTreeNode* const n,
+                               const unsigned              dst,
+                               const unsigned              src)
+{
+  const unsigned offset = n->data.inode.n_msgs[dst];
+  const unsigned count  = n->data.inode.n_msgs[src];
+
+  assert(offset + count <= ZIX_BUFFERED_BTREE_BATCH);
+  memcpy(n->data.inode.keys[dst] + offset,
+         n->data.inode.keys[src],
+         count * sizeof(uint64_t));
+  memcpy(n->data.inode.values[dst] + offset,
+         n->data.inode.values[src],
+         count * sizeof(uint64_t));
+  memcpy(n->data.inode.ops[dst] + offset, n->data.inode.ops[src], count);
+
+  n->data.inode.n_msgs[dst] = (uint8_t)(offset + count);
+}
+
+/*
+  Node allocation
+*/
+
+/// Allocate spare nodes so that restructuring one path can't fail
+static ZixStatus
+zix_buffered_btree_reserve(ZixBufferedBTree* const t)
+{
+  while (t->n_spares < t->height + 2U) {
+    ZixBufferedBTreeNode* const node =
+      (ZixBufferedBTreeNode*)zix_aligned_alloc(t->allocator,
+                                               ZIX_BUFFERED_BTREE_PAGE_SIZE,
+                                               ZIX_BUFFERED_BTREE_PAGE_SIZE);
+
+    if (!node) {
+      return ZIX_STATUS_NO_MEM;
+    }
+
+    node->data.inode.children[0] = t->spares;
+    t->spares                    = node;
+    ++t->n_spares;
+  }
+
+  return ZIX_STATUS_SUCCESS;
+}
+
+/// Take a new empty node from the reserved spares
+static ZixBufferedBTreeNode*
+zix_buffered_btree_take_node(ZixBufferedBTree* const t, const bool leaf)
+{
+  ZixBufferedBTreeNode* const node = t->spares;
+
+  assert(node);
+  t->spares = node->data.inode.children[0];
+  --t->n_spares;
+
+  node->is_leaf  = leaf;
+  node->n_keys   = 0U;
+  node->reserved = 0U;
+  if (!leaf) {
+    node->data.inode.n_msgs[0] = 0U;
+  }
+
+  return node;
+}
+
+/// Return a node that is no longer in the tree to the spares
+static void
+zix_buffered_btree_give_node(ZixBufferedBTree* const     t,
+                             ZixBufferedBTreeNode* const node)
+{
+  if (t->n_spares < ZIX_BUFFERED_BTREE_MAX_SPARES) {
+    node->data.inode.children[0] = t->spares;
+    t->spares                    = node;
+    ++t->n_spares;
+  } else {
+    zix_aligned_free(t->allocator, node);
+  }
+}
+
+static void
+zix_buffered_btree_free_rec(ZixAllocator* const         allocator,
+                            ZixBufferedBTreeNode* const n)
+{
+  if (!n->is_leaf) {
+    for (unsigned i = 0U; i <= n->n_keys; ++i) {
+      zix_buffered_btree_free_rec(allocator, n->data.inode.children[i]);
+    }
+  }
+
+  zix_aligned_free(allocator, n);
+}
+
+ZixBufferedBTree*
+zix_buffered_btree_new(ZixAllocator* const allocator)
+{
+  ZixBufferedBTree* const t =
+    (ZixBufferedBTree*)zix_malloc(allocator, sizeof(ZixBufferedBTree));
+
+  if (t) {
+    t->allocator = allocator;
+    t->root      = NULL;
+    t->spares    = NULL;
+    t->n_spares  = 0U;
+    t->height    = 0U;
+
+    if (zix_buffered_btree_reserve(t)) {
+      zix_buffered_btree_free(t);
+      return NULL;
+    }
+
+    t->root   = zix_buffered_btree_take_node(t, true);
+    t->height = 1U;
+  }
+
+  return t;
+}
+
+void
+zix_buffered_btree_free(ZixBufferedBTree* const t)
+{
+  if (t) {
+    if (t->root) {
+      zix_buffered_btree_free_rec(t->allocator, t->root);
+    }
+
+    while (t->spares) {
+      ZixBufferedBTreeNode* const next = t->spares->data.inode.children[0];
+      zix_aligned_free(t->allocator, t->spares);
+      t->spares = next;
+    }
+
+    zix_free(t->allocator, t);
+  }
+}
+
+/*
+  Restructuring
+*/
+
+/**
+   Merge the leaf at `i` in `n` with a sibling if it is small enough.
+
+   Like internal nodes, leaves are only merged if the combined buffer in the
+   parent has room for another message, so flushing always makes room.
+*/
+static void
+zix_buffered_btree_merge_leaf(ZixBufferedBTree* const     t,
+                              ZixBufferedBTreeNode* const n,
+                              const unsigned              i)
+{
+  const unsigned              l     = (i < n->n_keys) ? i : i - 1U;
+  ZixBufferedBTreeNode* const left  = n->data.inode.children[l];
+  ZixBufferedBTreeNode* const right = n->data.inode.children[l + 1U];
+  const unsigned              count = right->n_keys;
+
+  if (left->n_keys + count <= ZIX_BUFFERED_BTREE_LEAF_KEYS &&
+      n->data.inode.n_msgs[l] + n->data.inode.n_msgs[l + 1U] <
+        ZIX_BUFFERED_BTREE_BATCH) {
+    memcpy(left->data.leaf.keys + left->n_keys,
+           right->data.leaf.keys,
+           count * sizeof(uint64_t));
+    memcpy(left->data.leaf.values + left->n_keys,
+           right->data.leaf.values,
+           count * sizeof(uint64_t));
+
+    left->n_keys = (uint16_t)(left->n_keys + count);
+    zix_buffered_btree_append_msgs(n, l, l + 1U);
+    zix_buffered_btree_erase_pivot(n, l);
+    zix_buffered_btree_give_node(t, right);
+  }
+}
+
+/// Split an overfull internal child at `i` in `n`, or merge it if small
+static void
+zix_buffered_btree_fix_child(ZixBufferedBTree* const     t,
+                             ZixBufferedBTreeNode* const n,
+                             const unsigned              i)
+{
+  ZixBufferedBTreeNode* const child = n->data.inode.children[i];
+
+  assert(!child->is_leaf);
+  if (child->n_keys > ZIX_BUFFERED_BTREE_INODE_KEYS) {
+    // Move the upper half of the pivots and children to a new right sibling
+    ZixBufferedBTreeNode* const right = zix_buffered_btree_take_node(t, false);
+    const unsigned              mid   = child->n_keys / 2U;
+    const uint64_t              sep   = child->data.inode.pivots[mid];
+
+    right->n_keys = (uint16_t)(child->n_keys - mid - 1U);
+    memcpy(right->data.inode.pivots,
+           child->data.inode.pivots + mid + 1U,
+           right->n_keys * sizeof(uint64_t));
+    zix_buffered_btree_move_slots(
+      right, 0U, child, mid + 1U, right->n_keys + 1U);
+
+    child->n_keys = (uint16_t)mid;
+
+    // Move the messages in the parent for the right half to a new buffer
+    zix_buffered_btree_insert_pivot(n, i, sep, right);
+    for (unsigned j = 0U; j < n->data.inode.n_msgs[i];) {
+      if (n->data.inode.keys[i][j] >= sep) {
+        zix_buffered_btree_set_msg(n,
+                                   i + 1U,
+                                   n->data.inode.n_msgs[i + 1U],
+                                   n->data.inode.keys[i][j],
+                                   n->data.inode.values[i][j],
+                                   n->data.inode.ops[i][j]);
+        zix_buffered_btree_erase_msg(n, i, j);
+      } else {
+        ++j;
+      }
+    }
+
+  } else if (child->n_keys < ZIX_BUFFERED_BTREE_INODE_MIN && n->n_keys) {
+    const unsigned              l     = (i < n->n_keys) ? i : i - 1U;
+    ZixBufferedBTreeNode* const left  = n->data.inode.children[l];
+    ZixBufferedBTreeNode* const right = n->data.inode.children[l + 1U];
+
+    // Merge with a sibling if everything fits, leaving room in the buffer
+    if (left->n_keys + right->n_keys < ZIX_BUFFERED_BTREE_INODE_KEYS &&
+        n->data.inode.n_msgs[l] + n->data.inode.n_msgs[l + 1U] <
+          ZIX_BUFFERED_BTREE_BATCH) {
+      left->data.inode.pivots[left->n_keys] = n->data.inode.pivots[l];
+      memcpy(left->data.inode.pivots + left->n_keys + 1U,
+             right->data.inode.pivots,
+             right->n_keys * sizeof(uint64_t));
+      zix_buffered_btree_move_slots(
+        left, left->n_keys + 1U, right, 0U, right->n_keys + 1U);
+
+      left->n_keys = (uint16_t)(left->n_keys + 1U + right->n_keys);
+      zix_buffered_btree_append_msgs(n, l, l + 1U);
+      zix_buffered_btree_erase_pivot(n, l);
+      zix_buffered_btree_give_node(t, right);
+    }
+  }
+}
+
+/// Grow the tree if the root is overfull, or shrink it if it is empty
+static void
+zix_buffered_btree_fix_root(ZixBufferedBTree* const t)
+{
+  for (ZixBufferedBTreeNode* root = t->root; !root->is_leaf; root = t->root) {
+    if (root->n_keys > ZIX_BUFFERED_BTREE_INODE_KEYS) {
+      ZixBufferedBTreeNode* const new_root =
+        zix_buffered_btree_take_node(t, false);
+
+      new_root->data.inode.children[0] = root;
+      t->root                          = new_root;
+      ++t->height;
+      zix_buffered_btree_fix_child(t, new_root, 0U);
+    } else if (!root->n_keys && !root->data.inode.n_msgs[0]) {
+      t->root = root->data.inode.children[0];
+      --t->height;
+      zix_buffered_btree_give_node(t, root);
+    } else {
+      break;
+    }
+  }
+}
+
+/*
+  Flushing
+*/
+
+/// Apply all the messages in buffer `i` of `n` to its leaf child
+static void
+zix_buffered_btree_flush_to_leaf(ZixBufferedBTree* const     t,
+                                 ZixBufferedBTreeNode* const n,
+                                 const unsigned              i)
+{
+  enum { max_keys = ZIX_BUFFERED_BTREE_LEAF_KEYS + ZIX_BUFFERED_BTREE_BATCH };
+
+  ZixBufferedBTreeNode* const leaf   = n->data.inode.children[i];
+  const unsigned              n_msgs = n->data.inode.n_msgs[i];
+
+  // Sort the messages by key (there are few, so insertion sort is best)
+  uint64_t mkeys[ZIX_BUFFERED_BTREE_BATCH];
+  unsigned order[ZIX_BUFFERED_BTREE_BATCH];
+  for (unsigned j = 0U; j < n_msgs; ++j) {
+    const uint64_t key = n->data.inode.keys[i][j];
+    unsigned       k   = j;
+    for (; k > 0U && mkeys[k - 1U] > key; --k) {
+      mkeys[k] = mkeys[k - 1U];
+      order[k] = order[k - 1U];
+    }
+
+    mkeys[k] = key;
+    order[k] = j;
+  }
+
+  // Merge the messages with the entries in the leaf
+  const uint64_t* const lkeys = leaf->data.leaf.keys;
+  uint64_t              keys[max_keys];
+  uint64_t              values[max_keys];
+  unsigned              a = 0U;
+  unsigned              b = 0U;
+  unsigned              c = 0U;
+  while (a < leaf->n_keys || b < n_msgs) {
+    if (b == n_msgs || (a < leaf->n_keys && lkeys[a] < mkeys[b])) {
+      keys[c]     = lkeys[a];
+      values[c++] = leaf->data.leaf.values[a++];
+    } else {
+      if (a < leaf->n_keys && lkeys[a] == mkeys[b]) {
+        ++a; // Replaced or removed by the message
+      }
+
+      if (n->data.inode.ops[i][order[b]] == ZIX_BUFFERED_BTREE_INSERT) {
+        keys[c]     = mkeys[b];
+        values[c++] = n->data.inode.values[i][order[b]];
+      }
+
+      ++b;
+    }
+  }
+
+  n->data.inode.n_msgs[i] = 0U;
+
+  // Split the results between this leaf and a new right sibling if necessary
+  unsigned n_left = c;
+  if (c > ZIX_BUFFERED_BTREE_LEAF_KEYS) {
+    ZixBufferedBTreeNode* const right = zix_buffered_btree_take_node(t, true);
+
+    n_left        = c / 2U;
+    right->n_keys = (uint16_t)(c - n_left);
+    memcpy(right->data.leaf.keys,
+           keys + n_left,
+           right->n_keys * sizeof(uint64_t));
+    memcpy(right->data.leaf.values,
+           values + n_left,
+           right->n_keys * sizeof(uint64_t));
+
+    zix_buffered_btree_insert_pivot(n, i, keys[n_left], right);
+  }
+
+  memcpy(leaf->data.leaf.keys, keys, n_left * sizeof(uint64_t));
+  memcpy(leaf->data.leaf.values, values, n_left * sizeof(uint64_t));
+  leaf->n_keys = (uint16_t)n_left;
+
+  if (n_left < ZIX_BUFFERED_BTREE_LEAF_MIN && n->n_keys) {
+    zix_buffered_btree_merge_leaf(t, n, i);
+  }
+}
+
+/**
+   Move messages from buffer `i` of `n` down to its child.
+
+   This always moves at least one message, and adds at most one pivot to `n`,
+   which the caller must fix if it is now overfull.  Messages are moved until
+   the buffer is empty, or a buffer in the child fills up and must be flushed
+   first, in which case this stops after making room for one more.
+*/
+static void
+zix_buffered_btree_flush_node(ZixBufferedBTree* const     t,
+                              ZixBufferedBTreeNode* const n,
+                              unsigned                    i)
+{
+  assert(!n->is_leaf);
+  assert(n->data.inode.n_msgs[i]);
+
+  ZixBufferedBTreeNode* child = n->data.inode.children[i];
+  if (child->is_leaf) {
+    zix_buffered_btree_flush_to_leaf(t, n, i);
+    return;
+  }
+
+  for (unsigned j = n->data.inode.n_msgs[i]; j-- > 0U;) {
+    const uint64_t key  = n->data.inode.keys[i][j];
+    unsigned       g    = zix_buffered_btree_child_index(child, key);
+    unsigned       k    = zix_buffered_btree_msg_index(child, g, key);
+    const bool     full = k == ZIX_BUFFERED_BTREE_BATCH;
+
+    if (full) {
+      // Flush the full buffer in the child, then find everything again
+      zix_buffered_btree_flush_node(t, child, g);
+      zix_buffered_btree_fix_child(t, n, i);
+
+      i     = zix_buffered_btree_child_index(n, key);
+      j     = zix_buffered_btree_msg_index(n, i, key);
+      child = n->data.inode.children[i];
+      g     = zix_buffered_btree_child_index(child, key);
+      k     = zix_buffered_btree_msg_index(child, g, key);
+    }
+
+    zix_buffered_btree_set_msg(child,
+                               g,
+                               k,
+                               key,
+                               n->data.inode.values[i][j],
+                               n->data.inode.ops[i][j]);
+
+    zix_buffered_btree_erase_msg(n, i, j);
+    if (full) {
+      break;
+    }
+  }
+}
+
+/// Flush one batch from the first non-empty buffer with keys after `from`
+static bool
+zix_buffered_btree_flush_any(ZixBufferedBTree* const     t,
+                             ZixBufferedBTreeNode* const n,
+                             uint64_t* const             from)
+{
+  if (n->is_leaf) {
+    return false;
+  }
+
+  for (unsigned i = 0U; i <= n->n_keys; ++i) {
+    if (n->data.inode.n_msgs[i]) {
+      zix_buffered_btree_flush_node(t, n, i);
+      return true;
+    }
+  }
+
+  // Buffers above are empty, so nothing before `from` can be refilled
+  for (unsigned i = zix_buffered_btree_child_index(n, *from); i <= n->n_keys;
+       ++i) {
+    if (zix_buffered_btree_flush_any(t, n->data.inode.children[i], from)) {
+      zix_buffered_btree_fix_child(t, n, i);
+      return true;
+    }
+
+    if (i < n->n_keys) {
+      *from = n->data.inode.pivots[i];
+    }
+  }
+
+  return false;
+}
+
+ZixStatus
+zix_buffered_btree_flush(ZixBufferedBTree* const t)
+{
+  ZixStatus st   = ZIX_STATUS_SUCCESS;
+  uint64_t  from = 0U;
+
+  while (!(st = zix_buffered_btree_reserve(t)) &&
+         zix_buffered_btree_flush_any(t, t->root, &from)) {
+    zix_buffered_btree_fix_root(t);
+  }
+
+  return st;
+}
+
+/*
+  Modification
+*/
+
+/// Add a message to the tree, applying it directly if the root is a leaf
+static ZixStatus
+zix_buffered_btree_put(ZixBufferedBTree* const  t,
+                       const uint64_t           key,
+                       const uint64_t           value,
+                       const ZixBufferedBTreeOp op)
+{
+  for (;;) {
+    ZixBufferedBTreeNode* const root = t->root;
+
+    if (root->is_leaf) {
+      uint64_t* const keys   = root->data.leaf.keys;
+      uint64_t* const values = root->data.leaf.values;
+      const unsigned  n      = root->n_keys;
+      const unsigned  i = zix_buffered_btree_lower_bound(keys, n, key);
+
+      if (i < n && keys[i] == key) {
+        if (op == ZIX_BUFFERED_BTREE_INSERT) {
+          values[i] = value;
+        } else {
+          memmove(keys + i, keys + i + 1U, (n - i - 1U) * sizeof(uint64_t));
+          memmove(
+            values + i, values + i + 1U, (n - i - 1U) * sizeof(uint64_t));
+          --root->n_keys;
+        }
+
+        return ZIX_STATUS_SUCCESS;
+      }
+
+      if (op == ZIX_BUFFERED_BTREE_REMOVE) {
+        return ZIX_STATUS_SUCCESS;
+      }
+
+      if (n < ZIX_BUFFERED_BTREE_LEAF_KEYS) {
+        memmove(keys + i + 1U, keys + i, (n - i) * sizeof(uint64_t));
+        memmove(values + i + 1U, values + i, (n - i) * sizeof(uint64_t));
+        keys[i]   = key;
+        values[i] = value;
+        ++root->n_keys;
+        return ZIX_STATUS_SUCCESS;
+      }
+
+      // Full root leaf, grow a new root to buffer messages for it
+      if (zix_buffered_btree_reserve(t)) {
+        return ZIX_STATUS_NO_MEM;
+      }
+
+      t->root = zix_buffered_btree_take_node(t, false);
+      t->root->data.inode.children[0] = root;
+      ++t->height;
+      continue;
+    }
+
+    const unsigned i = zix_buffered_btree_child_index(root, key);
+    const unsigned j = zix_buffered_btree_msg_index(root, i, key);
+    if (j < ZIX_BUFFERED_BTREE_BATCH) {
+      zix_buffered_btree_set_msg(root, i, j, key, value, (uint8_t)op);
+      return ZIX_STATUS_SUCCESS;
+    }
+
+    // Full root buffer, flush it down and try again
+    if (zix_buffered_btree_reserve(t)) {
+      return ZIX_STATUS_NO_MEM;
+    }
+
+    zix_buffered_btree_flush_node(t, root, i);
+    zix_buffered_btree_fix_root(t);
+  }
+}
+
+ZixStatus
+zix_buffered_btree_insert(ZixBufferedBTree* const t,
+                          const uint64_t          key,
+                          const uint64_t          value)
+{
+  return zix_buffered_btree_put(t, key, value, ZIX_BUFFERED_BTREE_INSERT);
+}
+
+ZixStatus
+zix_buffered_btree_remove(ZixBufferedBTree* const t, const uint64_t key)
+{
+  return zix_buffered_btree_put(t, key, 0U, ZIX_BUFFERED_BTREE_REMOVE);
+}
+
+/*
+  Searching
+*/
+
+ZixStatus
+zix_buffered_btree_find(const ZixBufferedBTree* const t,
+                        const uint64_t                key,
+                        uint64_t* const               value)
+{
+  const ZixBufferedBTreeNode* n = t->root;
+
+  // Stop at the first (newest) message for this key on the way down
+  while (!n->is_leaf) {
+    const unsigned i = zix_buffered_btree_child_index(n, key);
+    const unsigned j = zix_buffered_btree_msg_index(n, i, key);
+
+    if (j < n->data.inode.n_msgs[i]) {
+      if (n->data.inode.ops[i][j] == ZIX_BUFFERED_BTREE_REMOVE) {
+        return ZIX_STATUS_NOT_FOUND;
+      }
+
+      if (value) {
+        *value = n->data.inode.values[i][j];
+      }
+
+      return ZIX_STATUS_SUCCESS;
+    }
+
+    n = n->data.inode.children[i];
+  }
+
+  const unsigned i =
+    zix_buffered_btree_lower_bound(n->data.leaf.keys, n->n_keys, key);
+
+  if (i < n->n_keys && n->data.leaf.keys[i] == key) {
+    if (value) {
+      *value = n->data.leaf.values[i];
+    }
+
+    return ZIX_STATUS_SUCCESS;
+  }
+
+  return ZIX_STATUS_NOT_FOUND;
+}
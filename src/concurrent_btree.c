@@ -0,0 +1,1166 @@
+// Copyright 2011-2022 David Robillard <d@drobilla.net>
+// SPDX-License-Identifier: ISC
+
+#include "zix/concurrent_btree.h"
+
+#include "zix_atomic.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#if !ZIX_ATOMIC_RMW
+#  error "ZixConcurrentBTree requires atomic read-modify-write operations"
+#endif
+
+#ifndef ZIX_CONCURRENT_BTREE_PAGE_SIZE
+#  define ZIX_CONCURRENT_BTREE_PAGE_SIZE 4096U
+#endif
+
+#define ZIX_CONCURRENT_BTREE_NODE_SPACE \
+  (ZIX_CONCURRENT_BTREE_PAGE_SIZE - 4U * sizeof(void*))
+
+#define ZIX_CONCURRENT_BTREE_LEAF_VALS \
+  ((ZIX_CONCURRENT_BTREE_NODE_SPACE / sizeof(void*)) - 1U)
+
+#define ZIX_CONCURRENT_BTREE_INODE_VALS (ZIX_CONCURRENT_BTREE_LEAF_VALS / 2U)
+
+/// Size of a cache line, used to keep writer-only fields away from readers
+#define ZIX_CONCURRENT_BTREE_CACHE_LINE 64U
+
+/// Version bit set when a node has been removed from the tree
+#define ZIX_VERSION_OBSOLETE 1U
+
+/// Version bit set while a node is locked (also the version increment)
+#define ZIX_VERSION_LOCKED 2U
+
+typedef struct ZixConcurrentBTreeNodeImpl ZixConcurrentBTreeNode;
+
+/*
+  Synchronization works like a sequence lock for every node.  A writer sets
+  the lock bit in the version before modifying a node, and increments the
+  version when it unlocks it.  Readers load the version, read whatever they
+  need, then check that the version hasn't changed, and restart from the root
+  if it has.  When moving from a node to a child, the parent is validated
+  after the child's version is read, so readers are never left in a subtree
+  that no longer covers their key.
+
+  Since readers may see a node mid-modification, all node fields that change
+  are accessed atomically (with relaxed ordering, the version does the rest),
+  and readers check that they got something sane before using it.
+
+  Insertion splits full nodes on the way down like ZixBTree, which only needs
+  a parent and child locked at once.  Writers never wait for a lock while
+  holding one: if a lock can't be taken, everything is released and the
+  operation restarts.
+
+  Removal also works like ZixBTree, fattening minimal nodes on the way down.
+  It descends optimistically to the highest node that needs to change, then
+  continues with lock coupling from there.  Removal only ever waits for locks
+  below the ones it holds, and insertion never waits while holding a lock, so
+  this can not deadlock.
+*/
+
+struct ZixConcurrentBTreeNodeImpl {
+  uintptr_t               version; ///< Modification counter and lock bits
+  uintptr_t               n_vals;  ///< Number of values
+  ZixConcurrentBTreeNode* retired; ///< Next node in retired list
+  bool                    is_leaf; ///< True iff this is a leaf (constant)
+
+  union {
+    struct {
+      void* vals[ZIX_CONCURRENT_BTREE_LEAF_VALS];
+    } leaf;
+
+    struct {
+      void*                   vals[ZIX_CONCURRENT_BTREE_INODE_VALS];
+      ZixConcurrentBTreeNode* children[ZIX_CONCURRENT_BTREE_INODE_VALS + 1U];
+    } inode;
+  } data;
+};
+
+struct ZixConcurrentBTreeImpl {
+  // Read by everything, written only when the root changes
+  ZixAllocator*           allocator;
+  ZixComparator           cmp;
+  const void*             cmp_data;
+  ZixConcurrentBTreeNode* root;
+
+  // Written by every modification
+  char padding[ZIX_CONCURRENT_BTREE_CACHE_LINE - 4U * sizeof(void*)];
+  uintptr_t               size;
+  ZixConcurrentBTreeNode* retired;
+};
+
+#if ((defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L) || \
+     (defined(__cplusplus) && __cplusplus >= 201103L))
+static_assert(sizeof(ZixConcurrentBTreeNode) <= ZIX_CONCURRENT_BTREE_PAGE_SIZE,
+              "");
+#endif
+
+/*
+  Node access
+*/
+
+static ZixConcurrentBTreeNode*
+zix_concurrent_btree_node_new(ZixAllocator* const allocator, const bool leaf)
+{
+#if !((defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L) || \
+      (defined(__cplusplus) && __cplusplus >= 201103L))
+  assert(sizeof(ZixConcurrentBTreeNode) <= ZIX_CONCURRENT_BTREE_PAGE_SIZE);
+#endif
+
+  ZixConcurrentBTreeNode* const node =
+    (ZixConcurrentBTreeNode*)zix_aligned_alloc(allocator,
+                                               ZIX_CONCURRENT_BTREE_PAGE_SIZE,
+                                               ZIX_CONCURRENT_BTREE_PAGE_SIZE);
+
+  if (node) {
+    // Readers may see unused slots, so they must never contain garbage
+    memset(node, 0, sizeof(ZixConcurrentBTreeNode));
+    node->is_leaf = leaf;
+  }
+
+  return node;
+}
+
+static unsigned
+zix_concurrent_btree_max_vals(const ZixConcurrentBTreeNode* const node)
+{
+  return node->is_leaf ? ZIX_CONCURRENT_BTREE_LEAF_VALS
+                       : ZIX_CONCURRENT_BTREE_INODE_VALS;
+}
+
+static unsigned
+zix_concurrent_btree_min_vals(const ZixConcurrentBTreeNode* const node)
+{
+  return ((zix_concurrent_btree_max_vals(node) + 1U) / 2U) - 1U;
+}
+
+static unsigned
+zix_concurrent_btree_n_vals(const ZixConcurrentBTreeNode* const node)
+{
+  return (unsigned)zix_atomic_load_relaxed(&node->n_vals);
+}
+
+static void
+zix_concurrent_btree_set_n_vals(ZixConcurrentBTreeNode* const node,
+                                const unsigned                n_vals)
+{
+  zix_atomic_store_relaxed(&node->n_vals, n_vals);
+}
+
+static bool
+zix_concurrent_btree_is_full(const ZixConcurrentBTreeNode* const node)
+{
+  return zix_concurrent_btree_n_vals(node) >=
+         zix_concurrent_btree_max_vals(node);
+}
+
+static bool
+zix_concurrent_btree_can_remove_from(const ZixConcurrentBTreeNode* const node)
+{
+  return zix_concurrent_btree_n_vals(node) >
+         zix_concurrent_btree_min_vals(node);
+}
+
+/// Return the values array of a node (values are first in both node types)
+static void**
+zix_concurrent_btree_vals(ZixConcurrentBTreeNode* const node)
+{
+  return node->data.leaf.vals;
+}
+
+/// Return the child pointers array of an internal node
+static void**
+zix_concurrent_btree_children(ZixConcurrentBTreeNode* const node)
+{
+  assert(!node->is_leaf);
+  return (void**)node->data.inode.children;
+}
+
+static void*
+zix_concurrent_btree_val(const ZixConcurrentBTreeNode* const node,
+                         const unsigned                      i)
+{
+  return zix_atomic_load_ptr_relaxed(node->data.leaf.vals + i);
+}
+
+static void
+zix_concurrent_btree_set_val(ZixConcurrentBTreeNode* const node,
+                             const unsigned                i,
+                             void* const                   value)
+{
+  zix_atomic_store_ptr_relaxed(node->data.leaf.vals + i, value);
+}
+
+static ZixConcurrentBTreeNode*
+zix_concurrent_btree_child(const ZixConcurrentBTreeNode* const node,
+                           const unsigned                      i)
+{
+  assert(!node->is_leaf);
+  return (ZixConcurrentBTreeNode*)zix_atomic_load_ptr_relaxed(
+    (void* const*)node->data.inode.children + i);
+}
+
+static void
+zix_concurrent_btree_set_child(ZixConcurrentBTreeNode* const node,
+                               const unsigned                i,
+                               ZixConcurrentBTreeNode* const child)
+{
+  zix_atomic_store_ptr_relaxed(zix_concurrent_btree_children(node) + i, child);
+}
+
+/// Shift pointers in `array` of length `n` right starting at `i`
+static void
+zix_concurrent_btree_ainsert(void** const   array,
+                             const unsigned n,
+                             const unsigned i,
+                             void* const    e)
+{
+  for (unsigned j = n; j > i; --j) {
+    zix_atomic_store_ptr_relaxed(array + j, array[j - 1U]);
+  }
+
+  zix_atomic_store_ptr_relaxed(array + i, e);
+}
+
+/// Erase element `i` in `array` of resulting length `n` and return it
+static void*
+zix_concurrent_btree_aerase(void** const   array,
+                            const unsigned n,
+                            const unsigned i)
+{
+  void* const ret = array[i];
+  for (unsigned j = i; j < n; ++j) {
+    zix_atomic_store_ptr_relaxed(array + j, array[j + 1U]);
+  }
+
+  return ret;
+}
+
+/*
+  Version locks
+*/
+
+/// Wait for `node` to be unlocked and get its version, or fail if obsolete
+static bool
+zix_concurrent_btree_read_lock(const ZixConcurrentBTreeNode* const node,
+                               uintptr_t* const                    version)
+{
+  uintptr_t v = zix_atomic_load(&node->version);
+  while (v & ZIX_VERSION_LOCKED) {
+    zix_atomic_pause();
+    v = zix_atomic_load(&node->version);
+  }
+
+  *version = v;
+  return !(v & ZIX_VERSION_OBSOLETE);
+}
+
+/// Return true iff `node` has not changed since `version` was read
+static bool
+zix_concurrent_btree_validate(const ZixConcurrentBTreeNode* const node,
+                              const uintptr_t                     version)
+{
+  zix_atomic_acquire_fence();
+  return zix_atomic_load_relaxed(&node->version) == version;
+}
+
+/// Lock `node` for writing if it has not changed since `version` was read
+static bool
+zix_concurrent_btree_upgrade(ZixConcurrentBTreeNode* const node,
+                             const uintptr_t               version)
+{
+  if (zix_atomic_cas(&node->version, version, version + ZIX_VERSION_LOCKED)) {
+    zix_atomic_release_fence();
+    return true;
+  }
+
+  return false;
+}
+
+/// Lock `node` for writing, waiting for any other writer to finish
+static bool
+zix_concurrent_btree_write_lock(ZixConcurrentBTreeNode* const node)
+{
+  for (;;) {
+    const uintptr_t v = zix_atomic_load(&node->version);
+    if (v & ZIX_VERSION_OBSOLETE) {
+      return false;
+    }
+
+    if (!(v & ZIX_VERSION_LOCKED) && zix_concurrent_btree_upgrade(node, v)) {
+      return true;
+    }
+
+    zix_atomic_pause();
+  }
+}
+
+static void
+zix_concurrent_btree_write_unlock(ZixConcurrentBTreeNode* const node)
+{
+  const uintptr_t v = zix_atomic_load_relaxed(&node->version);
+  assert(v & ZIX_VERSION_LOCKED);
+  zix_atomic_store(&node->version, v + ZIX_VERSION_LOCKED);
+}
+
+/// Lock and return the ith child of the write-locked node `n`
+static ZixConcurrentBTreeNode*
+zix_concurrent_btree_lock_child(const ZixConcurrentBTreeNode* const n,
+                                const unsigned                      i)
+{
+  ZixConcurrentBTreeNode* const child = zix_concurrent_btree_child(n, i);
+
+  // Children can only be retired with the parent locked, so this can't fail
+  const bool locked = zix_concurrent_btree_write_lock(child);
+  assert(locked);
+  (void)locked;
+
+  return child;
+}
+
+/// Unlock a node that was removed from the tree, and free it later
+static void
+zix_concurrent_btree_retire(ZixConcurrentBTree* const     t,
+                            ZixConcurrentBTreeNode* const node)
+{
+  const uintptr_t v = zix_atomic_load_relaxed(&node->version);
+  assert(v & ZIX_VERSION_LOCKED);
+  zix_atomic_store(&node->version,
+                   v + ZIX_VERSION_LOCKED + ZIX_VERSION_OBSOLETE);
+
+  void** const retired = (void**)&t->retired;
+  void*        head    = NULL;
+  do {
+    head          = zix_atomic_load_ptr(retired);
+    node->retired = (ZixConcurrentBTreeNode*)head;
+  } while (!zix_atomic_cas_ptr(retired, head, node));
+}
+
+/*
+  Tree
+*/
+
+ZixConcurrentBTree*
+zix_concurrent_btree_new(ZixAllocator* const allocator,
+                         const ZixComparator cmp,
+                         const void* const   cmp_data)
+{
+  assert(cmp);
+
+  ZixConcurrentBTree* const t = (ZixConcurrentBTree*)zix_aligned_alloc(
+    allocator, ZIX_CONCURRENT_BTREE_CACHE_LINE, sizeof(ZixConcurrentBTree));
+
+  if (!t) {
+    return NULL;
+  }
+
+  memset(t, 0, sizeof(ZixConcurrentBTree));
+  if (!(t->root = zix_concurrent_btree_node_new(allocator, true))) {
+    zix_aligned_free(allocator, t);
+    return NULL;
+  }
+
+  t->allocator = allocator;
+  t->cmp       = cmp;
+  t->cmp_data  = cmp_data;
+
+  return t;
+}
+
+static void
+zix_concurrent_btree_free_children(ZixConcurrentBTree* const     t,
+                                   ZixConcurrentBTreeNode* const n,
+                                   const ZixDestroyFunc          destroy,
+                                   const void* const destroy_user_data)
+{
+  const unsigned n_vals = zix_concurrent_btree_n_vals(n);
+
+  if (!n->is_leaf) {
+    for (unsigned i = 0U; i < n_vals + 1U; ++i) {
+      ZixConcurrentBTreeNode* const child = zix_concurrent_btree_child(n, i);
+      zix_concurrent_btree_free_children(t, child, destroy, destroy_user_data);
+      zix_aligned_free(t->allocator, child);
+    }
+  }
+
+  if (destroy) {
+    for (unsigned i = 0U; i < n_vals; ++i) {
+      destroy(zix_concurrent_btree_val(n, i), destroy_user_data);
+    }
+  }
+}
+
+void
+zix_concurrent_btree_free(ZixConcurrentBTree* const t,
+                          const ZixDestroyFunc      destroy,
+                          const void* const         destroy_user_data)
+{
+  if (t) {
+    zix_concurrent_btree_collect(t);
+    zix_concurrent_btree_free_children(t, t->root, destroy, destroy_user_data);
+    zix_aligned_free(t->allocator, t->root);
+    zix_aligned_free(t->allocator, t);
+  }
+}
+
+void
+zix_concurrent_btree_collect(ZixConcurrentBTree* const t)
+{
+  assert(t);
+
+  ZixConcurrentBTreeNode* node = t->retired;
+  while (node) {
+    ZixConcurrentBTreeNode* const next = node->retired;
+    zix_aligned_free(t->allocator, node);
+    node = next;
+  }
+
+  t->retired = NULL;
+}
+
+size_t
+zix_concurrent_btree_size(const ZixConcurrentBTree* const t)
+{
+  assert(t);
+  return zix_atomic_load_relaxed(&t->size);
+}
+
+static ZixConcurrentBTreeNode*
+zix_concurrent_btree_root(const ZixConcurrentBTree* const t)
+{
+  return (ZixConcurrentBTreeNode*)zix_atomic_load_ptr((void* const*)&t->root);
+}
+
+/// Get the root and its version, or return null if it changed in the process
+static ZixConcurrentBTreeNode*
+zix_concurrent_btree_read_root(const ZixConcurrentBTree* const t,
+                               uintptr_t* const                version)
+{
+  ZixConcurrentBTreeNode* const root = zix_concurrent_btree_root(t);
+
+  return (zix_concurrent_btree_read_lock(root, version) &&
+          root == zix_concurrent_btree_root(t))
+           ? root
+           : NULL;
+}
+
+/**
+   Find the index of the first value in `n` that is not less than `e`.
+
+   This may be called by readers on a node that is being modified, so it
+   returns false if the node is in an inconsistent state.
+*/
+static bool
+zix_concurrent_btree_find_value(const ZixConcurrentBTree* const     t,
+                                const ZixConcurrentBTreeNode* const n,
+                                const void* const                   e,
+                                unsigned* const                     index,
+                                bool* const                         equal)
+{
+  const unsigned n_vals = zix_concurrent_btree_n_vals(n);
+  if (n_vals > zix_concurrent_btree_max_vals(n)) {
+    return false;
+  }
+
+  unsigned first = 0U;
+  unsigned count = n_vals;
+
+  while (count > 0U) {
+    const unsigned    half  = count >> 1U;
+    const unsigned    i     = first + half;
+    const void* const value = zix_concurrent_btree_val(n, i);
+    if (!value) {
+      return false;
+    }
+
+    const int cmp = t->cmp(value, e, t->cmp_data);
+    if (!cmp) {
+      *index = i;
+      *equal = true;
+      return true;
+    }
+
+    if (cmp < 0) {
+      first += half + 1U;
+      count -= half + 1U;
+    } else {
+      count = half;
+    }
+  }
+
+  *index = first;
+  *equal = false;
+  return true;
+}
+
+/// Split lhs, the i'th child of `n`, into two nodes (all locked)
+static ZixConcurrentBTreeNode*
+zix_concurrent_btree_split_child(ZixAllocator* const           allocator,
+                                 ZixConcurrentBTreeNode* const n,
+                                 const unsigned                i,
+                                 ZixConcurrentBTreeNode* const lhs)
+{
+  const unsigned max_n_vals = zix_concurrent_btree_max_vals(lhs);
+  const unsigned n_n_vals   = zix_concurrent_btree_n_vals(n);
+
+  assert(zix_concurrent_btree_n_vals(lhs) == max_n_vals);
+  assert(n_n_vals < ZIX_CONCURRENT_BTREE_INODE_VALS);
+  assert(i < n_n_vals + 1U);
+  assert(zix_concurrent_btree_child(n, i) == lhs);
+
+  ZixConcurrentBTreeNode* const rhs =
+    zix_concurrent_btree_node_new(allocator, lhs->is_leaf);
+  if (!rhs) {
+    return NULL;
+  }
+
+  // LHS and RHS get roughly half, less the middle value which moves up
+  const unsigned lhs_n_vals = max_n_vals / 2U;
+  const unsigned rhs_n_vals = max_n_vals - lhs_n_vals - 1U;
+
+  // Copy large half from LHS to new RHS node, which nobody else can see yet
+  memcpy(zix_concurrent_btree_vals(rhs),
+         zix_concurrent_btree_vals(lhs) + lhs_n_vals + 1U,
+         rhs_n_vals * sizeof(void*));
+
+  if (!lhs->is_leaf) {
+    memcpy(zix_concurrent_btree_children(rhs),
+           zix_concurrent_btree_children(lhs) + lhs_n_vals + 1U,
+           (rhs_n_vals + 1U) * sizeof(void*));
+  }
+
+  rhs->n_vals = rhs_n_vals;
+
+  // Move middle value up to parent
+  zix_concurrent_btree_ainsert(zix_concurrent_btree_vals(n),
+                               n_n_vals,
+                               i,
+                               zix_concurrent_btree_val(lhs, lhs_n_vals));
+
+  // Insert new RHS node in parent at position i
+  zix_concurrent_btree_ainsert(
+    zix_concurrent_btree_children(n), n_n_vals + 1U, i + 1U, rhs);
+
+  zix_concurrent_btree_set_n_vals(n, n_n_vals + 1U);
+  zix_concurrent_btree_set_n_vals(lhs, lhs_n_vals);
+  return rhs;
+}
+
+/// Replace the full (locked) root with a new root above it
+static ZixStatus
+zix_concurrent_btree_grow_up(ZixConcurrentBTree* const     t,
+                             ZixConcurrentBTreeNode* const root)
+{
+  ZixConcurrentBTreeNode* const new_root =
+    zix_concurrent_btree_node_new(t->allocator, false);
+
+  if (!new_root) {
+    return ZIX_STATUS_NO_MEM;
+  }
+
+  // Set old root as the only child of the new root
+  new_root->data.inode.children[0] = root;
+
+  // Split the old root to get two balanced siblings
+  if (!zix_concurrent_btree_split_child(t->allocator, new_root, 0U, root)) {
+    zix_aligned_free(t->allocator, new_root);
+    return ZIX_STATUS_NO_MEM;
+  }
+
+  zix_atomic_store_ptr((void**)&t->root, new_root);
+  return ZIX_STATUS_SUCCESS;
+}
+
+/// Try to insert `e`, or return false if the operation must be restarted
+static bool
+zix_concurrent_btree_try_insert(ZixConcurrentBTree* const t,
+                                void* const               e,
+                                ZixStatus* const          st)
+{
+  uintptr_t               v = 0U;
+  ZixConcurrentBTreeNode* n = zix_concurrent_btree_read_root(t, &v);
+  if (!n) {
+    return false;
+  }
+
+  if (zix_concurrent_btree_is_full(n)) {
+    // Root is full, grow up then try again
+    if (!zix_concurrent_btree_upgrade(n, v)) {
+      return false;
+    }
+
+    *st = zix_concurrent_btree_grow_up(t, n);
+    zix_concurrent_btree_write_unlock(n);
+    return *st != ZIX_STATUS_SUCCESS;
+  }
+
+  for (;;) {
+    unsigned i     = 0U;
+    bool     equal = false;
+    if (!zix_concurrent_btree_find_value(t, n, e, &i, &equal)) {
+      return false;
+    }
+
+    if (equal) {
+      *st = ZIX_STATUS_EXISTS;
+      return zix_concurrent_btree_validate(n, v);
+    }
+
+    if (n->is_leaf) {
+      // Lock the leaf and insert if it hasn't changed since it was searched
+      if (!zix_concurrent_btree_upgrade(n, v)) {
+        return false;
+      }
+
+      const unsigned n_vals = zix_concurrent_btree_n_vals(n);
+      zix_concurrent_btree_ainsert(zix_concurrent_btree_vals(n), n_vals, i, e);
+      zix_concurrent_btree_set_n_vals(n, n_vals + 1U);
+      zix_concurrent_btree_write_unlock(n);
+
+      zix_atomic_fetch_add(&t->size, 1U);
+      *st = ZIX_STATUS_SUCCESS;
+      return true;
+    }
+
+    // Value not in this node, but may be in the ith child
+    ZixConcurrentBTreeNode* const child = zix_concurrent_btree_child(n, i);
+    uintptr_t                     child_v = 0U;
+    if (!zix_concurrent_btree_validate(n, v) ||
+        !zix_concurrent_btree_read_lock(child, &child_v)) {
+      return false;
+    }
+
+    if (zix_concurrent_btree_is_full(child)) {
+      // The child is full, lock both and split it, then try again
+      if (!zix_concurrent_btree_upgrade(n, v)) {
+        return false;
+      }
+
+      if (!zix_concurrent_btree_upgrade(child, child_v)) {
+        zix_concurrent_btree_write_unlock(n);
+        return false;
+      }
+
+      const ZixConcurrentBTreeNode* const rhs =
+        zix_concurrent_btree_split_child(t->allocator, n, i, child);
+
+      zix_concurrent_btree_write_unlock(child);
+      zix_concurrent_btree_write_unlock(n);
+      if (!rhs) {
+        *st = ZIX_STATUS_NO_MEM;
+        return true;
+      }
+
+      return false;
+    }
+
+    if (!zix_concurrent_btree_validate(n, v)) {
+      return false;
+    }
+
+    n = child;
+    v = child_v;
+  }
+}
+
+ZixStatus
+zix_concurrent_btree_insert(ZixConcurrentBTree* const t, void* const e)
+{
+  assert(t);
+  assert(e);
+
+  ZixStatus st = ZIX_STATUS_SUCCESS;
+  while (!zix_concurrent_btree_try_insert(t, e, &st)) {
+  }
+
+  return st;
+}
+
+/// Enlarge left child by stealing a value from its right sibling (all locked)
+static void
+zix_concurrent_btree_rotate_left(ZixConcurrentBTreeNode* const parent,
+                                 const unsigned                i,
+                                 ZixConcurrentBTreeNode* const lhs,
+                                 ZixConcurrentBTreeNode* const rhs)
+{
+  const unsigned lhs_n_vals = zix_concurrent_btree_n_vals(lhs);
+  const unsigned rhs_n_vals = zix_concurrent_btree_n_vals(rhs) - 1U;
+
+  // Move parent value to end of LHS
+  zix_concurrent_btree_set_val(
+    lhs, lhs_n_vals, zix_concurrent_btree_val(parent, i));
+
+  // Move first value in RHS to parent
+  void** const rhs_vals = zix_concurrent_btree_vals(rhs);
+  zix_concurrent_btree_set_val(
+    parent, i, zix_concurrent_btree_aerase(rhs_vals, rhs_n_vals, 0U));
+
+  if (!lhs->is_leaf) {
+    // Move first child pointer from RHS to end of LHS
+    zix_concurrent_btree_set_child(
+      lhs,
+      lhs_n_vals + 1U,
+      (ZixConcurrentBTreeNode*)zix_concurrent_btree_aerase(
+        zix_concurrent_btree_children(rhs), rhs_n_vals + 1U, 0U));
+  }
+
+  zix_concurrent_btree_set_n_vals(lhs, lhs_n_vals + 1U);
+  zix_concurrent_btree_set_n_vals(rhs, rhs_n_vals);
+}
+
+/// Enlarge right child by stealing a value from its left sibling (all locked)
+static void
+zix_concurrent_btree_rotate_right(ZixConcurrentBTreeNode* const parent,
+                                  const unsigned                i,
+                                  ZixConcurrentBTreeNode* const lhs,
+                                  ZixConcurrentBTreeNode* const rhs)
+{
+  const unsigned lhs_n_vals = zix_concurrent_btree_n_vals(lhs) - 1U;
+  const unsigned rhs_n_vals = zix_concurrent_btree_n_vals(rhs);
+
+  // Prepend parent value to RHS
+  zix_concurrent_btree_ainsert(zix_concurrent_btree_vals(rhs),
+                               rhs_n_vals,
+                               0U,
+                               zix_concurrent_btree_val(parent, i - 1U));
+
+  if (!lhs->is_leaf) {
+    // Move last child pointer from LHS and prepend to RHS
+    zix_concurrent_btree_ainsert(
+      zix_concurrent_btree_children(rhs),
+      rhs_n_vals + 1U,
+      0U,
+      zix_concurrent_btree_child(lhs, lhs_n_vals + 1U));
+  }
+
+  // Move last value from LHS to parent
+  zix_concurrent_btree_set_val(
+    parent, i - 1U, zix_concurrent_btree_val(lhs, lhs_n_vals));
+
+  zix_concurrent_btree_set_n_vals(lhs, lhs_n_vals);
+  zix_concurrent_btree_set_n_vals(rhs, rhs_n_vals + 1U);
+}
+
+/**
+   Move n[i] down and merge the left and right child.
+
+   All three nodes must be locked.  The right child is retired, and so is the
+   parent if it was the root and is now empty.  The parent is unlocked, and
+   the merged node is returned, still locked.
+*/
+static ZixConcurrentBTreeNode*
+zix_concurrent_btree_merge(ZixConcurrentBTree* const     t,
+                           ZixConcurrentBTreeNode* const n,
+                           const unsigned                i,
+                           ZixConcurrentBTreeNode* const lhs,
+                           ZixConcurrentBTreeNode* const rhs)
+{
+  const unsigned n_vals     = zix_concurrent_btree_n_vals(n) - 1U;
+  const unsigned lhs_n_vals = zix_concurrent_btree_n_vals(lhs);
+  const unsigned rhs_n_vals = zix_concurrent_btree_n_vals(rhs);
+
+  assert(lhs->is_leaf == rhs->is_leaf);
+  assert(lhs_n_vals + rhs_n_vals < zix_concurrent_btree_max_vals(lhs));
+
+  // Move parent value to end of LHS
+  zix_concurrent_btree_set_val(
+    lhs,
+    lhs_n_vals,
+    zix_concurrent_btree_aerase(zix_concurrent_btree_vals(n), n_vals, i));
+
+  // Erase corresponding child pointer (to RHS) in parent
+  zix_concurrent_btree_aerase(
+    zix_concurrent_btree_children(n), n_vals + 1U, i + 1U);
+
+  // Add everything from RHS to end of LHS
+  for (unsigned j = 0U; j < rhs_n_vals; ++j) {
+    zix_concurrent_btree_set_val(
+      lhs, lhs_n_vals + 1U + j, zix_concurrent_btree_val(rhs, j));
+  }
+
+  if (!lhs->is_leaf) {
+    for (unsigned j = 0U; j <= rhs_n_vals; ++j) {
+      zix_concurrent_btree_set_child(
+        lhs, lhs_n_vals + 1U + j, zix_concurrent_btree_child(rhs, j));
+    }
+  }
+
+  zix_concurrent_btree_set_n_vals(lhs, lhs_n_vals + 1U + rhs_n_vals);
+  zix_concurrent_btree_set_n_vals(n, n_vals);
+  zix_concurrent_btree_retire(t, rhs);
+
+  if (n_vals == 0U) {
+    // Root is now empty, replace it with its only child
+    assert(n == zix_concurrent_btree_root(t));
+    zix_atomic_store_ptr((void**)&t->root, lhs);
+    zix_concurrent_btree_retire(t, n);
+  } else {
+    zix_concurrent_btree_write_unlock(n);
+  }
+
+  return lhs;
+}
+
+/// Fatten the locked minimal ith child of `n`, unlock `n`, and return it
+static ZixConcurrentBTreeNode*
+zix_concurrent_btree_fatten_child(ZixConcurrentBTree* const     t,
+                                  ZixConcurrentBTreeNode* const n,
+                                  const unsigned                i,
+                                  ZixConcurrentBTreeNode* const child)
+{
+  const unsigned n_vals = zix_concurrent_btree_n_vals(n);
+
+  if (i > 0U) {
+    ZixConcurrentBTreeNode* const lhs =
+      zix_concurrent_btree_lock_child(n, i - 1U);
+    if (zix_concurrent_btree_can_remove_from(lhs)) {
+      // Steal a key from left sibling
+      zix_concurrent_btree_rotate_right(n, i, lhs, child);
+      zix_concurrent_btree_write_unlock(lhs);
+      zix_concurrent_btree_write_unlock(n);
+      return child;
+    }
+
+    if (i == n_vals) {
+      // Merge last two children
+      return zix_concurrent_btree_merge(t, n, i - 1U, lhs, child);
+    }
+
+    zix_concurrent_btree_write_unlock(lhs);
+  }
+
+  ZixConcurrentBTreeNode* const rhs =
+    zix_concurrent_btree_lock_child(n, i + 1U);
+
+  if (zix_concurrent_btree_can_remove_from(rhs)) {
+    // Steal a key from right sibling
+    zix_concurrent_btree_rotate_left(n, i, child, rhs);
+    zix_concurrent_btree_write_unlock(rhs);
+    zix_concurrent_btree_write_unlock(n);
+    return child;
+  }
+
+  // Both child's siblings are minimal, merge them
+  return zix_concurrent_btree_merge(t, n, i, child, rhs);
+}
+
+/// Move from locked `n` to its ith child, fattening it if necessary
+static ZixConcurrentBTreeNode*
+zix_concurrent_btree_descend(ZixConcurrentBTree* const     t,
+                             ZixConcurrentBTreeNode* const n,
+                             const unsigned                i)
+{
+  ZixConcurrentBTreeNode* const child = zix_concurrent_btree_lock_child(n, i);
+
+  if (zix_concurrent_btree_can_remove_from(child)) {
+    zix_concurrent_btree_write_unlock(n);
+    return child;
+  }
+
+  return zix_concurrent_btree_fatten_child(t, n, i, child);
+}
+
+/// Remove and return the min value from the subtree rooted at locked `n`
+static void*
+zix_concurrent_btree_remove_min(ZixConcurrentBTree* const t,
+                                ZixConcurrentBTreeNode*   n)
+{
+  assert(zix_concurrent_btree_can_remove_from(n));
+
+  while (!n->is_leaf) {
+    n = zix_concurrent_btree_descend(t, n, 0U);
+  }
+
+  const unsigned n_vals = zix_concurrent_btree_n_vals(n) - 1U;
+  void* const    value =
+    zix_concurrent_btree_aerase(zix_concurrent_btree_vals(n), n_vals, 0U);
+
+  zix_concurrent_btree_set_n_vals(n, n_vals);
+  zix_concurrent_btree_write_unlock(n);
+  return value;
+}
+
+/// Remove and return the max value from the subtree rooted at locked `n`
+static void*
+zix_concurrent_btree_remove_max(ZixConcurrentBTree* const t,
+                                ZixConcurrentBTreeNode*   n)
+{
+  assert(zix_concurrent_btree_can_remove_from(n));
+
+  while (!n->is_leaf) {
+    n = zix_concurrent_btree_descend(t, n, zix_concurrent_btree_n_vals(n));
+  }
+
+  const unsigned n_vals = zix_concurrent_btree_n_vals(n) - 1U;
+  void* const    value  = zix_concurrent_btree_val(n, n_vals);
+
+  zix_concurrent_btree_set_n_vals(n, n_vals);
+  zix_concurrent_btree_write_unlock(n);
+  return value;
+}
+
+/**
+   Try to find and lock the highest node that a removal needs to modify.
+
+   This descends optimistically while nothing needs to change, which is the
+   common case for all but the lowest levels, so removals don't serialize on
+   the root.  Returns false if the operation must be restarted, otherwise
+   `locked` is set to the locked node, or null if `e` isn't in the tree.
+*/
+static bool
+zix_concurrent_btree_try_lock_for_removal(ZixConcurrentBTree* const t,
+                                          const void* const         e,
+                                          ZixConcurrentBTreeNode**  locked)
+{
+  uintptr_t               v = 0U;
+  ZixConcurrentBTreeNode* n = zix_concurrent_btree_read_root(t, &v);
+  if (!n) {
+    return false;
+  }
+
+  if (!n->is_leaf && zix_concurrent_btree_n_vals(n) == 1U) {
+    // The root only needs to be merged away if both children are minimal
+    ZixConcurrentBTreeNode* const lhs   = zix_concurrent_btree_child(n, 0U);
+    ZixConcurrentBTreeNode* const rhs   = zix_concurrent_btree_child(n, 1U);
+    uintptr_t                     lhs_v = 0U;
+    uintptr_t                     rhs_v = 0U;
+    if (!zix_concurrent_btree_validate(n, v) ||
+        !zix_concurrent_btree_read_lock(lhs, &lhs_v) ||
+        !zix_concurrent_btree_read_lock(rhs, &rhs_v)) {
+      return false;
+    }
+
+    const bool merge = !zix_concurrent_btree_can_remove_from(lhs) &&
+                       !zix_concurrent_btree_can_remove_from(rhs);
+
+    if (!zix_concurrent_btree_validate(lhs, lhs_v) ||
+        !zix_concurrent_btree_validate(rhs, rhs_v) ||
+        !zix_concurrent_btree_validate(n, v)) {
+      return false;
+    }
+
+    if (merge) {
+      *locked = n;
+      return zix_concurrent_btree_upgrade(n, v);
+    }
+  }
+
+  for (;;) {
+    unsigned i     = 0U;
+    bool     equal = false;
+    if (!zix_concurrent_btree_find_value(t, n, e, &i, &equal)) {
+      return false;
+    }
+
+    if (n->is_leaf) {
+      if (!equal) {
+        *locked = NULL;
+        return zix_concurrent_btree_validate(n, v);
+      }
+
+      *locked = n;
+      return zix_concurrent_btree_upgrade(n, v);
+    }
+
+    if (equal) {
+      // Found in internal node, which will be modified
+      *locked = n;
+      return zix_concurrent_btree_upgrade(n, v);
+    }
+
+    ZixConcurrentBTreeNode* const child = zix_concurrent_btree_child(n, i);
+    uintptr_t                     child_v = 0U;
+    if (!zix_concurrent_btree_validate(n, v) ||
+        !zix_concurrent_btree_read_lock(child, &child_v)) {
+      return false;
+    }
+
+    if (!zix_concurrent_btree_can_remove_from(child)) {
+      // Child is minimal and must be fattened, which modifies this node
+      *locked = n;
+      return zix_concurrent_btree_upgrade(n, v);
+    }
+
+    if (!zix_concurrent_btree_validate(n, v)) {
+      return false;
+    }
+
+    n = child;
+    v = child_v;
+  }
+}
+
+ZixStatus
+zix_concurrent_btree_remove(ZixConcurrentBTree* const t,
+                            const void* const         e,
+                            void** const              out)
+{
+  assert(t);
+  assert(e);
+  assert(out);
+
+  ZixConcurrentBTreeNode* n = NULL;
+  while (!zix_concurrent_btree_try_lock_for_removal(t, e, &n)) {
+  }
+
+  *out = NULL;
+  if (!n) {
+    return ZIX_STATUS_NOT_FOUND;
+  }
+
+  /* From here on, this works like zix_btree_remove() with lock coupling.  The
+     current node always has a value to spare (or is the root), and is locked.
+     It is unlocked when moving to a child, except when a value in an
+     internal node is being replaced by one from a child. */
+
+  if (n == zix_concurrent_btree_root(t) && !n->is_leaf &&
+      zix_concurrent_btree_n_vals(n) == 1U) {
+    ZixConcurrentBTreeNode* const lhs = zix_concurrent_btree_lock_child(n, 0U);
+    ZixConcurrentBTreeNode* const rhs = zix_concurrent_btree_lock_child(n, 1U);
+
+    if (!zix_concurrent_btree_can_remove_from(lhs) &&
+        !zix_concurrent_btree_can_remove_from(rhs)) {
+      // Root has only two children, both minimal, merge them into a new root
+      n = zix_concurrent_btree_merge(t, n, 0U, lhs, rhs);
+    } else {
+      zix_concurrent_btree_write_unlock(rhs);
+      zix_concurrent_btree_write_unlock(lhs);
+    }
+  }
+
+  while (!n->is_leaf) {
+    unsigned i     = 0U;
+    bool     equal = false;
+    zix_concurrent_btree_find_value(t, n, e, &i, &equal);
+
+    if (!equal) {
+      // Not found in internal node, is in the ith child if anywhere
+      n = zix_concurrent_btree_descend(t, n, i);
+      continue;
+    }
+
+    // Found in internal node, replace it with a value from a child if possible
+    ZixConcurrentBTreeNode* const lhs = zix_concurrent_btree_lock_child(n, i);
+    ZixConcurrentBTreeNode* const rhs =
+      zix_concurrent_btree_lock_child(n, i + 1U);
+
+    const unsigned lhs_n_vals = zix_concurrent_btree_n_vals(lhs);
+    const unsigned rhs_n_vals = zix_concurrent_btree_n_vals(rhs);
+
+    if (!zix_concurrent_btree_can_remove_from(lhs) &&
+        !zix_concurrent_btree_can_remove_from(rhs)) {
+      // Both preceding and succeeding child are minimal, merge and continue
+      n = zix_concurrent_btree_merge(t, n, i, lhs, rhs);
+      continue;
+    }
+
+    *out = zix_concurrent_btree_val(n, i);
+
+    void* replacement = NULL;
+    if (lhs_n_vals > rhs_n_vals || (lhs_n_vals == rhs_n_vals && (i & 1U))) {
+      // Left child has more values (or is the tie breaker), steal its largest
+      zix_concurrent_btree_write_unlock(rhs);
+      replacement = zix_concurrent_btree_remove_max(t, lhs);
+    } else {
+      // Right child has more values, steal its smallest
+      zix_concurrent_btree_write_unlock(lhs);
+      replacement = zix_concurrent_btree_remove_min(t, rhs);
+    }
+
+    zix_concurrent_btree_set_val(n, i, replacement);
+    zix_concurrent_btree_write_unlock(n);
+    zix_atomic_fetch_add(&t->size, (uintptr_t)-1);
+    return ZIX_STATUS_SUCCESS;
+  }
+
+  // We're at the leaf the value may be in, search for the value in it
+  unsigned i     = 0U;
+  bool     equal = false;
+  zix_concurrent_btree_find_value(t, n, e, &i, &equal);
+
+  if (!equal) {
+    zix_concurrent_btree_write_unlock(n);
+    return ZIX_STATUS_NOT_FOUND;
+  }
+
+  // Erase from leaf node
+  const unsigned n_vals = zix_concurrent_btree_n_vals(n) - 1U;
+  *out = zix_concurrent_btree_aerase(zix_concurrent_btree_vals(n), n_vals, i);
+  zix_concurrent_btree_set_n_vals(n, n_vals);
+  zix_concurrent_btree_write_unlock(n);
+
+  zix_atomic_fetch_add(&t->size, (uintptr_t)-1);
+  return ZIX_STATUS_SUCCESS;
+}
+
+/// Try to find `e`, or return false if the operation must be restarted
+static bool
+zix_concurrent_btree_try_find(const ZixConcurrentBTree* const t,
+                              const void* const               e,
+                              void** const                    out,
+                              ZixStatus* const                st)
+{
+  uintptr_t                     v = 0U;
+  const ZixConcurrentBTreeNode* n = zix_concurrent_btree_read_root(t, &v);
+  if (!n) {
+    return false;
+  }
+
+  for (;;) {
+    unsigned i     = 0U;
+    bool     equal = false;
+    if (!zix_concurrent_btree_find_value(t, n, e, &i, &equal)) {
+      return false;
+    }
+
+    if (equal) {
+      *out = zix_concurrent_btree_val(n, i);
+      *st  = ZIX_STATUS_SUCCESS;
+      return zix_concurrent_btree_validate(n, v);
+    }
+
+    if (n->is_leaf) {
+      *st = ZIX_STATUS_NOT_FOUND;
+      return zix_concurrent_btree_validate(n, v);
+    }
+
+    const ZixConcurrentBTreeNode* const child =
+      zix_concurrent_btree_child(n, i);
+
+    uintptr_t child_v = 0U;
+    if (!zix_concurrent_btree_validate(n, v) ||
+        !zix_concurrent_btree_read_lock(child, &child_v) ||
+        !zix_concurrent_btree_validate(n, v)) {
+      return false;
+    }
+
+    n = child;
+    v = child_v;
+  }
+}
+
+ZixStatus
+zix_concurrent_btree_find(const ZixConcurrentBTree* const t,
+                          const void* const               e,
+                          void** const                    out)
+{
+  assert(t);
+  assert(e);
+  assert(out);
+
+  ZixStatus st = ZIX_STATUS_SUCCESS;
+
+  *out = NULL;
+  while (!zix_concurrent_btree_try_find(t, e, out, &st)) {
+  }
+
+  if (st) {
+    *out = NULL;
+  }
+
+  return st;
+}
@@ -0,0 +1,688 @@
+// Copyright 2011-2022 David Robillard <d@drobilla.net>
+// SPDX-License-Identifier: ISC
+
+#include "zix/file_btree.h"
+
+#include "zix_config.h"
+
+#if USE_MMAP
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#define ZIX_FILE_BTREE_VERSION 1U
+
+/// Number of pages to map for a new file, which is grown by doubling
+#define ZIX_FILE_BTREE_INITIAL_PAGES 16U
+
+static const char zix_file_btree_magic[8] =
+  {'Z', 'i', 'x', 'B', 'T', 'r', 'e', 'e'};
+
+/**
+   The header in the first page of the file.
+
+   Since the header is written in native byte order, the version also serves
+   to detect files written on machines with a different byte order.
+*/
+typedef struct {
+  char     magic[8];  ///< Always "ZixBTree"
+  uint32_t version;   ///< File format version
+  uint32_t page_size; ///< Size of every page in bytes
+  uint64_t n_pages;   ///< Number of pages in use, including this one
+  uint64_t root;      ///< Page number of the root node
+  uint64_t height;    ///< Number of levels, including the leaves
+  uint64_t size;      ///< Number of entries
+} ZixFileBTreeHeader;
+
+/**
+   A node, which fills exactly one page.
+
+   Leaves have keys followed by their values, internal nodes have keys
+   followed by the page numbers of their children.  Internal keys are only
+   separators: the ith child contains keys from the previous separator
+   (inclusive) up to the ith one (exclusive), and every entry is in a leaf.
+*/
+typedef struct {
+  uint16_t is_leaf;  ///< True iff this is a leaf
+  uint16_t n_keys;   ///< Number of keys
+  uint32_t reserved; ///< Unused padding, always zero
+  uint64_t words[];  ///< Keys, then values or children
+} ZixFileBTreeNode;
+
+/// Number of words that fit in a node after its header
+#define ZIX_FILE_BTREE_N_WORDS \
+  ((ZIX_FILE_BTREE_PAGE_SIZE - sizeof(ZixFileBTreeNode)) / sizeof(uint64_t))
+
+struct ZixFileBTreeImpl {
+  ZixAllocator* allocator; ///< Allocator for this struct
+  int           fd;        ///< Open file descriptor
+  void*         base;      ///< Start of the mapped file
+  uint64_t      n_mapped;  ///< Number of pages in the mapping and file
+};
+
+static ZixFileBTreeHeader*
+zix_file_btree_header(const ZixFileBTree* const t)
+{
+  return (ZixFileBTreeHeader*)t->base;
+}
+
+/// Return the address of `page` in the mapping, which is page-aligned
+static void*
+zix_file_btree_address(const ZixFileBTree* const t, const uint64_t page)
+{
+  return (uint8_t*)t->base + page * ZIX_FILE_BTREE_PAGE_SIZE;
+}
+
+static ZixFileBTreeNode*
+zix_file_btree_page(const ZixFileBTree* const t, const uint64_t page)
+{
+  assert(page > 0U);
+  assert(page < zix_file_btree_header(t)->n_pages);
+  return (ZixFileBTreeNode*)zix_file_btree_address(t, page);
+}
+
+/// Return the capacity of a node, so keys and values or children fill the page
+static unsigned
+zix_file_btree_max_keys(const ZixFileBTreeNode* const n)
+{
+  // An internal node has one more child than keys
+  return (unsigned)((ZIX_FILE_BTREE_N_WORDS - (n->is_leaf ? 0U : 1U)) / 2U);
+}
+
+/**
+   Return the node at `page` if it is sane, or null if the file is corrupt.
+
+   Internal links are only trusted by zix_file_btree_page() with assertions,
+   but everything read from the file is checked with this before it is
+   followed, so a corrupt file makes operations fail rather than crash.  The
+   node must be a leaf or not as expected, which ensures that every walk down
+   from the root reaches a leaf in exactly the height of the tree.
+*/
+static ZixFileBTreeNode*
+zix_file_btree_node(const ZixFileBTree* const t,
+                    const uint64_t            page,
+                    const bool                leaf)
+{
+  if (!page || page >= zix_file_btree_header(t)->n_pages) {
+    return NULL;
+  }
+
+  ZixFileBTreeNode* const n =
+    (ZixFileBTreeNode*)zix_file_btree_address(t, page);
+
+  return (n->is_leaf == leaf && n->n_keys <= zix_file_btree_max_keys(n))
+           ? n
+           : NULL;
+}
+
+/// Return the root node, or null if the file is corrupt
+static ZixFileBTreeNode*
+zix_file_btree_root(const ZixFileBTree* const t)
+{
+  const ZixFileBTreeHeader* const header = zix_file_btree_header(t);
+
+  return zix_file_btree_node(t, header->root, header->height == 1U);
+}
+
+/// Return the values of a leaf, or the children of an internal node
+static uint64_t*
+zix_file_btree_links(ZixFileBTreeNode* const n)
+{
+  return n->words + zix_file_btree_max_keys(n);
+}
+
+static bool
+zix_file_btree_is_full(const ZixFileBTreeNode* const n)
+{
+  return n->n_keys == zix_file_btree_max_keys(n);
+}
+
+/// Return the index of the first key that is not less than `key`
+static unsigned
+zix_file_btree_find_key(const ZixFileBTreeNode* const n, const uint64_t key)
+{
+  unsigned first = 0U;
+  unsigned count = n->n_keys;
+
+  while (count > 0U) {
+    const unsigned half = count >> 1U;
+    if (n->words[first + half] < key) {
+      first += half + 1U;
+      count -= half + 1U;
+    } else {
+      count = half;
+    }
+  }
+
+  return first;
+}
+
+/// Return the index of the child of an internal node that may contain `key`
+static unsigned
+zix_file_btree_child_index(const ZixFileBTreeNode* const n,
+                           const uint64_t                key)
+{
+  const unsigned i = zix_file_btree_find_key(n, key);
+
+  return (i < n->n_keys && n->words[i] == key) ? i + 1U : i;
+}
+
+/// Shift elements in `array` of length `n` right starting at `i`
+static void
+zix_file_btree_ainsert(uint64_t* const array,
+                       const unsigned  n,
+                       const unsigned  i,
+                       const uint64_t  e)
+{
+  memmove(array + i + 1, array + i, (n - i) * sizeof(e));
+  array[i] = e;
+}
+
+#if USE_MMAP
+
+/// Map `n_pages` of the file, replacing any current mapping
+static ZixStatus
+zix_file_btree_map(ZixFileBTree* const t, const uint64_t n_pages)
+{
+  const size_t length = (size_t)(n_pages * ZIX_FILE_BTREE_PAGE_SIZE);
+
+  void* const base =
+    mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, t->fd, 0);
+
+  if (base == MAP_FAILED) {
+    return ZIX_STATUS_NO_MEM;
+  }
+
+  if (t->base) {
+    munmap(t->base, (size_t)(t->n_mapped * ZIX_FILE_BTREE_PAGE_SIZE));
+  }
+
+  t->base     = base;
+  t->n_mapped = n_pages;
+  return ZIX_STATUS_SUCCESS;
+}
+
+#endif
+
+/// Ensure the file has room for at least `n_pages` pages
+static ZixStatus
+zix_file_btree_reserve(ZixFileBTree* const t, const uint64_t n_pages)
+{
+  if (n_pages <= t->n_mapped) {
+    return ZIX_STATUS_SUCCESS;
+  }
+
+#if USE_MMAP
+  uint64_t new_n_pages = t->n_mapped ? t->n_mapped : 1U;
+  while (new_n_pages < n_pages) {
+    new_n_pages *= 2U;
+  }
+
+  const off_t length = (off_t)(new_n_pages * ZIX_FILE_BTREE_PAGE_SIZE);
+  if (ftruncate(t->fd, length)) {
+    return ZIX_STATUS_ERROR;
+  }
+
+  return zix_file_btree_map(t, new_n_pages);
+#else
+  return ZIX_STATUS_ERROR;
+#endif
+}
+
+/// Append a new empty node, which must already be reserved
+static uint64_t
+zix_file_btree_new_node(const ZixFileBTree* const t, const bool leaf)
+{
+  ZixFileBTreeHeader* const header = zix_file_btree_header(t);
+  const uint64_t            page   = header->n_pages++;
+
+  assert(page < t->n_mapped);
+
+  ZixFileBTreeNode* const node = zix_file_btree_page(t, page);
+  node->is_leaf                = leaf;
+  node->n_keys                 = 0U;
+  node->reserved               = 0U;
+  return page;
+}
+
+static bool
+zix_file_btree_is_valid(const ZixFileBTree* const t)
+{
+  const ZixFileBTreeHeader* const header = zix_file_btree_header(t);
+
+  return !memcmp(header->magic, zix_file_btree_magic, sizeof(header->magic)) &&
+         header->version == ZIX_FILE_BTREE_VERSION &&
+         header->page_size == ZIX_FILE_BTREE_PAGE_SIZE &&
+         header->n_pages <= t->n_mapped && header->height > 0U &&
+         header->height <= ZIX_FILE_BTREE_MAX_HEIGHT &&
+         header->height < header->n_pages && zix_file_btree_root(t);
+}
+
+ZixFileBTree*
+zix_file_btree_open(ZixAllocator* const allocator, const char* const path)
+{
+  assert(path);
+
+#if USE_MMAP
+  ZixFileBTree* const t =
+    (ZixFileBTree*)zix_malloc(allocator, sizeof(ZixFileBTree));
+
+  if (!t) {
+    return NULL;
+  }
+
+  t->allocator = allocator;
+  t->base      = NULL;
+  t->n_mapped  = 0U;
+
+  struct stat st;
+  if ((t->fd = open(path, O_RDWR | O_CREAT, 0644)) < 0) {
+    zix_free(allocator, t);
+    return NULL;
+  }
+
+  if (fstat(t->fd, &st) || st.st_size % ZIX_FILE_BTREE_PAGE_SIZE) {
+    zix_file_btree_close(t);
+    return NULL;
+  }
+
+  if (!st.st_size) {
+    // Write a new file with only a header and an empty root leaf
+    if (zix_file_btree_reserve(t, ZIX_FILE_BTREE_INITIAL_PAGES)) {
+      zix_file_btree_close(t);
+      return NULL;
+    }
+
+    ZixFileBTreeHeader* const header = zix_file_btree_header(t);
+    memcpy(header->magic, zix_file_btree_magic, sizeof(header->magic));
+    header->version   = ZIX_FILE_BTREE_VERSION;
+    header->page_size = ZIX_FILE_BTREE_PAGE_SIZE;
+    header->n_pages   = 1U;
+    header->height    = 1U;
+    header->size      = 0U;
+    header->root      = zix_file_btree_new_node(t, true);
+
+  } else if (zix_file_btree_map(
+               t, (uint64_t)st.st_size / ZIX_FILE_BTREE_PAGE_SIZE) ||
+             !zix_file_btree_is_valid(t)) {
+    zix_file_btree_close(t);
+    return NULL;
+  }
+
+  return t;
+#else
+  (void)allocator;
+  return NULL;
+#endif
+}
+
+void
+zix_file_btree_close(ZixFileBTree* const t)
+{
+  if (t) {
+#if USE_MMAP
+    if (t->base) {
+      munmap(t->base, (size_t)(t->n_mapped * ZIX_FILE_BTREE_PAGE_SIZE));
+    }
+
+    close(t->fd);
+#endif
+
+    zix_free(t->allocator, t);
+  }
+}
+
+ZixStatus
+zix_file_btree_sync(ZixFileBTree* const t)
+{
+  assert(t);
+
+#if USE_MMAP
+  const size_t length = (size_t)(t->n_mapped * ZIX_FILE_BTREE_PAGE_SIZE);
+
+  return msync(t->base, length, MS_SYNC) ? ZIX_STATUS_ERROR
+                                         : ZIX_STATUS_SUCCESS;
+#else
+  return ZIX_STATUS_ERROR;
+#endif
+}
+
+size_t
+zix_file_btree_size(const ZixFileBTree* const t)
+{
+  assert(t);
+  return (size_t)zix_file_btree_header(t)->size;
+}
+
+/// Split the full ith child of internal node `n` into two nodes
+static void
+zix_file_btree_split_child(const ZixFileBTree* const t,
+                           ZixFileBTreeNode* const   n,
+                           const unsigned            i)
+{
+  uint64_t* const         children = zix_file_btree_links(n);
+  ZixFileBTreeNode* const lhs      = zix_file_btree_page(t, children[i]);
+  const uint64_t          rhs_page = zix_file_btree_new_node(t, lhs->is_leaf);
+  ZixFileBTreeNode* const rhs      = zix_file_btree_page(t, rhs_page);
+
+  assert(zix_file_btree_is_full(lhs));
+  assert(!zix_file_btree_is_full(n));
+
+  const unsigned max_keys = zix_file_btree_max_keys(lhs);
+  uint64_t       separator = 0U;
+
+  if (lhs->is_leaf) {
+    // Leaves keep every entry, the first key in the RHS is copied up
+    lhs->n_keys = (uint16_t)(max_keys / 2U);
+    rhs->n_keys = (uint16_t)(max_keys - lhs->n_keys);
+
+    memcpy(rhs->words,
+           lhs->words + lhs->n_keys,
+           rhs->n_keys * sizeof(uint64_t));
+    memcpy(zix_file_btree_links(rhs),
+           zix_file_btree_links(lhs) + lhs->n_keys,
+           rhs->n_keys * sizeof(uint64_t));
+
+    separator = rhs->words[0];
+  } else {
+    // Internal nodes move the middle key up to the parent
+    lhs->n_keys = (uint16_t)(max_keys / 2U);
+    rhs->n_keys = (uint16_t)(max_keys - lhs->n_keys - 1U);
+
+    memcpy(rhs->words,
+           lhs->words + lhs->n_keys + 1U,
+           rhs->n_keys * sizeof(uint64_t));
+    memcpy(zix_file_btree_links(rhs),
+           zix_file_btree_links(lhs) + lhs->n_keys + 1U,
+           (rhs->n_keys + 1U) * sizeof(uint64_t));
+
+    separator = lhs->words[lhs->n_keys];
+  }
+
+  zix_file_btree_ainsert(n->words, n->n_keys, i, separator);
+  zix_file_btree_ainsert(children, n->n_keys + 1U, i + 1U, rhs_page);
+  ++n->n_keys;
+}
+
+ZixStatus
+zix_file_btree_insert(ZixFileBTree* const t,
+                      const uint64_t      key,
+                      const uint64_t      value)
+{
+  assert(t);
+
+  /* Reserve enough pages to split every node on the path and grow a new
+     root, so the file is never remapped while node pointers are held. */
+
+  const ZixFileBTreeHeader* const old_header = zix_file_btree_header(t);
+  const ZixStatus                 st         = zix_file_btree_reserve(
+    t, old_header->n_pages + old_header->height + 1U);
+  if (st) {
+    return st;
+  }
+
+  ZixFileBTreeHeader* const header = zix_file_btree_header(t);
+  ZixFileBTreeNode*         n      = zix_file_btree_root(t);
+  if (!n) {
+    return ZIX_STATUS_BAD_ARG;
+  }
+
+  if (zix_file_btree_is_full(n)) {
+    if (header->height >= ZIX_FILE_BTREE_MAX_HEIGHT) {
+      return ZIX_STATUS_OVERFLOW;
+    }
+
+    // Grow up by splitting the old root under a new one
+    const uint64_t          root_page = zix_file_btree_new_node(t, false);
+    ZixFileBTreeNode* const root      = zix_file_btree_page(t, root_page);
+
+    zix_file_btree_links(root)[0] = header->root;
+    zix_file_btree_split_child(t, root, 0U);
+
+    header->root = root_page;
+    ++header->height;
+    n = root;
+  }
+
+  // Walk down, splitting full nodes on the way so there is always room
+  for (uint64_t level = 1U; level < header->height; ++level) {
+    unsigned                i     = zix_file_btree_child_index(n, key);
+    const bool              leaf  = level + 1U == header->height;
+    ZixFileBTreeNode* const child =
+      zix_file_btree_node(t, zix_file_btree_links(n)[i], leaf);
+
+    if (!child) {
+      return ZIX_STATUS_BAD_ARG;
+    }
+
+    if (zix_file_btree_is_full(child)) {
+      zix_file_btree_split_child(t, n, i);
+      if (key >= n->words[i]) {
+        ++i; // Key is at or after the new separator, move right
+      }
+    }
+
+    n = zix_file_btree_page(t, zix_file_btree_links(n)[i]);
+  }
+
+  const unsigned i = zix_file_btree_find_key(n, key);
+  if (i < n->n_keys && n->words[i] == key) {
+    return ZIX_STATUS_EXISTS;
+  }
+
+  zix_file_btree_ainsert(n->words, n->n_keys, i, key);
+  zix_file_btree_ainsert(zix_file_btree_links(n), n->n_keys, i, value);
+  ++n->n_keys;
+  ++header->size;
+  return ZIX_STATUS_SUCCESS;
+}
+
+/// Return the leaf that may contain `key`, or null if the file is corrupt
+static ZixFileBTreeNode*
+zix_file_btree_find_leaf(const ZixFileBTree* const t, const uint64_t key)
+{
+  const uint64_t    height = zix_file_btree_header(t)->height;
+  ZixFileBTreeNode* n      = zix_file_btree_root(t);
+
+  for (uint64_t level = 1U; n && level < height; ++level) {
+    const unsigned i    = zix_file_btree_child_index(n, key);
+    const bool     leaf = level + 1U == height;
+
+    n = zix_file_btree_node(t, zix_file_btree_links(n)[i], leaf);
+  }
+
+  return n;
+}
+
+ZixStatus
+zix_file_btree_remove(ZixFileBTree* const t,
+                      const uint64_t      key,
+                      uint64_t* const     value)
+{
+  assert(t);
+
+  ZixFileBTreeNode* const n = zix_file_btree_find_leaf(t, key);
+  if (!n) {
+    return ZIX_STATUS_BAD_ARG;
+  }
+
+  const unsigned i = zix_file_btree_find_key(n, key);
+  if (i == n->n_keys || n->words[i] != key) {
+    return ZIX_STATUS_NOT_FOUND;
+  }
+
+  // Simply erase from the leaf, separators above are still valid bounds
+  uint64_t* const values = zix_file_btree_links(n);
+  if (value) {
+    *value = values[i];
+  }
+
+  --n->n_keys;
+  memmove(n->words + i, n->words + i + 1U, (n->n_keys - i) * sizeof(key));
+  memmove(values + i, values + i + 1U, (n->n_keys - i) * sizeof(key));
+  --zix_file_btree_header(t)->size;
+  return ZIX_STATUS_SUCCESS;
+}
+
+ZixStatus
+zix_file_btree_find(const ZixFileBTree* const t,
+                    const uint64_t            key,
+                    uint64_t* const           value)
+{
+  assert(t);
+
+  ZixFileBTreeNode* const n = zix_file_btree_find_leaf(t, key);
+  if (!n) {
+    return ZIX_STATUS_BAD_ARG;
+  }
+
+  const unsigned i = zix_file_btree_find_key(n, key);
+  if (i == n->n_keys || n->words[i] != key) {
+    return ZIX_STATUS_NOT_FOUND;
+  }
+
+  if (value) {
+    *value = zix_file_btree_links(n)[i];
+  }
+
+  return ZIX_STATUS_SUCCESS;
+}
+
+/**
+   Move `ti` from the end of its leaf to the first entry in a later leaf.
+
+   Removal can leave leaves empty, so this moves up until there is a next
+   child, then down its left edge, and repeats until it finds an entry.
+*/
+static ZixStatus
+zix_file_btree_next_leaf(const ZixFileBTree* const t,
+                         ZixFileBTreeIter* const   ti)
+{
+  const uint64_t height = zix_file_btree_header(t)->height;
+
+  for (;;) {
+    // Move up until there is a next child
+    do {
+      if (!ti->level) {
+        *ti = zix_file_btree_end_iter;
+        return ZIX_STATUS_REACHED_END;
+      }
+
+      --ti->level;
+    } while (ti->indexes[ti->level] >=
+             zix_file_btree_page(t, ti->pages[ti->level])->n_keys);
+
+    ++ti->indexes[ti->level];
+
+    // Move down the left edge of the next child to a leaf
+    for (uint16_t l = ti->level; l + 1U < height; ++l) {
+      ZixFileBTreeNode* const n    = zix_file_btree_page(t, ti->pages[l]);
+      const uint64_t          page = zix_file_btree_links(n)[ti->indexes[l]];
+      if (!zix_file_btree_node(t, page, l + 2U == height)) {
+        *ti = zix_file_btree_end_iter;
+        return ZIX_STATUS_BAD_ARG;
+      }
+
+      ti->pages[l + 1U]   = page;
+      ti->indexes[l + 1U] = 0U;
+      ti->level           = (uint16_t)(l + 1U);
+    }
+
+    if (zix_file_btree_page(t, ti->pages[ti->level])->n_keys) {
+      return ZIX_STATUS_SUCCESS;
+    }
+  }
+}
+
+ZixStatus
+zix_file_btree_lower_bound(const ZixFileBTree* const t,
+                           const uint64_t            key,
+                           ZixFileBTreeIter* const   ti)
+{
+  assert(t);
+  assert(ti);
+
+  const ZixFileBTreeHeader* const header = zix_file_btree_header(t);
+  ZixFileBTreeNode*               n      = zix_file_btree_root(t);
+
+  // Walk down to the leaf that may contain the key, like a search
+  *ti          = zix_file_btree_end_iter;
+  ti->pages[0] = header->root;
+  for (uint16_t l = 0U; n && l + 1U < header->height; ++l) {
+    const unsigned i    = zix_file_btree_child_index(n, key);
+    const uint64_t page = zix_file_btree_links(n)[i];
+    const bool     leaf = l + 2U == header->height;
+
+    n                 = zix_file_btree_node(t, page, leaf);
+    ti->indexes[l]    = (uint16_t)i;
+    ti->pages[l + 1U] = page;
+    ti->level         = (uint16_t)(l + 1U);
+  }
+
+  if (!n) {
+    *ti = zix_file_btree_end_iter;
+    return ZIX_STATUS_BAD_ARG;
+  }
+
+  // Every later entry is after this point, which may be the end of the leaf
+  ti->indexes[ti->level] = (uint16_t)zix_file_btree_find_key(n, key);
+  if (ti->indexes[ti->level] < n->n_keys) {
+    return ZIX_STATUS_SUCCESS;
+  }
+
+  const ZixStatus st = zix_file_btree_next_leaf(t, ti);
+  return st == ZIX_STATUS_REACHED_END ? ZIX_STATUS_SUCCESS : st;
+}
+
+ZixStatus
+zix_file_btree_begin(const ZixFileBTree* const t, ZixFileBTreeIter* const ti)
+{
+  return zix_file_btree_lower_bound(t, 0U, ti);
+}
+
+uint64_t
+zix_file_btree_iter_key(const ZixFileBTree* const t, const ZixFileBTreeIter i)
+{
+  assert(t);
+  assert(!zix_file_btree_iter_is_end(i));
+
+  const ZixFileBTreeNode* const n = zix_file_btree_page(t, i.pages[i.level]);
+
+  assert(n->is_leaf);
+  assert(i.indexes[i.level] < n->n_keys);
+  return n->words[i.indexes[i.level]];
+}
+
+uint64_t
+zix_file_btree_iter_value(const ZixFileBTree* const t, const ZixFileBTreeIter i)
+{
+  assert(t);
+  assert(!zix_file_btree_iter_is_end(i));
+
+  ZixFileBTreeNode* const n = zix_file_btree_page(t, i.pages[i.level]);
+
+  assert(n->is_leaf);
+  assert(i.indexes[i.level] < n->n_keys);
+  return zix_file_btree_links(n)[i.indexes[i.level]];
+}
+
+ZixStatus
+zix_file_btree_iter_increment(const ZixFileBTree* const t,
+                              ZixFileBTreeIter* const   i)
+{
+  assert(t);
+  assert(i);
+  assert(!zix_file_btree_iter_is_end(*i));
+
+  const ZixFileBTreeNode* const n = zix_file_btree_page(t, i->pages[i->level]);
+
+  return (++i->indexes[i->level] < n->n_keys) ? ZIX_STATUS_SUCCESS
+                                               : zix_file_btree_next_leaf(t, i);
+}
@@ -0,0 +1,256 @@
+// Copyright 2021 David Robillard <d@drobilla.net>
+// SPDX-License-Identifier: ISC
+
+#include "zix/pool_allocator.h"
+#include "zix/allocator.h"
+#include "zix/attributes.h"
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+static const size_t page_size   = ZIX_POOL_ALLOCATOR_PAGE_SIZE;
+static const size_t granularity = ZIX_POOL_ALLOCATOR_GRANULARITY;
+static const size_t max_size    = ZIX_POOL_ALLOCATOR_MAX_SIZE;
+
+/**
+   The header at the start of every page.
+
+   Every page is aligned to the page size, so the page that contains a block
+   (and therefore its size) can be found by masking off the low bits of its
+   address.  Pages for large allocations may span several page sizes, but the
+   block itself always starts in the first one, so this works for them too.
+*/
+struct ZixPoolAllocatorPageImpl {
+  ZixPoolAllocatorPage* prev;       ///< Previous page in the pool
+  ZixPoolAllocatorPage* next;       ///< Next page in the pool
+  size_t                block_size; ///< Size of every block in this page
+};
+
+static size_t
+round_up_multiple(const size_t number, const size_t factor)
+{
+  assert(factor);                        // Factor must be non-zero
+  assert((factor & (factor - 1)) == 0U); // Factor must be a power of two
+
+  return (number + factor - 1U) & ~(factor - 1U);
+}
+
+static size_t
+header_size(void)
+{
+  return round_up_multiple(sizeof(ZixPoolAllocatorPage), granularity);
+}
+
+static ZixPoolAllocatorPage*
+block_page(void* const ptr)
+{
+  return (ZixPoolAllocatorPage*)((uintptr_t)ptr & ~(uintptr_t)(page_size - 1U));
+}
+
+static ZixPoolAllocatorPage*
+new_page(ZixPoolAllocator* const state,
+         const size_t            total_size,
+         const size_t            block_size)
+{
+  ZixPoolAllocatorPage* const page = (ZixPoolAllocatorPage*)zix_aligned_alloc(
+    state->backing, page_size, total_size);
+
+  if (page) {
+    page->prev       = NULL;
+    page->next       = state->pages;
+    page->block_size = block_size;
+    if (state->pages) {
+      state->pages->prev = page;
+    }
+
+    state->pages = page;
+  }
+
+  return page;
+}
+
+ZIX_MALLOC_FUNC
+static void*
+zix_pool_large_malloc(ZixPoolAllocator* const state, const size_t size)
+{
+  const size_t header = header_size();
+  if (size > SIZE_MAX - header - page_size) {
+    return NULL;
+  }
+
+  const size_t total = round_up_multiple(header + size, page_size);
+
+  ZixPoolAllocatorPage* const page = new_page(state, total, total - header);
+
+  return page ? (void*)((char*)page + header) : NULL;
+}
+
+static void
+zix_pool_large_free(ZixPoolAllocator* const     state,
+                    ZixPoolAllocatorPage* const page)
+{
+  if (page->prev) {
+    page->prev->next = page->next;
+  } else {
+    state->pages = page->next;
+  }
+
+  if (page->next) {
+    page->next->prev = page->prev;
+  }
+
+  zix_aligned_free(state->backing, page);
+}
+
+ZIX_MALLOC_FUNC
+static void*
+zix_pool_malloc(ZixAllocator* const allocator, const size_t size)
+{
+  ZixPoolAllocator* const state = (ZixPoolAllocator*)allocator;
+  if (size > max_size) {
+    return zix_pool_large_malloc(state, size);
+  }
+
+  const size_t bin_index = size ? ((size - 1U) / granularity) : 0U;
+  const size_t real_size = (bin_index + 1U) * granularity;
+
+  ZixPoolAllocatorBin* const bin = &state->bins[bin_index];
+
+  // Reuse the most recently freed block if possible
+  void* const block = bin->free;
+  if (block) {
+    bin->free = *(void**)block;
+    return block;
+  }
+
+  // Otherwise, take space from the newest page, allocating one if necessary
+  if (!bin->top || (size_t)(bin->end - bin->top) < real_size) {
+    ZixPoolAllocatorPage* const page = new_page(state, page_size, real_size);
+    if (!page) {
+      return NULL;
+    }
+
+    bin->top = (char*)page + header_size();
+    bin->end = (char*)page + page_size;
+  }
+
+  char* const ptr = bin->top;
+  bin->top += real_size;
+  return ptr;
+}
+
+ZIX_MALLOC_FUNC
+static void*
+zix_pool_calloc(ZixAllocator* const allocator,
+                const size_t        nmemb,
+                const size_t        size)
+{
+  if (size && nmemb > SIZE_MAX / size) {
+    return NULL;
+  }
+
+  const size_t total_size = nmemb * size;
+  void* const  ptr        = zix_pool_malloc(allocator, total_size);
+  if (ptr) {
+    memset(ptr, 0, total_size);
+  }
+
+  return ptr;
+}
+
+static void
+zix_pool_free(ZixAllocator* const allocator, void* const ptr)
+{
+  ZixPoolAllocator* const state = (ZixPoolAllocator*)allocator;
+  if (!ptr) {
+    return;
+  }
+
+  ZixPoolAllocatorPage* const page = block_page(ptr);
+  if (page->block_size > max_size) {
+    zix_pool_large_free(state, page);
+    return;
+  }
+
+  const size_t               bin_index = page->block_size / granularity - 1U;
+  ZixPoolAllocatorBin* const bin       = &state->bins[bin_index];
+
+  *(void**)ptr = bin->free;
+  bin->free    = ptr;
+}
+
+static void*
+zix_pool_realloc(ZixAllocator* const allocator,
+                 void* const         ptr,
+                 const size_t        size)
+{
+  if (!ptr) {
+    return zix_pool_malloc(allocator, size);
+  }
+
+  // Keep the same block if it fits and isn't much too large
+  const size_t old_size = block_page(ptr)->block_size;
+  if (size <= old_size && (old_size <= max_size || size > max_size)) {
+    return ptr;
+  }
+
+  void* const new_ptr = zix_pool_malloc(allocator, size);
+  if (new_ptr) {
+    memcpy(new_ptr, ptr, size < old_size ? size : old_size);
+    zix_pool_free(allocator, ptr);
+  }
+
+  return new_ptr;
+}
+
+ZIX_MALLOC_FUNC
+static void*
+zix_pool_aligned_alloc(ZixAllocator* const allocator,
+                       const size_t        alignment,
+                       const size_t        size)
+{
+  ZixPoolAllocator* const state = (ZixPoolAllocator*)allocator;
+
+  return zix_aligned_alloc(state->backing, alignment, size);
+}
+
+static void
+zix_pool_aligned_free(ZixAllocator* const allocator, void* const ptr)
+{
+  ZixPoolAllocator* const state = (ZixPoolAllocator*)allocator;
+
+  zix_aligned_free(state->backing, ptr);
+}
+
+ZixPoolAllocator
+zix_pool_allocator(ZixAllocator* const backing)
+{
+  ZixPoolAllocator pool_allocator;
+  memset(&pool_allocator, 0, sizeof(pool_allocator));
+
+  pool_allocator.base.malloc        = zix_pool_malloc;
+  pool_allocator.base.calloc        = zix_pool_calloc;
+  pool_allocator.base.realloc       = zix_pool_realloc;
+  pool_allocator.base.free          = zix_pool_free;
+  pool_allocator.base.aligned_alloc = zix_pool_aligned_alloc;
+  pool_allocator.base.aligned_free  = zix_pool_aligned_free;
+  pool_allocator.backing            = backing;
+
+  return pool_allocator;
+}
+
+void
+zix_pool_allocator_clear(ZixPoolAllocator* const allocator)
+{
+  ZixPoolAllocatorPage* page = allocator->pages;
+  while (page) {
+    ZixPoolAllocatorPage* const next = page->next;
+    zix_aligned_free(allocator->backing, page);
+    page = next;
+  }
+
+  allocator->pages = NULL;
+  memset(allocator->bins, 0, sizeof(allocator->bins));
+}
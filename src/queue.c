@@ -0,0 +1,218 @@
+// Copyright 2022 David Robillard <d@drobilla.net>
+// SPDX-License-Identifier: ISC
+
+#include "zix/queue.h"
+
+#include "zix_atomic.h"
+#include "zix_config.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if !ZIX_ATOMIC_RMW
+#  error "ZixQueue requires atomic read-modify-write operations"
+#endif
+
+#if USE_MLOCK
+#  include <sys/mman.h>
+#  define ZIX_MLOCK(ptr, size) mlock((ptr), (size))
+#elif defined(_WIN32)
+#  include <windows.h>
+#  define ZIX_MLOCK(ptr, size) VirtualLock((ptr), (size))
+#else
+#  pragma message("warning: No memory locking, possible RT violations")
+#  define ZIX_MLOCK(ptr, size)
+#endif
+
+/// Size of a cache line, used to keep the reader and writer fields apart
+#define ZIX_QUEUE_CACHE_LINE 64U
+
+/*
+  This is the bounded queue described by Dmitry Vyukov, where every slot has a
+  sequence number that says whether it is ready to be written or read.  A
+  writer claims the slot at the back by incrementing the back position, but
+  only if the slot's sequence shows that it has been emptied, then copies the
+  element in and advances the sequence to publish it.  Readers do the same
+  with the front position, and advance the sequence by a whole lap when they
+  empty a slot, so it is ready for the writer of the next lap.
+
+  So, writers only contend with writers, and readers with readers, except when
+  the queue is nearly full or empty and they meet at the same slot.  Both
+  read the constant fields on every operation, but each group only writes its
+  own position, so each position gets a cache line to itself, and a write to
+  one doesn't evict the constants or the other position from any other core.
+  Since positions are only a word, a line of padding after each (and after
+  the constants) is enough to ensure this without aligning the allocation.
+*/
+
+typedef struct {
+  uintptr_t sequence; ///< Position this slot is ready for (plus one if full)
+} ZixQueueSlot;
+
+struct ZixQueueImpl {
+  // Constant after creation
+  ZixAllocator* allocator; ///< User allocator
+  ZixQueueSlot* slots;     ///< Slot array, each a ZixQueueSlot then data
+  uint32_t      n_slots;   ///< Number of slots (a power of two)
+  uint32_t      mask;      ///< Mask for fast modulo
+  uint32_t      slot_size; ///< Size of element data in a slot
+  uint32_t      stride;    ///< Distance between slots in ZixQueueSlots
+  char          pad0[ZIX_QUEUE_CACHE_LINE];
+
+  // Contended by writers
+  uintptr_t back; ///< Position of the next slot to write
+  char      pad1[ZIX_QUEUE_CACHE_LINE];
+
+  // Contended by readers
+  uintptr_t front; ///< Position of the next slot to read
+  char      pad2[ZIX_QUEUE_CACHE_LINE];
+};
+
+static inline uint32_t
+next_power_of_two(uint32_t size)
+{
+  // http://graphics.stanford.edu/~seander/bithacks.html#RoundUpPowerOf2
+  size--;
+  size |= size >> 1U;
+  size |= size >> 2U;
+  size |= size >> 4U;
+  size |= size >> 8U;
+  size |= size >> 16U;
+  size++;
+  return size;
+}
+
+static inline ZixQueueSlot*
+queue_slot(const ZixQueue* const queue, const uintptr_t pos)
+{
+  return queue->slots + (size_t)(pos & queue->mask) * queue->stride;
+}
+
+ZixQueue*
+zix_queue_new(ZixAllocator* const allocator,
+              const uint32_t      n_slots,
+              const uint32_t      slot_size)
+{
+  static const uint32_t align = (uint32_t)sizeof(ZixQueueSlot);
+
+  if (n_slots > UINT32_MAX / 2U + 1U ||
+      slot_size > UINT32_MAX - 2U * align) {
+    return NULL;
+  }
+
+  // At least two slots are needed to tell a full slot from an empty one
+  const uint32_t size   = n_slots > 2U ? next_power_of_two(n_slots) : 2U;
+  const uint32_t stride = 1U + (slot_size + align - 1U) / align;
+  if ((size_t)size > SIZE_MAX / sizeof(ZixQueueSlot) / stride) {
+    return NULL;
+  }
+
+  ZixQueue* const queue = (ZixQueue*)zix_malloc(allocator, sizeof(ZixQueue));
+
+  if (queue) {
+    memset(queue, 0, sizeof(ZixQueue));
+    queue->allocator = allocator;
+    queue->n_slots   = size;
+    queue->mask      = size - 1U;
+    queue->slot_size = slot_size;
+    queue->stride    = stride;
+
+    if (!(queue->slots = (ZixQueueSlot*)zix_malloc(
+            allocator, (size_t)size * stride * sizeof(ZixQueueSlot)))) {
+      zix_free(allocator, queue);
+      return NULL;
+    }
+
+    // Every slot starts ready to be written in the first lap
+    for (uint32_t i = 0U; i < size; ++i) {
+      queue_slot(queue, i)->sequence = i;
+    }
+  }
+
+  return queue;
+}
+
+void
+zix_queue_free(ZixQueue* const queue)
+{
+  if (queue) {
+    zix_free(queue->allocator, queue->slots);
+    zix_free(queue->allocator, queue);
+  }
+}
+
+void
+zix_queue_mlock(ZixQueue* const queue)
+{
+  ZIX_MLOCK(queue, sizeof(ZixQueue));
+  ZIX_MLOCK(queue->slots,
+            (size_t)queue->n_slots * queue->stride * sizeof(ZixQueueSlot));
+}
+
+uint32_t
+zix_queue_capacity(const ZixQueue* const queue)
+{
+  return queue->n_slots;
+}
+
+uint32_t
+zix_queue_slot_size(const ZixQueue* const queue)
+{
+  return queue->slot_size;
+}
+
+bool
+zix_queue_push(ZixQueue* const queue, const void* const src)
+{
+  uintptr_t     pos  = zix_atomic_load_relaxed(&queue->back);
+  ZixQueueSlot* slot = NULL;
+
+  for (;;) {
+    slot = queue_slot(queue, pos);
+
+    const uintptr_t seq = zix_atomic_load(&slot->sequence);
+    if (seq == pos) {
+      // Slot is empty, try to claim it
+      if (zix_atomic_cas(&queue->back, pos, pos + 1U)) {
+        break;
+      }
+    } else if ((intptr_t)(seq - pos) < 0) {
+      return false; // Slot still holds an element from the last lap (full)
+    }
+
+    pos = zix_atomic_load_relaxed(&queue->back);
+  }
+
+  memcpy(slot + 1, src, queue->slot_size);
+  zix_atomic_store(&slot->sequence, pos + 1U);
+  return true;
+}
+
+bool
+zix_queue_pop(ZixQueue* const queue, void* const dst)
+{
+  uintptr_t     pos  = zix_atomic_load_relaxed(&queue->front);
+  ZixQueueSlot* slot = NULL;
+
+  for (;;) {
+    slot = queue_slot(queue, pos);
+
+    const uintptr_t seq = zix_atomic_load(&slot->sequence);
+    if (seq == pos + 1U) {
+      // Slot is full, try to claim it
+      if (zix_atomic_cas(&queue->front, pos, pos + 1U)) {
+        break;
+      }
+    } else if ((intptr_t)(seq - (pos + 1U)) < 0) {
+      return false; // Slot hasn't been written in this lap yet (empty)
+    }
+
+    pos = zix_atomic_load_relaxed(&queue->front);
+  }
+
+  memcpy(dst, slot + 1, queue->slot_size);
+  zix_atomic_store(&slot->sequence, pos + queue->mask + 1U);
+  return true;
+}
@@ -0,0 +1,865 @@
+// Copyright 2011-2022 David Robillard <d@drobilla.net>
+// SPDX-License-Identifier: ISC
+
+#include "zix/radix_tree.h"
+
+#if defined(__SSE2__) && defined(__GNUC__)
+#  include <emmintrin.h>
+#  define ZIX_RADIX_TREE_SSE2 1
+#else
+#  define ZIX_RADIX_TREE_SSE2 0
+#endif
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/// Type of an internal node, which determines how many children it can have
+typedef enum {
+  ZIX_RADIX_TREE_NODE4,
+  ZIX_RADIX_TREE_NODE16,
+  ZIX_RADIX_TREE_NODE48,
+  ZIX_RADIX_TREE_NODE256,
+} ZixRadixTreeNodeType;
+
+/**
+   The header at the start of every internal node.
+
+   A node branches on the key byte at `depth`, and every key below it has the
+   same bytes before that, which are stored in `prefix` with the rest zeroed.
+   Since the prefix is the absolute start of the key, it remains valid when
+   levels are added or removed above the node, so the bytes of skipped levels
+   never need to be stored.
+
+   Children point to either internal nodes or leaves.  Leaves are tagged by
+   setting the lowest bit of the pointer, which is otherwise always zero.
+*/
+struct ZixRadixTreeNodeImpl {
+  uint8_t  type;       ///< ZixRadixTreeNodeType
+  uint8_t  depth;      ///< Index of the key byte that this node branches on
+  uint16_t n_children; ///< Number of children
+  uint64_t prefix;     ///< Key bytes before depth, followed by zeros
+};
+
+struct ZixRadixTreeLeafImpl {
+  uint64_t key;
+  void*    value;
+};
+
+/// A node with up to 4 children, with keys in increasing order
+typedef struct {
+  ZixRadixTreeNode base;
+  uint8_t          keys[4];
+  void*            children[4];
+} ZixRadixTreeNode4;
+
+/// A node with up to 16 children, with keys in increasing order
+typedef struct {
+  ZixRadixTreeNode base;
+  uint8_t          keys[16];
+  void*            children[16];
+} ZixRadixTreeNode16;
+
+/// A node with up to 48 children, indexed by one more than their position
+typedef struct {
+  ZixRadixTreeNode base;
+  uint8_t          index[256];
+  void*            children[48];
+} ZixRadixTreeNode48;
+
+/// A node with up to 256 children, indexed directly by key byte
+typedef struct {
+  ZixRadixTreeNode base;
+  void*            children[256];
+} ZixRadixTreeNode256;
+
+struct ZixRadixTreeImpl {
+  ZixAllocator* allocator; ///< User allocator
+  void*         root;      ///< Root node or leaf, or null if empty
+  size_t        size;      ///< Number of entries
+};
+
+/// Return the byte of `key` at `depth`, where 0 is the most significant
+static uint8_t
+zix_radix_tree_key_byte(const uint64_t key, const unsigned depth)
+{
+  return (uint8_t)(key >> (56U - (8U * depth)));
+}
+
+/// Return the bytes of `key` before `depth`, followed by zeros
+static uint64_t
+zix_radix_tree_prefix(const uint64_t key, const unsigned depth)
+{
+  return depth ? (key & (UINT64_MAX << (64U - (8U * depth)))) : 0U;
+}
+
+/// Return the index of the first byte that differs between `a` and `b`
+static unsigned
+zix_radix_tree_first_difference(const uint64_t a, const uint64_t b)
+{
+  assert(a != b);
+
+  const uint64_t diff  = a ^ b;
+  unsigned       depth = 0U;
+  while (!zix_radix_tree_key_byte(diff, depth)) {
+    ++depth;
+  }
+
+  return depth;
+}
+
+static bool
+zix_radix_tree_is_leaf(const void* const child)
+{
+  return (uintptr_t)child & 1U;
+}
+
+static ZixRadixTreeLeaf*
+zix_radix_tree_leaf(void* const child)
+{
+  assert(zix_radix_tree_is_leaf(child));
+  return (ZixRadixTreeLeaf*)((uintptr_t)child & ~(uintptr_t)1U);
+}
+
+static void*
+zix_radix_tree_leaf_child(ZixRadixTreeLeaf* const leaf)
+{
+  return (void*)((uintptr_t)leaf | 1U);
+}
+
+static unsigned
+zix_radix_tree_capacity(const ZixRadixTreeNodeType type)
+{
+  return (type == ZIX_RADIX_TREE_NODE4)    ? 4U
+         : (type == ZIX_RADIX_TREE_NODE16) ? 16U
+         : (type == ZIX_RADIX_TREE_NODE48) ? 48U
+                                           : 256U;
+}
+
+/**
+   Return the number of children that a node shrinks at.
+
+   This is a bit less than the capacity of the next smaller type, so that
+   alternating insertions and removals don't resize the node every time.
+*/
+static unsigned
+zix_radix_tree_min_children(const ZixRadixTreeNodeType type)
+{
+  return (type == ZIX_RADIX_TREE_NODE4)    ? 1U
+         : (type == ZIX_RADIX_TREE_NODE16) ? 3U
+         : (type == ZIX_RADIX_TREE_NODE48) ? 12U
+                                           : 37U;
+}
+
+static ZixRadixTreeNode*
+zix_radix_tree_node_new(const ZixRadixTree* const  t,
+                        const ZixRadixTreeNodeType type,
+                        const unsigned             depth,
+                        const uint64_t             prefix)
+{
+  const size_t size =
+    (type == ZIX_RADIX_TREE_NODE4)    ? sizeof(ZixRadixTreeNode4)
+    : (type == ZIX_RADIX_TREE_NODE16) ? sizeof(ZixRadixTreeNode16)
+    : (type == ZIX_RADIX_TREE_NODE48) ? sizeof(ZixRadixTreeNode48)
+                                      : sizeof(ZixRadixTreeNode256);
+
+  ZixRadixTreeNode* const n =
+    (ZixRadixTreeNode*)zix_calloc(t->allocator, 1U, size);
+  if (n) {
+    n->type   = (uint8_t)type;
+    n->depth  = (uint8_t)depth;
+    n->prefix = prefix;
+  }
+
+  return n;
+}
+
+/// Return the position of `key` in a node with 16 sorted keys, or -1
+static int
+zix_radix_tree_find16(const ZixRadixTreeNode16* const n, const uint8_t key)
+{
+#if ZIX_RADIX_TREE_SSE2
+  // Compare every key at once, and take the first match in range
+  const __m128i keys = _mm_loadu_si128((const __m128i*)(const void*)n->keys);
+  const __m128i hits = _mm_cmpeq_epi8(keys, _mm_set1_epi8((char)key));
+  const unsigned mask =
+    (unsigned)_mm_movemask_epi8(hits) & ((1U << n->base.n_children) - 1U);
+
+  return mask ? __builtin_ctz(mask) : -1;
+#else
+  for (unsigned i = 0U; i < n->base.n_children; ++i) {
+    if (n->keys[i] == key) {
+      return (int)i;
+    }
+  }
+
+  return -1;
+#endif
+}
+
+/// Return a pointer to the child of `n` for `key`, or null
+static void**
+zix_radix_tree_find_child(ZixRadixTreeNode* const n, const uint8_t key)
+{
+  switch ((ZixRadixTreeNodeType)n->type) {
+  case ZIX_RADIX_TREE_NODE4: {
+    ZixRadixTreeNode4* const n4 = (ZixRadixTreeNode4*)n;
+    for (unsigned i = 0U; i < n->n_children; ++i) {
+      if (n4->keys[i] == key) {
+        return &n4->children[i];
+      }
+    }
+    break;
+  }
+
+  case ZIX_RADIX_TREE_NODE16: {
+    ZixRadixTreeNode16* const n16 = (ZixRadixTreeNode16*)n;
+    const int                 i   = zix_radix_tree_find16(n16, key);
+    return (i >= 0) ? &n16->children[i] : NULL;
+  }
+
+  case ZIX_RADIX_TREE_NODE48: {
+    ZixRadixTreeNode48* const n48 = (ZixRadixTreeNode48*)n;
+    const unsigned            i   = n48->index[key];
+    return i ? &n48->children[i - 1U] : NULL;
+  }
+
+  case ZIX_RADIX_TREE_NODE256: {
+    ZixRadixTreeNode256* const n256 = (ZixRadixTreeNode256*)n;
+    return n256->children[key] ? &n256->children[key] : NULL;
+  }
+  }
+
+  return NULL;
+}
+
+/**
+   Return the child of `n` with the smallest key that is at least `from`.
+
+   Sets `key` to the key of the child, or returns null if there is none.
+*/
+static void*
+zix_radix_tree_next_child(ZixRadixTreeNode* const n,
+                          const unsigned          from,
+                          uint8_t* const          key)
+{
+  switch ((ZixRadixTreeNodeType)n->type) {
+  case ZIX_RADIX_TREE_NODE4:
+  case ZIX_RADIX_TREE_NODE16: {
+    // Both have sorted keys, so the first one in range is the next child
+    const uint8_t* const keys =
+      (n->type == ZIX_RADIX_TREE_NODE4) ? ((ZixRadixTreeNode4*)n)->keys
+                                        : ((ZixRadixTreeNode16*)n)->keys;
+
+    void* const* const children =
+      (n->type == ZIX_RADIX_TREE_NODE4) ? ((ZixRadixTreeNode4*)n)->children
+                                        : ((ZixRadixTreeNode16*)n)->children;
+
+    for (unsigned i = 0U; i < n->n_children; ++i) {
+      if (keys[i] >= from) {
+        *key = keys[i];
+        return children[i];
+      }
+    }
+    break;
+  }
+
+  case ZIX_RADIX_TREE_NODE48: {
+    const ZixRadixTreeNode48* const n48 = (const ZixRadixTreeNode48*)n;
+    for (unsigned k = from; k < 256U; ++k) {
+      if (n48->index[k]) {
+        *key = (uint8_t)k;
+        return n48->children[n48->index[k] - 1U];
+      }
+    }
+    break;
+  }
+
+  case ZIX_RADIX_TREE_NODE256: {
+    const ZixRadixTreeNode256* const n256 = (const ZixRadixTreeNode256*)n;
+    for (unsigned k = from; k < 256U; ++k) {
+      if (n256->children[k]) {
+        *key = (uint8_t)k;
+        return n256->children[k];
+      }
+    }
+    break;
+  }
+  }
+
+  return NULL;
+}
+
+/// Insert a sorted key and child into arrays with `n` elements
+static void
+zix_radix_tree_sorted_insert(uint8_t* const  keys,
+                             void** const    children,
+                             const unsigned  n,
+                             const uint8_t   key,
+                             void* const     child)
+{
+  unsigned i = 0U;
+  while (i < n && keys[i] < key) {
+    ++i;
+  }
+
+  memmove(keys + i + 1U, keys + i, n - i);
+  memmove(children + i + 1U, children + i, (n - i) * sizeof(void*));
+  keys[i]     = key;
+  children[i] = child;
+}
+
+/// Add a child to `n`, which must have room for it
+static void
+zix_radix_tree_put_child(ZixRadixTreeNode* const n,
+                         const uint8_t           key,
+                         void* const             child)
+{
+  assert(n->n_children <
+         zix_radix_tree_capacity((ZixRadixTreeNodeType)n->type));
+
+  switch ((ZixRadixTreeNodeType)n->type) {
+  case ZIX_RADIX_TREE_NODE4: {
+    ZixRadixTreeNode4* const n4 = (ZixRadixTreeNode4*)n;
+    zix_radix_tree_sorted_insert(
+      n4->keys, n4->children, n->n_children, key, child);
+    break;
+  }
+
+  case ZIX_RADIX_TREE_NODE16: {
+    ZixRadixTreeNode16* const n16 = (ZixRadixTreeNode16*)n;
+    zix_radix_tree_sorted_insert(
+      n16->keys, n16->children, n->n_children, key, child);
+    break;
+  }
+
+  case ZIX_RADIX_TREE_NODE48: {
+    // Take the first free slot, since removal may leave gaps
+    ZixRadixTreeNode48* const n48 = (ZixRadixTreeNode48*)n;
+    unsigned                  i   = 0U;
+    while (n48->children[i]) {
+      ++i;
+    }
+
+    n48->children[i] = child;
+    n48->index[key]  = (uint8_t)(i + 1U);
+    break;
+  }
+
+  case ZIX_RADIX_TREE_NODE256:
+    ((ZixRadixTreeNode256*)n)->children[key] = child;
+    break;
+  }
+
+  ++n->n_children;
+}
+
+/// Remove the child of `n` for `key`, which must exist
+static void
+zix_radix_tree_erase_child(ZixRadixTreeNode* const n, const uint8_t key)
+{
+  switch ((ZixRadixTreeNodeType)n->type) {
+  case ZIX_RADIX_TREE_NODE4:
+  case ZIX_RADIX_TREE_NODE16: {
+    uint8_t* const keys = (n->type == ZIX_RADIX_TREE_NODE4)
+                            ? ((ZixRadixTreeNode4*)n)->keys
+                            : ((ZixRadixTreeNode16*)n)->keys;
+
+    void** const children = (n->type == ZIX_RADIX_TREE_NODE4)
+                              ? ((ZixRadixTreeNode4*)n)->children
+                              : ((ZixRadixTreeNode16*)n)->children;
+
+    unsigned i = 0U;
+    while (keys[i] != key) {
+      ++i;
+    }
+
+    const unsigned n_after = n->n_children - i - 1U;
+    memmove(keys + i, keys + i + 1U, n_after);
+    memmove(children + i, children + i + 1U, n_after * sizeof(void*));
+    break;
+  }
+
+  case ZIX_RADIX_TREE_NODE48: {
+    ZixRadixTreeNode48* const n48 = (ZixRadixTreeNode48*)n;
+    assert(n48->index[key]);
+    n48->children[n48->index[key] - 1U] = NULL;
+    n48->index[key]                     = 0U;
+    break;
+  }
+
+  case ZIX_RADIX_TREE_NODE256:
+    ((ZixRadixTreeNode256*)n)->children[key] = NULL;
+    break;
+  }
+
+  --n->n_children;
+}
+
+/// Replace `n` with a node of a different type, or return null
+static ZixRadixTreeNode*
+zix_radix_tree_resize(const ZixRadixTree* const  t,
+                      ZixRadixTreeNode* const    n,
+                      const ZixRadixTreeNodeType type)
+{
+  ZixRadixTreeNode* const r =
+    zix_radix_tree_node_new(t, type, n->depth, n->prefix);
+
+  if (r) {
+    uint8_t key   = 0U;
+    void*   child = zix_radix_tree_next_child(n, 0U, &key);
+    for (; child; child = zix_radix_tree_next_child(n, key + 1U, &key)) {
+      zix_radix_tree_put_child(r, key, child);
+    }
+
+    zix_free(t->allocator, n);
+  }
+
+  return r;
+}
+
+/// Free the subtree at `child`, calling `destroy` for every value
+static void
+zix_radix_tree_free_child(ZixRadixTree* const  t,
+                          void* const          child,
+                          const ZixDestroyFunc destroy,
+                          const void* const    destroy_user_data)
+{
+  if (zix_radix_tree_is_leaf(child)) {
+    ZixRadixTreeLeaf* const leaf = zix_radix_tree_leaf(child);
+    if (destroy) {
+      destroy(leaf->value, destroy_user_data);
+    }
+
+    zix_free(t->allocator, leaf);
+    return;
+  }
+
+  ZixRadixTreeNode* const n   = (ZixRadixTreeNode*)child;
+  uint8_t                 key = 0U;
+  void*                   c   = zix_radix_tree_next_child(n, 0U, &key);
+  for (; c; c = zix_radix_tree_next_child(n, key + 1U, &key)) {
+    zix_radix_tree_free_child(t, c, destroy, destroy_user_data);
+  }
+
+  zix_free(t->allocator, n);
+}
+
+ZixRadixTree*
+zix_radix_tree_new(ZixAllocator* const allocator)
+{
+  ZixRadixTree* const t =
+    (ZixRadixTree*)zix_malloc(allocator, sizeof(ZixRadixTree));
+
+  if (t) {
+    t->allocator = allocator;
+    t->root      = NULL;
+    t->size      = 0U;
+  }
+
+  return t;
+}
+
+void
+zix_radix_tree_free(ZixRadixTree* const  t,
+                    const ZixDestroyFunc destroy,
+                    const void* const    destroy_user_data)
+{
+  if (t) {
+    if (t->root) {
+      zix_radix_tree_free_child(t, t->root, destroy, destroy_user_data);
+    }
+
+    zix_free(t->allocator, t);
+  }
+}
+
+size_t
+zix_radix_tree_size(const ZixRadixTree* const t)
+{
+  assert(t);
+  return t->size;
+}
+
+/**
+   Replace the child at `ref` with a new node that also has `child`.
+
+   The new node branches on the first byte where `key` (the key of `child`)
+   differs from `other`, which is a key (or prefix) of the existing child.
+*/
+static ZixStatus
+zix_radix_tree_branch(const ZixRadixTree* const t,
+                      void** const              ref,
+                      const uint64_t            other,
+                      const uint64_t            key,
+                      void* const               child)
+{
+  const unsigned          depth = zix_radix_tree_first_difference(key, other);
+  ZixRadixTreeNode* const n     = zix_radix_tree_node_new(
+    t, ZIX_RADIX_TREE_NODE4, depth, zix_radix_tree_prefix(key, depth));
+
+  if (!n) {
+    return ZIX_STATUS_NO_MEM;
+  }
+
+  zix_radix_tree_put_child(n, zix_radix_tree_key_byte(other, depth), *ref);
+  zix_radix_tree_put_child(n, zix_radix_tree_key_byte(key, depth), child);
+  *ref = n;
+  return ZIX_STATUS_SUCCESS;
+}
+
+/// Add `child` to the node at `ref`, growing it if necessary
+static ZixStatus
+zix_radix_tree_add_child(const ZixRadixTree* const t,
+                         void** const              ref,
+                         const uint8_t             key,
+                         void* const               child)
+{
+  ZixRadixTreeNode* n = (ZixRadixTreeNode*)*ref;
+
+  const ZixRadixTreeNodeType type = (ZixRadixTreeNodeType)n->type;
+  if (n->n_children == zix_radix_tree_capacity(type)) {
+    assert(type < ZIX_RADIX_TREE_NODE256);
+    if (!(n = zix_radix_tree_resize(t, n, (ZixRadixTreeNodeType)(type + 1)))) {
+      return ZIX_STATUS_NO_MEM;
+    }
+
+    *ref = n;
+  }
+
+  zix_radix_tree_put_child(n, key, child);
+  return ZIX_STATUS_SUCCESS;
+}
+
+ZixStatus
+zix_radix_tree_insert(ZixRadixTree* const t,
+                      const uint64_t      key,
+                      void* const         value)
+{
+  assert(t);
+
+  // Descend as far as possible along the path for the key
+  void** ref = &t->root;
+  while (*ref && !zix_radix_tree_is_leaf(*ref)) {
+    ZixRadixTreeNode* const n = (ZixRadixTreeNode*)*ref;
+    if (zix_radix_tree_prefix(key, n->depth) != n->prefix) {
+      break; // Key diverges above this node
+    }
+
+    void** const slot =
+      zix_radix_tree_find_child(n, zix_radix_tree_key_byte(key, n->depth));
+
+    if (!slot) {
+      break; // Key belongs in a new child of this node
+    }
+
+    ref = slot;
+  }
+
+  if (*ref && zix_radix_tree_is_leaf(*ref) &&
+      zix_radix_tree_leaf(*ref)->key == key) {
+    return ZIX_STATUS_EXISTS;
+  }
+
+  ZixRadixTreeLeaf* const leaf =
+    (ZixRadixTreeLeaf*)zix_malloc(t->allocator, sizeof(ZixRadixTreeLeaf));
+
+  if (!leaf) {
+    return ZIX_STATUS_NO_MEM;
+  }
+
+  leaf->key   = key;
+  leaf->value = value;
+
+  void* const child = zix_radix_tree_leaf_child(leaf);
+  ZixStatus   st    = ZIX_STATUS_SUCCESS;
+  if (!*ref) {
+    *ref = child; // Empty tree
+  } else if (zix_radix_tree_is_leaf(*ref)) {
+    st = zix_radix_tree_branch(
+      t, ref, zix_radix_tree_leaf(*ref)->key, key, child);
+  } else {
+    const ZixRadixTreeNode* const n = (const ZixRadixTreeNode*)*ref;
+    st = (zix_radix_tree_prefix(key, n->depth) != n->prefix)
+           ? zix_radix_tree_branch(t, ref, n->prefix, key, child)
+           : zix_radix_tree_add_child(
+               t, ref, zix_radix_tree_key_byte(key, n->depth), child);
+  }
+
+  if (st) {
+    zix_free(t->allocator, leaf);
+    return st;
+  }
+
+  ++t->size;
+  return ZIX_STATUS_SUCCESS;
+}
+
+/// Remove the child for `key` from the node at `ref`, shrinking it if possible
+static void
+zix_radix_tree_remove_child(const ZixRadixTree* const t,
+                            void** const              ref,
+                            const uint8_t             key)
+{
+  ZixRadixTreeNode* const n = (ZixRadixTreeNode*)*ref;
+
+  zix_radix_tree_erase_child(n, key);
+
+  /* A failed shrink leaves a larger node than necessary, so this can't rely
+     on the type to know when the node has only one child left (or none). */
+
+  const ZixRadixTreeNodeType type = (ZixRadixTreeNodeType)n->type;
+  if (n->n_children <= 1U) {
+    // Replace the node with its only child, which already has its prefix
+    uint8_t child_key = 0U;
+    *ref =
+      n->n_children ? zix_radix_tree_next_child(n, 0U, &child_key) : NULL;
+    zix_free(t->allocator, n);
+  } else if (type != ZIX_RADIX_TREE_NODE4 &&
+             n->n_children <= zix_radix_tree_min_children(type)) {
+    // Shrink to the next smaller type (again, if it failed before)
+    ZixRadixTreeNode* const r =
+      zix_radix_tree_resize(t, n, (ZixRadixTreeNodeType)(type - 1));
+
+    if (r) {
+      *ref = r; // Otherwise, keep the larger node, which is still valid
+    }
+  }
+}
+
+ZixStatus
+zix_radix_tree_remove(ZixRadixTree* const t,
+                      const uint64_t      key,
+                      void** const        out)
+{
+  assert(t);
+  assert(out);
+
+  // Descend without checking prefixes, since the leaf key is checked
+  void**  ref        = &t->root;
+  void**  parent_ref = NULL;
+  uint8_t byte       = 0U;
+  while (*ref && !zix_radix_tree_is_leaf(*ref)) {
+    ZixRadixTreeNode* const n = (ZixRadixTreeNode*)*ref;
+
+    byte = zix_radix_tree_key_byte(key, n->depth);
+
+    void** const slot = zix_radix_tree_find_child(n, byte);
+    if (!slot) {
+      return ZIX_STATUS_NOT_FOUND;
+    }
+
+    parent_ref = ref;
+    ref        = slot;
+  }
+
+  if (!*ref || zix_radix_tree_leaf(*ref)->key != key) {
+    return ZIX_STATUS_NOT_FOUND;
+  }
+
+  ZixRadixTreeLeaf* const leaf = zix_radix_tree_leaf(*ref);
+
+  *out = leaf->value;
+  zix_free(t->allocator, leaf);
+
+  if (parent_ref) {
+    zix_radix_tree_remove_child(t, parent_ref, byte);
+  } else {
+    t->root = NULL;
+  }
+
+  --t->size;
+  return ZIX_STATUS_SUCCESS;
+}
+
+static void
+zix_radix_tree_iter_push(ZixRadixTreeIter* const ti,
+                         ZixRadixTreeNode* const n,
+                         const uint8_t           key)
+{
+  assert(ti->level < ZIX_RADIX_TREE_MAX_HEIGHT);
+
+  ti->nodes[ti->level]   = n;
+  ti->indexes[ti->level] = key;
+  ++ti->level;
+}
+
+/// Move `ti` down to the leftmost leaf of the subtree at `child`
+static void
+zix_radix_tree_iter_descend(ZixRadixTreeIter* const ti, void* child)
+{
+  while (!zix_radix_tree_is_leaf(child)) {
+    ZixRadixTreeNode* const n   = (ZixRadixTreeNode*)child;
+    uint8_t                 key = 0U;
+
+    child = zix_radix_tree_next_child(n, 0U, &key);
+    zix_radix_tree_iter_push(ti, n, key);
+  }
+
+  ti->leaf = zix_radix_tree_leaf(child);
+}
+
+/// Move `ti` to the first leaf after the current child of its lowest node
+static void
+zix_radix_tree_iter_advance(ZixRadixTreeIter* const ti)
+{
+  while (ti->level) {
+    const unsigned l = ti->level - 1U;
+
+    uint8_t     key   = 0U;
+    void* const child = zix_radix_tree_next_child(
+      ti->nodes[l], ti->indexes[l] + 1U, &key);
+
+    if (child) {
+      ti->indexes[l] = key;
+      zix_radix_tree_iter_descend(ti, child);
+      return;
+    }
+
+    ti->nodes[l]   = NULL;
+    ti->indexes[l] = 0U;
+    --ti->level;
+  }
+
+  *ti = zix_radix_tree_end_iter;
+}
+
+ZixStatus
+zix_radix_tree_find(const ZixRadixTree* const t,
+                    const uint64_t            key,
+                    ZixRadixTreeIter* const   ti)
+{
+  assert(t);
+  assert(ti);
+
+  ti->level = 0U;
+
+  // Descend without checking prefixes, since the leaf key is checked
+  void* child = t->root;
+  while (child && !zix_radix_tree_is_leaf(child)) {
+    ZixRadixTreeNode* const n    = (ZixRadixTreeNode*)child;
+    const uint8_t           byte = zix_radix_tree_key_byte(key, n->depth);
+    void** const            slot = zix_radix_tree_find_child(n, byte);
+    if (!slot) {
+      break;
+    }
+
+    zix_radix_tree_iter_push(ti, n, byte);
+    child = *slot;
+  }
+
+  if (child && zix_radix_tree_is_leaf(child) &&
+      zix_radix_tree_leaf(child)->key == key) {
+    ti->leaf = zix_radix_tree_leaf(child);
+    return ZIX_STATUS_SUCCESS;
+  }
+
+  *ti = zix_radix_tree_end_iter;
+  return ZIX_STATUS_NOT_FOUND;
+}
+
+ZixStatus
+zix_radix_tree_lower_bound(const ZixRadixTree* const t,
+                           const uint64_t            key,
+                           ZixRadixTreeIter* const   ti)
+{
+  assert(t);
+  assert(ti);
+
+  *ti = zix_radix_tree_end_iter;
+
+  void* child = t->root;
+  while (child) {
+    if (zix_radix_tree_is_leaf(child)) {
+      if (zix_radix_tree_leaf(child)->key >= key) {
+        ti->leaf = zix_radix_tree_leaf(child);
+        return ZIX_STATUS_SUCCESS;
+      }
+
+      break; // Leaf is too small, so the result is after it
+    }
+
+    ZixRadixTreeNode* const n      = (ZixRadixTreeNode*)child;
+    const uint64_t          prefix = zix_radix_tree_prefix(key, n->depth);
+    if (prefix != n->prefix) {
+      if (n->prefix > prefix) {
+        // Everything in this subtree is greater, so the result is its first
+        zix_radix_tree_iter_descend(ti, child);
+        return ZIX_STATUS_SUCCESS;
+      }
+
+      break; // Everything in this subtree is less, so the result is after it
+    }
+
+    const uint8_t byte = zix_radix_tree_key_byte(key, n->depth);
+    void** const  slot = zix_radix_tree_find_child(n, byte);
+
+    zix_radix_tree_iter_push(ti, n, byte);
+    if (!slot) {
+      break; // No child for the key, so the result is in a later child
+    }
+
+    child = *slot;
+  }
+
+  zix_radix_tree_iter_advance(ti);
+  return ZIX_STATUS_SUCCESS;
+}
+
+uint64_t
+zix_radix_tree_key(const ZixRadixTreeIter ti)
+{
+  assert(ti.leaf);
+  return ti.leaf->key;
+}
+
+void*
+zix_radix_tree_get(const ZixRadixTreeIter ti)
+{
+  return ti.leaf ? ti.leaf->value : NULL;
+}
+
+ZixRadixTreeIter
+zix_radix_tree_begin(const ZixRadixTree* const t)
+{
+  assert(t);
+
+  ZixRadixTreeIter iter = zix_radix_tree_end_iter;
+  if (t->root) {
+    zix_radix_tree_iter_descend(&iter, t->root);
+  }
+
+  return iter;
+}
+
+ZixRadixTreeIter
+zix_radix_tree_end(const ZixRadixTree* const t)
+{
+  (void)t;
+  return zix_radix_tree_end_iter;
+}
+
+bool
+zix_radix_tree_iter_equals(const ZixRadixTreeIter lhs,
+                           const ZixRadixTreeIter rhs)
+{
+  return lhs.leaf == rhs.leaf;
+}
+
+ZixStatus
+zix_radix_tree_iter_increment(ZixRadixTreeIter* const i)
+{
+  assert(i);
+  assert(i->leaf);
+
+  zix_radix_tree_iter_advance(i);
+  return ZIX_STATUS_SUCCESS;
+}
+
+ZixRadixTreeIter
+zix_radix_tree_iter_next(ZixRadixTreeIter iter)
+{
+  zix_radix_tree_iter_increment(&iter);
+  return iter;
+}
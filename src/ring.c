@@ -1,10 +1,24 @@
 // Copyright 2011-2020 David Robillard <d@drobilla.net>
 // SPDX-License-Identifier: ISC
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#  define _GNU_SOURCE // For memfd_create()
+#endif
+
 #include "zix/ring.h"
+#include "zix/common.h"
 
+#include "zix_atomic.h"
 #include "zix_config.h"
 
+#if USE_MEMFD_CREATE
+#  include <sys/mman.h>
+#  include <unistd.h>
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -19,36 +33,42 @@
 #  define ZIX_MLOCK(ptr, size)
 #endif
 
-#if defined(_MSC_VER)
-#  if defined(_M_AMD64) || defined(_M_IX86) || defined(_M_X64)
-    /* acquire and release fences are only necessary for
-     * non-x86 systems. In fact, gcc will generate no
-     * instructions for acq/rel fences on x86. We only need
-     * to prevent compiler reordering. */
-#    include <intrin.h>
-#    define ZIX_READ_BARRIER() _ReadBarrier()
-#    define ZIX_WRITE_BARRIER() _WriteBarrier()
-#  else
-#    include <windows.h>
-#    define ZIX_READ_BARRIER() MemoryBarrier()
-#    define ZIX_WRITE_BARRIER() MemoryBarrier()
-#  endif
-#elif defined(__GNUC__)
-#  define ZIX_READ_BARRIER() __atomic_thread_fence(__ATOMIC_ACQUIRE)
-#  define ZIX_WRITE_BARRIER() __atomic_thread_fence(__ATOMIC_RELEASE)
-#else
-#  pragma message("warning: No memory barriers, possible SMP bugs")
-#  define ZIX_READ_BARRIER()
-#  define ZIX_WRITE_BARRIER()
-#endif
+/// Size of a cache line, used to keep the reader and writer fields apart
+#define ZIX_RING_CACHE_LINE 64U
+
+/// Size of the header before every message, which is the payload size
+#define ZIX_RING_MSG_HEADER_SIZE ((uint32_t)sizeof(uint32_t))
+
+/*
+  The reader and writer each have their own head, which only they modify, and
+  a cached copy of the other head, which is only reloaded when the cached
+  value indicates that there isn't enough space.  Each pair is on its own
+  cache line, so the reader and writer only share a line when one needs to
+  see the progress of the other, rather than on every access.
+
+  The ring is allocated normally, so it may not be aligned to a cache line.
+  Instead, every group of fields is followed by a whole line of padding,
+  which keeps them on separate lines regardless of alignment.
+*/
 
 struct ZixRingImpl {
-  ZixAllocator* allocator;  ///< User allocator
-  uint32_t      write_head; ///< Read index into buf
-  uint32_t      read_head;  ///< Write index into buf
-  uint32_t      size;       ///< Size (capacity) in bytes
-  uint32_t      size_mask;  ///< Mask for fast modulo
-  char*         buf;        ///< Contents
+  // Constant after creation
+  ZixAllocator* allocator; ///< User allocator
+  char*         buf;       ///< Contents
+  uint32_t      size;      ///< Size (capacity) in bytes
+  uint32_t      size_mask; ///< Mask for fast modulo
+  bool          mirrored;  ///< True if buf is mapped twice in a row
+  char          pad0[ZIX_RING_CACHE_LINE];
+
+  // Owned by the writer
+  uintptr_t write_head;       ///< Write index into buf
+  uintptr_t cached_read_head; ///< Read head as last seen by the writer
+  char      pad1[ZIX_RING_CACHE_LINE];
+
+  // Owned by the reader
+  uintptr_t read_head;         ///< Read index into buf
+  uintptr_t cached_write_head; ///< Write head as last seen by the reader
+  char      pad2[ZIX_RING_CACHE_LINE];
 };
 
 static inline uint32_t
@@ -71,11 +91,10 @@ zix_ring_new(ZixAllocator* const allocator, uint32_t size)
   ZixRing* ring = (ZixRing*)zix_malloc(allocator, sizeof(ZixRing));
 
   if (ring) {
-    ring->allocator  = allocator;
-    ring->write_head = 0;
-    ring->read_head  = 0;
-    ring->size       = next_power_of_two(size);
-    ring->size_mask  = ring->size - 1;
+    memset(ring, 0, sizeof(ZixRing));
+    ring->allocator = allocator;
+    ring->size      = next_power_of_two(size);
+    ring->size_mask = ring->size - 1;
 
     if (!(ring->buf = (char*)zix_malloc(allocator, ring->size))) {
       zix_free(allocator, ring);
@@ -86,11 +105,105 @@ zix_ring_new(ZixAllocator* const allocator, uint32_t size)
   return ring;
 }
 
+#if USE_MEMFD_CREATE
+
+/// Map a buffer of `size` bytes twice in a row, or return null
+static char*
+map_mirrored(const size_t size)
+{
+  const int fd = memfd_create("zix_ring", MFD_CLOEXEC);
+  if (fd < 0) {
+    return NULL;
+  }
+
+  // Reserve space for both copies, then map the same pages over each half
+  char* buf = NULL;
+  void* addr =
+    mmap(NULL, 2U * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  if (addr != MAP_FAILED) {
+    buf = (char*)addr;
+    if (ftruncate(fd, (off_t)size) ||
+        mmap(buf,
+             size,
+             PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_FIXED,
+             fd,
+             0) == MAP_FAILED ||
+        mmap(buf + size,
+             size,
+             PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_FIXED,
+             fd,
+             0) == MAP_FAILED) {
+      munmap(buf, 2U * size);
+      buf = NULL;
+    }
+  }
+
+  close(fd);
+  return buf;
+}
+
+ZixRing*
+zix_ring_new_mirrored(ZixAllocator* const allocator, uint32_t size)
+{
+  // Round the size up to a whole number of pages (which is a power of two)
+  const long page_size = sysconf(_SC_PAGESIZE);
+  if (page_size <= 0 || (unsigned long)page_size > UINT32_MAX / 2U ||
+      size > UINT32_MAX / 2U + 1U) {
+    return NULL;
+  }
+
+  size = next_power_of_two(size);
+  if (size < (uint32_t)page_size) {
+    size = (uint32_t)page_size;
+  }
+
+  ZixRing* ring = (ZixRing*)zix_malloc(allocator, sizeof(ZixRing));
+
+  if (ring) {
+    memset(ring, 0, sizeof(ZixRing));
+    ring->allocator = allocator;
+    ring->size      = size;
+    ring->size_mask = size - 1;
+    ring->mirrored  = true;
+
+    if (!(ring->buf = map_mirrored(size))) {
+      zix_free(allocator, ring);
+      return NULL;
+    }
+  }
+
+  return ring;
+}
+
+#else
+
+ZixRing*
+zix_ring_new_mirrored(ZixAllocator* const allocator, const uint32_t size)
+{
+  (void)allocator;
+  (void)size;
+  return NULL;
+}
+
+#endif
+
 void
 zix_ring_free(ZixRing* ring)
 {
   if (ring) {
+#if USE_MEMFD_CREATE
+    if (ring->mirrored) {
+      munmap(ring->buf, 2U * (size_t)ring->size);
+    } else {
+      zix_free(ring->allocator, ring->buf);
+    }
+#else
     zix_free(ring->allocator, ring->buf);
+#endif
+
     zix_free(ring->allocator, ring);
   }
 }
@@ -99,14 +212,22 @@ void
 zix_ring_mlock(ZixRing* ring)
 {
   ZIX_MLOCK(ring, sizeof(ZixRing));
-  ZIX_MLOCK(ring->buf, ring->size);
+  ZIX_MLOCK(ring->buf, ring->mirrored ? 2U * (size_t)ring->size : ring->size);
+}
+
+bool
+zix_ring_is_mirrored(const ZixRing* ring)
+{
+  return ring->mirrored;
 }
 
 void
 zix_ring_reset(ZixRing* ring)
 {
-  ring->write_head = 0;
-  ring->read_head  = 0;
+  ring->write_head        = 0;
+  ring->cached_read_head  = 0;
+  ring->read_head         = 0;
+  ring->cached_write_head = 0;
 }
 
 static inline uint32_t
@@ -122,8 +243,8 @@ read_space_internal(const ZixRing* ring, uint32_t r, uint32_t w)
 uint32_t
 zix_ring_read_space(const ZixRing* ring)
 {
-  const uint32_t r = ring->read_head;
-  const uint32_t w = ring->write_head; ZIX_READ_BARRIER();
+  const uint32_t r = (uint32_t)zix_atomic_load(&ring->read_head);
+  const uint32_t w = (uint32_t)zix_atomic_load(&ring->write_head);
   return read_space_internal(ring, r, w);
 }
 
@@ -144,8 +265,8 @@ write_space_internal(const ZixRing* ring, uint32_t r, uint32_t w)
 uint32_t
 zix_ring_write_space(const ZixRing* ring)
 {
-  const uint32_t r = ring->read_head; ZIX_READ_BARRIER();
-  const uint32_t w = ring->write_head;
+  const uint32_t r = (uint32_t)zix_atomic_load(&ring->read_head);
+  const uint32_t w = (uint32_t)zix_atomic_load(&ring->write_head);
   return write_space_internal(ring, r, w);
 }
 
@@ -155,6 +276,32 @@ zix_ring_capacity(const ZixRing* ring)
   return ring->size - 1;
 }
 
+/// Return the write head for the reader, reloading it if `size` isn't ready
+static inline uint32_t
+reader_write_head(ZixRing* ring, uint32_t r, uint32_t size)
+{
+  uint32_t w = (uint32_t)ring->cached_write_head;
+  if (read_space_internal(ring, r, w) < size) {
+    w = (uint32_t)zix_atomic_load(&ring->write_head);
+    ring->cached_write_head = w;
+  }
+
+  return w;
+}
+
+/// Return the read head for the writer, reloading it if `size` doesn't fit
+static inline uint32_t
+writer_read_head(ZixRing* ring, uint32_t w, uint32_t size)
+{
+  uint32_t r = (uint32_t)ring->cached_read_head;
+  if (write_space_internal(ring, r, w) < size) {
+    r = (uint32_t)zix_atomic_load(&ring->read_head);
+    ring->cached_read_head = r;
+  }
+
+  return r;
+}
+
 static inline uint32_t
 peek_internal(const ZixRing* ring,
               uint32_t       r,
@@ -166,7 +313,7 @@ peek_internal(const ZixRing* ring,
     return 0;
   }
 
-  if (r + size < ring->size) {
+  if (r + size < ring->size || ring->mirrored) {
     memcpy(dst, &ring->buf[r], size);
   } else {
     const uint32_t first_size = ring->size - r;
@@ -180,20 +327,19 @@ peek_internal(const ZixRing* ring,
 uint32_t
 zix_ring_peek(ZixRing* ring, void* dst, uint32_t size)
 {
-  const uint32_t r = ring->read_head;
-  const uint32_t w = ring->write_head; ZIX_READ_BARRIER();
+  const uint32_t r = (uint32_t)ring->read_head;
+  const uint32_t w = reader_write_head(ring, r, size);
   return peek_internal(ring, r, w, size, dst);
 }
 
 uint32_t
 zix_ring_read(ZixRing* ring, void* dst, uint32_t size)
 {
-  const uint32_t r = ring->read_head;
-  const uint32_t w = ring->write_head; ZIX_READ_BARRIER();
+  const uint32_t r = (uint32_t)ring->read_head;
+  const uint32_t w = reader_write_head(ring, r, size);
 
   if (peek_internal(ring, r, w, size, dst)) {
-    ZIX_WRITE_BARRIER();
-    ring->read_head = (r + size) & ring->size_mask;
+    zix_atomic_store(&ring->read_head, (r + size) & ring->size_mask);
     return size;
   }
 
@@ -203,37 +349,224 @@ zix_ring_read(ZixRing* ring, void* dst, uint32_t size)
 uint32_t
 zix_ring_skip(ZixRing* ring, uint32_t size)
 {
-  const uint32_t r = ring->read_head;
-  const uint32_t w = ring->write_head; ZIX_READ_BARRIER();
+  const uint32_t r = (uint32_t)ring->read_head;
+  const uint32_t w = reader_write_head(ring, r, size);
   if (read_space_internal(ring, r, w) < size) {
     return 0;
   }
 
-  ZIX_WRITE_BARRIER();
-  ring->read_head = (r + size) & ring->size_mask;
+  zix_atomic_store(&ring->read_head, (r + size) & ring->size_mask);
   return size;
 }
 
+/// Copy `size` bytes to the ring at `w` and return the following write head
+static inline uint32_t
+write_internal(ZixRing* ring, uint32_t w, uint32_t size, const void* src)
+{
+  if (w + size <= ring->size || ring->mirrored) {
+    memcpy(&ring->buf[w], src, size);
+    return (w + size) & ring->size_mask;
+  }
+
+  const uint32_t this_size = ring->size - w;
+  memcpy(&ring->buf[w], src, this_size);
+  memcpy(&ring->buf[0], (const char*)src + this_size, size - this_size);
+  return size - this_size;
+}
+
 uint32_t
 zix_ring_write(ZixRing* ring, const void* src, uint32_t size)
 {
-  const uint32_t r = ring->read_head; ZIX_READ_BARRIER();
-  const uint32_t w = ring->write_head;
+  const uint32_t w = (uint32_t)ring->write_head;
+  const uint32_t r = writer_read_head(ring, w, size);
   if (write_space_internal(ring, r, w) < size) {
     return 0;
   }
 
-  if (w + size <= ring->size) {
-    memcpy(&ring->buf[w], src, size);
-    ZIX_WRITE_BARRIER();
-    ring->write_head = (w + size) & ring->size_mask;
-  } else {
-    const uint32_t this_size = ring->size - w;
-    memcpy(&ring->buf[w], src, this_size);
-    memcpy(&ring->buf[0], (const char*)src + this_size, size - this_size);
-    ZIX_WRITE_BARRIER();
-    ring->write_head = size - this_size;
+  zix_atomic_store(&ring->write_head, write_internal(ring, w, size, src));
+  return size;
+}
+
+/// Set `regions` to the `size` bytes starting at `start`
+static inline void
+set_regions(ZixRing*       ring,
+            uint32_t       start,
+            uint32_t       size,
+            ZixRingRegion* regions)
+{
+  const uint32_t first_size = (start + size <= ring->size || ring->mirrored)
+                                ? size
+                                : ring->size - start;
+
+  regions[0].data = first_size ? &ring->buf[start] : NULL;
+  regions[0].size = first_size;
+  regions[1].data = (size > first_size) ? &ring->buf[0] : NULL;
+  regions[1].size = size - first_size;
+}
+
+uint32_t
+zix_ring_write_reserve(ZixRing* ring, uint32_t size, ZixRingRegion* regions)
+{
+  const uint32_t w = (uint32_t)ring->write_head;
+  const uint32_t r = writer_read_head(ring, w, size);
+  if (write_space_internal(ring, r, w) < size) {
+    set_regions(ring, w, 0U, regions);
+    return 0;
+  }
+
+  set_regions(ring, w, size, regions);
+  return size;
+}
+
+uint32_t
+zix_ring_write_commit(ZixRing* ring, uint32_t size)
+{
+  const uint32_t w = (uint32_t)ring->write_head;
+  const uint32_t r = (uint32_t)ring->cached_read_head;
+  if (write_space_internal(ring, r, w) < size) {
+    return 0;
   }
 
+  zix_atomic_store(&ring->write_head, (w + size) & ring->size_mask);
   return size;
 }
+
+uint32_t
+zix_ring_read_acquire(ZixRing* ring, uint32_t size, ZixRingRegion* regions)
+{
+  const uint32_t r = (uint32_t)ring->read_head;
+  const uint32_t w = reader_write_head(ring, r, size);
+  if (read_space_internal(ring, r, w) < size) {
+    set_regions(ring, r, 0U, regions);
+    return 0;
+  }
+
+  set_regions(ring, r, size, regions);
+  return size;
+}
+
+uint32_t
+zix_ring_read_release(ZixRing* ring, uint32_t size)
+{
+  const uint32_t r = (uint32_t)ring->read_head;
+  const uint32_t w = (uint32_t)ring->cached_write_head;
+  if (read_space_internal(ring, r, w) < size) {
+    return 0;
+  }
+
+  zix_atomic_store(&ring->read_head, (r + size) & ring->size_mask);
+  return size;
+}
+
+ZixStatus
+zix_ring_write_msg(ZixRing* ring, const void* src, uint32_t size)
+{
+  if (size > UINT32_MAX - ZIX_RING_MSG_HEADER_SIZE) {
+    return ZIX_STATUS_NO_MEM;
+  }
+
+  const uint32_t total = ZIX_RING_MSG_HEADER_SIZE + size;
+  const uint32_t w     = (uint32_t)ring->write_head;
+  const uint32_t r     = writer_read_head(ring, w, total);
+  if (write_space_internal(ring, r, w) < total) {
+    return ZIX_STATUS_NO_MEM;
+  }
+
+  // Write the whole frame, then publish it all at once
+  const uint32_t p = write_internal(ring, w, ZIX_RING_MSG_HEADER_SIZE, &size);
+  zix_atomic_store(&ring->write_head, write_internal(ring, p, size, src));
+  return ZIX_STATUS_SUCCESS;
+}
+
+/// Set `size` to the payload size of the message at `r`, if there is one
+static inline ZixStatus
+msg_header(ZixRing* ring, uint32_t r, uint32_t w, uint32_t* size)
+{
+  // Messages are published whole, so if the header is there the rest is too
+  return peek_internal(ring, r, w, ZIX_RING_MSG_HEADER_SIZE, size)
+           ? ZIX_STATUS_SUCCESS
+           : ZIX_STATUS_NOT_FOUND;
+}
+
+/// Return the position of the payload of the message at `r`
+static inline uint32_t
+msg_payload(const ZixRing* ring, uint32_t r)
+{
+  return (r + ZIX_RING_MSG_HEADER_SIZE) & ring->size_mask;
+}
+
+ZixStatus
+zix_ring_read_msg(ZixRing* ring, void* dst, uint32_t capacity, uint32_t* size)
+{
+  const uint32_t r  = (uint32_t)ring->read_head;
+  const uint32_t w  = reader_write_head(ring, r, ZIX_RING_MSG_HEADER_SIZE);
+  ZixStatus      st = msg_header(ring, r, w, size);
+  if (st) {
+    *size = 0U;
+    return st;
+  }
+
+  if (*size > capacity) {
+    return ZIX_STATUS_NO_MEM;
+  }
+
+  const uint32_t p = msg_payload(ring, r);
+  peek_internal(ring, p, w, *size, dst);
+  zix_atomic_store(&ring->read_head, (p + *size) & ring->size_mask);
+  return ZIX_STATUS_SUCCESS;
+}
+
+ZixStatus
+zix_ring_read_msg_acquire(ZixRing* ring, ZixRingRegion* regions)
+{
+  const uint32_t r    = (uint32_t)ring->read_head;
+  const uint32_t w    = reader_write_head(ring, r, ZIX_RING_MSG_HEADER_SIZE);
+  uint32_t       size = 0U;
+  ZixStatus      st   = msg_header(ring, r, w, &size);
+
+  set_regions(ring, msg_payload(ring, r), st ? 0U : size, regions);
+  return st;
+}
+
+ZixStatus
+zix_ring_read_msg_release(ZixRing* ring)
+{
+  const uint32_t r    = (uint32_t)ring->read_head;
+  const uint32_t w    = (uint32_t)ring->cached_write_head;
+  uint32_t       size = 0U;
+  ZixStatus      st   = msg_header(ring, r, w, &size);
+
+  if (!st) {
+    const uint32_t end = (msg_payload(ring, r) + size) & ring->size_mask;
+    zix_atomic_store(&ring->read_head, end);
+  }
+
+  return st;
+}
+
+uint32_t
+zix_ring_read_msgs(ZixRing* ring, ZixRingMsgFunc func, void* user_data)
+{
+  // Load the write head once and read every message before it
+  const uint32_t w = (uint32_t)zix_atomic_load(&ring->write_head);
+  ring->cached_write_head = w;
+
+  ZixRingRegion regions[2] = {{NULL, 0U}, {NULL, 0U}};
+  uint32_t      r          = (uint32_t)ring->read_head;
+  uint32_t      size       = 0U;
+  uint32_t      n_msgs     = 0U;
+  while (!msg_header(ring, r, w, &size)) {
+    const uint32_t p = msg_payload(ring, r);
+    set_regions(ring, p, size, regions);
+    func(regions, user_data);
+    r = (p + size) & ring->size_mask;
+    ++n_msgs;
+  }
+
+  // Release all of the messages at once
+  if (n_msgs) {
+    zix_atomic_store(&ring->read_head, r);
+  }
+
+  return n_msgs;
+}
@@ -6,6 +6,7 @@
 #include "zix/common.h"
 
 #include <assert.h>
+#include <stdint.h>
 #include <string.h>
 
 typedef struct ZixTreeNodeImpl ZixTreeNode;
@@ -18,20 +19,81 @@ struct ZixTreeImpl {
   ZixComparator  cmp;
   void*          cmp_data;
   size_t         size;
+  size_t         links_offset;
   bool           allow_duplicates;
+  bool           intrusive;
+  bool           ranked;
 };
 
-struct ZixTreeNodeImpl {
-  void*                   data;
-  struct ZixTreeNodeImpl* left;
-  struct ZixTreeNodeImpl* right;
-  struct ZixTreeNodeImpl* parent;
-  int                     balance;
-};
+/// A node in a ranked tree, which also stores the size of its subtree
+typedef struct {
+  ZixTreeNode links; ///< Links, which must be first
+  size_t      count; ///< Number of nodes in this subtree, including this one
+} ZixTreeRankedNode;
 
 #define MIN(a, b) (((a) < (b)) ? (a) : (b))
 #define MAX(a, b) (((a) > (b)) ? (a) : (b))
 
+/* The balance of a node (the height of its right subtree minus the height of
+   its left) is always -1, 0, or 1 in a valid tree, so it's stored in the low
+   two bits of the parent pointer, offset by 1.  Nodes contain pointers, so
+   they are at least 4-byte aligned, and these bits are otherwise zero.  While
+   rebalancing, a node may temporarily be out of balance by 2, but such values
+   are only passed around in local variables, and never stored. */
+
+#define BALANCE_MASK ((uintptr_t)3U)
+
+static inline ZixTreeNode*
+node_parent(const ZixTreeNode* const n)
+{
+  return (ZixTreeNode*)(n->parent_balance & ~BALANCE_MASK);
+}
+
+static inline int
+node_balance(const ZixTreeNode* const n)
+{
+  return (int)(n->parent_balance & BALANCE_MASK) - 1;
+}
+
+static inline void
+set_parent(ZixTreeNode* const n, ZixTreeNode* const parent)
+{
+  assert(!((uintptr_t)parent & BALANCE_MASK));
+  n->parent_balance = (uintptr_t)parent | (n->parent_balance & BALANCE_MASK);
+}
+
+static inline void
+set_balance(ZixTreeNode* const n, const int balance)
+{
+  assert(balance >= -1 && balance <= 1);
+  n->parent_balance = (n->parent_balance & ~BALANCE_MASK) |
+                      (uintptr_t)(balance + 1);
+}
+
+/// Return the size of the subtree at `n` in a ranked tree
+static inline size_t
+node_count(const ZixTreeNode* const n)
+{
+  return n ? ((const ZixTreeRankedNode*)n)->count : 0U;
+}
+
+/// Add `delta` (which may have wrapped around to be negative) to a count
+static inline void
+add_count(ZixTreeNode* const n, const size_t delta)
+{
+  ((ZixTreeRankedNode*)n)->count += delta;
+}
+
+/// Recalculate the size of the subtree at `n` if `t` is ranked
+static inline void
+update_count(const ZixTree* const t, ZixTreeNode* const n)
+{
+  if (t->ranked) {
+    ((ZixTreeRankedNode*)n)->count =
+      1U + node_count(n->left) + node_count(n->right);
+  }
+}
+
 // Uncomment these for debugging features
 // #define ZIX_TREE_DUMP         1
 // #define ZIX_TREE_VERIFY       1
@@ -71,12 +133,60 @@ zix_tree_new(ZixAllocator* const allocator,
     t->cmp               = cmp;
     t->cmp_data          = cmp_data;
     t->size              = 0;
+    t->links_offset      = 0U;
     t->allow_duplicates  = allow_duplicates;
+    t->intrusive         = false;
+    t->ranked            = false;
+  }
+
+  return t;
+}
+
+ZixTree*
+zix_tree_new_intrusive(ZixAllocator* const allocator,
+                       bool                allow_duplicates,
+                       ZixComparator       cmp,
+                       void*               cmp_data,
+                       size_t              links_offset)
+{
+  ZixTree* t =
+    zix_tree_new(allocator, allow_duplicates, cmp, cmp_data, NULL, NULL);
+
+  if (t) {
+    t->links_offset = links_offset;
+    t->intrusive    = true;
   }
 
   return t;
 }
 
+ZixTree*
+zix_tree_new_ranked(ZixAllocator* const allocator,
+                    bool                allow_duplicates,
+                    ZixComparator       cmp,
+                    void*               cmp_data,
+                    ZixDestroyFunc      destroy,
+                    const void*         destroy_user_data)
+{
+  ZixTree* t = zix_tree_new(
+    allocator, allow_duplicates, cmp, cmp_data, destroy, destroy_user_data);
+
+  if (t) {
+    t->ranked = true;
+  }
+
+  return t;
+}
+
+/// Free the links of a removed node, if they were allocated by the tree
+static void
+zix_tree_node_free(ZixTree* t, ZixTreeNode* n)
+{
+  if (!t->intrusive) {
+    zix_free(t->allocator, n);
+  }
+}
+
 static void
 zix_tree_free_rec(ZixTree* t, ZixTreeNode* n)
 {
@@ -95,7 +205,10 @@ void
 zix_tree_free(ZixTree* t)
 {
   if (t) {
-    zix_tree_free_rec(t, t->root);
+    if (!t->intrusive) {
+      zix_tree_free_rec(t, t->root);
+    }
+
     zix_free(t->allocator, t);
   }
 }
@@ -107,17 +220,19 @@ zix_tree_size(const ZixTree* t)
 }
 
 static void
-rotate(ZixTreeNode* p, ZixTreeNode* q)
+rotate(const ZixTree* t, ZixTreeNode* p, ZixTreeNode* q)
 {
-  assert(q->parent == p);
+  assert(node_parent(q) == p);
   assert(p->left == q || p->right == q);
 
-  q->parent = p->parent;
-  if (q->parent) {
-    if (q->parent->left == p) {
-      q->parent->left = q;
+  ZixTreeNode* const pp = node_parent(p);
+
+  set_parent(q, pp);
+  if (pp) {
+    if (pp->left == p) {
+      pp->left = q;
     } else {
-      q->parent->right = q;
+      pp->right = q;
     }
   }
 
@@ -126,7 +241,7 @@ rotate(ZixTreeNode* p, ZixTreeNode* q)
     p->right = q->left;
     q->left  = p;
     if (p->right) {
-      p->right->parent = p;
+      set_parent(p->right, p);
     }
   } else {
     // Rotate right
@@ -134,15 +249,17 @@ rotate(ZixTreeNode* p, ZixTreeNode* q)
     p->left  = q->right;
     q->right = p;
     if (p->left) {
-      p->left->parent = p;
+      set_parent(p->left, p);
     }
   }
 
-  p->parent = q;
+  set_parent(p, q);
+  update_count(t, p);
+  update_count(t, q);
 }
 
 /**
- * Rotate left about `p`.
+ * Rotate left about `p`, which has a balance of 2.
  *
  *    p              q
  *   / \            / \
@@ -151,22 +268,21 @@ rotate(ZixTreeNode* p, ZixTreeNode* q)
  *    B   C      A   B
  */
 static ZixTreeNode*
-rotate_left(ZixTreeNode* p, int* height_change)
+rotate_left(const ZixTree* t, ZixTreeNode* p, int* height_change)
 {
-  ZixTreeNode* const q = p->right;
-  *height_change       = (q->balance == 0) ? 0 : -1;
+  ZixTreeNode* const q         = p->right;
+  const int          q_balance = node_balance(q);
+
+  *height_change = (q_balance == 0) ? 0 : -1;
 
   DEBUG_PRINTF("LL %ld\n", (intptr_t)p->data);
 
-  assert(p->balance == 2);
-  assert(q->balance == 0 || q->balance == 1);
+  assert(q_balance == 0 || q_balance == 1);
 
-  rotate(p, q);
+  rotate(t, p, q);
 
-  // p->balance -= 1 + MAX(0, q->balance);
-  // q->balance -= 1 - MIN(0, p->balance);
-  --q->balance;
-  p->balance = -(q->balance);
+  set_balance(q, q_balance - 1);
+  set_balance(p, 1 - q_balance);
 
   ASSERT_BALANCE(p);
   ASSERT_BALANCE(q);
@@ -174,7 +290,7 @@ rotate_left(ZixTreeNode* p, int* height_change)
 }
 
 /**
- * Rotate right about `p`.
+ * Rotate right about `p`, which has a balance of -2.
  *
  *      p          q
  *     / \        / \
@@ -184,22 +300,21 @@ rotate_left(ZixTreeNode* p, int* height_change)
  *
  */
 static ZixTreeNode*
-rotate_right(ZixTreeNode* p, int* height_change)
+rotate_right(const ZixTree* t, ZixTreeNode* p, int* height_change)
 {
-  ZixTreeNode* const q = p->left;
-  *height_change       = (q->balance == 0) ? 0 : -1;
+  ZixTreeNode* const q         = p->left;
+  const int          q_balance = node_balance(q);
+
+  *height_change = (q_balance == 0) ? 0 : -1;
 
   DEBUG_PRINTF("RR %ld\n", (intptr_t)p->data);
 
-  assert(p->balance == -2);
-  assert(q->balance == 0 || q->balance == -1);
+  assert(q_balance == 0 || q_balance == -1);
 
-  rotate(p, q);
+  rotate(t, p, q);
 
-  // p->balance += 1 - MIN(0, q->balance);
-  // q->balance += 1 + MAX(0, p->balance);
-  ++q->balance;
-  p->balance = -(q->balance);
+  set_balance(q, q_balance + 1);
+  set_balance(p, -1 - q_balance);
 
   ASSERT_BALANCE(p);
   ASSERT_BALANCE(q);
@@ -207,7 +322,7 @@ rotate_right(ZixTreeNode* p, int* height_change)
 }
 
 /**
- * Rotate left about `p->left` then right about `p`.
+ * Rotate left about `p->left` then right about `p`, which has a balance of -2.
  *
  *      p             r
  *     / \           / \
@@ -219,31 +334,26 @@ rotate_right(ZixTreeNode* p, int* height_change)
  *
  */
 static ZixTreeNode*
-rotate_left_right(ZixTreeNode* p, int* height_change)
+rotate_left_right(const ZixTree* t, ZixTreeNode* p, int* height_change)
 {
-  ZixTreeNode* const q = p->left;
-  ZixTreeNode* const r = q->right;
+  ZixTreeNode* const q         = p->left;
+  ZixTreeNode* const r         = q->right;
+  const int          r_balance = node_balance(r);
 
-  assert(p->balance == -2);
-  assert(q->balance == 1);
-  assert(r->balance == -1 || r->balance == 0 || r->balance == 1);
+  assert(node_balance(q) == 1);
 
   DEBUG_PRINTF("LR %ld  P: %2d  Q: %2d  R: %2d\n",
                (intptr_t)p->data,
-               p->balance,
-               q->balance,
-               r->balance);
-
-  rotate(q, r);
-  rotate(p, r);
+               -2,
+               node_balance(q),
+               r_balance);
 
-  q->balance -= 1 + MAX(0, r->balance);
-  p->balance += 1 - MIN(MIN(0, r->balance) - 1, r->balance + q->balance);
-  // r->balance += MAX(0, p->balance) + MIN(0, q->balance);
+  rotate(t, q, r);
+  rotate(t, p, r);
 
-  // p->balance = (p->left && p->right) ? -MIN(r->balance, 0) : 0;
-  // q->balance = - MAX(r->balance, 0);
-  r->balance = 0;
+  set_balance(q, -MAX(0, r_balance));
+  set_balance(p, -MIN(0, r_balance));
+  set_balance(r, 0);
 
   *height_change = -1;
 
@@ -254,7 +364,7 @@ rotate_left_right(ZixTreeNode* p, int* height_change)
 }
 
 /**
- * Rotate right about `p->right` then right about `p`.
+ * Rotate right about `p->right` then left about `p`, which has a balance of 2.
  *
  *    p               r
  *   / \             / \
@@ -266,32 +376,26 @@ rotate_left_right(ZixTreeNode* p, int* height_change)
  *
  */
 static ZixTreeNode*
-rotate_right_left(ZixTreeNode* p, int* height_change)
+rotate_right_left(const ZixTree* t, ZixTreeNode* p, int* height_change)
 {
-  ZixTreeNode* const q = p->right;
-  ZixTreeNode* const r = q->left;
+  ZixTreeNode* const q         = p->right;
+  ZixTreeNode* const r         = q->left;
+  const int          r_balance = node_balance(r);
 
-  assert(p->balance == 2);
-  assert(q->balance == -1);
-  assert(r->balance == -1 || r->balance == 0 || r->balance == 1);
+  assert(node_balance(q) == -1);
 
   DEBUG_PRINTF("RL %ld  P: %2d  Q: %2d  R: %2d\n",
                (intptr_t)p->data,
-               p->balance,
-               q->balance,
-               r->balance);
+               2,
+               node_balance(q),
+               r_balance);
 
-  rotate(q, r);
-  rotate(p, r);
+  rotate(t, q, r);
+  rotate(t, p, r);
 
-  q->balance += 1 - MIN(0, r->balance);
-  p->balance -= 1 + MAX(MAX(0, r->balance) + 1, r->balance + q->balance);
-  // r->balance += MAX(0, q->balance) + MIN(0, p->balance);
-
-  // p->balance = (p->left && p->right) ? -MAX(r->balance, 0) : 0;
-  // q->balance = - MIN(r->balance, 0);
-  r->balance = 0;
-  // assert(r->balance == 0);
+  set_balance(q, -MIN(0, r_balance));
+  set_balance(p, -MAX(0, r_balance));
+  set_balance(r, 0);
 
   *height_change = -1;
 
@@ -301,34 +405,55 @@ rotate_right_left(ZixTreeNode* p, int* height_change)
   return r;
 }
 
+/**
+   Rebalance `node` if necessary, and return the root of its subtree.
+
+   The new balance of `node` is given as a parameter rather than being stored
+   beforehand, since it may be out of the range that can be stored.
+*/
 static ZixTreeNode*
-zix_tree_rebalance(ZixTree* t, ZixTreeNode* node, int* height_change)
+zix_tree_rotate(const ZixTree* t,
+                ZixTreeNode*   node,
+                const int      balance,
+                int*           height_change)
+{
+  *height_change = 0;
+  if (balance == -2) {
+    assert(node->left);
+    return (node_balance(node->left) == 1)
+             ? rotate_left_right(t, node, height_change)
+             : rotate_right(t, node, height_change);
+  }
+
+  if (balance == 2) {
+    assert(node->right);
+    return (node_balance(node->right) == -1)
+             ? rotate_right_left(t, node, height_change)
+             : rotate_left(t, node, height_change);
+  }
+
+  set_balance(node, balance);
+  return node;
+}
+
+/// Rebalance `node` like zix_tree_rotate(t, ), and update the root if necessary
+static ZixTreeNode*
+zix_tree_rebalance(ZixTree*     t,
+                   ZixTreeNode* node,
+                   const int    balance,
+                   int*         height_change)
 {
 #ifdef ZIX_TREE_HYPER_VERIFY
   const size_t old_height = height(node);
 #endif
-  DEBUG_PRINTF("REBALANCE %ld (%d)\n", (intptr_t)node->data, node->balance);
-  *height_change     = 0;
-  const bool is_root = !node->parent;
+  DEBUG_PRINTF("REBALANCE %ld (%d)\n", (intptr_t)node->data, balance);
+  const bool is_root = !node_parent(node);
   assert((is_root && t->root == node) || (!is_root && t->root != node));
-  ZixTreeNode* replacement = node;
-  if (node->balance == -2) {
-    assert(node->left);
-    if (node->left->balance == 1) {
-      replacement = rotate_left_right(node, height_change);
-    } else {
-      replacement = rotate_right(node, height_change);
-    }
-  } else if (node->balance == 2) {
-    assert(node->right);
-    if (node->right->balance == -1) {
-      replacement = rotate_right_left(node, height_change);
-    } else {
-      replacement = rotate_left(node, height_change);
-    }
-  }
+  ZixTreeNode* const replacement =
+    zix_tree_rotate(t, node, balance, height_change);
+
   if (is_root) {
-    assert(!replacement->parent);
+    assert(!node_parent(replacement));
     t->root = replacement;
   }
   DUMP(t);
@@ -363,13 +488,21 @@ zix_tree_insert(ZixTree* t, void* e, ZixTreeIter** ti)
     }
   }
 
-  // Allocate a new node n
-  if (!(n = (ZixTreeNode*)zix_malloc(t->allocator, sizeof(ZixTreeNode)))) {
+  // Allocate a new node n, or use the links in e for an intrusive tree
+  const size_t node_size =
+    t->ranked ? sizeof(ZixTreeRankedNode) : sizeof(ZixTreeNode);
+
+  if (t->intrusive) {
+    assert(e);
+    void* const links = (char*)e + t->links_offset;
+    n                 = (ZixTreeNode*)links;
+  } else if (!(n = (ZixTreeNode*)zix_malloc(t->allocator, node_size))) {
     return ZIX_STATUS_NO_MEM;
   }
-  memset(n, '\0', sizeof(ZixTreeNode));
-  n->data    = e;
-  n->balance = 0;
+
+  memset(n, '\0', node_size);
+  n->data = e;
+  set_balance(n, 0);
   if (ti) {
     *ti = n;
   }
@@ -377,46 +510,57 @@ zix_tree_insert(ZixTree* t, void* e, ZixTreeIter** ti)
   bool p_height_increased = false;
 
   // Make p the parent of n
-  n->parent = p;
+  set_parent(n, p);
   if (!p) {
     t->root = n;
   } else {
+    const int p_balance = node_balance(p);
     if (cmp < 0) {
       assert(!p->left);
-      assert(p->balance == 0 || p->balance == 1);
+      assert(p_balance == 0 || p_balance == 1);
       p->left = n;
-      --p->balance;
+      set_balance(p, p_balance - 1);
       p_height_increased = !p->right;
     } else {
       assert(!p->right);
-      assert(p->balance == 0 || p->balance == -1);
+      assert(p_balance == 0 || p_balance == -1);
       p->right = n;
-      ++p->balance;
+      set_balance(p, p_balance + 1);
       p_height_increased = !p->left;
     }
   }
 
+  // Count the new node in the subtree of every ancestor
+  if (t->ranked) {
+    add_count(n, 1U);
+    for (ZixTreeNode* i = p; i; i = node_parent(i)) {
+      add_count(i, 1U);
+    }
+  }
+
   DUMP(t);
 
   // Rebalance if necessary (at most 1 rotation)
-  assert(!p || p->balance == -1 || p->balance == 0 || p->balance == 1);
   if (p && p_height_increased) {
-    int height_change = 0;
-    for (ZixTreeNode* i = p; i && i->parent; i = i->parent) {
-      if (i == i->parent->left) {
-        if (--i->parent->balance == -2) {
-          zix_tree_rebalance(t, i->parent, &height_change);
+    int          height_change = 0;
+    ZixTreeNode* parent        = NULL;
+    for (ZixTreeNode* i = p; (parent = node_parent(i)); i = parent) {
+      int balance = node_balance(parent);
+      if (i == parent->left) {
+        if (--balance == -2) {
+          zix_tree_rebalance(t, parent, balance, &height_change);
           break;
         }
       } else {
-        assert(i == i->parent->right);
-        if (++i->parent->balance == 2) {
-          zix_tree_rebalance(t, i->parent, &height_change);
+        assert(i == parent->right);
+        if (++balance == 2) {
+          zix_tree_rebalance(t, parent, balance, &height_change);
           break;
         }
       }
 
-      if (i->parent->balance == 0) {
+      set_balance(parent, balance);
+      if (balance == 0) {
         break;
       }
     }
@@ -439,9 +583,10 @@ ZixStatus
 zix_tree_remove(ZixTree* t, ZixTreeIter* ti)
 {
   ZixTreeNode* const n          = ti;
-  ZixTreeNode**      pp         = NULL;      // parent pointer
-  ZixTreeNode*       to_balance = n->parent; // lowest node to balance
-  int                d_balance  = 0;         // delta(balance) for n->parent
+  ZixTreeNode* const n_parent   = node_parent(n);
+  ZixTreeNode**      pp         = NULL;     // parent pointer
+  ZixTreeNode*       to_balance = n_parent; // lowest node to balance
+  int                d_balance  = 0;        // delta(balance) for n_parent
 
   DEBUG_PRINTF("*** REMOVE %ld\n", (intptr_t)n->data);
 
@@ -450,78 +595,92 @@ zix_tree_remove(ZixTree* t, ZixTreeIter* ti)
     if (t->destroy) {
       t->destroy(n->data, t->destroy_user_data);
     }
-    zix_free(t->allocator, n);
+    zix_tree_node_free(t, n);
     --t->size;
     assert(t->size == 0);
     return ZIX_STATUS_SUCCESS;
   }
 
   // Set pp to the parent pointer to n, if applicable
-  if (n->parent) {
-    assert(n->parent->left == n || n->parent->right == n);
-    if (n->parent->left == n) { // n is left child
-      pp        = &n->parent->left;
+  if (n_parent) {
+    assert(n_parent->left == n || n_parent->right == n);
+    if (n_parent->left == n) { // n is left child
+      pp        = &n_parent->left;
       d_balance = 1;
     } else { // n is right child
-      assert(n->parent->right == n);
-      pp        = &n->parent->right;
+      assert(n_parent->right == n);
+      pp        = &n_parent->right;
       d_balance = -1;
     }
   }
 
   assert(!pp || *pp == n);
 
+  // Uncount the node that will be unlinked from the subtree of every ancestor
+  if (t->ranked) {
+    ZixTreeNode* i = n;
+    if (n->left && n->right) {
+      for (i = n->right; i->left; i = i->left) {
+      }
+    }
+
+    while ((i = node_parent(i))) {
+      add_count(i, SIZE_MAX);
+    }
+  }
+
   int height_change = 0;
   if (!n->left && !n->right) {
     // n is a leaf, just remove it
     if (pp) {
       *pp           = NULL;
-      to_balance    = n->parent;
-      height_change = (!n->parent->left && !n->parent->right) ? -1 : 0;
+      to_balance    = n_parent;
+      height_change = (!n_parent->left && !n_parent->right) ? -1 : 0;
     }
 
   } else if (!n->left) {
     // Replace n with right (only) child
     if (pp) {
       *pp        = n->right;
-      to_balance = n->parent;
+      to_balance = n_parent;
     } else {
       t->root = n->right;
     }
-    n->right->parent = n->parent;
-    height_change    = -1;
+    set_parent(n->right, n_parent);
+    height_change = -1;
 
   } else if (!n->right) {
     // Replace n with left (only) child
     if (pp) {
       *pp        = n->left;
-      to_balance = n->parent;
+      to_balance = n_parent;
     } else {
       t->root = n->left;
     }
-    n->left->parent = n->parent;
-    height_change   = -1;
+    set_parent(n->left, n_parent);
+    height_change = -1;
 
   } else {
     // Replace n with in-order successor (leftmost child of right subtree)
     ZixTreeNode* replace = n->right;
     while (replace->left) {
-      assert(replace->left->parent == replace);
+      assert(node_parent(replace->left) == replace);
       replace = replace->left;
     }
 
     // Remove replace from parent (replace_p)
-    if (replace->parent->left == replace) {
-      height_change         = replace->parent->right ? 0 : -1;
-      d_balance             = 1;
-      to_balance            = replace->parent;
-      replace->parent->left = replace->right;
+    ZixTreeNode* const replace_p = node_parent(replace);
+    if (replace_p->left == replace) {
+      height_change   = replace_p->right ? 0 : -1;
+      d_balance       = 1;
+      to_balance      = replace_p;
+      replace_p->left = replace->right;
     } else {
-      assert(replace->parent == n);
-      height_change          = replace->parent->left ? 0 : -1;
-      d_balance              = -1;
-      to_balance             = replace->parent;
-      replace->parent->right = replace->right;
+      assert(replace_p == n);
+      height_change    = replace_p->left ? 0 : -1;
+      d_balance        = -1;
+      to_balance       = replace_p;
+      replace_p->right = replace->right;
     }
 
     if (to_balance == n) {
@@ -529,11 +688,9 @@ zix_tree_remove(ZixTree* t, ZixTreeIter* ti)
     }
 
     if (replace->right) {
-      replace->right->parent = replace->parent;
+      set_parent(replace->right, replace_p);
     }
 
-    replace->balance = n->balance;
-
     // Swap node to delete with replace
     if (pp) {
       *pp = replace;
@@ -542,36 +699,42 @@ zix_tree_remove(ZixTree* t, ZixTreeIter* ti)
       t->root = replace;
     }
 
-    replace->parent = n->parent;
-    replace->left   = n->left;
-    n->left->parent = replace;
-    replace->right  = n->right;
+    if (t->ranked) {
+      ((ZixTreeRankedNode*)replace)->count = node_count(n);
+    }
+
+    replace->parent_balance = n->parent_balance;
+    replace->left           = n->left;
+    set_parent(n->left, replace);
+    replace->right = n->right;
     if (n->right) {
-      n->right->parent = replace;
+      set_parent(n->right, replace);
     }
 
-    assert(!replace->parent || replace->parent->left == replace ||
-           replace->parent->right == replace);
+    assert(!n_parent || n_parent->left == replace ||
+           n_parent->right == replace);
   }
 
   // Rebalance starting at to_balance upwards.
-  for (ZixTreeNode* i = to_balance; i; i = i->parent) {
-    i->balance += d_balance;
-    if (d_balance == 0 || i->balance == -1 || i->balance == 1) {
+  for (ZixTreeNode* i = to_balance; i; i = node_parent(i)) {
+    const int balance = node_balance(i) + d_balance;
+    if (d_balance == 0 || balance == -1 || balance == 1) {
+      set_balance(i, balance);
       break;
     }
 
     assert(i != n);
-    i = zix_tree_rebalance(t, i, &height_change);
-    if (i->balance == 0) {
+    i = zix_tree_rebalance(t, i, balance, &height_change);
+    if (node_balance(i) == 0) {
       height_change = -1;
     }
 
-    if (i->parent) {
-      if (i == i->parent->left) {
+    ZixTreeNode* const parent = node_parent(i);
+    if (parent) {
+      if (i == parent->left) {
         d_balance = height_change * -1;
       } else {
-        assert(i == i->parent->right);
+        assert(i == parent->right);
         d_balance = height_change;
       }
     }
@@ -582,9 +745,460 @@ zix_tree_remove(ZixTree* t, ZixTreeIter* ti)
   if (t->destroy) {
     t->destroy(n->data, t->destroy_user_data);
   }
-  zix_free(t->allocator, n);
+  zix_tree_node_free(t, n);
+
+  --t->size;
+
+#ifdef ZIX_TREE_VERIFY
+  if (!verify(t, t->root)) {
+    return ZIX_STATUS_ERROR;
+  }
+#endif
+
+  return ZIX_STATUS_SUCCESS;
+}
+
+/// A detached subtree with a known height, used for splitting and joining
+typedef struct {
+  ZixTreeNode* root;   ///< Root node, or null for an empty subtree
+  int          height; ///< Number of nodes on the longest path to a leaf
+} ZixTreeSubtree;
+
+static const ZixTreeSubtree empty_subtree = {NULL, 0};
+
+/// Return the height of a tree by following the taller child at each level
+static int
+zix_tree_height(const ZixTreeNode* n)
+{
+  int h = 0;
+  for (; n; n = (node_balance(n) < 0) ? n->left : n->right) {
+    ++h;
+  }
+
+  return h;
+}
+
+/// Detach the node `root` from its parent, and return it as a subtree
+static ZixTreeSubtree
+zix_tree_detach(ZixTreeNode* const root, const int height)
+{
+  const ZixTreeSubtree result = {root, root ? height : 0};
+
+  if (root) {
+    set_parent(root, NULL);
+  }
+
+  return result;
+}
+
+static ZixTreeSubtree
+zix_tree_left_subtree(const ZixTreeSubtree s)
+{
+  const int drop = (node_balance(s.root) > 0) ? 2 : 1;
+
+  return zix_tree_detach(s.root->left, s.height - drop);
+}
+
+static ZixTreeSubtree
+zix_tree_right_subtree(const ZixTreeSubtree s)
+{
+  const int drop = (node_balance(s.root) < 0) ? 2 : 1;
+
+  return zix_tree_detach(s.root->right, s.height - drop);
+}
+
+/// Make `k` the parent of `left` and `right`, and return it as a subtree
+static ZixTreeSubtree
+zix_tree_link(const ZixTree* const   t,
+              ZixTreeNode* const   k,
+              const ZixTreeSubtree left,
+              const ZixTreeSubtree right,
+              ZixTreeNode* const   parent)
+{
+  k->left           = left.root;
+  k->right          = right.root;
+  k->parent_balance = (uintptr_t)parent;
+  set_balance(k, right.height - left.height);
+
+  if (left.root) {
+    set_parent(left.root, k);
+  }
+
+  if (right.root) {
+    set_parent(right.root, k);
+  }
+
+  update_count(t, k);
+
+  const ZixTreeSubtree result = {k, 1 + MAX(left.height, right.height)};
+
+  return result;
+}
+
+/**
+   Join two subtrees and a middle node, where `left` is much taller.
+
+   The middle node replaces the node on the right edge of `left` that has
+   about the same height as `right`, which makes that subtree one taller, and
+   the tree is then rebalanced from there upwards like after an insertion.
+*/
+static ZixTreeSubtree
+zix_tree_join_right(const ZixTree* const   t,
+                    const ZixTreeSubtree left,
+                    ZixTreeNode* const   k,
+                    const ZixTreeSubtree right)
+{
+  ZixTreeNode* p = NULL;
+  ZixTreeNode* c = left.root;
+  int          h = left.height;
+  const size_t delta = t->ranked ? 1U + node_count(right.root) : 0U;
+  while (h > right.height + 1) {
+    h -= (node_balance(c) < 0) ? 2 : 1;
+    p = c;
+    c = c->right;
+    if (t->ranked) {
+      add_count(p, delta); // Count k and right, which will be below p
+    }
+  }
+
+  const ZixTreeSubtree c_sub    = {c, h};
+  ZixTreeSubtree       result   = left;
+  bool                 taller   = true;
+  ZixTreeNode*         parent   = p;
+  ZixTreeNode*         new_root = NULL;
+
+  zix_tree_link(t, k, c_sub, right, p);
+  p->right = k;
+
+  while (taller && parent) {
+    const int    balance       = node_balance(parent) + 1;
+    int          height_change = 0;
+    ZixTreeNode* sub           = parent;
+
+    if (balance == 2) {
+      sub    = zix_tree_rotate(t, parent, balance, &height_change);
+      taller = !height_change;
+    } else {
+      set_balance(parent, balance);
+      taller = balance == 1;
+    }
+
+    new_root = sub;
+    parent   = node_parent(sub);
+  }
+
+  if (!parent) {
+    result.root = new_root;
+    result.height += taller ? 1 : 0;
+  }
+
+  return result;
+}
+
+/// Join two subtrees and a middle node, where `right` is much taller
+static ZixTreeSubtree
+zix_tree_join_left(const ZixTree* const   t,
+                   const ZixTreeSubtree left,
+                   ZixTreeNode* const   k,
+                   const ZixTreeSubtree right)
+{
+  ZixTreeNode* p = NULL;
+  ZixTreeNode* c = right.root;
+  int          h = right.height;
+  const size_t delta = t->ranked ? 1U + node_count(left.root) : 0U;
+  while (h > left.height + 1) {
+    h -= (node_balance(c) > 0) ? 2 : 1;
+    p = c;
+    c = c->left;
+    if (t->ranked) {
+      add_count(p, delta); // Count left and k, which will be below p
+    }
+  }
+
+  const ZixTreeSubtree c_sub    = {c, h};
+  ZixTreeSubtree       result   = right;
+  bool                 taller   = true;
+  ZixTreeNode*         parent   = p;
+  ZixTreeNode*         new_root = NULL;
+
+  zix_tree_link(t, k, left, c_sub, p);
+  p->left = k;
+
+  while (taller && parent) {
+    const int    balance       = node_balance(parent) - 1;
+    int          height_change = 0;
+    ZixTreeNode* sub           = parent;
+
+    if (balance == -2) {
+      sub    = zix_tree_rotate(t, parent, balance, &height_change);
+      taller = !height_change;
+    } else {
+      set_balance(parent, balance);
+      taller = balance == -1;
+    }
+
+    new_root = sub;
+    parent   = node_parent(sub);
+  }
+
+  if (!parent) {
+    result.root = new_root;
+    result.height += taller ? 1 : 0;
+  }
+
+  return result;
+}
+
+/// Join two subtrees with every element in `left` less than `k` and `right`
+static ZixTreeSubtree
+zix_tree_join(const ZixTree* const   t,
+              const ZixTreeSubtree left,
+              ZixTreeNode* const   k,
+              const ZixTreeSubtree right)
+{
+  if (left.height > right.height + 1) {
+    return zix_tree_join_right(t, left, k, right);
+  }
+
+  if (right.height > left.height + 1) {
+    return zix_tree_join_left(t, left, k, right);
+  }
+
+  return zix_tree_link(t, k, left, right, NULL);
+}
+
+/// Remove the last node from `s`, setting `rest` to the remaining subtree
+static ZixTreeNode*
+zix_tree_split_last(const ZixTree* const  t,
+                    const ZixTreeSubtree  s,
+                    ZixTreeSubtree* const rest)
+{
+  ZixTreeNode* const n = s.root;
+  if (!n->right) {
+    *rest = zix_tree_detach(n->left, s.height - 1);
+    return n;
+  }
+
+  const ZixTreeSubtree left  = zix_tree_left_subtree(s);
+  ZixTreeSubtree       right = zix_tree_right_subtree(s);
+  ZixTreeNode* const   last  = zix_tree_split_last(t, right, &right);
+
+  *rest = zix_tree_join(t, left, n, right);
+  return last;
+}
+
+/// Join two subtrees with every element in `left` less than those in `right`
+static ZixTreeSubtree
+zix_tree_join2(const ZixTree* const   t,
+               const ZixTreeSubtree left,
+               const ZixTreeSubtree right)
+{
+  if (!left.root) {
+    return right;
+  }
+
+  if (!right.root) {
+    return left;
+  }
+
+  ZixTreeSubtree     rest = empty_subtree;
+  ZixTreeNode* const k    = zix_tree_split_last(t, left, &rest);
+
+  return zix_tree_join(t, rest, k, right);
+}
+
+/**
+   Split a subtree into the nodes less and greater than `key`.
+
+   @return The node equal to `key`, which is in neither side, or null.
+*/
+static ZixTreeNode*
+zix_tree_split(const ZixTree* const  t,
+               const ZixTreeSubtree  s,
+               const void* const     key,
+               ZixTreeSubtree* const left,
+               ZixTreeSubtree* const right)
+{
+  ZixTreeNode* const n = s.root;
+  if (!n) {
+    *left = *right = empty_subtree;
+    return NULL;
+  }
+
+  const ZixTreeSubtree l   = zix_tree_left_subtree(s);
+  const ZixTreeSubtree r   = zix_tree_right_subtree(s);
+  const int            cmp = t->cmp(key, n->data, t->cmp_data);
+  ZixTreeNode*         mid = n;
+  ZixTreeSubtree       sub = empty_subtree;
+
+  if (cmp < 0) {
+    mid    = zix_tree_split(t, l, key, left, &sub);
+    *right = zix_tree_join(t, sub, n, r);
+  } else if (cmp > 0) {
+    mid   = zix_tree_split(t, r, key, &sub, right);
+    *left = zix_tree_join(t, l, n, sub);
+  } else {
+    *left  = l;
+    *right = r;
+  }
+
+  return mid;
+}
+
+/// Remove a node that was detached from `t`
+static void
+zix_tree_discard(ZixTree* const t, ZixTreeNode* const n)
+{
+  if (t->destroy) {
+    t->destroy(n->data, t->destroy_user_data);
+  }
 
+  zix_tree_node_free(t, n);
   --t->size;
+}
+
+/// Remove every node in a subtree that was detached from `t`
+static void
+zix_tree_discard_rec(ZixTree* const t, ZixTreeNode* const n)
+{
+  if (n) {
+    zix_tree_discard_rec(t, n->left);
+    zix_tree_discard_rec(t, n->right);
+    zix_tree_discard(t, n);
+  }
+}
+
+static ZixTreeSubtree
+zix_tree_union_rec(ZixTree* const       t,
+                   ZixTree* const       other,
+                   const ZixTreeSubtree a,
+                   const ZixTreeSubtree b)
+{
+  if (!b.root) {
+    return a;
+  }
+
+  if (!a.root) {
+    return b;
+  }
+
+  ZixTreeNode* const   k  = b.root;
+  const ZixTreeSubtree bl = zix_tree_left_subtree(b);
+  const ZixTreeSubtree br = zix_tree_right_subtree(b);
+  ZixTreeSubtree       al = empty_subtree;
+  ZixTreeSubtree       ar = empty_subtree;
+  ZixTreeNode* const   m  = zix_tree_split(t, a, k->data, &al, &ar);
+
+  const ZixTreeSubtree l = zix_tree_union_rec(t, other, al, bl);
+  const ZixTreeSubtree r = zix_tree_union_rec(t, other, ar, br);
+
+  if (m) {
+    zix_tree_discard(other, k); // Keep the equal element already in t
+    return zix_tree_join(t, l, m, r);
+  }
+
+  return zix_tree_join(t, l, k, r);
+}
+
+static ZixTreeSubtree
+zix_tree_intersection_rec(ZixTree* const           t,
+                          const ZixTreeSubtree     a,
+                          const ZixTreeNode* const b)
+{
+  if (!a.root) {
+    return a;
+  }
+
+  if (!b) {
+    zix_tree_discard_rec(t, a.root);
+    return empty_subtree;
+  }
+
+  ZixTreeSubtree     al = empty_subtree;
+  ZixTreeSubtree     ar = empty_subtree;
+  ZixTreeNode* const m  = zix_tree_split(t, a, b->data, &al, &ar);
+
+  const ZixTreeSubtree l = zix_tree_intersection_rec(t, al, b->left);
+  const ZixTreeSubtree r = zix_tree_intersection_rec(t, ar, b->right);
+
+  return m ? zix_tree_join(t, l, m, r) : zix_tree_join2(t, l, r);
+}
+
+static ZixTreeSubtree
+zix_tree_difference_rec(ZixTree* const           t,
+                        const ZixTreeSubtree     a,
+                        const ZixTreeNode* const b)
+{
+  if (!a.root || !b) {
+    return a;
+  }
+
+  ZixTreeSubtree     al = empty_subtree;
+  ZixTreeSubtree     ar = empty_subtree;
+  ZixTreeNode* const m  = zix_tree_split(t, a, b->data, &al, &ar);
+
+  const ZixTreeSubtree l = zix_tree_difference_rec(t, al, b->left);
+  const ZixTreeSubtree r = zix_tree_difference_rec(t, ar, b->right);
+
+  if (m) {
+    zix_tree_discard(t, m);
+  }
+
+  return zix_tree_join2(t, l, r);
+}
+
+static ZixTreeSubtree
+zix_tree_subtree(const ZixTree* const t)
+{
+  const ZixTreeSubtree result = {t->root, zix_tree_height(t->root)};
+
+  return result;
+}
+
+ZixStatus
+zix_tree_union(ZixTree* const t, ZixTree* const other)
+{
+  if (t->allow_duplicates || other->allow_duplicates ||
+      t->allocator != other->allocator || t->intrusive != other->intrusive ||
+      t->ranked != other->ranked || t->links_offset != other->links_offset) {
+    return ZIX_STATUS_BAD_ARG;
+  }
+
+  if (t == other) {
+    return ZIX_STATUS_SUCCESS;
+  }
+
+  const ZixTreeSubtree a = zix_tree_subtree(t);
+  const ZixTreeSubtree b = zix_tree_subtree(other);
+
+  // Equal elements are removed from other, and the rest are moved to t
+  t->root = zix_tree_union_rec(t, other, a, b).root;
+  t->size += other->size;
+
+  other->root = NULL;
+  other->size = 0U;
+
+#ifdef ZIX_TREE_VERIFY
+  if (!verify(t, t->root)) {
+    return ZIX_STATUS_ERROR;
+  }
+#endif
+
+  return ZIX_STATUS_SUCCESS;
+}
+
+ZixStatus
+zix_tree_intersection(ZixTree* const t, const ZixTree* const other)
+{
+  if (t->allow_duplicates || other->allow_duplicates) {
+    return ZIX_STATUS_BAD_ARG;
+  }
+
+  if (t != other) {
+    const ZixTreeSubtree a = zix_tree_subtree(t);
+
+    t->root = zix_tree_intersection_rec(t, a, other->root).root;
+  }
 
 #ifdef ZIX_TREE_VERIFY
   if (!verify(t, t->root)) {
@@ -595,6 +1209,70 @@ zix_tree_remove(ZixTree* t, ZixTreeIter* ti)
   return ZIX_STATUS_SUCCESS;
 }
 
+ZixStatus
+zix_tree_difference(ZixTree* const t, const ZixTree* const other)
+{
+  if (t->allow_duplicates || other->allow_duplicates) {
+    return ZIX_STATUS_BAD_ARG;
+  }
+
+  if (t == other) {
+    zix_tree_discard_rec(t, t->root);
+    t->root = NULL;
+  } else {
+    const ZixTreeSubtree a = zix_tree_subtree(t);
+
+    t->root = zix_tree_difference_rec(t, a, other->root).root;
+  }
+
+#ifdef ZIX_TREE_VERIFY
+  if (!verify(t, t->root)) {
+    return ZIX_STATUS_ERROR;
+  }
+#endif
+
+  return ZIX_STATUS_SUCCESS;
+}
+
+size_t
+zix_tree_rank(const ZixTree* const t, const void* const e)
+{
+  assert(t->ranked);
+
+  size_t rank = 0U;
+  for (const ZixTreeNode* n = t->root; n;) {
+    if (t->cmp(e, n->data, t->cmp_data) <= 0) {
+      n = n->left;
+    } else {
+      rank += node_count(n->left) + 1U;
+      n = n->right;
+    }
+  }
+
+  return rank;
+}
+
+ZixTreeIter*
+zix_tree_select(ZixTree* const t, size_t k)
+{
+  assert(t->ranked);
+
+  ZixTreeNode* n = t->root;
+  while (n) {
+    const size_t n_left = node_count(n->left);
+    if (k < n_left) {
+      n = n->left;
+    } else if (k > n_left) {
+      k -= n_left + 1U;
+      n = n->right;
+    } else {
+      break;
+    }
+  }
+
+  return n;
+}
+
 ZixStatus
 zix_tree_find(const ZixTree* t, const void* e, ZixTreeIter** ti)
 {
@@ -689,11 +1367,13 @@ zix_tree_iter_next(ZixTreeIter* i)
       i = i->left;
     }
   } else {
-    while (i->parent && i->parent->right == i) { // i is a right child
-      i = i->parent;
+    ZixTreeNode* parent = node_parent(i);
+    while (parent && parent->right == i) { // i is a right child
+      i      = parent;
+      parent = node_parent(i);
     }
 
-    i = i->parent;
+    i = parent;
   }
 
   return i;
@@ -713,11 +1393,13 @@ zix_tree_iter_prev(ZixTreeIter* i)
     }
 
   } else {
-    while (i->parent && i->parent->left == i) { // i is a left child
-      i = i->parent;
+    ZixTreeNode* parent = node_parent(i);
+    while (parent && parent->left == i) { // i is a left child
+      i      = parent;
+      parent = node_parent(i);
     }
 
-    i = i->parent;
+    i = parent;
   }
 
   return i;
@@ -5,13 +5,14 @@
 #define ZIX_TREE_DEBUG_H
 
 #include <inttypes.h>
+#include <stdio.h>
 
 #ifdef ZIX_TREE_DUMP
 static void
 zix_tree_print(ZixTreeNode* node, int level)
 {
   if (node) {
-    if (!node->parent) {
+    if (!node_parent(node)) {
       printf("{{{\n");
     }
 
@@ -20,9 +21,9 @@ zix_tree_print(ZixTreeNode* node, int level)
       printf("  ");
     }
 
-    printf("%ld.%d\n", (intptr_t)node->data, node->balance);
+    printf("%ld.%d\n", (intptr_t)node->data, node_balance(node));
     zix_tree_print(node->left, level + 1);
-    if (!node->parent) {
+    if (!node_parent(node)) {
       printf("}}}\n");
     }
   }
@@ -49,49 +50,49 @@ verify_balance(ZixTreeNode* n)
     return true;
   }
 
-  if (n->balance < -2 || n->balance > 2) {
+  if (node_balance(n) < -1 || node_balance(n) > 1) {
     fprintf(stderr,
             "Balance out of range : %ld (balance %d)\n",
             (intptr_t)n->data,
-            n->balance);
+            node_balance(n));
     return false;
   }
 
-  if (n->balance < 0 && !n->left) {
+  if (node_balance(n) < 0 && !n->left) {
     fprintf(stderr,
             "Bad balance : %ld (balance %d) has no left child\n",
             (intptr_t)n->data,
-            n->balance);
+            node_balance(n));
     return false;
   }
 
-  if (n->balance > 0 && !n->right) {
+  if (node_balance(n) > 0 && !n->right) {
     fprintf(stderr,
             "Bad balance : %ld (balance %d) has no right child\n",
             (intptr_t)n->data,
-            n->balance);
+            node_balance(n));
     return false;
   }
 
-  if (n->balance != 0 && !n->left && !n->right) {
+  if (node_balance(n) != 0 && !n->left && !n->right) {
     fprintf(stderr,
             "Bad balance : %ld (balance %d) has no children\n",
             (intptr_t)n->data,
-            n->balance);
+            node_balance(n));
     return false;
   }
 
 #  ifdef ZIX_TREE_HYPER_VERIFY
   const intptr_t left_height  = (intptr_t)height(n->left);
   const intptr_t right_height = (intptr_t)height(n->right);
-  if (n->balance != right_height - left_height) {
+  if (node_balance(n) != right_height - left_height) {
     fprintf(stderr,
             "Bad balance at %ld: h_r (%" PRIdPTR ")"
             "- l_h (%" PRIdPTR ") != %d\n",
             (intptr_t)n->data,
             right_height,
             left_height,
-            n->balance);
+            node_balance(n));
     assert(false);
     return false;
   }
@@ -109,8 +110,9 @@ verify(ZixTree* t, ZixTreeNode* n)
     return true;
   }
 
-  if (n->parent) {
-    if ((n->parent->left != n) && (n->parent->right != n)) {
+  const ZixTreeNode* const parent = node_parent(n);
+  if (parent) {
+    if ((parent->left != n) && (parent->right != n)) {
       fprintf(stderr, "Corrupt child/parent pointers\n");
       return false;
     }
@@ -150,8 +152,14 @@ verify(ZixTree* t, ZixTreeNode* n)
     return false;
   }
 
-  if (n->balance <= -2 || n->balance >= 2) {
-    fprintf(stderr, "Imbalance: %p (balance %d)\n", (void*)n, n->balance);
+  if (t->ranked &&
+      node_count(n) != 1U + node_count(n->left) + node_count(n->right)) {
+    fprintf(stderr, "Bad count: %p (count %zu)\n", (void*)n, node_count(n));
+    return false;
+  }
+
+  if (node_balance(n) <= -2 || node_balance(n) >= 2) {
+    fprintf(stderr, "Imbalance: %p (balance %d)\n", (void*)n, node_balance(n));
     return false;
   }
 
@@ -0,0 +1,309 @@
+// Copyright 2022 David Robillard <d@drobilla.net>
+// SPDX-License-Identifier: ISC
+
+/*
+  Minimal atomic operations for internal use.
+
+  The library is written in C99, which has no standard atomics, so this wraps
+  the compiler builtins for the few operations that lock-free code needs.
+  Only pointer-sized integers and pointers are supported, since those are
+  atomic on every supported platform.  Unless noted otherwise, loads have
+  acquire semantics, stores have release semantics, and read-modify-write
+  operations are sequentially consistent.
+
+  Other compilers get plain loads and stores with a warning, like the library
+  had before, which is enough for a single-reader single-writer ring.  There
+  is no way to make read-modify-write operations atomic without compiler
+  support though, so they are only available if ZIX_ATOMIC_RMW is true, and
+  code that needs them can't be built otherwise.
+*/
+
+#ifndef ZIX_ATOMIC_H
+#define ZIX_ATOMIC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#if defined(_MSC_VER)
+#  include <windows.h>
+#endif
+
+#if defined(__GNUC__)
+
+#  define ZIX_ATOMIC_RMW 1
+
+static inline uintptr_t
+zix_atomic_load(const uintptr_t* const ptr)
+{
+  return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+
+static inline uintptr_t
+zix_atomic_load_relaxed(const uintptr_t* const ptr)
+{
+  return __atomic_load_n(ptr, __ATOMIC_RELAXED);
+}
+
+static inline void
+zix_atomic_store(uintptr_t* const ptr, const uintptr_t value)
+{
+  __atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+}
+
+static inline void
+zix_atomic_store_relaxed(uintptr_t* const ptr, const uintptr_t value)
+{
+  __atomic_store_n(ptr, value, __ATOMIC_RELAXED);
+}
+
+static inline bool
+zix_atomic_cas(uintptr_t* const ptr,
+               uintptr_t        expected,
+               const uintptr_t  desired)
+{
+  return __atomic_compare_exchange_n(
+    ptr, &expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+static inline uintptr_t
+zix_atomic_fetch_add(uintptr_t* const ptr, const uintptr_t value)
+{
+  return __atomic_fetch_add(ptr, value, __ATOMIC_SEQ_CST);
+}
+
+static inline void*
+zix_atomic_load_ptr(void* const* const ptr)
+{
+  return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+
+static inline void*
+zix_atomic_load_ptr_relaxed(void* const* const ptr)
+{
+  return __atomic_load_n(ptr, __ATOMIC_RELAXED);
+}
+
+static inline void
+zix_atomic_store_ptr(void** const ptr, void* const value)
+{
+  __atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+}
+
+static inline void
+zix_atomic_store_ptr_relaxed(void** const ptr, void* const value)
+{
+  __atomic_store_n(ptr, value, __ATOMIC_RELAXED);
+}
+
+static inline bool
+zix_atomic_cas_ptr(void** const ptr, void* expected, void* const desired)
+{
+  return __atomic_compare_exchange_n(
+    ptr, &expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+static inline void
+zix_atomic_acquire_fence(void)
+{
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+}
+
+static inline void
+zix_atomic_release_fence(void)
+{
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/// Hint to the CPU that the caller is spinning in a busy-wait loop
+static inline void
+zix_atomic_pause(void)
+{
+#  if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#  elif defined(__aarch64__) || (defined(__arm__) && __ARM_ARCH >= 7)
+  __asm__ __volatile__("yield");
+#  endif
+}
+
+#elif defined(_MSC_VER)
+
+#  define ZIX_ATOMIC_RMW 1
+
+/* Aligned pointer-sized accesses are atomic on all Windows targets, so plain
+   loads and stores only need a fence to get the required ordering.  A full
+   barrier is stronger than necessary, but only costs a compiler barrier on
+   x86, where MSVC-compiled code spends most of its time. */
+
+static inline uintptr_t
+zix_atomic_load(const uintptr_t* const ptr)
+{
+  const uintptr_t value = *(const volatile uintptr_t*)ptr;
+  MemoryBarrier();
+  return value;
+}
+
+static inline uintptr_t
+zix_atomic_load_relaxed(const uintptr_t* const ptr)
+{
+  return *(const volatile uintptr_t*)ptr;
+}
+
+static inline void
+zix_atomic_store(uintptr_t* const ptr, const uintptr_t value)
+{
+  MemoryBarrier();
+  *(volatile uintptr_t*)ptr = value;
+}
+
+static inline void
+zix_atomic_store_relaxed(uintptr_t* const ptr, const uintptr_t value)
+{
+  *(volatile uintptr_t*)ptr = value;
+}
+
+static inline bool
+zix_atomic_cas(uintptr_t* const ptr,
+               const uintptr_t  expected,
+               const uintptr_t  desired)
+{
+  return InterlockedCompareExchangePointer((PVOID volatile*)ptr,
+                                           (PVOID)desired,
+                                           (PVOID)expected) == (PVOID)expected;
+}
+
+static inline uintptr_t
+zix_atomic_fetch_add(uintptr_t* const ptr, const uintptr_t value)
+{
+#  ifdef _WIN64
+  return (uintptr_t)InterlockedExchangeAdd64((LONG64 volatile*)ptr,
+                                             (LONG64)value);
+#  else
+  return (uintptr_t)InterlockedExchangeAdd((LONG volatile*)ptr, (LONG)value);
+#  endif
+}
+
+static inline void*
+zix_atomic_load_ptr(void* const* const ptr)
+{
+  void* const value = *(void* const volatile*)ptr;
+  MemoryBarrier();
+  return value;
+}
+
+static inline void*
+zix_atomic_load_ptr_relaxed(void* const* const ptr)
+{
+  return *(void* const volatile*)ptr;
+}
+
+static inline void
+zix_atomic_store_ptr(void** const ptr, void* const value)
+{
+  MemoryBarrier();
+  *(void* volatile*)ptr = value;
+}
+
+static inline void
+zix_atomic_store_ptr_relaxed(void** const ptr, void* const value)
+{
+  *(void* volatile*)ptr = value;
+}
+
+static inline bool
+zix_atomic_cas_ptr(void** const ptr, void* const expected, void* const desired)
+{
+  return InterlockedCompareExchangePointer(
+           (PVOID volatile*)ptr, desired, expected) == expected;
+}
+
+static inline void
+zix_atomic_acquire_fence(void)
+{
+  MemoryBarrier();
+}
+
+static inline void
+zix_atomic_release_fence(void)
+{
+  MemoryBarrier();
+}
+
+static inline void
+zix_atomic_pause(void)
+{
+  YieldProcessor();
+}
+
+#else
+
+/* Without compiler support, fall back to plain accesses.  Aligned
+   pointer-sized loads and stores are atomic on most platforms, but there is
+   nothing to order them. */
+
+#  pragma message("warning: No memory barriers, possible SMP bugs")
+
+#  define ZIX_ATOMIC_RMW 0
+
+static inline uintptr_t
+zix_atomic_load(const uintptr_t* const ptr)
+{
+  return *(const volatile uintptr_t*)ptr;
+}
+
+static inline uintptr_t
+zix_atomic_load_relaxed(const uintptr_t* const ptr)
+{
+  return *(const volatile uintptr_t*)ptr;
+}
+
+static inline void
+zix_atomic_store(uintptr_t* const ptr, const uintptr_t value)
+{
+  *(volatile uintptr_t*)ptr = value;
+}
+
+static inline void
+zix_atomic_store_relaxed(uintptr_t* const ptr, const uintptr_t value)
+{
+  *(volatile uintptr_t*)ptr = value;
+}
+
+static inline void*
+zix_atomic_load_ptr(void* const* const ptr)
+{
+  return *(void* const volatile*)ptr;
+}
+
+static inline void*
+zix_atomic_load_ptr_relaxed(void* const* const ptr)
+{
+  return *(void* const volatile*)ptr;
+}
+
+static inline void
+zix_atomic_store_ptr(void** const ptr, void* const value)
+{
+  *(void* volatile*)ptr = value;
+}
+
+static inline void
+zix_atomic_store_ptr_relaxed(void** const ptr, void* const value)
+{
+  *(void* volatile*)ptr = value;
+}
+
+static inline void
+zix_atomic_acquire_fence(void)
+{}
+
+static inline void
+zix_atomic_release_fence(void)
+{}
+
+static inline void
+zix_atomic_pause(void)
+{}
+
+#endif
+
+#endif // ZIX_ATOMIC_H
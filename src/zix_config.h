@@ -39,6 +39,24 @@
 #    endif
 #  endif
 
+// Linux: madvise() (which is not in POSIX and needs _DEFAULT_SOURCE)
+#  ifndef HAVE_MADVISE
+#    if defined(__linux__)
+#      define HAVE_MADVISE 1
+#    else
+#      define HAVE_MADVISE 0
+#    endif
+#  endif
+
+// Linux: memfd_create() (which is not in POSIX and needs _GNU_SOURCE)
+#  ifndef HAVE_MEMFD_CREATE
+#    if defined(__linux__)
+#      define HAVE_MEMFD_CREATE 1
+#    else
+#      define HAVE_MEMFD_CREATE 0
+#    endif
+#  endif
+
 // POSIX.1-2001: mlock()
 #  ifndef HAVE_MLOCK
 #    if defined(_POSIX_VERSION) && _POSIX_VERSION >= 200112L
@@ -48,6 +66,15 @@
 #    endif
 #  endif
 
+// POSIX.1-2001: mmap(), msync(), and ftruncate()
+#  ifndef HAVE_MMAP
+#    if defined(_POSIX_VERSION) && _POSIX_VERSION >= 200112L
+#      define HAVE_MMAP 1
+#    else
+#      define HAVE_MMAP 0
+#    endif
+#  endif
+
 // POSIX.1-2001: posix_memalign()
 #  ifndef HAVE_POSIX_MEMALIGN
 #    if defined(_POSIX_VERSION) && _POSIX_VERSION >= 200112L
@@ -67,12 +94,30 @@
   if the build system defines them all.
 */
 
+#if HAVE_MADVISE
+#  define USE_MADVISE 1
+#else
+#  define USE_MADVISE 0
+#endif
+
+#if HAVE_MEMFD_CREATE && HAVE_MMAP
+#  define USE_MEMFD_CREATE 1
+#else
+#  define USE_MEMFD_CREATE 0
+#endif
+
 #if HAVE_MLOCK
 #  define USE_MLOCK 1
 #else
 #  define USE_MLOCK 0
 #endif
 
+#if HAVE_MMAP
+#  define USE_MMAP 1
+#else
+#  define USE_MMAP 0
+#endif
+
 #if HAVE_POSIX_MEMALIGN
 #  define USE_POSIX_MEMALIGN 1
 #else
@@ -3,11 +3,16 @@
 
 #undef NDEBUG
 
+#include "failing_allocator.h"
+
 #include "zix/allocator.h"
 #include "zix/bump_allocator.h"
+#include "zix/pool_allocator.h"
 
 #include <assert.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 
 static void
 test_allocator(void)
@@ -111,11 +116,157 @@ test_bump_allocator(void)
   zix_free(&allocator.base, malloced);  // Correct, but a noop
 }
 
+static void
+test_pool_allocator_sizes(ZixPoolAllocator* const pool)
+{
+  static const size_t n_blocks = 1024U;
+
+  static const size_t sizes[] = {0U, 1U, 16U, 17U, 40U, 511U, 512U, 513U};
+
+  for (size_t s = 0U; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+    const size_t size     = sizes[s];
+    const size_t fill_len = size ? size : 1U;
+
+    // Allocate many blocks and fill each with a different byte
+    unsigned char* blocks[1024] = {NULL};
+    for (size_t i = 0U; i < n_blocks; ++i) {
+      blocks[i] = (unsigned char*)zix_malloc(&pool->base, fill_len);
+      assert(blocks[i]);
+      assert((uintptr_t)blocks[i] % ZIX_POOL_ALLOCATOR_GRANULARITY == 0U);
+      memset(blocks[i], (int)(i & 0xFFU), fill_len);
+    }
+
+    // Check that no blocks overlap
+    for (size_t i = 0U; i < n_blocks; ++i) {
+      for (size_t j = 0U; j < fill_len; ++j) {
+        assert(blocks[i][j] == (unsigned char)(i & 0xFFU));
+      }
+    }
+
+    // Free every other block, and check that they are reused
+    for (size_t i = 0U; i < n_blocks; i += 2U) {
+      zix_free(&pool->base, blocks[i]);
+    }
+
+    for (size_t i = n_blocks; i > 0U; i -= 2U) {
+      void* const block = zix_malloc(&pool->base, fill_len);
+      assert(size > ZIX_POOL_ALLOCATOR_MAX_SIZE ||
+             block == blocks[i - 2U]);
+
+      blocks[i - 2U] = (unsigned char*)block;
+    }
+
+    for (size_t i = 0U; i < n_blocks; ++i) {
+      zix_free(&pool->base, blocks[i]);
+    }
+  }
+}
+
+static void
+test_pool_allocator(void)
+{
+  ZixPoolAllocator pool = zix_pool_allocator(NULL);
+
+  test_pool_allocator_sizes(&pool);
+
+  // Freed blocks are zeroed when reused by calloc()
+  char* const malloced = (char*)zix_malloc(&pool.base, 24);
+  memset(malloced, 1, 24);
+  zix_free(&pool.base, malloced);
+
+  char* const calloced = (char*)zix_calloc(&pool.base, 3, 8);
+  assert(calloced == malloced);
+  for (size_t i = 0U; i < 24U; ++i) {
+    assert(!calloced[i]);
+  }
+
+  assert(!zix_calloc(&pool.base, SIZE_MAX / 2U, 3U));
+  assert(!zix_malloc(&pool.base, SIZE_MAX));
+
+  // Shrinking keeps the same block
+  calloced[0] = 'a';
+  calloced[7] = 'b';
+  char* const shrunk = (char*)zix_realloc(&pool.base, calloced, 8);
+  assert(shrunk == calloced);
+
+  // Growing moves to a new block with the same contents
+  char* const grown = (char*)zix_realloc(&pool.base, shrunk, 100);
+  assert(grown[0] == 'a');
+  assert(grown[7] == 'b');
+  grown[99] = 'c';
+
+  // Growing past the maximum size moves to a large block
+  char* const large = (char*)zix_realloc(&pool.base, grown, 10000);
+  assert(large[0] == 'a');
+  assert(large[7] == 'b');
+  assert(large[99] == 'c');
+  large[9999] = 'd';
+  assert(zix_realloc(&pool.base, large, 5000) == large);
+
+  // Shrinking back to a small size moves to a small block
+  char* const small = (char*)zix_realloc(&pool.base, large, 8);
+  assert(small[0] == 'a');
+  assert(small[7] == 'b');
+  zix_free(&pool.base, small);
+  zix_free(&pool.base, NULL);
+
+  // Aligned allocations are passed through
+  char* const aligned = (char*)zix_aligned_alloc(&pool.base, 4096, 4096);
+  assert((uintptr_t)aligned % 4096 == 0);
+  aligned[0]    = 0;
+  aligned[4095] = 1;
+  zix_aligned_free(&pool.base, aligned);
+
+  // Everything can be freed at once, and the pool used again
+  for (size_t i = 0U; i < 100U; ++i) {
+    assert(zix_malloc(&pool.base, i * 8U));
+  }
+
+  zix_pool_allocator_clear(&pool);
+  assert(!pool.pages);
+  assert(zix_malloc(&pool.base, 8U));
+  zix_pool_allocator_clear(&pool);
+}
+
+static void
+test_pool_allocator_failure(void)
+{
+  ZixFailingAllocator backing = zix_failing_allocator();
+  ZixPoolAllocator    pool    = zix_pool_allocator(&backing.base);
+
+  // Allocating a page fails
+  backing.n_remaining = 0U;
+  assert(!zix_malloc(&pool.base, 8U));
+  assert(!zix_malloc(&pool.base, 8192U));
+  assert(!zix_realloc(&pool.base, NULL, 8U));
+
+  // Allocating one page succeeds, and is used for many blocks
+  backing.n_remaining = 1U;
+  void* const first = zix_malloc(&pool.base, 8U);
+  assert(first);
+
+  const size_t n_allocations = backing.n_allocations;
+  for (size_t i = 0U; i < 100U; ++i) {
+    assert(zix_malloc(&pool.base, 8U));
+  }
+
+  assert(backing.n_allocations == n_allocations);
+
+  // Moving a block to a new page fails, leaving it as it was
+  assert(!zix_realloc(&pool.base, first, 8192U));
+  zix_free(&pool.base, first);
+  assert(zix_malloc(&pool.base, 8U) == first);
+
+  zix_pool_allocator_clear(&pool);
+}
+
 int
 main(void)
 {
   test_allocator();
   test_bump_allocator();
+  test_pool_allocator();
+  test_pool_allocator_failure();
 
   return 0;
 }
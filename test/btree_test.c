@@ -17,6 +17,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 static bool expect_failure = false;
 
@@ -249,6 +250,961 @@ test_remove_cases(void)
   zix_btree_free(t, NULL, NULL);
 }
 
+static void
+test_sorted_batch(void)
+{
+  static const size_t n_batches = 7U;
+  static const size_t n_elems   = 16384U;
+
+  ZixBTree* const t = zix_btree_new(NULL, int_cmp, NULL);
+  assert(t);
+
+  // Insert every other value in a single batch
+  void** const values = (void**)calloc(n_elems, sizeof(void*));
+  for (size_t i = 0U; i < n_elems / 2U; ++i) {
+    values[i] = (void*)(2U * (i + 1U));
+  }
+
+  assert(!zix_btree_insert_sorted_batch(t, values, n_elems / 2U));
+  assert(zix_btree_size(t) == n_elems / 2U);
+
+  // Insert every value in interleaved batches, so half of them already exist
+  for (size_t b = 0U; b < n_batches; ++b) {
+    size_t n = 0U;
+    for (size_t i = b; i < n_elems; i += n_batches) {
+      values[n++] = (void*)(i + 1U);
+    }
+
+    assert(zix_btree_insert_sorted_batch(t, values, n) ==
+           ZIX_STATUS_EXISTS);
+  }
+
+  assert(zix_btree_size(t) == n_elems);
+
+  // Check that everything is there in order
+  uintptr_t    expected = 1U;
+  ZixBTreeIter i        = zix_btree_begin(t);
+  for (; !zix_btree_iter_is_end(i); zix_btree_iter_increment(&i)) {
+    assert((uintptr_t)zix_btree_get(i) == expected++);
+  }
+
+  // Remove every third value and some that don't exist in a single batch
+  size_t n_keys = 0U;
+  for (uintptr_t v = 3U; v < n_elems + 64U; v += 3U) {
+    values[n_keys++] = (void*)v;
+  }
+
+  assert(zix_btree_remove_sorted_batch(
+           t, (const void* const*)values, n_keys, NULL, NULL) ==
+         ZIX_STATUS_NOT_FOUND);
+
+  assert(zix_btree_size(t) == n_elems - (n_elems / 3U));
+  for (uintptr_t v = 1U; v <= n_elems; ++v) {
+    assert(!zix_btree_find(t, (void*)v, &i) == !!(v % 3U));
+  }
+
+  // Remove everything that's left in order
+  n_keys = 0U;
+  for (i = zix_btree_begin(t); !zix_btree_iter_is_end(i);
+       zix_btree_iter_increment(&i)) {
+    values[n_keys++] = zix_btree_get(i);
+  }
+
+  assert(!zix_btree_remove_sorted_batch(
+    t, (const void* const*)values, n_keys, NULL, NULL));
+
+  assert(!zix_btree_size(t));
+  assert(zix_btree_iter_is_end(zix_btree_begin(t)));
+
+  free(values);
+  zix_btree_free(t, NULL, NULL);
+}
+
+static void
+test_sorted_batch_failed_alloc(void)
+{
+  static const size_t n_elems = 4096U;
+
+  void** const values = (void**)calloc(n_elems, sizeof(void*));
+  for (size_t i = 0U; i < n_elems; ++i) {
+    values[i] = (void*)(i + 1U);
+  }
+
+  ZixFailingAllocator allocator = zix_failing_allocator();
+
+  // Successfully insert a batch to count the number of allocations
+  ZixBTree* t = zix_btree_new(&allocator.base, int_cmp, NULL);
+  assert(!zix_btree_insert_sorted_batch(t, values, n_elems));
+  zix_btree_free(t, NULL, NULL);
+
+  // Test that each allocation failing is handled gracefully
+  const size_t n_new_allocs = allocator.n_allocations;
+  for (size_t i = 0U; i < n_new_allocs; ++i) {
+    allocator.n_remaining = i;
+
+    if ((t = zix_btree_new(&allocator.base, int_cmp, NULL))) {
+      assert(zix_btree_insert_sorted_batch(t, values, n_elems) ==
+             ZIX_STATUS_NO_MEM);
+
+      assert(zix_btree_size(t) < n_elems);
+      zix_btree_free(t, NULL, NULL);
+    }
+  }
+
+  free(values);
+}
+
+static void
+test_snapshot(void)
+{
+  static const size_t n_elems = 8192U;
+
+  // Use small pages so the tree is deep enough to share internal nodes
+  ZixBTree* const t =
+    zix_btree_new_with_page_size(NULL, ZIX_BTREE_MIN_PAGE_SIZE, int_cmp, NULL);
+
+  for (uintptr_t v = 1U; v <= n_elems; ++v) {
+    assert(!zix_btree_insert(t, (void*)v));
+  }
+
+  // Take a snapshot and modify both trees independently
+  ZixBTree* const s = zix_btree_snapshot(t);
+  assert(s);
+  assert(zix_btree_size(s) == n_elems);
+  assert(zix_btree_page_size(s) == zix_btree_page_size(t));
+
+  void*        out = NULL;
+  ZixBTreeIter i   = zix_btree_end_iter;
+  for (uintptr_t v = 2U; v <= n_elems; v += 2U) {
+    assert(!zix_btree_remove(t, (void*)v, &out, &i));
+    assert((uintptr_t)out == v);
+  }
+
+  for (uintptr_t v = n_elems + 1U; v <= 2U * n_elems; ++v) {
+    assert(!zix_btree_insert(s, (void*)v));
+  }
+
+  assert(zix_btree_size(t) == n_elems / 2U);
+  assert(zix_btree_size(s) == 2U * n_elems);
+
+  // Snapshot the snapshot, then clear it
+  ZixBTree* const s2 = zix_btree_snapshot(s);
+  assert(s2);
+  zix_btree_clear(s, NULL, NULL);
+  assert(!zix_btree_size(s));
+  assert(zix_btree_iter_is_end(zix_btree_begin(s)));
+
+  // Check that each tree still has exactly its own contents
+  for (uintptr_t v = 1U; v <= 2U * n_elems; ++v) {
+    const bool in_t = v <= n_elems && (v & 1U);
+    assert(!zix_btree_find(t, (void*)v, &i) == in_t);
+    assert(!zix_btree_find(s2, (void*)v, &i));
+  }
+
+  uintptr_t expected = 1U;
+  for (i = zix_btree_begin(s2); !zix_btree_iter_is_end(i);
+       zix_btree_iter_increment(&i)) {
+    assert((uintptr_t)zix_btree_get(i) == expected++);
+  }
+
+  // Free the original while the snapshot is still alive
+  zix_btree_free(t, NULL, NULL);
+  assert(zix_btree_size(s2) == 2U * n_elems);
+  assert(!zix_btree_find(s2, (void*)n_elems, &i));
+
+  zix_btree_free(s2, NULL, NULL);
+  zix_btree_free(s, NULL, NULL);
+}
+
+static void
+test_snapshot_failed_alloc(void)
+{
+  static const size_t n_elems = 4096U;
+
+  ZixFailingAllocator allocator = zix_failing_allocator();
+
+  ZixBTree* const t = zix_btree_new_with_page_size(
+    &allocator.base, ZIX_BTREE_MIN_PAGE_SIZE, int_cmp, NULL);
+
+  for (uintptr_t v = 1U; v <= n_elems; ++v) {
+    assert(!zix_btree_insert(t, (void*)v));
+  }
+
+  // Successfully snapshot and modify the tree to count the allocations
+  const size_t n_tree_allocs = allocator.n_allocations;
+  ZixBTree*    s             = zix_btree_snapshot(t);
+  void*        out           = NULL;
+  ZixBTreeIter next          = zix_btree_end_iter;
+  for (uintptr_t v = 1U; v <= n_elems; v += 2U) {
+    assert(!zix_btree_remove(s, (void*)v, &out, &next));
+  }
+
+  zix_btree_free(s, NULL, NULL);
+
+  // Test that each allocation failing leaves both trees intact
+  const size_t n_new_allocs = allocator.n_allocations - n_tree_allocs;
+  for (size_t i = 0U; i < n_new_allocs; ++i) {
+    allocator.n_remaining = i;
+
+    if ((s = zix_btree_snapshot(t))) {
+      size_t n_removed = 0U;
+      for (uintptr_t v = 1U; v <= n_elems; v += 2U) {
+        const ZixStatus st = zix_btree_remove(s, (void*)v, &out, &next);
+        if (st) {
+          assert(st == ZIX_STATUS_NO_MEM);
+          break;
+        }
+
+        ++n_removed;
+      }
+
+      assert(n_removed < n_elems / 2U);
+      assert(zix_btree_size(s) == n_elems - n_removed);
+      for (uintptr_t v = 1U; v <= n_elems; ++v) {
+        assert(!zix_btree_find(t, (void*)v, &next));
+        const bool in_s = !(v & 1U) || v > 2U * n_removed;
+        assert(!zix_btree_find(s, (void*)v, &next) == in_s);
+      }
+
+      zix_btree_free(s, NULL, NULL);
+    }
+  }
+
+  allocator.n_remaining = SIZE_MAX;
+  assert(zix_btree_size(t) == n_elems);
+  zix_btree_free(t, NULL, NULL);
+}
+
+static size_t n_destroyed = 0U;
+
+static void
+count_destroyed(void* const ZIX_UNUSED(ptr), const void* const ZIX_UNUSED(data))
+{
+  ++n_destroyed;
+}
+
+/// Return an iterator to `v`, which must be in `t`
+static ZixBTreeIter
+iter_at(const ZixBTree* const t, const uintptr_t v)
+{
+  ZixBTreeIter i = zix_btree_end_iter;
+  assert(!zix_btree_find(t, (void*)v, &i));
+  return i;
+}
+
+/// Check that `t` contains exactly the values not in `[lower, upper)`
+static void
+check_erased(const ZixBTree* const t,
+             const size_t          n_elems,
+             const uintptr_t       lower,
+             const uintptr_t       upper)
+{
+  ZixBTreeIter i = zix_btree_end_iter;
+  for (uintptr_t v = 1U; v <= n_elems; ++v) {
+    assert(!zix_btree_find(t, (void*)v, &i) == (v < lower || v >= upper));
+  }
+
+  assert(zix_btree_size(t) == n_elems - (upper - lower));
+}
+
+static void
+test_erase_range(void)
+{
+  static const size_t n_elems = 32768U;
+
+  for (size_t page_size = ZIX_BTREE_MIN_PAGE_SIZE; page_size <= 4096U;
+       page_size *= 4U) {
+    ZixBTree* const t =
+      zix_btree_new_with_page_size(NULL, page_size, int_cmp, NULL);
+
+    for (uintptr_t v = 1U; v <= n_elems; ++v) {
+      assert(!zix_btree_insert(t, (void*)v));
+    }
+
+    // Erasing an empty or backwards range does nothing
+    n_destroyed = 0U;
+    assert(!zix_btree_erase_range(
+      t, iter_at(t, 7U), iter_at(t, 7U), count_destroyed, NULL));
+    assert(!zix_btree_erase_range(
+      t, iter_at(t, 9U), iter_at(t, 7U), count_destroyed, NULL));
+    assert(!zix_btree_erase_range(
+      t, zix_btree_end(t), zix_btree_end(t), count_destroyed, NULL));
+    assert(!n_destroyed);
+    assert(zix_btree_size(t) == n_elems);
+
+    // Erase a range from the middle, and check the rest in a snapshot
+    ZixBTree* const s = zix_btree_snapshot(t);
+    assert(!zix_btree_erase_range(
+      s, iter_at(s, 100U), iter_at(s, 30000U), count_destroyed, NULL));
+
+    assert(n_destroyed == 29900U);
+    check_erased(s, n_elems, 100U, 30000U);
+    assert(zix_btree_size(t) == n_elems);
+
+    // Erase everything before a cutoff from the original
+    n_destroyed = 0U;
+    assert(!zix_btree_erase_range(t,
+                                  zix_btree_begin(t),
+                                  iter_at(t, 20000U),
+                                  count_destroyed,
+                                  NULL));
+
+    assert(n_destroyed == 19999U);
+    check_erased(t, n_elems, 1U, 20000U);
+
+    // Erase everything after a value
+    assert(!zix_btree_erase_range(
+      t, iter_at(t, 30000U), zix_btree_end(t), NULL, NULL));
+    assert(zix_btree_size(t) == 10000U);
+
+    // Check that the remaining values are still in order
+    uintptr_t    expected = 20000U;
+    ZixBTreeIter i        = zix_btree_begin(t);
+    for (; !zix_btree_iter_is_end(i); zix_btree_iter_increment(&i)) {
+      assert((uintptr_t)zix_btree_get(i) == expected++);
+    }
+
+    assert(expected == 30000U);
+
+    // Erase everything
+    assert(!zix_btree_erase_range(
+      t, zix_btree_begin(t), zix_btree_end(t), NULL, NULL));
+    assert(!zix_btree_size(t));
+    assert(zix_btree_iter_is_end(zix_btree_begin(t)));
+    assert(!zix_btree_insert(t, (void*)1U));
+
+    zix_btree_free(t, NULL, NULL);
+    zix_btree_free(s, NULL, NULL);
+  }
+}
+
+static void
+test_erase_range_failed_alloc(void)
+{
+  static const size_t n_elems = 4096U;
+
+  ZixFailingAllocator allocator = zix_failing_allocator();
+
+  ZixBTree* const t = zix_btree_new_with_page_size(
+    &allocator.base, ZIX_BTREE_MIN_PAGE_SIZE, int_cmp, NULL);
+
+  for (uintptr_t v = 1U; v <= n_elems; ++v) {
+    assert(!zix_btree_insert(t, (void*)v));
+  }
+
+  /* Erase from snapshots (which copies shared nodes from the pool) with no
+     more memory available, until the pool runs out and erasing fails. */
+  ZixBTree* snapshots[256] = {NULL};
+  ZixStatus st             = ZIX_STATUS_SUCCESS;
+  size_t    n_snapshots    = 0U;
+  while (!st && n_snapshots < 256U) {
+    allocator.n_remaining = SIZE_MAX;
+
+    ZixBTree* const s = zix_btree_snapshot(t);
+    assert(s);
+    snapshots[n_snapshots++] = s;
+
+    const ZixBTreeIter lower = iter_at(s, 1000U);
+    const ZixBTreeIter upper = iter_at(s, 3000U);
+
+    allocator.n_remaining = 0U;
+    if ((st = zix_btree_erase_range(s, lower, upper, NULL, NULL))) {
+      // Failed cleanly, leaving everything in the tree
+      assert(st == ZIX_STATUS_NO_MEM);
+      check_erased(s, n_elems, 1U, 1U);
+    } else {
+      check_erased(s, n_elems, 1000U, 3000U);
+    }
+  }
+
+  assert(st == ZIX_STATUS_NO_MEM);
+  check_erased(t, n_elems, 1U, 1U);
+
+  allocator.n_remaining = SIZE_MAX;
+  for (size_t i = 0U; i < n_snapshots; ++i) {
+    zix_btree_free(snapshots[i], NULL, NULL);
+  }
+
+  zix_btree_free(t, NULL, NULL);
+}
+
+/// Check that `t` contains exactly the values in `[first, last)`, in order
+static void
+check_values(const ZixBTree* const t,
+             const uintptr_t       first,
+             const uintptr_t       last)
+{
+  assert(zix_btree_size(t) == last - first);
+
+  uintptr_t    expected = first;
+  ZixBTreeIter i        = zix_btree_begin(t);
+  for (; !zix_btree_iter_is_end(i); zix_btree_iter_increment(&i)) {
+    assert((uintptr_t)zix_btree_get(i) == expected++);
+  }
+
+  assert(expected == last);
+}
+
+static void
+test_split_join(void)
+{
+  static const size_t n_elems = 32768U;
+
+  static const uintptr_t keys[] = {1U, 2U, 100U, 9999U, 32768U, 40000U};
+
+  for (size_t page_size = ZIX_BTREE_MIN_PAGE_SIZE; page_size <= 4096U;
+       page_size *= 4U) {
+    ZixBTree* t = zix_btree_new_with_page_size(NULL, page_size, int_cmp, NULL);
+
+    for (uintptr_t v = 1U; v <= n_elems; ++v) {
+      assert(!zix_btree_insert(t, (void*)v));
+    }
+
+    // Split and join at keys in the tree, and at both ends
+    for (size_t i = 0U; i < sizeof(keys) / sizeof(keys[0]); ++i) {
+      const uintptr_t key   = keys[i];
+      const uintptr_t end   = n_elems + 1U;
+      const uintptr_t split = key < end ? key : end;
+      ZixBTree*       right = NULL;
+
+      assert(!zix_btree_split(t, (void*)key, &right));
+      check_values(t, 1U, split);
+      check_values(right, split, end);
+
+      assert(!zix_btree_join(t, right));
+      check_values(t, 1U, end);
+    }
+
+    // Modify and join split trees before their sizes are counted
+    ZixBTree*    lazy  = NULL;
+    void*        taken = NULL;
+    ZixBTreeIter pos   = zix_btree_end_iter;
+    assert(!zix_btree_split(t, (void*)5000U, &lazy));
+    assert(!zix_btree_remove(t, (void*)1U, &taken, &pos));
+    assert(!zix_btree_remove(lazy, (void*)5000U, &taken, &pos));
+    assert(!zix_btree_insert(t, (void*)1U));
+    assert(!zix_btree_insert(lazy, (void*)5000U));
+    assert(!zix_btree_join(t, lazy));
+    check_values(t, 1U, n_elems + 1U);
+
+    // Split a snapshot, modify both sides, and check that it's unaffected
+    ZixBTree* const s     = zix_btree_snapshot(t);
+    ZixBTree*       right = NULL;
+    void*           out   = NULL;
+    ZixBTreeIter    next  = zix_btree_end_iter;
+    assert(!zix_btree_split(s, (void*)20000U, &right));
+    assert(zix_btree_count(right) == n_elems + 1U - 20000U);
+    assert(!zix_btree_insert(right, (void*)(n_elems + 1U)));
+    assert(!zix_btree_remove(s, (void*)1U, &out, &next));
+    assert(zix_btree_count(right) == n_elems + 2U - 20000U);
+    assert(zix_btree_count(s) == 20000U - 2U);
+    check_values(s, 2U, 20000U);
+    check_values(right, 20000U, n_elems + 2U);
+    check_values(t, 1U, n_elems + 1U);
+    zix_btree_free(right, NULL, NULL);
+    zix_btree_free(s, NULL, NULL);
+
+    // Join trees with different pools and heights in either order
+    ZixBTree* const small =
+      zix_btree_new_with_page_size(NULL, page_size, int_cmp, NULL);
+    for (uintptr_t v = n_elems + 1U; v <= n_elems + 10U; ++v) {
+      assert(!zix_btree_insert(small, (void*)v));
+    }
+
+    assert(zix_btree_join(small, t) == ZIX_STATUS_BAD_ARG);
+    assert(!zix_btree_join(t, small));
+    check_values(t, 1U, n_elems + 11U);
+
+    assert(!zix_btree_split(t, (void*)10U, &right));
+    assert(!zix_btree_join(t, right));
+    check_values(t, 1U, n_elems + 11U);
+
+    // Trees with different page sizes can't be joined
+    ZixBTree* const other = zix_btree_new_with_page_size(
+      NULL, page_size * 2U, int_cmp, NULL);
+    assert(!zix_btree_insert(other, (void*)(n_elems + 100U)));
+    assert(zix_btree_join(t, other) == ZIX_STATUS_BAD_ARG);
+    zix_btree_free(other, NULL, NULL);
+
+    zix_btree_free(t, NULL, NULL);
+  }
+}
+
+static void
+test_split_failed_alloc(void)
+{
+  ZixFailingAllocator allocator = zix_failing_allocator();
+
+  ZixBTree* const t = zix_btree_new_with_page_size(
+    &allocator.base, ZIX_BTREE_MIN_PAGE_SIZE, int_cmp, NULL);
+
+  for (uintptr_t v = 1U; v <= 4096U; ++v) {
+    assert(!zix_btree_insert(t, (void*)v));
+  }
+
+  ZixBTree* right = t;
+  allocator.n_remaining = 0U;
+  assert(zix_btree_split(t, (void*)1000U, &right) == ZIX_STATUS_NO_MEM);
+  assert(!right);
+  check_values(t, 1U, 4097U);
+
+  zix_btree_free(t, NULL, NULL);
+}
+
+static void
+test_partition(void)
+{
+  static const size_t n_parts[] = {1U, 2U, 3U, 7U, 64U, 1000U};
+  static ZixBTreeIter bounds[1001U];
+
+  for (size_t page_size = ZIX_BTREE_MIN_PAGE_SIZE; page_size <= 4096U;
+       page_size *= 16U) {
+    for (size_t n_elems = 0U; n_elems <= 65536U; n_elems = n_elems * 4U + 1U) {
+      ZixBTree* const t =
+        zix_btree_new_with_page_size(NULL, page_size, int_cmp, NULL);
+
+      for (uintptr_t v = 1U; v <= n_elems; ++v) {
+        assert(!zix_btree_insert(t, (void*)v));
+      }
+
+      for (size_t i = 0U; i < sizeof(n_parts) / sizeof(n_parts[0]); ++i) {
+        const size_t n = zix_btree_partition(t, n_parts[i], bounds);
+        assert(n >= 1U && n <= n_parts[i]);
+        assert(zix_btree_iter_equals(bounds[0], zix_btree_begin(t)));
+        assert(zix_btree_iter_is_end(bounds[n]));
+
+        // Scan every range and check that they cover the tree in order
+        uintptr_t expected = 1U;
+        for (size_t r = 0U; r < n; ++r) {
+          ZixBTreeIter j = bounds[r];
+          assert(!n_elems || !zix_btree_iter_equals(j, bounds[r + 1U]));
+          for (; !zix_btree_iter_equals(j, bounds[r + 1U]);
+               zix_btree_iter_increment(&j)) {
+            assert((uintptr_t)zix_btree_get(j) == expected++);
+          }
+        }
+
+        assert(expected == n_elems + 1U);
+      }
+
+      zix_btree_free(t, NULL, NULL);
+    }
+  }
+}
+
+static void
+test_finger(void)
+{
+  static const uintptr_t n_elems = 16384U;
+
+  ZixBTree* const t =
+    zix_btree_new_with_page_size(NULL, ZIX_BTREE_MIN_PAGE_SIZE, int_cmp, NULL);
+
+  // Insert even values in order, keeping a finger at the last one
+  ZixBTreeIter finger = zix_btree_end_iter;
+  for (uintptr_t v = 2U; v <= n_elems; v += 2U) {
+    assert(!zix_btree_insert_near(t, (void*)v, &finger));
+    assert((uintptr_t)zix_btree_get(finger) == v);
+  }
+
+  // Insert odd values backwards from a snapshot, which must copy nodes
+  ZixBTree* const s = zix_btree_snapshot(t);
+  for (uintptr_t v = n_elems; v > 0U; v -= 2U) {
+    assert(!zix_btree_insert_near(t, (void*)(v - 1U), &finger));
+    assert((uintptr_t)zix_btree_get(finger) == v - 1U);
+  }
+
+  assert(zix_btree_insert_near(t, (void*)10U, &finger) == ZIX_STATUS_EXISTS);
+  assert((uintptr_t)zix_btree_get(finger) == 10U);
+  assert(zix_btree_size(t) == n_elems);
+  assert(zix_btree_size(s) == n_elems / 2U);
+  zix_btree_free(s, NULL, NULL);
+
+  // Find values near each other, and far apart, from the same finger
+  finger = zix_btree_end_iter;
+  for (uintptr_t v = 1U; v <= n_elems; v += 7U) {
+    const uintptr_t far = n_elems + 1U - v;
+
+    ZixBTreeIter exact = zix_btree_end_iter;
+    assert(!zix_btree_find(t, (void*)v, &exact));
+    assert(!zix_btree_find_near(t, (void*)v, &finger));
+    assert(zix_btree_iter_equals(finger, exact));
+    assert(!zix_btree_find_near(t, (void*)far, &finger));
+    assert((uintptr_t)zix_btree_get(finger) == far);
+  }
+
+  // A failed search leaves the finger where it was
+  const ZixBTreeIter last = finger;
+  assert(zix_btree_find_near(t, (void*)(n_elems + 1U), &finger) ==
+         ZIX_STATUS_NOT_FOUND);
+  assert(zix_btree_iter_equals(finger, last));
+
+  zix_btree_free(t, NULL, NULL);
+}
+
+static void
+test_pool(void)
+{
+  static const size_t n_elems = 16384U;
+
+  ZixBTree* const t = zix_btree_new(NULL, int_cmp, NULL);
+
+  // A new tree has a single slab with only the root in it
+  ZixBTreePoolStats stats = zix_btree_pool_stats(t);
+  assert(stats.n_slabs == 1U);
+  assert(stats.n_pages == 1U);
+  assert(stats.n_used_pages == 1U);
+  assert(!stats.n_free_pages);
+
+  for (uintptr_t v = 1U; v <= n_elems; ++v) {
+    assert(!zix_btree_insert(t, (void*)v));
+  }
+
+  stats = zix_btree_pool_stats(t);
+  assert(stats.n_used_pages > 1U);
+  assert(stats.n_slabs < stats.n_used_pages);
+  assert(stats.n_pages >= stats.n_used_pages + stats.n_free_pages);
+
+  // Clearing the tree moves its nodes to the free list
+  const size_t n_pages = stats.n_pages;
+  zix_btree_clear(t, NULL, NULL);
+  stats = zix_btree_pool_stats(t);
+  assert(stats.n_pages == n_pages);
+  assert(stats.n_used_pages == 1U);
+  assert(stats.n_free_pages > 0U);
+
+  // Refilling the tree reuses those pages instead of allocating more
+  for (uintptr_t v = 1U; v <= n_elems; ++v) {
+    assert(!zix_btree_insert(t, (void*)v));
+  }
+
+  assert(zix_btree_pool_stats(t).n_pages == n_pages);
+
+  // Snapshots share the pool
+  ZixBTree* const s = zix_btree_snapshot(t);
+  stats             = zix_btree_pool_stats(t);
+  assert(stats.n_used_pages == zix_btree_pool_stats(s).n_used_pages);
+
+  zix_btree_free(t, NULL, NULL);
+  assert(zix_btree_pool_stats(s).n_used_pages < stats.n_used_pages);
+  zix_btree_free(s, NULL, NULL);
+}
+
+static size_t
+count_nodes(const ZixBTreeStats* const stats)
+{
+  size_t n_nodes = 0U;
+  for (unsigned i = 0U; i < stats->height; ++i) {
+    n_nodes += stats->levels[i].n_nodes;
+  }
+
+  return n_nodes;
+}
+
+static void
+check_stats(const ZixBTree* const t)
+{
+  const ZixBTreeStats stats  = zix_btree_stats(t);
+  size_t              n_vals = 0U;
+
+  assert(stats.levels[0].n_nodes == 1U);
+  assert(stats.n_bytes == count_nodes(&stats) * zix_btree_page_size(t));
+
+  for (unsigned i = 0U; i < stats.height; ++i) {
+    const ZixBTreeLevelStats* const l = &stats.levels[i];
+
+    assert(l->n_nodes > 0U);
+    assert(l->min_vals <= l->max_vals);
+    assert(l->n_vals >= l->n_nodes * l->min_vals);
+    assert(l->n_vals <= l->n_nodes * l->max_vals);
+    assert(i == 0U || 2U * (l->min_vals + 1U) >= l->max_vals);
+    n_vals += l->n_vals;
+  }
+
+  assert(n_vals == zix_btree_size(t));
+}
+
+static void
+test_stats(void)
+{
+  static const size_t n_elems = 16384U;
+
+  ZixBTree* const t = zix_btree_new(NULL, int_cmp, NULL);
+
+  // A new tree is a single empty leaf with no history
+  ZixBTreeStats stats = zix_btree_stats(t);
+  assert(stats.height == 1U);
+  assert(stats.levels[0].n_nodes == 1U);
+  assert(!stats.levels[0].n_vals);
+  assert(!stats.levels[0].min_vals);
+  assert(stats.levels[0].max_vals > 0U);
+  assert(stats.n_bytes == zix_btree_page_size(t));
+  assert(!stats.n_splits && !stats.n_merges && !stats.n_rotations);
+
+  // Filling the tree splits nodes
+  for (size_t i = 0U; i < n_elems; ++i) {
+    assert(!zix_btree_insert(t, (void*)(1U + unique_rand(i))));
+  }
+
+  check_stats(t);
+  stats = zix_btree_stats(t);
+  assert(stats.height > 1U);
+
+  // Every node except the original root and the new ones added above it
+  assert(stats.n_splits == count_nodes(&stats) - stats.height);
+  assert(!stats.n_merges);
+
+  // Removing most values merges and rotates nodes
+  for (size_t i = 0U; i < n_elems - 16U; ++i) {
+    ZixBTreeIter next = zix_btree_end_iter;
+    void*        out  = NULL;
+    assert(!zix_btree_remove(t, (void*)(1U + unique_rand(i)), &out, &next));
+  }
+
+  check_stats(t);
+  stats = zix_btree_stats(t);
+  assert(stats.n_merges > 0U);
+  assert(stats.n_rotations > 0U);
+
+  // Snapshots inherit the history of their source
+  ZixBTree* const s = zix_btree_snapshot(t);
+  assert(zix_btree_stats(s).n_merges == stats.n_merges);
+
+  zix_btree_free(s, NULL, NULL);
+  zix_btree_free(t, NULL, NULL);
+}
+
+static void
+check_compact(const size_t page_size, const size_t n_elems, const unsigned fill)
+{
+  ZixBTree* const t =
+    zix_btree_new_with_page_size(NULL, page_size, int_cmp, NULL);
+
+  // Insert everything, then remove all but every 8th element
+  for (size_t i = 0U; i < n_elems; ++i) {
+    assert(!zix_btree_insert(t, (void*)(1U + unique_rand(i))));
+  }
+
+  for (size_t i = 0U; i < n_elems; ++i) {
+    if (i % 8U) {
+      ZixBTreeIter next = zix_btree_end_iter;
+      void*        out  = NULL;
+      assert(!zix_btree_remove(t, (void*)(1U + unique_rand(i)), &out, &next));
+    }
+  }
+
+  const size_t        n_vals = zix_btree_size(t);
+  const ZixBTreeStats before = zix_btree_stats(t);
+
+  // Compact the tree, which moves it to a single slab if it's small enough
+  assert(!zix_btree_compact(t, fill));
+  check_stats(t);
+
+  const ZixBTreeStats     after = zix_btree_stats(t);
+  const ZixBTreePoolStats pool  = zix_btree_pool_stats(t);
+  assert(zix_btree_size(t) == n_vals);
+  assert(fill < 100U || after.height <= before.height);
+  assert(fill < 100U || after.n_bytes <= before.n_bytes);
+  assert(pool.n_used_pages == count_nodes(&after));
+  assert(pool.n_slabs == 1U || pool.n_used_pages > pool.n_pages / 2U);
+  assert(!pool.n_free_pages);
+
+  // Every level except the root is packed as tightly as requested
+  for (unsigned i = 1U; i < after.height; ++i) {
+    const ZixBTreeLevelStats* const l      = &after.levels[i];
+    const size_t                    target = (l->max_vals + 1U) * fill / 100U;
+    assert(l->n_vals + l->n_nodes > (l->n_nodes - 1U) * target);
+  }
+
+  // Everything is still there, in order
+  size_t       count = 0U;
+  uintptr_t    last  = 0U;
+  ZixBTreeIter iter  = zix_btree_begin(t);
+  for (; !zix_btree_iter_is_end(iter); zix_btree_iter_increment(&iter)) {
+    const uintptr_t v = (uintptr_t)zix_btree_get(iter);
+    assert(v > last);
+    last = v;
+    ++count;
+  }
+
+  assert(count == n_vals);
+
+  for (size_t i = 0U; i < n_elems; i += 8U) {
+    ZixBTreeIter ti = zix_btree_end_iter;
+    assert(!zix_btree_find(t, (void*)(1U + unique_rand(i)), &ti));
+  }
+
+  // Any node that isn't completely filled has room to insert without a split
+  if (fill < 100U && n_elems > 1U) {
+    ZixBTreeIter next = zix_btree_end_iter;
+    void*        out  = NULL;
+    assert(!zix_btree_insert(t, (void*)(1U + unique_rand(1U))));
+    assert(zix_btree_stats(t).n_splits == after.n_splits);
+    assert(!zix_btree_remove(t, (void*)(1U + unique_rand(1U)), &out, &next));
+  }
+
+  // The compacted tree can be modified as usual
+  for (size_t i = 0U; i < n_elems; ++i) {
+    const ZixStatus st = zix_btree_insert(t, (void*)(1U + unique_rand(i)));
+    assert(st == ((i % 8U) ? ZIX_STATUS_SUCCESS : ZIX_STATUS_EXISTS));
+  }
+
+  assert(zix_btree_size(t) == n_elems);
+  check_stats(t);
+  zix_btree_free(t, NULL, NULL);
+}
+
+static void
+test_compact(void)
+{
+  static const size_t sizes[] = {0U, 1U, 8U, 100U, 1000U, 20000U};
+
+  for (size_t i = 0U; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+    check_compact(ZIX_BTREE_MIN_PAGE_SIZE, sizes[i], 100U);
+    check_compact(ZIX_BTREE_MIN_PAGE_SIZE, sizes[i], 75U);
+    check_compact(4096U, sizes[i], 100U);
+    check_compact(4096U, sizes[i], 50U);
+  }
+
+  // Compacting a tree leaves its snapshots untouched
+  ZixBTree* const t = zix_btree_new(NULL, int_cmp, NULL);
+  for (uintptr_t v = 1U; v <= 4096U; ++v) {
+    assert(!zix_btree_insert(t, (void*)v));
+  }
+
+  // Fill factors that would break the invariants are rejected
+  assert(zix_btree_compact(t, 49U) == ZIX_STATUS_BAD_ARG);
+  assert(zix_btree_compact(t, 101U) == ZIX_STATUS_BAD_ARG);
+
+  ZixBTree* const s = zix_btree_snapshot(t);
+  assert(!zix_btree_compact(t, 100U));
+  assert(!zix_btree_compact(s, 100U));
+  check_stats(t);
+  check_stats(s);
+
+  ZixBTreeIter ti = zix_btree_begin(t);
+  ZixBTreeIter si = zix_btree_begin(s);
+  for (uintptr_t v = 1U; v <= 4096U; ++v) {
+    assert((uintptr_t)zix_btree_get(ti) == v);
+    assert((uintptr_t)zix_btree_get(si) == v);
+    zix_btree_iter_increment(&ti);
+    zix_btree_iter_increment(&si);
+  }
+
+  zix_btree_free(s, NULL, NULL);
+  zix_btree_free(t, NULL, NULL);
+}
+
+static void
+test_compact_failed_alloc(void)
+{
+  ZixFailingAllocator allocator = zix_failing_allocator();
+
+  ZixBTree* const t = zix_btree_new(&allocator.base, int_cmp, NULL);
+  for (uintptr_t v = 1U; v <= 4096U; ++v) {
+    assert(!zix_btree_insert(t, (void*)v));
+  }
+
+  // Fail every allocation in turn, which leaves the tree unchanged
+  allocator.n_allocations = 0U;
+  assert(!zix_btree_compact(t, 100U));
+
+  const size_t n_allocs = allocator.n_allocations;
+  for (size_t i = 0U; i < n_allocs; ++i) {
+    allocator.n_remaining = i;
+    assert(zix_btree_compact(t, 100U) == ZIX_STATUS_NO_MEM);
+    assert(zix_btree_size(t) == 4096U);
+    check_stats(t);
+  }
+
+  allocator.n_remaining = SIZE_MAX;
+  zix_btree_free(t, NULL, NULL);
+}
+
+static void
+test_page_sizes(void)
+{
+  static const size_t n_elems = 32768U;
+
+  // Invalid page sizes are rejected
+  assert(!zix_btree_new_with_page_size(NULL, 0U, int_cmp, NULL));
+  assert(!zix_btree_new_with_page_size(NULL, 128U, int_cmp, NULL));
+  assert(!zix_btree_new_with_page_size(NULL, 1000U, int_cmp, NULL));
+  assert(!zix_btree_new_with_page_size(NULL, 131072U, int_cmp, NULL));
+
+  ZixBTree* const d = zix_btree_new(NULL, int_cmp, NULL);
+  assert(zix_btree_page_size(d) == 4096U);
+  zix_btree_free(d, NULL, NULL);
+
+  for (size_t page_size = ZIX_BTREE_MIN_PAGE_SIZE;
+       page_size <= ZIX_BTREE_MAX_PAGE_SIZE;
+       page_size *= 4U) {
+    ZixBTree* const t =
+      zix_btree_new_with_page_size(NULL, page_size, int_cmp, NULL);
+
+    assert(t);
+    assert(zix_btree_page_size(t) == page_size);
+
+    // Insert values in a pseudo-random order
+    for (size_t i = 0U; i < n_elems; ++i) {
+      assert(!zix_btree_insert(t, (void*)(1U + unique_rand(i))));
+    }
+
+    assert(zix_btree_size(t) == n_elems);
+
+    // Check that everything is there in order
+    ZixBTreeIter i    = zix_btree_begin(t);
+    uintptr_t    last = 0U;
+    for (; !zix_btree_iter_is_end(i); zix_btree_iter_increment(&i)) {
+      const uintptr_t value = (uintptr_t)zix_btree_get(i);
+      assert(value > last);
+      last = value;
+    }
+
+    // Remove half of the values, then clear and reuse the tree
+    for (size_t j = 0U; j < n_elems; j += 2U) {
+      void* const  e   = (void*)(1U + unique_rand(j));
+      void*        out = NULL;
+      ZixBTreeIter next;
+      assert(!zix_btree_remove(t, e, &out, &next));
+      assert(out == e);
+      assert(zix_btree_find(t, e, &i) == ZIX_STATUS_NOT_FOUND);
+    }
+
+    assert(zix_btree_size(t) == n_elems / 2U);
+    zix_btree_clear(t, NULL, NULL);
+    assert(!zix_btree_insert(t, (void*)1U));
+    assert(zix_btree_size(t) == 1U);
+
+    zix_btree_free(t, NULL, NULL);
+  }
+
+  /* The smallest pages only fit about a million sequential values within the
+     default maximum height, and inserting more fails without changing the
+     tree (unless the maximum height is configured to be higher) */
+  static const uintptr_t n_max = 1U << 22U;
+
+  ZixBTree* const t =
+    zix_btree_new_with_page_size(NULL, ZIX_BTREE_MIN_PAGE_SIZE, int_cmp, NULL);
+
+  ZixStatus    st = ZIX_STATUS_SUCCESS;
+  ZixBTreeIter ti = zix_btree_end_iter;
+  uintptr_t    n  = 0U;
+  while (!st && n < n_max) {
+    if (!(st = zix_btree_insert_near(t, (void*)(n + 1U), &ti))) {
+      ++n;
+    }
+  }
+
+  const ZixBTreeStats stats = zix_btree_stats(t);
+  assert(st == ZIX_STATUS_OVERFLOW || (st == ZIX_STATUS_SUCCESS && n == n_max));
+  assert(st != ZIX_STATUS_OVERFLOW || stats.height == ZIX_BTREE_MAX_HEIGHT);
+  assert(zix_btree_iter_is_end(ti) == (st == ZIX_STATUS_OVERFLOW));
+  assert(zix_btree_size(t) == n);
+  check_values(t, 1U, n + 1U);
+  zix_btree_free(t, NULL, NULL);
+}
+
 static int
 stress(ZixAllocator* const allocator,
        const unsigned      test_num,
@@ -594,6 +1550,125 @@ stress(ZixAllocator* const allocator,
   return EXIT_SUCCESS;
 }
 
+static const char*
+string_key(const void* const value, const void* ZIX_UNUSED(user_data))
+{
+  return (const char*)value;
+}
+
+static void
+free_string(void* const ptr, const void* ZIX_UNUSED(user_data))
+{
+  free(ptr);
+}
+
+/// Write the ith string key to `buf`, keys have long and varied prefixes
+static void
+ith_string(char* const buf, const size_t size, const size_t i)
+{
+  static const char* const prefixes[] = {
+    "http://example.org/vocabulary#",
+    "http://example.org/vocabulary/",
+    "urn:example:",
+  };
+
+  const unsigned n = (unsigned)(unique_rand(i) % 10000U);
+
+  snprintf(buf, size, "%s%u", prefixes[i % 3U], n);
+}
+
+static void
+test_string_keys(void)
+{
+  static const size_t n_elems = 8192U;
+
+  char buf[64] = {0};
+
+  for (size_t page_size = ZIX_BTREE_MIN_PAGE_SIZE; page_size <= 4096U;
+       page_size *= 4U) {
+    ZixBTree* const t =
+      zix_btree_new_with_string_keys(NULL, page_size, string_key, NULL);
+
+    assert(t);
+    assert(zix_btree_page_size(t) == page_size);
+
+    // Insert strings, where numbers make some keys prefixes of others
+    size_t n_inserted = 0U;
+    for (size_t i = 0U; i < n_elems; ++i) {
+      ith_string(buf, sizeof(buf), i);
+
+      ZixBTreeIter ti = zix_btree_end_iter;
+      if (zix_btree_find(t, buf, &ti)) {
+        char* const str = (char*)calloc(1U, strlen(buf) + 1U);
+        memcpy(str, buf, strlen(buf));
+        assert(!zix_btree_insert(t, str));
+        ++n_inserted;
+      }
+
+      assert(zix_btree_insert(t, buf) == ZIX_STATUS_EXISTS);
+    }
+
+    assert(zix_btree_size(t) == n_inserted);
+
+    // Check that everything is there in order
+    size_t       count = 0U;
+    const char*  last  = "";
+    ZixBTreeIter i     = zix_btree_begin(t);
+    for (; !zix_btree_iter_is_end(i); zix_btree_iter_increment(&i)) {
+      const char* const str = (const char*)zix_btree_get(i);
+      assert(strcmp(last, str) < 0);
+      last = str;
+      ++count;
+    }
+
+    assert(count == n_inserted);
+
+    // Search for keys that aren't there but share prefixes with others
+    ZixBTreeIter ti = zix_btree_end_iter;
+    assert(zix_btree_find(t, "http://example.org/", &ti));
+    assert(zix_btree_find(t, "http://example.org/vocabulary#x", &ti));
+    assert(zix_btree_find(t, "http://example.org/vocabulary/99999", &ti));
+    assert(zix_btree_find(t, "urn:example", &ti));
+    assert(zix_btree_find(t, "urn:example:10000", &ti));
+    assert(zix_btree_find(t, "", &ti));
+    assert(zix_btree_find(t, "zzz", &ti));
+
+    // Snapshot the tree, then remove half of the keys from the original
+    ZixBTree* const s = zix_btree_snapshot(t);
+    assert(s);
+
+    for (size_t j = 0U; j < n_elems / 2U; ++j) {
+      void*        out  = NULL;
+      ZixBTreeIter next = zix_btree_end_iter;
+
+      ith_string(buf, sizeof(buf), j);
+      if (!zix_btree_remove(t, buf, &out, &next)) {
+        assert(!strcmp((const char*)out, buf));
+      }
+
+      assert(zix_btree_find(t, buf, &ti) == ZIX_STATUS_NOT_FOUND);
+      assert(!zix_btree_find(s, buf, &ti));
+      assert(!strcmp((const char*)zix_btree_get(ti), buf));
+    }
+
+    // Compact the original, which rebuilds the key slices in every node
+    assert(!zix_btree_compact(t, 90U));
+
+    // Check that the remaining keys are still in both trees
+    for (size_t j = n_elems / 2U; j < n_elems; ++j) {
+      ith_string(buf, sizeof(buf), j);
+      if (!zix_btree_find(t, buf, &ti)) {
+        assert(!strcmp((const char*)zix_btree_get(ti), buf));
+        assert(!zix_btree_find(s, buf, &ti));
+      }
+    }
+
+    assert(zix_btree_size(s) == n_inserted);
+    zix_btree_free(t, NULL, NULL);
+    zix_btree_free(s, free_string, NULL);
+  }
+}
+
 static void
 test_failed_alloc(void)
 {
@@ -623,6 +1698,22 @@ main(int argc, char** argv)
   test_iter_comparison();
   test_insert_split_value();
   test_remove_cases();
+  test_sorted_batch();
+  test_sorted_batch_failed_alloc();
+  test_page_sizes();
+  test_snapshot();
+  test_snapshot_failed_alloc();
+  test_erase_range();
+  test_erase_range_failed_alloc();
+  test_split_join();
+  test_split_failed_alloc();
+  test_partition();
+  test_finger();
+  test_pool();
+  test_stats();
+  test_compact();
+  test_compact_failed_alloc();
+  test_string_keys();
   test_failed_alloc();
 
   const unsigned n_tests = 3U;
@@ -0,0 +1,150 @@
+// Copyright 2011-2022 David Robillard <d@drobilla.net>
+// SPDX-License-Identifier: ISC
+
+#undef NDEBUG
+
+#include "failing_allocator.h"
+#include "test_data.h"
+
+#include "zix/buffered_btree.h"
+#include "zix/common.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static uint64_t
+ith_key(const size_t i)
+{
+  return unique_rand(i);
+}
+
+static uint64_t
+ith_value(const size_t i)
+{
+  return ((uint64_t)i << 32U) | 0xFFU;
+}
+
+static void
+check_contents(const ZixBufferedBTree* const t,
+               const size_t                  n_elems,
+               const size_t                  n_removed)
+{
+  uint64_t value = 0U;
+  for (size_t i = 0U; i < n_elems; ++i) {
+    const ZixStatus st = zix_buffered_btree_find(t, ith_key(i), &value);
+    if (i < n_removed) {
+      assert(st == ZIX_STATUS_NOT_FOUND);
+    } else {
+      assert(!st);
+      assert(value == ith_value(i));
+    }
+  }
+}
+
+static void
+test_insert_remove(const size_t n_elems)
+{
+  ZixBufferedBTree* const t = zix_buffered_btree_new(NULL);
+  assert(t);
+  assert(zix_buffered_btree_find(t, 1U, NULL) == ZIX_STATUS_NOT_FOUND);
+  assert(!zix_buffered_btree_remove(t, 1U));
+
+  // Insert everything twice, so the second value replaces the first
+  for (size_t i = 0U; i < n_elems; ++i) {
+    assert(!zix_buffered_btree_insert(t, ith_key(i), 0U));
+  }
+
+  for (size_t i = 0U; i < n_elems; ++i) {
+    assert(!zix_buffered_btree_insert(t, ith_key(i), ith_value(i)));
+  }
+
+  check_contents(t, n_elems, 0U);
+
+  // Remove the first half, and check that it's gone while still buffered
+  for (size_t i = 0U; i < n_elems / 2U; ++i) {
+    assert(!zix_buffered_btree_remove(t, ith_key(i)));
+    assert(zix_buffered_btree_find(t, ith_key(i), NULL) ==
+           ZIX_STATUS_NOT_FOUND);
+  }
+
+  check_contents(t, n_elems, n_elems / 2U);
+
+  // Flush everything to the leaves and check again
+  assert(!zix_buffered_btree_flush(t));
+  check_contents(t, n_elems, n_elems / 2U);
+
+  // Reinsert some removed keys and remove everything else
+  for (size_t i = n_elems / 4U; i < n_elems / 2U; ++i) {
+    assert(!zix_buffered_btree_insert(t, ith_key(i), ith_value(i)));
+  }
+
+  check_contents(t, n_elems, n_elems / 4U);
+
+  for (size_t i = 0U; i < n_elems; ++i) {
+    assert(!zix_buffered_btree_remove(t, ith_key(i)));
+  }
+
+  check_contents(t, n_elems, n_elems);
+  assert(!zix_buffered_btree_flush(t));
+  check_contents(t, n_elems, n_elems);
+
+  zix_buffered_btree_free(t);
+  zix_buffered_btree_free(NULL);
+}
+
+static void
+test_failed_alloc(const size_t n_elems)
+{
+  ZixFailingAllocator allocator = zix_failing_allocator();
+
+  // Successfully fill a tree to count the number of allocations
+  ZixBufferedBTree* t = zix_buffered_btree_new(&allocator.base);
+  for (size_t i = 0U; i < n_elems; ++i) {
+    assert(!zix_buffered_btree_insert(t, ith_key(i), ith_value(i)));
+  }
+
+  assert(!zix_buffered_btree_flush(t));
+  zix_buffered_btree_free(t);
+
+  // Test that each allocation failing is handled gracefully
+  const size_t n_new_allocs = allocator.n_allocations;
+  for (size_t i = 0U; i < n_new_allocs; ++i) {
+    allocator.n_remaining = i;
+
+    if ((t = zix_buffered_btree_new(&allocator.base))) {
+      ZixStatus st = ZIX_STATUS_SUCCESS;
+      size_t    n  = 0U;
+      while (n < n_elems &&
+             !(st = zix_buffered_btree_insert(t, ith_key(n), ith_value(n)))) {
+        ++n;
+      }
+
+      if (!st) {
+        st = zix_buffered_btree_flush(t);
+      }
+
+      // Everything before the failure must still be intact
+      assert(st == ZIX_STATUS_NO_MEM);
+      check_contents(t, n, 0U);
+      zix_buffered_btree_free(t);
+    }
+  }
+}
+
+int
+main(int argc, char** argv)
+{
+  if (argc > 2) {
+    fprintf(stderr, "Usage: %s [N_ELEMS]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  const size_t n_elems = (argc > 1) ? strtoul(argv[1], NULL, 10) : 131072U;
+
+  test_insert_remove(n_elems);
+  test_failed_alloc(n_elems / 32U);
+
+  return 0;
+}
@@ -0,0 +1,348 @@
+// Copyright 2011-2022 David Robillard <d@drobilla.net>
+// SPDX-License-Identifier: ISC
+
+#undef NDEBUG
+
+#include "failing_allocator.h"
+#include "test_data.h"
+
+#include "zix/attributes.h"
+#include "zix/common.h"
+#include "zix/concurrent_btree.h"
+#include "zix/thread.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define N_WRITERS 4U
+#define N_READERS 4U
+
+ZIX_PURE_FUNC
+static int
+int_cmp(const void* a, const void* b, const void* ZIX_UNUSED(user_data))
+{
+  const uintptr_t ia = (uintptr_t)a;
+  const uintptr_t ib = (uintptr_t)b;
+
+  assert(ia != 0U);
+  assert(ib != 0U);
+
+  return ia < ib ? -1 : ia > ib ? 1 : 0;
+}
+
+static void*
+ith_elem(const size_t i)
+{
+  return (void*)(1U + unique_rand(i));
+}
+
+static void
+test_sequential(const size_t n_elems)
+{
+  ZixConcurrentBTree* const t = zix_concurrent_btree_new(NULL, int_cmp, NULL);
+  assert(t);
+  assert(!zix_concurrent_btree_size(t));
+
+  // Insert and re-insert everything
+  for (size_t i = 0U; i < n_elems; ++i) {
+    assert(!zix_concurrent_btree_insert(t, ith_elem(i)));
+    assert(zix_concurrent_btree_insert(t, ith_elem(i)) == ZIX_STATUS_EXISTS);
+  }
+
+  assert(zix_concurrent_btree_size(t) == n_elems);
+
+  // Find everything
+  void* out = NULL;
+  for (size_t i = 0U; i < n_elems; ++i) {
+    assert(!zix_concurrent_btree_find(t, ith_elem(i), &out));
+    assert(out == ith_elem(i));
+  }
+
+  assert(zix_concurrent_btree_find(t, ith_elem(n_elems), &out) ==
+         ZIX_STATUS_NOT_FOUND);
+  assert(!out);
+
+  // Remove every other element, then the rest
+  for (size_t start = 0U; start < 2U; ++start) {
+    for (size_t i = start; i < n_elems; i += 2U) {
+      assert(!zix_concurrent_btree_remove(t, ith_elem(i), &out));
+      assert(out == ith_elem(i));
+      assert(zix_concurrent_btree_remove(t, ith_elem(i), &out) ==
+             ZIX_STATUS_NOT_FOUND);
+      assert(zix_concurrent_btree_find(t, ith_elem(i), &out) ==
+             ZIX_STATUS_NOT_FOUND);
+    }
+
+    for (size_t i = 1U - start; i < n_elems; i += 2U) {
+      assert(!zix_concurrent_btree_find(t, ith_elem(i), &out) == !start);
+    }
+
+    zix_concurrent_btree_collect(t);
+  }
+
+  assert(!zix_concurrent_btree_size(t));
+
+  // Insert everything again and free with values remaining
+  for (size_t i = 0U; i < n_elems; ++i) {
+    assert(!zix_concurrent_btree_insert(t, ith_elem(i)));
+  }
+
+  zix_concurrent_btree_free(t, NULL, NULL);
+  zix_concurrent_btree_free(NULL, NULL, NULL);
+}
+
+static void
+test_failed_alloc(void)
+{
+  static const size_t n_elems = 8192U;
+
+  ZixFailingAllocator allocator = zix_failing_allocator();
+
+  // Successfully fill a tree to count the number of allocations
+  ZixConcurrentBTree* t =
+    zix_concurrent_btree_new(&allocator.base, int_cmp, NULL);
+
+  for (size_t i = 0U; i < n_elems; ++i) {
+    assert(!zix_concurrent_btree_insert(t, ith_elem(i)));
+  }
+
+  zix_concurrent_btree_free(t, NULL, NULL);
+
+  // Test that each allocation failing is handled gracefully
+  const size_t n_new_allocs = allocator.n_allocations;
+  for (size_t i = 0U; i < n_new_allocs; ++i) {
+    allocator.n_remaining = i;
+
+    if ((t = zix_concurrent_btree_new(&allocator.base, int_cmp, NULL))) {
+      size_t n_inserted = 0U;
+      while (n_inserted < n_elems &&
+             !zix_concurrent_btree_insert(t, ith_elem(n_inserted))) {
+        ++n_inserted;
+      }
+
+      assert(n_inserted < n_elems);
+      assert(zix_concurrent_btree_size(t) == n_inserted);
+
+      void* out = NULL;
+      for (size_t j = 0U; j < n_inserted; ++j) {
+        assert(!zix_concurrent_btree_find(t, ith_elem(j), &out));
+      }
+
+      zix_concurrent_btree_free(t, NULL, NULL);
+    }
+  }
+}
+
+typedef struct {
+  ZixConcurrentBTree* tree;
+  size_t              n_elems;
+  unsigned            index;
+} TestThread;
+
+/// Base elements that are always in the tree, and the range written
+static const size_t n_base = 4096U;
+
+static void*
+test_writer(void* const arg)
+{
+  const TestThread* const thread = (const TestThread*)arg;
+  ZixConcurrentBTree* const t    = thread->tree;
+
+  // Insert this thread's stripe, then remove half of it again
+  for (size_t i = n_base + thread->index; i < thread->n_elems;
+       i += N_WRITERS) {
+    assert(!zix_concurrent_btree_insert(t, ith_elem(i)));
+  }
+
+  void* out = NULL;
+  for (size_t i = n_base + thread->index; i < thread->n_elems;
+       i += 2U * N_WRITERS) {
+    assert(!zix_concurrent_btree_remove(t, ith_elem(i), &out));
+    assert(out == ith_elem(i));
+  }
+
+  return NULL;
+}
+
+static void*
+test_reader(void* const arg)
+{
+  const TestThread* const thread = (const TestThread*)arg;
+
+  // The base elements must always be found while writers are working
+  void* out = NULL;
+  for (size_t r = 0U; r < 8U; ++r) {
+    for (size_t i = thread->index; i < n_base; i += N_READERS) {
+      assert(!zix_concurrent_btree_find(thread->tree, ith_elem(i), &out));
+      assert(out == ith_elem(i));
+    }
+  }
+
+  return NULL;
+}
+
+static void
+test_threads(const size_t n_elems)
+{
+  ZixConcurrentBTree* const t = zix_concurrent_btree_new(NULL, int_cmp, NULL);
+
+  for (size_t i = 0U; i < n_base; ++i) {
+    assert(!zix_concurrent_btree_insert(t, ith_elem(i)));
+  }
+
+  TestThread writers[N_WRITERS];
+  TestThread readers[N_READERS];
+  ZixThread  writer_threads[N_WRITERS]; // NOLINT
+  ZixThread  reader_threads[N_READERS]; // NOLINT
+
+  for (unsigned i = 0U; i < N_WRITERS; ++i) {
+    writers[i].tree    = t;
+    writers[i].n_elems = n_elems;
+    writers[i].index   = i;
+    assert(!zix_thread_create(
+      &writer_threads[i], 65536U, test_writer, &writers[i]));
+  }
+
+  for (unsigned i = 0U; i < N_READERS; ++i) {
+    readers[i].tree    = t;
+    readers[i].n_elems = n_elems;
+    readers[i].index   = i;
+    assert(!zix_thread_create(
+      &reader_threads[i], 65536U, test_reader, &readers[i]));
+  }
+
+  for (unsigned i = 0U; i < N_WRITERS; ++i) {
+    assert(!zix_thread_join(writer_threads[i], NULL));
+  }
+
+  for (unsigned i = 0U; i < N_READERS; ++i) {
+    assert(!zix_thread_join(reader_threads[i], NULL));
+  }
+
+  // Check that exactly the expected elements are left
+  size_t n_expected = n_base;
+  void*  out        = NULL;
+  for (size_t i = n_base; i < n_elems; ++i) {
+    const bool removed = ((i - n_base) % (2U * N_WRITERS)) < N_WRITERS;
+    assert(!zix_concurrent_btree_find(t, ith_elem(i), &out) == !removed);
+    n_expected += !removed;
+  }
+
+  assert(zix_concurrent_btree_size(t) == n_expected);
+
+  zix_concurrent_btree_free(t, NULL, NULL);
+}
+
+/// Number of values in a tree with a single value in the root
+static const size_t n_shallow = 600U;
+
+static void*
+test_remover(void* const arg)
+{
+  const TestThread* const thread = (const TestThread*)arg;
+  ZixConcurrentBTree* const t    = thread->tree;
+
+  // Remove this thread's stripe, except for multiples of 3
+  void* out = NULL;
+  for (uintptr_t v = 1U + thread->index; v <= n_shallow; v += N_WRITERS) {
+    if (v % 3U) {
+      assert(!zix_concurrent_btree_remove(t, (void*)v, &out));
+      assert(out == (void*)v);
+    }
+  }
+
+  return NULL;
+}
+
+static void*
+test_shallow_reader(void* const arg)
+{
+  const TestThread* const thread = (const TestThread*)arg;
+
+  // Multiples of 3 must always be found, even while the root is merged away
+  void* out = NULL;
+  for (size_t r = 0U; r < 8U; ++r) {
+    for (uintptr_t v = 3U * (1U + thread->index); v <= n_shallow;
+         v += 3U * N_READERS) {
+      assert(!zix_concurrent_btree_find(thread->tree, (void*)v, &out));
+      assert(out == (void*)v);
+    }
+  }
+
+  return NULL;
+}
+
+static void
+test_threads_remove(void)
+{
+  for (unsigned round = 0U; round < 16U; ++round) {
+    ZixConcurrentBTree* const t =
+      zix_concurrent_btree_new(NULL, int_cmp, NULL);
+
+    // Fill a little more than one leaf, so the root has a single value
+    for (uintptr_t v = 1U; v <= n_shallow; ++v) {
+      assert(!zix_concurrent_btree_insert(t, (void*)v));
+    }
+
+    TestThread writers[N_WRITERS];
+    TestThread readers[N_READERS];
+    ZixThread  writer_threads[N_WRITERS]; // NOLINT
+    ZixThread  reader_threads[N_READERS]; // NOLINT
+
+    for (unsigned i = 0U; i < N_WRITERS; ++i) {
+      writers[i].tree    = t;
+      writers[i].n_elems = n_shallow;
+      writers[i].index   = i;
+      assert(!zix_thread_create(
+        &writer_threads[i], 65536U, test_remover, &writers[i]));
+    }
+
+    for (unsigned i = 0U; i < N_READERS; ++i) {
+      readers[i].tree    = t;
+      readers[i].n_elems = n_shallow;
+      readers[i].index   = i;
+      assert(!zix_thread_create(
+        &reader_threads[i], 65536U, test_shallow_reader, &readers[i]));
+    }
+
+    for (unsigned i = 0U; i < N_WRITERS; ++i) {
+      assert(!zix_thread_join(writer_threads[i], NULL));
+    }
+
+    for (unsigned i = 0U; i < N_READERS; ++i) {
+      assert(!zix_thread_join(reader_threads[i], NULL));
+    }
+
+    // Check that exactly the multiples of 3 are left
+    void* out = NULL;
+    for (uintptr_t v = 1U; v <= n_shallow; ++v) {
+      assert(!zix_concurrent_btree_find(t, (void*)v, &out) == !(v % 3U));
+    }
+
+    assert(zix_concurrent_btree_size(t) == n_shallow / 3U);
+
+    zix_concurrent_btree_free(t, NULL, NULL);
+  }
+}
+
+int
+main(int argc, char** argv)
+{
+  if (argc > 2) {
+    fprintf(stderr, "Usage: %s [N_ELEMS]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  const size_t n_elems = (argc > 1) ? strtoul(argv[1], NULL, 10) : 262144U;
+
+  test_sequential(n_elems);
+  test_failed_alloc();
+  test_threads(n_elems);
+  test_threads_remove();
+
+  return 0;
+}
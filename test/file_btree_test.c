@@ -0,0 +1,318 @@
+// Copyright 2011-2022 David Robillard <d@drobilla.net>
+// SPDX-License-Identifier: ISC
+
+#undef NDEBUG
+
+#include "failing_allocator.h"
+#include "test_data.h"
+
+#include "zix/common.h"
+#include "zix/file_btree.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static const char* const path = "zix_file_btree_test.zbt";
+
+static uint64_t
+ith_key(const size_t i)
+{
+  return unique_rand(i);
+}
+
+static uint64_t
+ith_value(const size_t i)
+{
+  return ((uint64_t)i << 32U) | 0xFFU;
+}
+
+static void
+check_contents(const ZixFileBTree* const t,
+               const size_t              n_elems,
+               const size_t              n_removed)
+{
+  assert(zix_file_btree_size(t) == n_elems - n_removed);
+
+  uint64_t value = 0U;
+  for (size_t i = 0U; i < n_elems; ++i) {
+    const ZixStatus st = zix_file_btree_find(t, ith_key(i), &value);
+    if (i < n_removed) {
+      assert(st == ZIX_STATUS_NOT_FOUND);
+    } else {
+      assert(!st);
+      assert(value == ith_value(i));
+    }
+  }
+}
+
+static void
+test_persistence(const size_t n_elems)
+{
+  remove(path);
+
+  // Create a new file and fill it
+  ZixFileBTree* t = zix_file_btree_open(NULL, path);
+  assert(t);
+  assert(!zix_file_btree_size(t));
+  assert(zix_file_btree_find(t, 1U, NULL) == ZIX_STATUS_NOT_FOUND);
+
+  for (size_t i = 0U; i < n_elems; ++i) {
+    assert(!zix_file_btree_insert(t, ith_key(i), ith_value(i)));
+    assert(zix_file_btree_insert(t, ith_key(i), 0U) == ZIX_STATUS_EXISTS);
+  }
+
+  check_contents(t, n_elems, 0U);
+  assert(!zix_file_btree_sync(t));
+  zix_file_btree_close(t);
+
+  // Reopen it and check that everything is still there
+  assert((t = zix_file_btree_open(NULL, path)));
+  check_contents(t, n_elems, 0U);
+
+  // Remove the first half, without syncing explicitly
+  uint64_t value = 0U;
+  for (size_t i = 0U; i < n_elems / 2U; ++i) {
+    assert(!zix_file_btree_remove(t, ith_key(i), &value));
+    assert(value == ith_value(i));
+    assert(zix_file_btree_remove(t, ith_key(i), &value) ==
+           ZIX_STATUS_NOT_FOUND);
+  }
+
+  zix_file_btree_close(t);
+
+  // Reopen it again, check the contents, and reinsert some removed keys
+  assert((t = zix_file_btree_open(NULL, path)));
+  check_contents(t, n_elems, n_elems / 2U);
+
+  for (size_t i = n_elems / 4U; i < n_elems / 2U; ++i) {
+    assert(!zix_file_btree_insert(t, ith_key(i), ith_value(i)));
+  }
+
+  check_contents(t, n_elems, n_elems / 4U);
+  zix_file_btree_close(t);
+  zix_file_btree_close(NULL);
+
+  remove(path);
+}
+
+/// Return the smallest key not less than `key` that test_iteration() keeps
+static uint64_t
+expected_lower_bound(const uint64_t key, const uint64_t n_keys)
+{
+  const uint64_t even = key < 2U ? 2U : key + (key & 1U);
+
+  return (even > 2000U && even <= 3000U) ? 3002U
+         : even <= 2U * n_keys           ? even
+                                         : 0U;
+}
+
+static void
+test_iteration(void)
+{
+  static const uint64_t n_keys = 4096U;
+
+  remove(path);
+  ZixFileBTree* const t = zix_file_btree_open(NULL, path);
+  assert(t);
+
+  // An empty tree has no entries to iterate over
+  ZixFileBTreeIter i = zix_file_btree_end_iter;
+  assert(!zix_file_btree_begin(t, &i));
+  assert(zix_file_btree_iter_is_end(i));
+
+  // Insert even keys out of order, then remove enough to empty some leaves
+  for (uint64_t k = 0U; k < n_keys; ++k) {
+    const uint64_t key = 2U * (1U + ((k * 2731U) % n_keys));
+    assert(!zix_file_btree_insert(t, key, 3U * key));
+  }
+
+  for (uint64_t key = 2002U; key <= 3000U; key += 2U) {
+    assert(!zix_file_btree_remove(t, key, NULL));
+  }
+
+  // Iterate over everything in order
+  size_t    n_entries = 0U;
+  uint64_t  expected  = 2U;
+  ZixStatus st        = zix_file_btree_begin(t, &i);
+  for (; !st; st = zix_file_btree_iter_increment(t, &i)) {
+    assert(zix_file_btree_iter_key(t, i) == expected);
+    assert(zix_file_btree_iter_value(t, i) == 3U * expected);
+    expected = expected_lower_bound(expected + 1U, n_keys);
+    ++n_entries;
+  }
+
+  assert(st == ZIX_STATUS_REACHED_END);
+  assert(zix_file_btree_iter_is_end(i));
+  assert(!expected);
+  assert(n_entries == zix_file_btree_size(t));
+
+  // Find the lower bound of every key, present or not
+  for (uint64_t key = 0U; key <= 2U * n_keys + 2U; ++key) {
+    const uint64_t lower = expected_lower_bound(key, n_keys);
+
+    assert(!zix_file_btree_lower_bound(t, key, &i));
+    assert(zix_file_btree_iter_is_end(i) == !lower);
+    assert(!lower || zix_file_btree_iter_key(t, i) == lower);
+  }
+
+  // Scan a range that starts in the removed keys
+  n_entries = 0U;
+  assert(!zix_file_btree_lower_bound(t, 2500U, &i));
+  for (; zix_file_btree_iter_key(t, i) < 4000U;
+       zix_file_btree_iter_increment(t, &i)) {
+    ++n_entries;
+  }
+
+  assert(zix_file_btree_iter_key(t, i) == 4000U);
+  assert(n_entries == (4000U - 3002U) / 2U);
+
+  zix_file_btree_close(t);
+  remove(path);
+}
+
+static void
+test_invalid_file(void)
+{
+  // A file that isn't a whole number of pages
+  FILE* const file = fopen(path, "wb");
+  assert(file);
+  fprintf(file, "Not a tree");
+  fclose(file);
+
+  assert(!zix_file_btree_open(NULL, path));
+
+  // A file with pages, but no valid header
+  FILE* const pages = fopen(path, "wb");
+  assert(pages);
+  for (unsigned i = 0U; i < 2U * ZIX_FILE_BTREE_PAGE_SIZE; ++i) {
+    fputc('Z', pages);
+  }
+  fclose(pages);
+
+  assert(!zix_file_btree_open(NULL, path));
+  remove(path);
+
+  // A file that can't be opened at all
+  assert(!zix_file_btree_open(NULL, "/nonexistent/zix_file_btree_test.zbt"));
+}
+
+/// Overwrite `size` bytes at `offset` in the test file
+static void
+write_at(const long offset, const void* const data, const size_t size)
+{
+  FILE* const file = fopen(path, "r+b");
+  assert(file);
+  assert(!fseek(file, offset, SEEK_SET));
+  assert(fwrite(data, size, 1U, file) == 1U);
+  fclose(file);
+}
+
+/// Overwrite the 64-bit word at `offset` in the test file
+static void
+write_word(const long offset, const uint64_t word)
+{
+  write_at(offset, &word, sizeof(word));
+}
+
+/// Read the 64-bit word at `offset` in the test file
+static uint64_t
+read_word(const long offset)
+{
+  uint64_t    word = 0U;
+  FILE* const file = fopen(path, "rb");
+  assert(file);
+  assert(!fseek(file, offset, SEEK_SET));
+  assert(fread(&word, sizeof(word), 1U, file) == 1U);
+  fclose(file);
+  return word;
+}
+
+static void
+test_corrupt_file(void)
+{
+  /* These depend on the file format: the root page number is in the header
+     after the magic, version, page size, and number of pages, and the first
+     child of an internal node follows its 8 byte header and 255 keys. */
+
+  static const long root_offset  = 24L;
+  static const long child_offset = 8L + (255L * 8L);
+  static const long page_size    = (long)ZIX_FILE_BTREE_PAGE_SIZE;
+
+  // Make a tree with an internal root and close it
+  remove(path);
+  ZixFileBTree* t = zix_file_btree_open(NULL, path);
+  assert(t);
+  for (uint64_t k = 1U; k <= 1024U; ++k) {
+    assert(!zix_file_btree_insert(t, k, k));
+  }
+  zix_file_btree_close(t);
+
+  const long     root_page = (long)read_word(root_offset) * page_size;
+  const uint64_t first     = read_word(root_page + child_offset);
+
+  // A child link past the end of the file
+  write_word(root_page + child_offset, 0xFFFFFFFFU);
+  assert((t = zix_file_btree_open(NULL, path)));
+  assert(zix_file_btree_find(t, 1U, NULL) == ZIX_STATUS_BAD_ARG);
+  assert(zix_file_btree_remove(t, 1U, NULL) == ZIX_STATUS_BAD_ARG);
+  assert(zix_file_btree_insert(t, 0U, 0U) == ZIX_STATUS_BAD_ARG);
+  assert(!zix_file_btree_find(t, 1000U, NULL));
+
+  ZixFileBTreeIter i = zix_file_btree_end_iter;
+  assert(zix_file_btree_begin(t, &i) == ZIX_STATUS_BAD_ARG);
+  assert(zix_file_btree_iter_is_end(i));
+  assert(!zix_file_btree_lower_bound(t, 1000U, &i));
+  assert(zix_file_btree_iter_key(t, i) == 1000U);
+  zix_file_btree_close(t);
+
+  // A child link to the root itself, which would otherwise loop forever
+  write_word(root_page + child_offset, (uint64_t)(root_page / page_size));
+  assert((t = zix_file_btree_open(NULL, path)));
+  assert(zix_file_btree_find(t, 1U, NULL) == ZIX_STATUS_BAD_ARG);
+  zix_file_btree_close(t);
+
+  // A leaf with more keys than fit in a page (after the leaf flag)
+  static const uint16_t n_keys = 0xFFFFU;
+  write_word(root_page + child_offset, first);
+  write_at((long)first * page_size + 2L, &n_keys, sizeof(n_keys));
+  assert((t = zix_file_btree_open(NULL, path)));
+  assert(zix_file_btree_find(t, 1U, NULL) == ZIX_STATUS_BAD_ARG);
+  zix_file_btree_close(t);
+
+  // A root link past the end of the file
+  write_word(root_offset, 0xFFFFFFFFU);
+  assert(!zix_file_btree_open(NULL, path));
+
+  remove(path);
+}
+
+static void
+test_failed_alloc(void)
+{
+  ZixFailingAllocator allocator = zix_failing_allocator();
+
+  remove(path);
+  allocator.n_remaining = 0U;
+  assert(!zix_file_btree_open(&allocator.base, path));
+}
+
+int
+main(int argc, char** argv)
+{
+  if (argc > 2) {
+    fprintf(stderr, "Usage: %s [N_ELEMS]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  const size_t n_elems = (argc > 1) ? strtoul(argv[1], NULL, 10) : 131072U;
+
+  test_persistence(n_elems);
+  test_iteration();
+  test_invalid_file();
+  test_corrupt_file();
+  test_failed_alloc();
+
+  return 0;
+}
@@ -0,0 +1,219 @@
+// Copyright 2022 David Robillard <d@drobilla.net>
+// SPDX-License-Identifier: ISC
+
+#undef NDEBUG
+
+#include "failing_allocator.h"
+
+#include "zix/queue.h"
+#include "zix/thread.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_THREADS 16U
+
+typedef struct {
+  uint32_t thread; ///< Index of the thread that pushed this message
+  uint32_t count;  ///< Number of messages that thread pushed before this
+  uint64_t check;  ///< Value calculated from the above to check for tearing
+} Message;
+
+typedef struct {
+  ZixQueue* queue;      ///< Queue shared by every thread
+  uint32_t  index;      ///< Index of this thread
+  uint32_t  n_messages; ///< Number of messages for this thread to move
+  uint32_t  n_writers;  ///< Total number of writer threads
+  uint64_t  sum;        ///< Sum of message counts seen by a reader
+} TestThread;
+
+static uint64_t
+message_check(const uint32_t thread, const uint32_t count)
+{
+  return ((uint64_t)thread << 32U) ^ (count * 2654435761U);
+}
+
+static void*
+writer(void* const arg)
+{
+  TestThread* const thread = (TestThread*)arg;
+
+  for (uint32_t i = 0U; i < thread->n_messages; ++i) {
+    const Message msg = {thread->index, i, message_check(thread->index, i)};
+    while (!zix_queue_push(thread->queue, &msg)) {
+    }
+  }
+
+  return NULL;
+}
+
+static void*
+reader(void* const arg)
+{
+  TestThread* const thread = (TestThread*)arg;
+
+  // Messages from each writer must arrive in the order they were pushed
+  uint32_t next[MAX_THREADS] = {0U};
+
+  for (uint32_t i = 0U; i < thread->n_messages; ++i) {
+    Message msg = {0U, 0U, 0U};
+    while (!zix_queue_pop(thread->queue, &msg)) {
+    }
+
+    assert(msg.thread < thread->n_writers);
+    assert(msg.check == message_check(msg.thread, msg.count));
+    assert(msg.count >= next[msg.thread]);
+    next[msg.thread] = msg.count + 1U;
+    thread->sum += msg.count;
+  }
+
+  return NULL;
+}
+
+static void
+test_threads(const unsigned n_writers,
+             const unsigned n_readers,
+             const uint32_t n_messages)
+{
+  printf("Testing %u writers and %u readers...\n", n_writers, n_readers);
+
+  ZixQueue* const queue = zix_queue_new(NULL, 64U, sizeof(Message));
+  assert(queue);
+  zix_queue_mlock(queue);
+
+  TestThread writers[MAX_THREADS];
+  TestThread readers[MAX_THREADS];
+  ZixThread  writer_threads[MAX_THREADS]; // NOLINT
+  ZixThread  reader_threads[MAX_THREADS]; // NOLINT
+
+  const uint32_t n_total = n_messages * n_writers;
+  for (unsigned i = 0U; i < n_readers; ++i) {
+    const TestThread thread = {queue, i, n_total / n_readers, n_writers, 0U};
+
+    readers[i] = thread;
+    assert(!zix_thread_create(&reader_threads[i], 65536U, reader, &readers[i]));
+  }
+
+  for (unsigned i = 0U; i < n_writers; ++i) {
+    const TestThread thread = {queue, i, n_messages, n_writers, 0U};
+
+    writers[i] = thread;
+    assert(!zix_thread_create(&writer_threads[i], 65536U, writer, &writers[i]));
+  }
+
+  // Every message must have been read exactly once
+  uint64_t sum = 0U;
+  for (unsigned i = 0U; i < n_writers; ++i) {
+    zix_thread_join(writer_threads[i], NULL);
+  }
+
+  for (unsigned i = 0U; i < n_readers; ++i) {
+    zix_thread_join(reader_threads[i], NULL);
+    sum += readers[i].sum;
+  }
+
+  assert(sum == (uint64_t)n_writers * n_messages * (n_messages - 1U) / 2U);
+
+  Message msg = {0U, 0U, 0U};
+  assert(!zix_queue_pop(queue, &msg));
+
+  zix_queue_free(queue);
+}
+
+static void
+test_sequential(void)
+{
+  zix_queue_free(NULL);
+
+  ZixQueue* const queue = zix_queue_new(NULL, 5U, 3U);
+  assert(queue);
+  assert(zix_queue_capacity(queue) == 8U);
+  assert(zix_queue_slot_size(queue) == 3U);
+
+  // An empty queue has nothing to pop
+  char out[3] = {0};
+  assert(!zix_queue_pop(queue, out));
+
+  // Go around several times, with a different fill level each time
+  char in[3] = {0};
+  char next  = 0;
+  for (unsigned lap = 0U; lap < 10U; ++lap) {
+    const unsigned n = lap < 8U ? lap + 1U : 8U;
+    for (unsigned i = 0U; i < n; ++i) {
+      memset(in, next + (char)i, sizeof(in));
+      assert(zix_queue_push(queue, in));
+    }
+
+    if (n == zix_queue_capacity(queue)) {
+      assert(!zix_queue_push(queue, in));
+    }
+
+    for (unsigned i = 0U; i < n; ++i) {
+      assert(zix_queue_pop(queue, out));
+      assert(out[0] == next && out[1] == next && out[2] == next);
+      ++next;
+    }
+
+    assert(!zix_queue_pop(queue, out));
+  }
+
+  zix_queue_free(queue);
+
+  // The smallest queue has two slots
+  ZixQueue* const small = zix_queue_new(NULL, 0U, sizeof(in));
+  assert(small);
+  assert(zix_queue_capacity(small) == 2U);
+  for (unsigned i = 0U; i < 3U; ++i) {
+    assert(zix_queue_push(small, in));
+    assert(zix_queue_push(small, in));
+    assert(!zix_queue_push(small, in));
+    assert(zix_queue_pop(small, out));
+    assert(zix_queue_pop(small, out));
+    assert(!zix_queue_pop(small, out));
+  }
+
+  zix_queue_free(small);
+}
+
+static void
+test_failed_alloc(void)
+{
+  ZixFailingAllocator allocator = zix_failing_allocator();
+
+  // Successfully allocate a queue to count the number of allocations
+  ZixQueue* const queue = zix_queue_new(&allocator.base, 512U, 16U);
+  assert(queue);
+
+  // Test that each allocation failing is handled gracefully
+  const size_t n_new_allocs = allocator.n_allocations;
+  for (size_t i = 0U; i < n_new_allocs; ++i) {
+    allocator.n_remaining = i;
+    assert(!zix_queue_new(&allocator.base, 512U, 16U));
+  }
+
+  zix_queue_free(queue);
+}
+
+int
+main(int argc, char** argv)
+{
+  if (argc > 2) {
+    fprintf(stderr, "Usage: %s [N_MESSAGES]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  const uint32_t n_messages =
+    (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 10) : 4096U;
+
+  test_sequential();
+  test_failed_alloc();
+  test_threads(1U, 1U, n_messages);
+  test_threads(4U, 1U, n_messages);
+  test_threads(1U, 4U, n_messages);
+  test_threads(4U, 4U, n_messages);
+  return 0;
+}
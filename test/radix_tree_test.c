@@ -0,0 +1,269 @@
+// Copyright 2011-2022 David Robillard <d@drobilla.net>
+// SPDX-License-Identifier: ISC
+
+#undef NDEBUG
+
+#include "failing_allocator.h"
+#include "test_data.h"
+
+#include "zix/common.h"
+#include "zix/radix_tree.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/// Return the ith key for a test, with a variety of densities
+static uint64_t
+ith_key(const unsigned test_num, const size_t i)
+{
+  switch (test_num % 4U) {
+  case 0:
+    return i; // Dense, so the lowest levels are full
+  case 1:
+    return lcg64(unique_rand(i)); // Sparse, all over the key space
+  case 2:
+    return (uint64_t)i << 40U; // Sparse, with many skipped levels below
+  default:
+    return ((uint64_t)unique_rand(i) << 32U) | (i & 0x3FU); // Clumps
+  }
+}
+
+static void*
+ith_value(const size_t i)
+{
+  return (void*)(uintptr_t)(i + 1U);
+}
+
+static int
+key_cmp(const void* const a, const void* const b)
+{
+  const uint64_t ka = *(const uint64_t*)a;
+  const uint64_t kb = *(const uint64_t*)b;
+
+  return ka < kb ? -1 : ka > kb ? 1 : 0;
+}
+
+/// Check that `t` contains exactly the sorted `keys` in order
+static void
+check_order(const ZixRadixTree* const t,
+            const uint64_t* const     keys,
+            const size_t              n_keys)
+{
+  size_t           count = 0U;
+  ZixRadixTreeIter i     = zix_radix_tree_begin(t);
+  for (; !zix_radix_tree_iter_is_end(i); zix_radix_tree_iter_increment(&i)) {
+    assert(count < n_keys);
+    assert(zix_radix_tree_key(i) == keys[count]);
+    ++count;
+  }
+
+  assert(count == n_keys);
+  assert(zix_radix_tree_size(t) == n_keys);
+  assert(zix_radix_tree_iter_equals(i, zix_radix_tree_end(t)));
+}
+
+static void
+test_operations(const unsigned test_num, const size_t n_elems)
+{
+  ZixRadixTree* const t   = zix_radix_tree_new(NULL);
+  ZixRadixTreeIter    ti  = zix_radix_tree_end_iter;
+  void*               out = NULL;
+
+  // An empty tree has nothing to find or remove
+  assert(!zix_radix_tree_size(t));
+  assert(zix_radix_tree_iter_is_end(zix_radix_tree_begin(t)));
+  assert(zix_radix_tree_find(t, 0U, &ti) == ZIX_STATUS_NOT_FOUND);
+  assert(zix_radix_tree_remove(t, 0U, &out) == ZIX_STATUS_NOT_FOUND);
+  assert(!zix_radix_tree_lower_bound(t, 0U, &ti));
+  assert(zix_radix_tree_iter_is_end(ti));
+
+  // Insert everything, and check that duplicates are rejected
+  uint64_t* const keys = (uint64_t*)calloc(n_elems, sizeof(uint64_t));
+  for (size_t i = 0U; i < n_elems; ++i) {
+    keys[i] = ith_key(test_num, i);
+    assert(!zix_radix_tree_insert(t, keys[i], ith_value(i)));
+    assert(zix_radix_tree_insert(t, keys[i], NULL) == ZIX_STATUS_EXISTS);
+  }
+
+  // Find everything
+  for (size_t i = 0U; i < n_elems; ++i) {
+    assert(!zix_radix_tree_find(t, keys[i], &ti));
+    assert(zix_radix_tree_key(ti) == keys[i]);
+    assert(zix_radix_tree_get(ti) == ith_value(i));
+  }
+
+  // Iterate over everything in order
+  qsort(keys, n_elems, sizeof(uint64_t), key_cmp);
+  check_order(t, keys, n_elems);
+
+  // Search for every key, and for the gaps between them
+  for (size_t i = 0U; i < n_elems; ++i) {
+    assert(!zix_radix_tree_lower_bound(t, keys[i], &ti));
+    assert(zix_radix_tree_key(ti) == keys[i]);
+
+    if (keys[i] < UINT64_MAX) {
+      assert(!zix_radix_tree_lower_bound(t, keys[i] + 1U, &ti));
+      if (i + 1U < n_elems) {
+        assert(zix_radix_tree_key(ti) == keys[i + 1U]);
+      } else {
+        assert(zix_radix_tree_iter_is_end(ti));
+      }
+    }
+
+    // Check that iterators from searches can be incremented
+    assert(!zix_radix_tree_find(t, keys[i], &ti));
+    const ZixRadixTreeIter next = zix_radix_tree_iter_next(ti);
+    if (i + 1U < n_elems) {
+      assert(zix_radix_tree_key(next) == keys[i + 1U]);
+    } else {
+      assert(zix_radix_tree_iter_is_end(next));
+    }
+  }
+
+  if (keys[0]) {
+    assert(!zix_radix_tree_lower_bound(t, 0U, &ti));
+    assert(zix_radix_tree_key(ti) == keys[0]);
+  }
+
+  // Remove every other key, and check that the rest remain in order
+  size_t n_kept = 0U;
+  for (size_t i = 0U; i < n_elems; ++i) {
+    if (i % 2U) {
+      assert(!zix_radix_tree_remove(t, keys[i], &out));
+      assert(zix_radix_tree_find(t, keys[i], &ti) == ZIX_STATUS_NOT_FOUND);
+      assert(zix_radix_tree_remove(t, keys[i], &out) == ZIX_STATUS_NOT_FOUND);
+    } else {
+      keys[n_kept++] = keys[i];
+    }
+  }
+
+  check_order(t, keys, n_kept);
+
+  // Remove everything else
+  for (size_t i = 0U; i < n_kept; ++i) {
+    assert(!zix_radix_tree_remove(t, keys[i], &out));
+    assert(out);
+  }
+
+  assert(!zix_radix_tree_size(t));
+  assert(zix_radix_tree_iter_is_end(zix_radix_tree_begin(t)));
+
+  free(keys);
+  zix_radix_tree_free(t, NULL, NULL);
+}
+
+static void
+destroy(void* const ptr, const void* const user_data)
+{
+  (void)ptr;
+  ++*(size_t*)(uintptr_t)user_data;
+}
+
+static void
+test_free(void)
+{
+  ZixRadixTree* const t = zix_radix_tree_new(NULL);
+  for (size_t i = 0U; i < 1024U; ++i) {
+    assert(!zix_radix_tree_insert(t, ith_key(1U, i), ith_value(i)));
+  }
+
+  size_t n_destroyed = 0U;
+  zix_radix_tree_free(t, destroy, &n_destroyed);
+  zix_radix_tree_free(NULL, NULL, NULL);
+  assert(n_destroyed == 1024U);
+}
+
+static void
+test_failed_alloc(void)
+{
+  static const size_t n_elems = 1024U;
+
+  ZixFailingAllocator allocator = zix_failing_allocator();
+
+  // Successfully fill a tree to count the number of allocations
+  ZixRadixTree* t = zix_radix_tree_new(&allocator.base);
+  for (size_t i = 0U; i < n_elems; ++i) {
+    assert(!zix_radix_tree_insert(t, ith_key(0U, i), ith_value(i)));
+  }
+
+  zix_radix_tree_free(t, NULL, NULL);
+
+  // Test that each allocation failing is handled gracefully
+  const size_t n_new_allocs = allocator.n_allocations;
+  for (size_t i = 0U; i < n_new_allocs; ++i) {
+    allocator.n_remaining = i;
+
+    if ((t = zix_radix_tree_new(&allocator.base))) {
+      ZixStatus st = ZIX_STATUS_SUCCESS;
+      size_t    n  = 0U;
+      while (n < n_elems &&
+             !(st = zix_radix_tree_insert(t, ith_key(0U, n), ith_value(n)))) {
+        ++n;
+      }
+
+      // Everything before the failure must still be there
+      assert(st == ZIX_STATUS_NO_MEM);
+      assert(zix_radix_tree_size(t) == n);
+
+      ZixRadixTreeIter ti = zix_radix_tree_end_iter;
+      for (size_t j = 0U; j < n; ++j) {
+        assert(!zix_radix_tree_find(t, ith_key(0U, j), &ti));
+      }
+
+      zix_radix_tree_free(t, NULL, NULL);
+    }
+  }
+
+  // Remove everything while shrinking nodes fails, then iterate
+  static const uint64_t n_wide = 64U;
+
+  allocator.n_remaining = SIZE_MAX;
+  t                     = zix_radix_tree_new(&allocator.base);
+  for (uint64_t k = 0U; k < n_wide; ++k) {
+    assert(!zix_radix_tree_insert(t, k, ith_value((size_t)k)));
+  }
+
+  void* out             = NULL;
+  allocator.n_remaining = 0U;
+  for (uint64_t k = 0U; k < n_wide; ++k) {
+    assert(!zix_radix_tree_remove(t, k, &out));
+    assert(out == ith_value((size_t)k));
+
+    // The remaining keys must still be in order
+    uint64_t         expected = k + 1U;
+    ZixRadixTreeIter ti       = zix_radix_tree_begin(t);
+    for (; !zix_radix_tree_iter_is_end(ti);
+         zix_radix_tree_iter_increment(&ti)) {
+      assert(zix_radix_tree_key(ti) == expected++);
+    }
+
+    assert(expected == n_wide);
+  }
+
+  assert(!zix_radix_tree_size(t));
+  zix_radix_tree_free(t, NULL, NULL);
+}
+
+int
+main(int argc, char** argv)
+{
+  if (argc > 2) {
+    fprintf(stderr, "Usage: %s [N_ELEMS]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  const size_t n_elems = (argc > 1) ? strtoul(argv[1], NULL, 10) : 65536U;
+
+  for (unsigned i = 0U; i < 4U; ++i) {
+    test_operations(i, 1U);
+    test_operations(i, 100U);
+    test_operations(i, n_elems);
+  }
+
+  test_free();
+  test_failed_alloc();
+
+  return 0;
+}
@@ -15,8 +15,10 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #define MSG_SIZE 20U
+#define N_MESSAGES 4096U
 
 static ZixRing* ring       = 0;
 static unsigned n_writes   = 0;
@@ -157,6 +159,272 @@ test_ring(const unsigned size)
   return 0;
 }
 
+static void
+write_regions(const ZixRingRegion* const regions, const char first)
+{
+  char c = first;
+  for (unsigned r = 0U; r < 2U; ++r) {
+    for (uint32_t i = 0U; i < regions[r].size; ++i) {
+      ((char*)regions[r].data)[i] = c++;
+    }
+  }
+}
+
+static void
+check_regions(const ZixRingRegion* const regions,
+              const uint32_t             size,
+              const char                 first)
+{
+  assert(regions[0].size + regions[1].size == size);
+  assert(!regions[0].size == !regions[0].data);
+  assert(!regions[1].size == !regions[1].data);
+
+  char c = first;
+  for (unsigned r = 0U; r < 2U; ++r) {
+    for (uint32_t i = 0U; i < regions[r].size; ++i) {
+      assert(((const char*)regions[r].data)[i] == c++);
+    }
+  }
+}
+
+static void
+test_regions(void)
+{
+  ZixRingRegion regions[2] = {{NULL, 0U}, {NULL, 0U}};
+  char          buf[16]    = {0};
+
+  ring = zix_ring_new(NULL, 16U);
+  assert(ring);
+
+  // Nothing can be acquired from an empty ring, or more than fits reserved
+  assert(!zix_ring_read_acquire(ring, 1U, regions));
+  assert(!regions[0].size && !regions[1].size);
+  assert(!zix_ring_write_reserve(ring, 16U, regions));
+  assert(!regions[0].size && !regions[1].size);
+
+  // Write in place without wrapping, and read it back with a copy
+  assert(zix_ring_write_reserve(ring, 10U, regions) == 10U);
+  assert(regions[0].size == 10U && !regions[1].size);
+  write_regions(regions, 'a');
+  assert(!zix_ring_read_space(ring));
+  assert(zix_ring_write_commit(ring, 10U) == 10U);
+  assert(zix_ring_read_space(ring) == 10U);
+  assert(zix_ring_read(ring, buf, 10U) == 10U);
+  assert(buf[0] == 'a' && buf[9] == 'j');
+
+  // Write with a copy that wraps, and read it in place
+  assert(zix_ring_write(ring, "klmnopqr", 8U) == 8U);
+  assert(zix_ring_read_acquire(ring, 8U, regions) == 8U);
+  assert(regions[0].size == 6U && regions[1].size == 2U);
+  check_regions(regions, 8U, 'k');
+  assert(!zix_ring_read_release(ring, 9U));
+  assert(zix_ring_read_release(ring, 8U) == 8U);
+  assert(!zix_ring_read_space(ring));
+
+  // Write and read in place across the end of the ring
+  assert(zix_ring_write_reserve(ring, 15U, regions) == 15U);
+  assert(regions[0].size == 14U && regions[1].size == 1U);
+  write_regions(regions, 'A');
+  assert(!zix_ring_write_commit(ring, 16U));
+  assert(zix_ring_write_commit(ring, 15U) == 15U);
+  assert(!zix_ring_write_space(ring));
+  assert(zix_ring_read_acquire(ring, 15U, regions) == 15U);
+  check_regions(regions, 15U, 'A');
+  assert(zix_ring_read_release(ring, 15U) == 15U);
+  assert(zix_ring_write_space(ring) == zix_ring_capacity(ring));
+
+  zix_ring_free(ring);
+}
+
+static void
+test_mirrored(void)
+{
+  ZixRingRegion regions[2] = {{NULL, 0U}, {NULL, 0U}};
+  char          buf[32]    = {0};
+
+  if (!(ring = zix_ring_new_mirrored(NULL, 16U))) {
+    return; // Not supported on this platform
+  }
+
+  // The size is rounded up to whole pages
+  const uint32_t size = zix_ring_capacity(ring) + 1U;
+  assert(zix_ring_is_mirrored(ring));
+  assert(size >= 16U && !(size & (size - 1U)));
+  zix_ring_mlock(ring);
+
+  // Move the heads to just before the end
+  assert(zix_ring_write_reserve(ring, size - 8U, regions) == size - 8U);
+  assert(zix_ring_write_commit(ring, size - 8U) == size - 8U);
+  assert(zix_ring_skip(ring, size - 8U) == size - 8U);
+
+  // Write in place across the end, which is a single region
+  assert(zix_ring_write_reserve(ring, 32U, regions) == 32U);
+  assert(regions[0].size == 32U && !regions[1].size && !regions[1].data);
+  write_regions(regions, 'A');
+  assert(zix_ring_write_commit(ring, 32U) == 32U);
+
+  // Read it back in place and with a copy
+  assert(zix_ring_read_acquire(ring, 32U, regions) == 32U);
+  assert(regions[0].size == 32U && !regions[1].size && !regions[1].data);
+  check_regions(regions, 32U, 'A');
+  assert(zix_ring_read(ring, buf, 32U) == 32U);
+  for (unsigned i = 0U; i < 32U; ++i) {
+    assert(buf[i] == (char)('A' + i));
+  }
+
+  // Check that the part past the end was written to the start of the buffer
+  assert(zix_ring_write_reserve(ring, 8U, regions) == 8U);
+  const char* const start = (const char*)regions[0].data - 24U;
+  for (unsigned i = 0U; i < 24U; ++i) {
+    assert(start[i] == (char)('A' + 8U + i));
+  }
+
+  zix_ring_free(ring);
+
+  // Test that failing to allocate the ring itself is handled gracefully
+  ZixFailingAllocator allocator = zix_failing_allocator();
+  allocator.n_remaining         = 0U;
+  assert(!zix_ring_new_mirrored(&allocator.base, 16U));
+}
+
+/// Return the payload size of the ith message, which is filled with byte i
+static uint32_t
+msg_size(const uint32_t i)
+{
+  return i % 13U;
+}
+
+typedef struct {
+  uint32_t n_msgs; ///< Number of messages read so far
+} MsgReader;
+
+static void
+check_msg(const ZixRingRegion* const regions, void* const user_data)
+{
+  MsgReader* const reader = (MsgReader*)user_data;
+  const uint32_t   i      = reader->n_msgs++;
+
+  assert(regions[0].size + regions[1].size == msg_size(i));
+  assert(!regions[0].size == !regions[0].data);
+  assert(!regions[1].size == !regions[1].data);
+
+  for (unsigned r = 0U; r < 2U; ++r) {
+    for (uint32_t j = 0U; j < regions[r].size; ++j) {
+      assert(((const char*)regions[r].data)[j] == (char)i);
+    }
+  }
+}
+
+static ZixStatus
+write_msg(const uint32_t i)
+{
+  char payload[16];
+  memset(payload, (char)i, sizeof(payload));
+  return zix_ring_write_msg(ring, payload, msg_size(i));
+}
+
+static void*
+msg_reader(void* ZIX_UNUSED(arg))
+{
+  MsgReader reader = {0U};
+  while (reader.n_msgs < N_MESSAGES) {
+    zix_ring_read_msgs(ring, check_msg, &reader);
+  }
+
+  return NULL;
+}
+
+static void*
+msg_writer(void* ZIX_UNUSED(arg))
+{
+  for (uint32_t i = 0U; i < N_MESSAGES; ++i) {
+    while (write_msg(i)) {
+    }
+  }
+
+  return NULL;
+}
+
+static void
+test_messages(const bool mirrored)
+{
+  ZixRingRegion regions[2] = {{NULL, 0U}, {NULL, 0U}};
+  char          buf[16]    = {0};
+  uint32_t      size       = 0U;
+  MsgReader     reader     = {0U};
+
+  if (!(ring = mirrored ? zix_ring_new_mirrored(NULL, 64U)
+                        : zix_ring_new(NULL, 64U))) {
+    assert(mirrored);
+    return; // Not supported on this platform
+  }
+
+  // An empty ring has no messages
+  assert(zix_ring_read_msg(ring, buf, sizeof(buf), &size) ==
+         ZIX_STATUS_NOT_FOUND);
+  assert(!size);
+  assert(zix_ring_read_msg_acquire(ring, regions) == ZIX_STATUS_NOT_FOUND);
+  assert(!regions[0].size && !regions[1].size);
+  assert(zix_ring_read_msg_release(ring) == ZIX_STATUS_NOT_FOUND);
+  assert(!zix_ring_read_msgs(ring, check_msg, &reader));
+
+  // A message and its header must fit in the ring
+  const uint32_t capacity = zix_ring_capacity(ring);
+  char* const    big_buf  = (char*)calloc(capacity, 1U);
+  assert(zix_ring_write_msg(ring, big_buf, capacity) == ZIX_STATUS_NO_MEM);
+  assert(zix_ring_write_msg(ring, big_buf, UINT32_MAX) == ZIX_STATUS_NO_MEM);
+  assert(!zix_ring_read_space(ring));
+  free(big_buf);
+
+  // Fill the ring and read messages back in every way, many times around
+  uint32_t n_written = 0U;
+  for (unsigned round = 0U; round < 64U; ++round) {
+    while (!write_msg(n_written)) {
+      ++n_written;
+    }
+
+    // Read one with a copy, after trying with a buffer that's too small
+    const uint32_t i = reader.n_msgs++;
+    if (msg_size(i)) {
+      assert(zix_ring_read_msg(ring, buf, msg_size(i) - 1U, &size) ==
+             ZIX_STATUS_NO_MEM);
+      assert(size == msg_size(i));
+    }
+
+    assert(!zix_ring_read_msg(ring, buf, sizeof(buf), &size));
+    assert(size == msg_size(i));
+    for (uint32_t j = 0U; j < size; ++j) {
+      assert(buf[j] == (char)i);
+    }
+
+    // Read one in place
+    assert(!zix_ring_read_msg_acquire(ring, regions));
+    assert(!mirrored || !regions[1].size);
+    check_msg(regions, &reader);
+    assert(!zix_ring_read_msg_release(ring));
+
+    // Read the rest in a batch
+    const uint32_t n_left = n_written - reader.n_msgs;
+    assert(zix_ring_read_msgs(ring, check_msg, &reader) == n_left);
+    assert(reader.n_msgs == n_written);
+    assert(!zix_ring_read_space(ring));
+  }
+
+  // Move messages between threads
+  zix_ring_reset(ring);
+
+  ZixThread reader_thread; // NOLINT
+  assert(!zix_thread_create(&reader_thread, 65536U, msg_reader, NULL));
+
+  ZixThread writer_thread; // NOLINT
+  assert(!zix_thread_create(&writer_thread, 65536U, msg_writer, NULL));
+
+  zix_thread_join(reader_thread, NULL);
+  zix_thread_join(writer_thread, NULL);
+
+  zix_ring_free(ring);
+}
+
 static void
 test_failed_alloc(void)
 {
@@ -190,6 +458,10 @@ main(int argc, char** argv)
   n_writes = (argc > 2) ? (unsigned)strtoul(argv[2], NULL, 10) : size * 1024;
 
   test_failed_alloc();
+  test_regions();
+  test_mirrored();
+  test_messages(false);
+  test_messages(true);
   test_ring(size);
   return 0;
 }
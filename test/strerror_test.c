@@ -15,7 +15,7 @@ main(void)
   const char* msg = zix_strerror(ZIX_STATUS_SUCCESS);
   assert(!strcmp(msg, "Success"));
 
-  for (int i = ZIX_STATUS_ERROR; i <= ZIX_STATUS_REACHED_END; ++i) {
+  for (int i = ZIX_STATUS_ERROR; i <= ZIX_STATUS_OVERFLOW; ++i) {
     msg = zix_strerror((ZixStatus)i);
     assert(strcmp(msg, "Success"));
   }
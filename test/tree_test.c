@@ -1,6 +1,7 @@
 // Copyright 2011-2020 David Robillard <d@drobilla.net>
 // SPDX-License-Identifier: ISC
 
+#include "failing_allocator.h"
 #include "test_data.h"
 
 #include "zix/attributes.h"
@@ -9,6 +10,7 @@
 
 #include <inttypes.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
@@ -187,6 +189,341 @@ stress(unsigned test_num, size_t n_elems)
   return EXIT_SUCCESS;
 }
 
+typedef struct {
+  uintptr_t    key;
+  ZixTreeLinks links;
+} Record;
+
+static int
+record_cmp(const void* a, const void* b, const void* ZIX_UNUSED(user_data))
+{
+  const uintptr_t ka = ((const Record*)a)->key;
+  const uintptr_t kb = ((const Record*)b)->key;
+
+  return ka < kb ? -1 : ka > kb ? 1 : 0;
+}
+
+static int
+test_intrusive(size_t n_elems)
+{
+  ZixFailingAllocator allocator = zix_failing_allocator();
+
+  ZixTree* t = zix_tree_new_intrusive(
+    &allocator.base, false, record_cmp, NULL, offsetof(Record, links));
+
+  Record* const records = (Record*)calloc(n_elems, sizeof(Record));
+  if (!t || !records) {
+    return test_fail();
+  }
+
+  // Insert every record, which never allocates
+  allocator.n_remaining = 0U;
+  for (size_t i = 0U; i < n_elems; ++i) {
+    ZixTreeIter* ti = NULL;
+
+    records[i].key = unique_rand(i);
+    if (zix_tree_insert(t, &records[i], &ti) ||
+        zix_tree_get(ti) != &records[i]) {
+      fprintf(stderr, "Intrusive insert failed\n");
+      return test_fail();
+    }
+  }
+
+  // Duplicates are rejected without touching the links of the new record
+  Record       dup = {records[0].key, {NULL, NULL, NULL, 0U}};
+  ZixTreeIter* ti  = NULL;
+  if (zix_tree_insert(t, &dup, &ti) != ZIX_STATUS_EXISTS ||
+      zix_tree_get(ti) != &records[0] || dup.links.data) {
+    fprintf(stderr, "Intrusive duplicate insert succeeded\n");
+    return test_fail();
+  }
+
+  // Find every record, by any record with an equal key
+  for (size_t i = 0U; i < n_elems; ++i) {
+    const Record key = {records[i].key, {NULL, NULL, NULL, 0U}};
+    if (zix_tree_find(t, &key, &ti) || zix_tree_get(ti) != &records[i]) {
+      fprintf(stderr, "Intrusive find failed\n");
+      return test_fail();
+    }
+  }
+
+  // Iterate over every record in order
+  size_t    count = 0U;
+  uintptr_t last  = 0U;
+  for (ZixTreeIter* i = zix_tree_begin(t); !zix_tree_iter_is_end(i);
+       i              = zix_tree_iter_next(i)) {
+    const Record* const record = (const Record*)zix_tree_get(i);
+    if (&record->links != i || (count && record->key <= last)) {
+      fprintf(stderr, "Intrusive iteration failed\n");
+      return test_fail();
+    }
+
+    last = record->key;
+    ++count;
+  }
+
+  if (count != n_elems) {
+    fprintf(stderr, "Intrusive iteration stopped at %zu\n", count);
+    return test_fail();
+  }
+
+  // Remove every other record, then free the tree with the rest still in it
+  for (size_t i = 0U; i < n_elems; i += 2U) {
+    if (zix_tree_remove(t, &records[i].links)) {
+      fprintf(stderr, "Intrusive remove failed\n");
+      return test_fail();
+    }
+  }
+
+  if (zix_tree_size(t) != n_elems / 2U) {
+    fprintf(stderr, "Intrusive tree size %zu\n", zix_tree_size(t));
+    return test_fail();
+  }
+
+  zix_tree_free(t);
+  free(records);
+  return EXIT_SUCCESS;
+}
+
+/// Check that every element of a ranked tree can be found by its index
+static int
+check_ranks(ZixTree* t)
+{
+  size_t index = 0U;
+  for (ZixTreeIter* i = zix_tree_begin(t); !zix_tree_iter_is_end(i);
+       i              = zix_tree_iter_next(i)) {
+    if (zix_tree_select(t, index) != i ||
+        zix_tree_rank(t, zix_tree_get(i)) != index) {
+      fprintf(stderr, "Bad rank for element %zu\n", index);
+      return test_fail();
+    }
+
+    ++index;
+  }
+
+  if (zix_tree_select(t, index) || zix_tree_select(t, SIZE_MAX)) {
+    fprintf(stderr, "Selected element past the end\n");
+    return test_fail();
+  }
+
+  return EXIT_SUCCESS;
+}
+
+static int
+test_ranked(size_t n_elems)
+{
+  ZixTree* const t =
+    zix_tree_new_ranked(NULL, false, int_cmp, NULL, NULL, NULL);
+
+  uintptr_t* const order = (uintptr_t*)calloc(n_elems, sizeof(uintptr_t));
+
+  // Shuffle the first n_elems even numbers
+  for (size_t i = 0U; i < n_elems; ++i) {
+    order[i] = 2U * i;
+  }
+
+  for (size_t i = n_elems; i > 1U; --i) {
+    const size_t    j   = lcg(seed + i) % i;
+    const uintptr_t tmp = order[i - 1U];
+    order[i - 1U]       = order[j];
+    order[j]            = tmp;
+  }
+
+  // Insert the even numbers in a random order
+  for (size_t i = 0U; i < n_elems; ++i) {
+    const uintptr_t e = order[i];
+    if (zix_tree_insert(t, (void*)e, NULL)) {
+      fprintf(stderr, "Ranked insert failed\n");
+      return test_fail();
+    }
+  }
+
+  // Check the index of every element, and of the odd numbers between them
+  for (size_t i = 0U; i < n_elems; ++i) {
+    ZixTreeIter* const ti = zix_tree_select(t, i);
+    if ((uintptr_t)zix_tree_get(ti) != 2U * i ||
+        zix_tree_rank(t, (const void*)(2U * i)) != i ||
+        zix_tree_rank(t, (const void*)(2U * i + 1U)) != i + 1U) {
+      fprintf(stderr, "Bad rank for %zu\n", 2U * i);
+      return test_fail();
+    }
+  }
+
+  // Remove elements in the reverse order, checking ranks as we go
+  for (size_t i = 0U; i < n_elems; ++i) {
+    const uintptr_t e  = order[n_elems - 1U - i];
+    ZixTreeIter*    ti = NULL;
+    if (zix_tree_find(t, (const void*)e, &ti) || zix_tree_remove(t, ti)) {
+      fprintf(stderr, "Ranked remove failed\n");
+      return test_fail();
+    }
+
+    if (!(i % (n_elems / 8U + 1U)) && check_ranks(t)) {
+      return test_fail();
+    }
+  }
+
+  free(order);
+  zix_tree_free(t);
+  return EXIT_SUCCESS;
+}
+
+typedef enum { SET_UNION, SET_INTERSECTION, SET_DIFFERENCE } SetOperation;
+
+static void
+count_destroyed(void* ZIX_UNUSED(ptr), const void* user_data)
+{
+  ++*(size_t*)(uintptr_t)user_data;
+}
+
+/// Return whether `i` is in the first (0) or second (1) of two test sets
+static bool
+in_set(unsigned set, size_t density, size_t i)
+{
+  return set ? (lcg(i) % 100U < density) : (i % 3U != 0U);
+}
+
+static int
+test_set_operation(SetOperation op,
+                   bool         ranked,
+                   size_t       n_elems,
+                   size_t       density)
+{
+  size_t   n_destroyed = 0U;
+  ZixTree* a           = NULL;
+  ZixTree* b           = NULL;
+  if (ranked) {
+    a = zix_tree_new_ranked(NULL, false, int_cmp, NULL, NULL, NULL);
+    b = zix_tree_new_ranked(
+      NULL, false, int_cmp, NULL, count_destroyed, &n_destroyed);
+  } else {
+    a = zix_tree_new(NULL, false, int_cmp, NULL, NULL, NULL);
+    b = zix_tree_new(NULL, false, int_cmp, NULL, count_destroyed, &n_destroyed);
+  }
+
+  // Build both trees, with a mix of shared and distinct elements
+  for (size_t i = 0U; i < n_elems; ++i) {
+    if ((in_set(0U, density, i) &&
+         zix_tree_insert(a, (void*)(i + 1U), NULL)) ||
+        (in_set(1U, density, i) &&
+         zix_tree_insert(b, (void*)(i + 1U), NULL))) {
+      fprintf(stderr, "Insert failed\n");
+      return test_fail();
+    }
+  }
+
+  const size_t b_size = zix_tree_size(b);
+  ZixStatus    st     = ZIX_STATUS_SUCCESS;
+  switch (op) {
+  case SET_UNION:
+    st = zix_tree_union(a, b);
+    break;
+  case SET_INTERSECTION:
+    st = zix_tree_intersection(a, b);
+    break;
+  case SET_DIFFERENCE:
+    st = zix_tree_difference(a, b);
+    break;
+  }
+
+  if (st) {
+    fprintf(stderr, "Set operation failed (%s)\n", zix_strerror(st));
+    return test_fail();
+  }
+
+  // Check that the result contains exactly the expected elements, in order
+  size_t       n_expected = 0U;
+  size_t       n_shared   = 0U;
+  ZixTreeIter* ti         = zix_tree_begin(a);
+  for (size_t i = 0U; i < n_elems; ++i) {
+    const bool in_a = in_set(0U, density, i);
+    const bool in_b = in_set(1U, density, i);
+
+    n_shared += (in_a && in_b) ? 1U : 0U;
+    if ((op == SET_UNION && (in_a || in_b)) ||
+        (op == SET_INTERSECTION && in_a && in_b) ||
+        (op == SET_DIFFERENCE && in_a && !in_b)) {
+      if ((uintptr_t)zix_tree_get(ti) != i + 1U) {
+        fprintf(stderr, "Missing element %zu in set operation %d\n", i, op);
+        return test_fail();
+      }
+
+      ti = zix_tree_iter_next(ti);
+      ++n_expected;
+    }
+  }
+
+  if (!zix_tree_iter_is_end(ti) || zix_tree_size(a) != n_expected) {
+    fprintf(stderr, "Extra elements after set operation %d\n", op);
+    return test_fail();
+  }
+
+  // A union moves every element from b, and destroys the duplicates
+  if (op == SET_UNION &&
+      (zix_tree_size(b) || n_destroyed != n_shared ||
+       !zix_tree_iter_is_end(zix_tree_begin(b)))) {
+    fprintf(stderr, "Union left %zu elements\n", zix_tree_size(b));
+    return test_fail();
+  }
+
+  // Other operations leave b alone
+  if (op != SET_UNION && (zix_tree_size(b) != b_size || n_destroyed)) {
+    fprintf(stderr, "Set operation %d modified the other tree\n", op);
+    return test_fail();
+  }
+
+  if (ranked && check_ranks(a)) {
+    return test_fail();
+  }
+
+  zix_tree_free(a);
+  zix_tree_free(b);
+  return EXIT_SUCCESS;
+}
+
+static int
+test_set_operations(size_t n_elems)
+{
+  static const size_t densities[] = {0U, 1U, 10U, 50U, 100U};
+
+  for (unsigned op = SET_UNION; op <= SET_DIFFERENCE; ++op) {
+    for (size_t d = 0U; d < sizeof(densities) / sizeof(size_t); ++d) {
+      const SetOperation o = (SetOperation)op;
+      if (test_set_operation(o, false, n_elems, densities[d]) ||
+          test_set_operation(o, false, n_elems / 100U, densities[d]) ||
+          test_set_operation(o, true, n_elems / 10U, densities[d])) {
+        return test_fail();
+      }
+    }
+  }
+
+  // Trees with duplicates can't be used
+  ZixTree* const a = zix_tree_new(NULL, false, int_cmp, NULL, NULL, NULL);
+  ZixTree* const b = zix_tree_new(NULL, true, int_cmp, NULL, NULL, NULL);
+  if (zix_tree_union(a, b) != ZIX_STATUS_BAD_ARG ||
+      zix_tree_intersection(a, b) != ZIX_STATUS_BAD_ARG ||
+      zix_tree_difference(b, a) != ZIX_STATUS_BAD_ARG) {
+    fprintf(stderr, "Set operation with duplicates succeeded\n");
+    return test_fail();
+  }
+
+  // Operations with the same tree on both sides work as expected
+  for (uintptr_t i = 1U; i < 100U; ++i) {
+    zix_tree_insert(a, (void*)i, NULL);
+  }
+
+  if (zix_tree_union(a, a) || zix_tree_intersection(a, a) ||
+      zix_tree_size(a) != 99U || zix_tree_difference(a, a) ||
+      zix_tree_size(a) || zix_tree_begin(a)) {
+    fprintf(stderr, "Set operation on the same tree failed\n");
+    return test_fail();
+  }
+
+  zix_tree_free(b);
+  zix_tree_free(a);
+  return EXIT_SUCCESS;
+}
+
 int
 main(int argc, char** argv)
 {
@@ -220,5 +557,21 @@ main(int argc, char** argv)
     }
   }
   printf("\n");
+
+  if (test_intrusive(n_elems)) {
+    fprintf(stderr, "FAIL: Intrusive tree\n");
+    return test_fail();
+  }
+
+  if (test_ranked(n_elems)) {
+    fprintf(stderr, "FAIL: Ranked tree\n");
+    return test_fail();
+  }
+
+  if (test_set_operations(n_elems)) {
+    fprintf(stderr, "FAIL: Set operations\n");
+    return test_fail();
+  }
+
   return EXIT_SUCCESS;
 }